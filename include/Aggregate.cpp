@@ -0,0 +1,403 @@
+#ifndef AGGREGATE
+#define AGGREGATE
+
+#include "models.cpp"
+#include "Helper.cpp"
+#include "Sketches.cpp"
+#include <memory>
+#include <numeric>
+
+// One aggregate call as written in a select list or HAVING clause, such as AVG(gpa),
+// COUNT(DISTINCT major) or APPROX_PERCENTILE(latency, 0.99)
+struct AggregateSpec
+{
+    enum Kind
+    {
+        COUNT_ROWS,
+        COUNT,
+        COUNT_DISTINCT,
+        SUM,
+        AVG,
+        MIN,
+        MAX,
+        APPROX_COUNT_DISTINCT,
+        APPROX_PERCENTILE
+    };
+
+    Kind kind = COUNT_ROWS;
+    int column = NOT_FOUND; // an unknown column makes COUNT 0 and the others NULL
+    double fraction = 0;    // APPROX_PERCENTILE only
+
+    // Whether a row can be taken back out of the state (see AggregateState::remove)
+    bool retractable() const { return kind != APPROX_COUNT_DISTINCT && kind != APPROX_PERCENTILE; }
+
+    static bool is_aggregate(const string &expr)
+    {
+        static const vector<string> names = {"count", "sum", "avg", "min", "max", "approx_count_distinct", "approx_percentile"};
+        size_t paren(expr.find('('));
+        if (paren == string::npos)
+            return false;
+        string name(Helper::to_lower(Helper::trim(expr.substr(0, paren))));
+        return find(names.begin(), names.end(), name) != names.end();
+    }
+
+    // False with a message in `error` when the call is malformed
+    static bool parse(const string &expr, const Table *table, AggregateSpec &spec, string &error)
+    {
+        size_t open(expr.find('(')), close(expr.rfind(')'));
+        if (open == string::npos || close == string::npos || close < open)
+        {
+            error = "Invalid aggregate '" + expr + "'";
+            return false;
+        }
+        string name(Helper::to_lower(Helper::trim(expr.substr(0, open)))),
+            args(Helper::trim(expr.substr(open + 1, close - open - 1))), col(args);
+
+        if (name == "count" && args == "*")
+        {
+            spec.kind = COUNT_ROWS;
+            return true;
+        }
+
+        if (name == "count" && Helper::to_lower(args.substr(0, 9)) == "distinct ")
+        {
+            spec.kind = COUNT_DISTINCT;
+            col = Helper::trim(args.substr(9));
+        }
+        else if (name == "approx_percentile")
+        {
+            size_t comma(args.find(','));
+            char *end(nullptr);
+            string p(comma == string::npos ? "" : Helper::trim(args.substr(comma + 1)));
+            spec.fraction = strtod(p.c_str(), &end);
+            if (p.empty() || *end || spec.fraction < 0 || spec.fraction > 1)
+            {
+                error = "APPROX_PERCENTILE takes a column and a fraction between 0 and 1";
+                return false;
+            }
+            spec.kind = APPROX_PERCENTILE;
+            col = Helper::trim(args.substr(0, comma));
+        }
+        else if (name == "count")
+            spec.kind = COUNT;
+        else if (name == "sum")
+            spec.kind = SUM;
+        else if (name == "avg")
+            spec.kind = AVG;
+        else if (name == "min")
+            spec.kind = MIN;
+        else if (name == "max")
+            spec.kind = MAX;
+        else if (name == "approx_count_distinct")
+            spec.kind = APPROX_COUNT_DISTINCT;
+        else
+        {
+            error = "Unknown aggregate '" + expr + "'";
+            return false;
+        }
+
+        spec.column = table->get_column_index(col);
+        return true;
+    }
+};
+
+// Running state of one aggregate over the rows fed to it. Rows are never kept: COUNT, SUM and AVG
+// hold counters, MIN and MAX the extreme value, the approximate functions a fixed-size sketch;
+// only the exact COUNT(DISTINCT) grows with its input. States of the same spec merge, so a group
+// can be aggregated in pieces (partitions, threads) and combined afterwards.
+// A retractable state also takes rows back out, for materialized views: MIN and MAX then count
+// every value, so removing the current extreme falls back to the next one.
+class AggregateState
+{
+    const AggregateSpec *spec;
+    bool retractable;
+    uint64_t count = 0;
+    double sum = 0;
+    Value extreme;
+    map<Value, uint64_t> values;              // MIN and MAX when retractable
+    unordered_map<Value, uint64_t, ValueHash> distinct; // value, rows holding it
+    unique_ptr<HyperLogLog> hll;
+    unique_ptr<TDigest> digest;
+
+    static bool numeric(const Value &v) { return holds_alternative<Int>(v.raw()) || holds_alternative<Double>(v.raw()); }
+
+    // MIN or MAX of the two non-NULL values
+    bool replaces(const Value &candidate) const
+    {
+        if (extreme.is_null())
+            return true;
+        return spec->kind == AggregateSpec::MIN ? candidate < extreme : candidate > extreme;
+    }
+
+public:
+    AggregateState(const AggregateSpec &s, bool retract = false) : spec(&s), retractable(retract)
+    {
+        if (s.kind == AggregateSpec::APPROX_COUNT_DISTINCT)
+            hll = make_unique<HyperLogLog>();
+        else if (s.kind == AggregateSpec::APPROX_PERCENTILE)
+            digest = make_unique<TDigest>();
+    }
+
+    void add(const Row &row)
+    {
+        if (spec->kind == AggregateSpec::COUNT_ROWS)
+        {
+            ++count;
+            return;
+        }
+        if (spec->column == NOT_FOUND)
+            return;
+        const Value &val(row[spec->column]);
+        if (val.is_null())
+            return;
+
+        switch (spec->kind)
+        {
+        case AggregateSpec::COUNT:
+            ++count;
+            break;
+        case AggregateSpec::SUM:
+        case AggregateSpec::AVG:
+            if (numeric(val))
+            {
+                sum += val.get_double();
+                ++count;
+            }
+            break;
+        case AggregateSpec::MIN:
+        case AggregateSpec::MAX:
+            if (retractable)
+                ++values[val];
+            else if (replaces(val))
+                extreme = val;
+            break;
+        case AggregateSpec::COUNT_DISTINCT:
+            ++distinct[val]; // 1 and 1.0 compare equal and hash alike
+            break;
+        case AggregateSpec::APPROX_COUNT_DISTINCT:
+            hll->add_hash(HyperLogLog::mix(val.hash()));
+            break;
+        case AggregateSpec::APPROX_PERCENTILE:
+            if (numeric(val))
+                digest->add(val.get_double());
+            break;
+        default:
+            break;
+        }
+    }
+
+    // Takes back a row added earlier; only for retractable states
+    void remove(const Row &row)
+    {
+        if (spec->kind == AggregateSpec::COUNT_ROWS)
+        {
+            --count;
+            return;
+        }
+        if (spec->column == NOT_FOUND)
+            return;
+        const Value &val(row[spec->column]);
+        if (val.is_null())
+            return;
+
+        switch (spec->kind)
+        {
+        case AggregateSpec::COUNT:
+            --count;
+            break;
+        case AggregateSpec::SUM:
+        case AggregateSpec::AVG:
+            if (numeric(val))
+            {
+                sum -= val.get_double();
+                --count;
+            }
+            break;
+        case AggregateSpec::MIN:
+        case AggregateSpec::MAX:
+        {
+            auto it(values.find(val));
+            if (it != values.end() && !--it->second)
+                values.erase(it);
+            break;
+        }
+        case AggregateSpec::COUNT_DISTINCT:
+        {
+            auto it(distinct.find(val));
+            if (it != distinct.end() && !--it->second)
+                distinct.erase(it);
+            break;
+        }
+        default:
+            break;
+        }
+    }
+
+    // Folds in the state of the same spec built over other rows
+    void merge(const AggregateState &o)
+    {
+        count += o.count;
+        sum += o.sum;
+        if (!o.extreme.is_null() && replaces(o.extreme))
+            extreme = o.extreme;
+        for (const auto &v : o.values)
+            values[v.first] += v.second;
+        for (const auto &d : o.distinct)
+            distinct[d.first] += d.second;
+        if (hll)
+            hll->merge(*o.hll);
+        if (digest)
+            digest->merge(*o.digest);
+    }
+
+    Value result()
+    {
+        switch (spec->kind)
+        {
+        case AggregateSpec::COUNT_ROWS:
+        case AggregateSpec::COUNT:
+            return Value((int)count);
+        case AggregateSpec::SUM:
+            return spec->column == NOT_FOUND ? Value() : Value(sum);
+        case AggregateSpec::AVG:
+            return count ? Value(sum / count) : Value();
+        case AggregateSpec::MIN:
+            return retractable ? (values.empty() ? Value() : values.begin()->first) : extreme;
+        case AggregateSpec::MAX:
+            return retractable ? (values.empty() ? Value() : values.rbegin()->first) : extreme;
+        case AggregateSpec::COUNT_DISTINCT:
+            return Value((int)distinct.size());
+        case AggregateSpec::APPROX_COUNT_DISTINCT:
+            return Value((int)hll->estimate());
+        case AggregateSpec::APPROX_PERCENTILE:
+            return digest->empty() ? Value() : Value(digest->quantile(spec->fraction));
+        }
+        return Value();
+    }
+
+    size_t bytes() const
+    {
+        size_t total(sizeof(*this) + distinct.bucket_count() * sizeof(void *) +
+                     values.size() * (sizeof(pair<Value, uint64_t>) + 4 * sizeof(void *)));
+        for (const auto &d : distinct)
+        {
+            const Text *text(get_if<Text>(&d.first.raw()));
+            total += sizeof(d) + 2 * sizeof(void *) + (text && text->capacity() > 15 ? text->capacity() + 1 : 0);
+        }
+        if (hll)
+            total += hll->bytes();
+        if (digest)
+            total += digest->bytes();
+        return total;
+    }
+};
+
+// Groups of rows keyed on some of their columns. A row finds its group through a hash of its key
+// columns and a value-by-value comparison with the keys of the groups in that bucket, both with
+// the columns' ValueOps, so no key string is built per row
+template <typename G>
+class GroupTable
+{
+public:
+    struct Entry
+    {
+        Row keys;
+        G group;
+    };
+    using Map = unordered_multimap<size_t, Entry>;
+
+private:
+    vector<int> cols;
+    vector<ValueOps> ops;
+    Map entries; // by key hash
+
+    size_t hash_of(const Row &row) const
+    {
+        size_t h(0);
+        for (size_t i(0); i < cols.size(); ++i)
+            h ^= ops[i].hash(row[cols[i]]) + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2);
+        return h;
+    }
+
+    typename Map::iterator find(const Row &row, size_t h)
+    {
+        auto range(entries.equal_range(h));
+        for (auto it(range.first); it != range.second; ++it)
+        {
+            size_t i(0);
+            while (i < cols.size() && ops[i].compare(it->second.keys[i], row[cols[i]]) == 0)
+                ++i;
+            if (i == cols.size())
+                return it;
+        }
+        return entries.end();
+    }
+
+public:
+    GroupTable(vector<int> key_cols, vector<ValueOps> key_ops) : cols(move(key_cols)), ops(move(key_ops)) {}
+
+    // The group of the row's key, end() when there is none
+    typename Map::iterator find(const Row &row) { return find(row, hash_of(row)); }
+
+    // The group of the row's key, made by `make` when there is none yet
+    template <typename Make>
+    G &find_or_add(const Row &row, Make make)
+    {
+        size_t h(hash_of(row));
+        auto it(find(row, h));
+        if (it == entries.end())
+        {
+            Row keys;
+            keys.values().reserve(cols.size());
+            for (int col : cols)
+                keys.push_back(row[col]);
+            it = entries.emplace(h, Entry{move(keys), make()});
+        }
+        return it->second.group;
+    }
+
+    void erase(typename Map::iterator it) { entries.erase(it); }
+
+    // An empty table keyed on the keys of this one's groups (columns 0 to n - 1), for split and absorb
+    GroupTable keys_table() const
+    {
+        vector<int> keys(cols.size());
+        iota(keys.begin(), keys.end(), 0);
+        return GroupTable(keys, ops);
+    }
+
+    // Moves every group into one of `parts`, chosen by its hash
+    void split(vector<GroupTable> &parts)
+    {
+        for (auto it(entries.begin()); it != entries.end();)
+        {
+            auto node(entries.extract(it++));
+            parts[node.key() % parts.size()].entries.insert(move(node));
+        }
+    }
+
+    // Moves the groups of another table in, merge(into, from) combining those whose key is here
+    // already; both tables key on columns 0 to n - 1
+    template <typename Merge>
+    void absorb(GroupTable &other, Merge merge)
+    {
+        for (auto it(other.entries.begin()); it != other.entries.end();)
+        {
+            auto found(find(it->second.keys, it->first));
+            if (found == entries.end())
+                entries.insert(other.entries.extract(it++));
+            else
+                merge(found->second.group, (it++)->second.group);
+        }
+        other.entries.clear();
+    }
+
+    typename Map::iterator begin() { return entries.begin(); }
+    typename Map::iterator end() { return entries.end(); }
+    typename Map::const_iterator begin() const { return entries.begin(); }
+    typename Map::const_iterator end() const { return entries.end(); }
+    size_t size() const { return entries.size(); }
+    size_t bucket_count() const { return entries.bucket_count(); }
+};
+
+#endif
@@ -0,0 +1,356 @@
+#ifndef BITMAP
+#define BITMAP
+
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+
+using namespace std;
+
+// Set of row ids laid out as a roaring bitmap: the ids are grouped by their high 16 bits into
+// containers, and a container keeps its low 16 bits as a sorted array while it holds at most
+// ARRAY_MAX of them, as 65536 bits once it holds more. Sparse and dense sets both stay small, and
+// intersection, union and difference work container by container, word by word where dense.
+class Bitmap
+{
+public:
+    static const int ARRAY_MAX = 4096; // beyond it an array would outgrow the 8 KB of bits
+    static const int WORDS = 1024;     // 64-bit words of a dense container
+
+private:
+    struct Container
+    {
+        uint16_t key;
+        int count = 0;
+        vector<uint16_t> array; // sorted, while count <= ARRAY_MAX
+        vector<uint64_t> words; // WORDS of them once count > ARRAY_MAX
+
+        bool dense() const { return !words.empty(); }
+
+        bool contains(uint16_t low) const
+        {
+            if (dense())
+                return words[low >> 6] >> (low & 63) & 1;
+            return binary_search(array.begin(), array.end(), low);
+        }
+
+        bool add(uint16_t low) // false when already there
+        {
+            if (dense())
+            {
+                uint64_t &word(words[low >> 6]), bit(1ULL << (low & 63));
+                if (word & bit)
+                    return false;
+                word |= bit;
+                ++count;
+                return true;
+            }
+            auto it(lower_bound(array.begin(), array.end(), low));
+            if (it != array.end() && *it == low)
+                return false;
+            array.insert(it, low);
+            if (++count > ARRAY_MAX)
+                to_words();
+            return true;
+        }
+
+        bool remove(uint16_t low) // false when not there
+        {
+            if (dense())
+            {
+                uint64_t &word(words[low >> 6]), bit(1ULL << (low & 63));
+                if (!(word & bit))
+                    return false;
+                word &= ~bit;
+                if (--count <= ARRAY_MAX)
+                    to_array();
+                return true;
+            }
+            auto it(lower_bound(array.begin(), array.end(), low));
+            if (it == array.end() || *it != low)
+                return false;
+            array.erase(it);
+            --count;
+            return true;
+        }
+
+        void to_words()
+        {
+            words.assign(WORDS, 0);
+            for (uint16_t low : array)
+                words[low >> 6] |= 1ULL << (low & 63);
+            vector<uint16_t>().swap(array);
+        }
+
+        void to_array()
+        {
+            array.clear();
+            array.reserve(count);
+            for (int i(0); i < WORDS; ++i)
+            {
+                for (uint64_t word(words[i]); word; word &= word - 1)
+                    array.push_back(i << 6 | __builtin_ctzll(word));
+            }
+            vector<uint64_t>().swap(words);
+        }
+
+        // Counts the bits of words computed in bulk and picks the layout for that many
+        void settle()
+        {
+            count = 0;
+            for (uint64_t word : words)
+                count += __builtin_popcountll(word);
+            if (count <= ARRAY_MAX)
+                to_array();
+        }
+
+        // fn(low) for the low bits in [from, to), ascending
+        template <typename Fn>
+        void for_each(uint32_t from, uint32_t to, Fn fn) const
+        {
+            if (!dense())
+            {
+                for (auto it(lower_bound(array.begin(), array.end(), from)); it != array.end() && *it < to; ++it)
+                    fn(*it);
+                return;
+            }
+            for (uint32_t i(from >> 6); i < WORDS && i << 6 < to; ++i)
+            {
+                uint64_t word(words[i]);
+                if (i == from >> 6)
+                    word &= ~0ULL << (from & 63);
+                for (; word; word &= word - 1)
+                {
+                    uint32_t low(i << 6 | __builtin_ctzll(word));
+                    if (low >= to)
+                        return;
+                    fn(low);
+                }
+            }
+        }
+    };
+
+    vector<Container> containers; // by key, none empty
+
+    // Position of the first container whose key is at least `key`
+    int position(uint16_t key) const
+    {
+        return lower_bound(containers.begin(), containers.end(), key, [](const Container &c, uint16_t k)
+                           { return c.key < k; }) -
+               containers.begin();
+    }
+    int find(uint16_t key) const
+    {
+        int c(position(key));
+        return c < containers.size() && containers[c].key == key ? c : -1;
+    }
+
+    static Container intersect(const Container &a, const Container &b)
+    {
+        Container out;
+        out.key = a.key;
+        if (a.dense() && b.dense())
+        {
+            out.words.resize(WORDS);
+            for (int i(0); i < WORDS; ++i)
+                out.words[i] = a.words[i] & b.words[i];
+            out.settle();
+            return out;
+        }
+        if (a.dense() || b.dense())
+        {
+            const Container &sparse(a.dense() ? b : a), &dense(a.dense() ? a : b);
+            for (uint16_t low : sparse.array)
+            {
+                if (dense.contains(low))
+                    out.array.push_back(low);
+            }
+        }
+        else
+            set_intersection(a.array.begin(), a.array.end(), b.array.begin(), b.array.end(), back_inserter(out.array));
+        out.count = out.array.size();
+        return out;
+    }
+
+    static Container unite(const Container &a, const Container &b)
+    {
+        Container out;
+        out.key = a.key;
+        if (a.dense() || b.dense())
+        {
+            const Container &dense(a.dense() ? a : b), &other(a.dense() ? b : a);
+            out.words = dense.words;
+            if (other.dense())
+            {
+                for (int i(0); i < WORDS; ++i)
+                    out.words[i] |= other.words[i];
+            }
+            else
+            {
+                for (uint16_t low : other.array)
+                    out.words[low >> 6] |= 1ULL << (low & 63);
+            }
+            out.settle();
+            return out;
+        }
+        set_union(a.array.begin(), a.array.end(), b.array.begin(), b.array.end(), back_inserter(out.array));
+        out.count = out.array.size();
+        if (out.count > ARRAY_MAX)
+            out.to_words();
+        return out;
+    }
+
+    static Container subtract(const Container &a, const Container &b)
+    {
+        Container out;
+        out.key = a.key;
+        if (a.dense())
+        {
+            out.words = a.words;
+            if (b.dense())
+            {
+                for (int i(0); i < WORDS; ++i)
+                    out.words[i] &= ~b.words[i];
+            }
+            else
+            {
+                for (uint16_t low : b.array)
+                    out.words[low >> 6] &= ~(1ULL << (low & 63));
+            }
+            out.settle();
+            return out;
+        }
+        if (b.dense())
+        {
+            for (uint16_t low : a.array)
+            {
+                if (!b.contains(low))
+                    out.array.push_back(low);
+            }
+        }
+        else
+            set_difference(a.array.begin(), a.array.end(), b.array.begin(), b.array.end(), back_inserter(out.array));
+        out.count = out.array.size();
+        return out;
+    }
+
+public:
+    void add(uint32_t id)
+    {
+        uint16_t key(id >> 16);
+        int c(position(key));
+        if (c == containers.size() || containers[c].key != key)
+        {
+            containers.insert(containers.begin() + c, Container());
+            containers[c].key = key;
+        }
+        containers[c].add(id & 0xFFFF);
+    }
+
+    void remove(uint32_t id)
+    {
+        int c(find(id >> 16));
+        if (c < 0 || !containers[c].remove(id & 0xFFFF) || containers[c].count)
+            return;
+        containers.erase(containers.begin() + c);
+    }
+
+    bool contains(uint32_t id) const
+    {
+        int c(find(id >> 16));
+        return c >= 0 && containers[c].contains(id & 0xFFFF);
+    }
+
+    bool empty() const { return containers.empty(); }
+    void clear() { containers.clear(); }
+
+    uint64_t cardinality() const
+    {
+        uint64_t total(0);
+        for (const auto &c : containers)
+            total += c.count;
+        return total;
+    }
+
+    // Ids in both
+    static Bitmap intersect(const Bitmap &a, const Bitmap &b)
+    {
+        Bitmap out;
+        auto i(a.containers.begin()), j(b.containers.begin());
+        while (i != a.containers.end() && j != b.containers.end())
+        {
+            if (i->key < j->key)
+                ++i;
+            else if (j->key < i->key)
+                ++j;
+            else
+            {
+                Container c(intersect(*i++, *j++));
+                if (c.count)
+                    out.containers.push_back(move(c));
+            }
+        }
+        return out;
+    }
+
+    // Ids in either
+    static Bitmap unite(const Bitmap &a, const Bitmap &b)
+    {
+        Bitmap out;
+        auto i(a.containers.begin()), j(b.containers.begin());
+        while (i != a.containers.end() || j != b.containers.end())
+        {
+            if (j == b.containers.end() || (i != a.containers.end() && i->key < j->key))
+                out.containers.push_back(*i++);
+            else if (i == a.containers.end() || j->key < i->key)
+                out.containers.push_back(*j++);
+            else
+                out.containers.push_back(unite(*i++, *j++));
+        }
+        return out;
+    }
+
+    // Ids in `a` and not in `b`
+    static Bitmap subtract(const Bitmap &a, const Bitmap &b)
+    {
+        Bitmap out;
+        auto j(b.containers.begin());
+        for (const auto &c : a.containers)
+        {
+            while (j != b.containers.end() && j->key < c.key)
+                ++j;
+            if (j == b.containers.end() || j->key != c.key)
+            {
+                out.containers.push_back(c);
+                continue;
+            }
+            Container left(subtract(c, *j));
+            if (left.count)
+                out.containers.push_back(move(left));
+        }
+        return out;
+    }
+
+    // Appends the ids in [from, to) to `out`, ascending
+    void collect(uint32_t from, uint32_t to, vector<int> &out) const
+    {
+        for (int c(position(from >> 16)); c < containers.size(); ++c)
+        {
+            uint32_t base(uint32_t(containers[c].key) << 16);
+            if (base >= to)
+                break;
+            containers[c].for_each(from > base ? from - base : 0, min<uint64_t>(to - base, 0x10000), [&](uint32_t low)
+                                   { out.push_back(base | low); });
+        }
+    }
+
+    size_t bytes() const
+    {
+        size_t total(sizeof(*this) + containers.capacity() * sizeof(Container));
+        for (const auto &c : containers)
+            total += c.array.capacity() * sizeof(uint16_t) + c.words.capacity() * sizeof(uint64_t);
+        return total;
+    }
+};
+
+#endif
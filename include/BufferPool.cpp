@@ -0,0 +1,247 @@
+#ifndef BUFFER_POOL
+#define BUFFER_POOL
+
+#include "Metrics.cpp"
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <cstdint>
+
+using namespace std;
+
+// Page cache shared by every table. Each frame holds one page, found by (source, page id); a page
+// stays in its frame while pinned. Once the resident pages outgrow the memory limit a CLOCK hand
+// evicts unpinned ones, writing dirty pages back to their source first. Page needs bytes().
+template <typename Page>
+class BufferPool
+{
+public:
+    // Where a page lives while it is not in a frame
+    class Source
+    {
+    public:
+        virtual ~Source() {}
+        virtual void read_page(uint64_t id, Page &into) = 0;
+        virtual void write_page(uint64_t id, const Page &from) = 0;
+    };
+
+private:
+    struct Frame
+    {
+        Source *owner = nullptr; // nullptr while free
+        uint64_t id = 0;
+        Page page;
+        int pins = 0;
+        bool dirty = false;
+        bool referenced = false; // CLOCK second chance
+        bool resized = false;    // bytes needs recounting at unpin
+        size_t bytes = 0;
+    };
+    struct Key
+    {
+        const Source *owner;
+        uint64_t id;
+        bool operator==(const Key &o) const { return owner == o.owner && id == o.id; }
+    };
+    struct KeyHash
+    {
+        size_t operator()(const Key &k) const { return hash<const void *>()(k.owner) ^ (k.id * 0x9e3779b97f4a7c15ULL); }
+    };
+
+    mutex _mutex; // frame table and page I/O; rows inside a pinned page are guarded by their table
+    vector<unique_ptr<Frame>> _frames;
+    vector<Frame *> _free;
+    unordered_map<Key, Frame *, KeyHash> _index;
+    size_t _hand = 0;
+    size_t _limit = SIZE_MAX;
+    size_t _resident = 0;
+
+    bool evict_one()
+    {
+        for (size_t step(0); step < 2 * _frames.size(); ++step)
+        {
+            Frame *f(_frames[_hand].get());
+            _hand = (_hand + 1) % _frames.size();
+            if (!f->owner || f->pins)
+                continue;
+            if (f->referenced)
+            {
+                f->referenced = false;
+                continue;
+            }
+
+            if (f->dirty)
+            {
+                f->owner->write_page(f->id, f->page);
+                Metrics::add(Metrics::BUFFER_WRITEBACKS);
+            }
+            release_frame(f);
+            Metrics::add(Metrics::BUFFER_EVICTIONS);
+            return true;
+        }
+        return false; // everything is pinned: run over the limit rather than fail
+    }
+
+    void release_frame(Frame *f)
+    {
+        _index.erase({f->owner, f->id});
+        _resident -= f->bytes;
+        f->page = Page();
+        f->owner = nullptr;
+        f->dirty = f->referenced = f->resized = false;
+        f->bytes = 0;
+        _free.push_back(f);
+    }
+
+    Frame *take_frame()
+    {
+        while (_resident > _limit && evict_one())
+            ;
+        if (!_free.empty())
+        {
+            Frame *f(_free.back());
+            _free.pop_back();
+            return f;
+        }
+        _frames.push_back(make_unique<Frame>());
+        return _frames.back().get();
+    }
+
+    void unpin(Frame *f)
+    {
+        lock_guard<mutex> lock(_mutex);
+        if (f->resized)
+        {
+            _resident -= f->bytes;
+            f->bytes = f->page.bytes();
+            _resident += f->bytes;
+            f->resized = false;
+        }
+        --f->pins;
+    }
+
+public:
+    // A pin on one frame; the page cannot be evicted until every Ref to it is gone
+    class Ref
+    {
+        BufferPool *pool = nullptr;
+        Frame *frame = nullptr;
+
+    public:
+        Ref() = default;
+        Ref(BufferPool *p, Frame *f) : pool(p), frame(f) {}
+        Ref(Ref &&o) noexcept : pool(o.pool), frame(o.frame) { o.frame = nullptr; }
+        Ref &operator=(Ref &&o) noexcept
+        {
+            if (this != &o)
+            {
+                release();
+                pool = o.pool;
+                frame = o.frame;
+                o.frame = nullptr;
+            }
+            return *this;
+        }
+        ~Ref() { release(); }
+
+        explicit operator bool() const { return frame; }
+        Page &operator*() const { return frame->page; }
+        Page *operator->() const { return &frame->page; }
+        void mark_dirty() // the holder changed the page
+        {
+            frame->dirty = true;
+            frame->resized = true;
+        }
+        void release()
+        {
+            if (frame)
+                pool->unpin(frame);
+            frame = nullptr;
+        }
+    };
+
+    static BufferPool &instance()
+    {
+        static BufferPool pool;
+        return pool;
+    }
+
+    void set_limit(size_t bytes)
+    {
+        lock_guard<mutex> lock(_mutex);
+        _limit = bytes;
+        while (_resident > _limit && evict_one())
+            ;
+    }
+    size_t limit()
+    {
+        lock_guard<mutex> lock(_mutex);
+        return _limit;
+    }
+
+    // Pins the page, reading it from its source on a miss; `create` starts a new empty page instead
+    Ref fetch(Source *owner, uint64_t id, bool create = false)
+    {
+        lock_guard<mutex> lock(_mutex);
+        auto it(_index.find({owner, id}));
+        if (it != _index.end())
+        {
+            Frame *f(it->second);
+            ++f->pins;
+            f->referenced = true;
+            Metrics::add(Metrics::BUFFER_HITS);
+            return Ref(this, f);
+        }
+
+        Frame *f(take_frame());
+        f->owner = owner;
+        f->id = id;
+        f->pins = 1;
+        f->referenced = true;
+        f->dirty = create;
+        _index[{owner, id}] = f;
+        if (!create)
+        {
+            Metrics::add(Metrics::BUFFER_MISSES);
+            try
+            {
+                owner->read_page(id, f->page);
+            }
+            catch (...)
+            {
+                f->pins = 0;
+                release_frame(f);
+                throw;
+            }
+            f->bytes = f->page.bytes();
+            _resident += f->bytes;
+        }
+        return Ref(this, f);
+    }
+
+    // Forgets pages without writing them back: from page `from` on, or all of a source being destroyed
+    void discard(const Source *owner, uint64_t from = 0)
+    {
+        lock_guard<mutex> lock(_mutex);
+        for (auto &f : _frames)
+        {
+            if (f->owner == owner && f->id >= from)
+                release_frame(f.get());
+        }
+    }
+
+    size_t resident_bytes(const Source *owner)
+    {
+        lock_guard<mutex> lock(_mutex);
+        size_t bytes(0);
+        for (auto &f : _frames)
+        {
+            if (f->owner == owner)
+                bytes += f->bytes;
+        }
+        return bytes;
+    }
+};
+
+#endif
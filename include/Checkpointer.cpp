@@ -0,0 +1,67 @@
+#ifndef CHECKPOINTER
+#define CHECKPOINTER
+
+#include "models.cpp"
+#include "Helper.cpp"
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+
+// Writes a checkpoint every interval, and a last one on shutdown so the next start restores
+// from images instead of replaying the csv and log files
+class Checkpointer
+{
+    Catalog *_catalog;
+    chrono::milliseconds _interval;
+    atomic<bool> _running;
+    mutex _wait_mutex;
+    condition_variable _wake;
+    thread _worker;
+
+    void run()
+    {
+        while (_running)
+        {
+            {
+                unique_lock<mutex> lock(_wait_mutex);
+                if (_interval.count())
+                    _wake.wait_for(lock, _interval, [this]
+                                   { return !_running; });
+                else // only on shutdown
+                    _wake.wait(lock, [this]
+                               { return !_running; });
+            }
+            Helper::write_checkpoint(_catalog);
+        }
+    }
+
+public:
+    Checkpointer(Catalog *cat, chrono::milliseconds interval = chrono::seconds(60))
+        : _catalog(cat), _interval(interval), _running(false) {}
+
+    ~Checkpointer() { stop(); }
+
+    void start()
+    {
+        if (_running)
+            return;
+        _running = true;
+        _worker = thread(&Checkpointer::run, this);
+    }
+
+    void stop()
+    {
+        if (!_running)
+            return;
+        {
+            lock_guard<mutex> lock(_wait_mutex);
+            _running = false;
+        }
+        _wake.notify_all();
+        if (_worker.joinable())
+            _worker.join();
+    }
+};
+
+#endif
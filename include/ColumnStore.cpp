@@ -0,0 +1,750 @@
+#ifndef COLUMN_STORE
+#define COLUMN_STORE
+
+#include "models.cpp"
+#include <fstream>
+#include <cstring>
+#include <functional>
+#include <filesystem>
+#include <cmath>
+
+namespace fs = std::filesystem;
+
+// Compressed columnar image of a table, written by compaction and read back on load.
+// Rows are cut into blocks of BLOCK_ROWS; inside a block every column is one chunk:
+//   INT, DATE  delta + bit-packing, or run-length when that is smaller
+//   DOUBLE     scaled to integers when every value has few decimals (then as INT), else raw IEEE
+//              bits or run-length; all three round-trip exactly
+//   text       dictionary + bit-packed codes, or plain strings, then an LZ block codec
+// NULLs are kept in a per-chunk bitmap and left out of the encoded values.
+class ColumnStore
+{
+public:
+    static const uint32_t MAGIC = 0x4344424d; // "MDBC"
+    static const uint32_t VERSION = 1;
+    static const int BLOCK_ROWS = 65536;
+
+private:
+    enum Encoding : uint8_t
+    {
+        DELTA_PACKED,
+        RUN_LENGTH,
+        RAW,
+        DICTIONARY,
+        PLAIN,
+        DECIMAL
+    };
+
+public: // byte-level encoding, shared with the checkpoint format
+    class Writer
+    {
+    public:
+        string buf;
+
+        void u8(uint8_t v) { buf.push_back((char)v); }
+        void u32(uint32_t v) { buf.append((const char *)&v, 4); }
+        void u64(uint64_t v) { buf.append((const char *)&v, 8); }
+        void bytes(const string &s) { buf.append(s); }
+        void varint(uint64_t v)
+        {
+            while (v >= 0x80)
+            {
+                buf.push_back((char)(v | 0x80));
+                v >>= 7;
+            }
+            buf.push_back((char)v);
+        }
+        void text(const string &s)
+        {
+            varint(s.size());
+            buf.append(s);
+        }
+    };
+
+    class Reader
+    {
+        const char *start;
+        const char *p;
+        const char *end;
+
+        void need(size_t n) const
+        {
+            if (end - p < (ptrdiff_t)n)
+                throw runtime_error("column file is truncated");
+        }
+
+    public:
+        Reader(const char *data, size_t size) : start(data), p(data), end(data + size) {}
+        Reader(const string &s) : Reader(s.data(), s.size()) {}
+
+        bool done() const { return p >= end; }
+        size_t position() const { return p - start; }
+        const char *skip(size_t n) // the next n bytes, in place
+        {
+            need(n);
+            const char *at(p);
+            p += n;
+            return at;
+        }
+        uint8_t u8()
+        {
+            need(1);
+            return (uint8_t)*p++;
+        }
+        uint32_t u32()
+        {
+            uint32_t v;
+            need(4);
+            memcpy(&v, p, 4);
+            p += 4;
+            return v;
+        }
+        uint64_t u64()
+        {
+            uint64_t v;
+            need(8);
+            memcpy(&v, p, 8);
+            p += 8;
+            return v;
+        }
+        uint64_t varint()
+        {
+            uint64_t v(0);
+            for (int shift(0); shift < 64; shift += 7)
+            {
+                uint8_t b(u8());
+                v |= (uint64_t)(b & 0x7f) << shift;
+                if (!(b & 0x80))
+                    return v;
+            }
+            throw runtime_error("column file has a bad varint");
+        }
+        string bytes(size_t n)
+        {
+            need(n);
+            string s(p, n);
+            p += n;
+            return s;
+        }
+        string text() { return bytes(varint()); }
+    };
+
+private:
+    static uint64_t zigzag(int64_t v) { return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63); }
+    static int64_t unzigzag(uint64_t v) { return (int64_t)(v >> 1) ^ -(int64_t)(v & 1); }
+    static int bit_width(uint64_t v) { return v ? 64 - __builtin_clzll(v) : 0; }
+
+    static void pack(Writer &w, const vector<uint64_t> &values, int width)
+    {
+        w.u8(width);
+        if (!width)
+            return;
+
+        size_t start(w.buf.size());
+        w.buf.resize(start + (values.size() * width + 7) / 8 + 8, 0); // slack for the 8-byte stores
+        uint64_t bit(0);
+        for (uint64_t v : values)
+        {
+            char *at(&w.buf[start + bit / 8]);
+            uint64_t word;
+            memcpy(&word, at, 8);
+            word |= v << (bit % 8);
+            memcpy(at, &word, 8);
+            if (bit % 8 + width > 64) // the value straddles a ninth byte
+                at[8] |= (char)(v >> (64 - bit % 8));
+            bit += width;
+        }
+        w.buf.resize(start + (values.size() * width + 7) / 8);
+    }
+
+    static vector<uint64_t> unpack(Reader &r, size_t count)
+    {
+        int width(r.u8());
+        vector<uint64_t> values(count, 0);
+        if (!width)
+            return values;
+
+        string packed(r.bytes((count * width + 7) / 8));
+        packed.append(9, '\0');
+        uint64_t mask(width == 64 ? ~0ull : (1ull << width) - 1), bit(0);
+        for (size_t i(0); i < count; ++i, bit += width)
+        {
+            const char *at(&packed[bit / 8]);
+            uint64_t word;
+            memcpy(&word, at, 8);
+            uint64_t v(word >> (bit % 8));
+            if (bit % 8 + width > 64)
+                v |= (uint64_t)(uint8_t)at[8] << (64 - bit % 8);
+            values[i] = v & mask;
+        }
+        return values;
+    }
+
+    // Byte-oriented LZ77 with a 4-byte hash, in the spirit of LZ4: fast to decode, no entropy stage
+    static string lz_compress(const string &in)
+    {
+        const int HASH_BITS = 14, MIN_MATCH = 4, MAX_OFFSET = 1 << 16;
+        vector<int> table(1 << HASH_BITS, -1);
+        Writer w;
+        size_t anchor(0), i(0), n(in.size());
+
+        auto read32 = [&](size_t at)
+        {
+            uint32_t v;
+            memcpy(&v, &in[at], 4);
+            return v;
+        };
+
+        while (i + MIN_MATCH <= n)
+        {
+            uint32_t seq(read32(i)), h((seq * 2654435761u) >> (32 - HASH_BITS));
+            int cand(table[h]);
+            table[h] = i;
+
+            if (cand < 0 || i - cand > MAX_OFFSET || read32(cand) != seq)
+            {
+                ++i;
+                continue;
+            }
+
+            size_t len(MIN_MATCH);
+            while (i + len < n && in[cand + len] == in[i + len])
+                ++len;
+
+            w.varint(i - anchor);
+            w.buf.append(in, anchor, i - anchor);
+            w.varint(len);
+            w.varint(i - cand);
+            i += len;
+            anchor = i;
+        }
+
+        w.varint(n - anchor);
+        w.buf.append(in, anchor, n - anchor);
+        w.varint(0);
+        return w.buf;
+    }
+
+    static string lz_decompress(const string &in, size_t raw_size)
+    {
+        Reader r(in);
+        string out;
+        out.reserve(raw_size);
+        while (!r.done())
+        {
+            out += r.bytes(r.varint());
+            size_t len(r.varint());
+            if (!len)
+                break;
+            size_t offset(r.varint());
+            if (!offset || offset > out.size() || out.size() + len > raw_size)
+                throw runtime_error("column file has a bad match offset");
+            size_t from(out.size() - offset);
+            for (size_t k(0); k < len; ++k) // byte by byte: matches may overlap their own output
+                out.push_back(out[from + k]);
+        }
+        if (out.size() != raw_size)
+            throw runtime_error("column file has a bad text block");
+        return out;
+    }
+
+    static int type_class(const string &type)
+    {
+        if (type == "INT")
+            return 0;
+        if (type == "DATE")
+            return 1;
+        if (type == "DOUBLE")
+            return 2;
+        return 3;
+    }
+
+    static int64_t date_key(const Date &d) { return (int64_t)d.get_year() * 512 + d.get_month() * 32 + d.get_day(); }
+    static Date key_date(int64_t k) { return Date(k / 512, (k % 512) / 32, k % 32); }
+
+    static void encode_ints(Writer &w, const vector<int64_t> &values)
+    {
+        Writer delta, rle;
+
+        delta.u8(DELTA_PACKED);
+        vector<uint64_t> deltas;
+        deltas.reserve(values.size());
+        uint64_t widest(0);
+        for (size_t i(1); i < values.size(); ++i)
+        {
+            deltas.push_back(zigzag(values[i] - values[i - 1]));
+            widest |= deltas.back();
+        }
+        delta.varint(values.empty() ? 0 : zigzag(values[0]));
+        pack(delta, deltas, bit_width(widest));
+
+        rle.u8(RUN_LENGTH);
+        for (size_t i(0); i < values.size();)
+        {
+            size_t j(i);
+            while (j < values.size() && values[j] == values[i])
+                ++j;
+            rle.varint(zigzag(values[i]));
+            rle.varint(j - i);
+            i = j;
+        }
+
+        w.bytes(rle.buf.size() < delta.buf.size() ? rle.buf : delta.buf);
+    }
+
+    static vector<int64_t> decode_ints(Reader &r, size_t count)
+    {
+        vector<int64_t> values;
+        values.reserve(count);
+        uint8_t enc(r.u8());
+        if (enc == RUN_LENGTH)
+        {
+            while (values.size() < count)
+            {
+                int64_t v(unzigzag(r.varint()));
+                size_t run(r.varint());
+                if (!run)
+                    throw runtime_error("column file has an empty run");
+                values.insert(values.end(), min<size_t>(run, count - values.size()), v);
+            }
+            return values;
+        }
+
+        int64_t v(unzigzag(r.varint()));
+        vector<uint64_t> deltas(unpack(r, count ? count - 1 : 0));
+        if (count)
+            values.push_back(v);
+        for (uint64_t d : deltas)
+            values.push_back(v += unzigzag(d));
+        return values;
+    }
+
+    // Smallest power of ten that turns every value into an exact integer, or -1
+    static int decimal_scale(const vector<double> &values)
+    {
+        static const double POW10[] = {1, 10, 100, 1000, 10000, 100000, 1000000};
+        for (int scale(0); scale < 7; ++scale)
+        {
+            bool exact(true);
+            for (double v : values)
+            {
+                double scaled(nearbyint(v * POW10[scale]));
+                if (fabs(scaled) >= 9007199254740992.0 || scaled / POW10[scale] != v)
+                {
+                    exact = false;
+                    break;
+                }
+            }
+            if (exact)
+                return scale;
+        }
+        return -1;
+    }
+
+    static void encode_doubles(Writer &w, const vector<double> &values)
+    {
+        int scale(decimal_scale(values));
+        if (scale >= 0)
+        {
+            vector<int64_t> scaled;
+            scaled.reserve(values.size());
+            for (double v : values)
+                scaled.push_back((int64_t)nearbyint(v * pow(10.0, scale)));
+            w.u8(DECIMAL);
+            w.u8(scale);
+            encode_ints(w, scaled);
+            return;
+        }
+
+        Writer raw, rle;
+
+        raw.u8(RAW);
+        raw.buf.append((const char *)values.data(), values.size() * sizeof(double));
+
+        rle.u8(RUN_LENGTH);
+        for (size_t i(0); i < values.size();)
+        {
+            size_t j(i);
+            while (j < values.size() && !memcmp(&values[j], &values[i], sizeof(double)))
+                ++j;
+            rle.buf.append((const char *)&values[i], sizeof(double));
+            rle.varint(j - i);
+            i = j;
+        }
+
+        w.bytes(rle.buf.size() < raw.buf.size() ? rle.buf : raw.buf);
+    }
+
+    static vector<double> decode_doubles(Reader &r, size_t count)
+    {
+        vector<double> values(count);
+        uint8_t enc(r.u8());
+        if (enc == DECIMAL)
+        {
+            double factor(pow(10.0, r.u8()));
+            vector<int64_t> scaled(decode_ints(r, count));
+            for (size_t i(0); i < count; ++i)
+                values[i] = scaled[i] / factor;
+            return values;
+        }
+        if (enc == RAW)
+        {
+            string raw(r.bytes(count * sizeof(double)));
+            memcpy(values.data(), raw.data(), raw.size());
+            return values;
+        }
+
+        for (size_t i(0); i < count;)
+        {
+            double v;
+            string bits(r.bytes(sizeof(double)));
+            memcpy(&v, bits.data(), sizeof(double));
+            size_t run(min<size_t>(r.varint(), count - i));
+            if (!run)
+                throw runtime_error("column file has an empty run");
+            fill(values.begin() + i, values.begin() + i + run, v);
+            i += run;
+        }
+        return values;
+    }
+
+    static void encode_texts(Writer &w, const vector<const string *> &values)
+    {
+        unordered_map<string, uint32_t> ids;
+        vector<const string *> dict;
+        vector<uint64_t> codes;
+        codes.reserve(values.size());
+        for (const string *s : values)
+        {
+            auto it(ids.emplace(*s, dict.size()));
+            if (it.second)
+                dict.push_back(s);
+            codes.push_back(it.first->second);
+        }
+
+        Writer body;
+        if (dict.size() <= values.size() / 2)
+        {
+            body.u8(DICTIONARY);
+            body.varint(dict.size());
+            for (const string *s : dict)
+                body.text(*s);
+            pack(body, codes, bit_width(dict.empty() ? 0 : dict.size() - 1));
+        }
+        else
+        {
+            body.u8(PLAIN);
+            for (const string *s : values)
+                body.text(*s);
+        }
+
+        string compressed(lz_compress(body.buf));
+        bool use_lz(compressed.size() < body.buf.size());
+        w.u8(use_lz);
+        w.varint(body.buf.size());
+        w.varint(use_lz ? compressed.size() : body.buf.size());
+        w.bytes(use_lz ? compressed : body.buf);
+    }
+
+    static vector<string> decode_texts(Reader &r, size_t count)
+    {
+        bool use_lz(r.u8());
+        size_t raw_size(r.varint()), stored(r.varint());
+        string body(r.bytes(stored));
+        if (use_lz)
+            body = lz_decompress(body, raw_size);
+
+        Reader b(body);
+        vector<string> values;
+        values.reserve(count);
+        if (b.u8() == DICTIONARY)
+        {
+            vector<string> dict(b.varint());
+            for (auto &s : dict)
+                s = b.text();
+            for (uint64_t code : unpack(b, count))
+            {
+                if (code >= dict.size())
+                    throw runtime_error("column file has a bad dictionary code");
+                values.push_back(dict[code]);
+            }
+            return values;
+        }
+
+        for (size_t i(0); i < count; ++i)
+            values.push_back(b.text());
+        return values;
+    }
+
+    static void encode_chunk(Writer &w, const vector<Row> &rows, size_t from, size_t to, int col, int kind)
+    {
+        size_t n(to - from);
+        string nulls((n + 7) / 8, '\0');
+        bool any_null(false);
+
+        vector<int64_t> ints;
+        vector<double> doubles;
+        vector<const string *> texts;
+        vector<string> converted; // non-Text values of a text column, rare
+        converted.reserve(n);
+
+        for (size_t i(from); i < to; ++i)
+        {
+            const Value &v(rows[i][col]);
+            if (v.is_null())
+            {
+                nulls[(i - from) / 8] |= (char)(1 << ((i - from) % 8));
+                any_null = true;
+                continue;
+            }
+
+            if (kind == 0)
+                ints.push_back(v.get_int());
+            else if (kind == 1)
+                ints.push_back(holds_alternative<Date>(v.raw()) ? date_key(get<Date>(v.raw())) : 0);
+            else if (kind == 2)
+                doubles.push_back(v.get_double());
+            else if (const Text *t = get_if<Text>(&v.raw()))
+                texts.push_back(t);
+            else
+            {
+                converted.push_back(v.to_string());
+                texts.push_back(&converted.back());
+            }
+        }
+
+        w.u8(any_null);
+        if (any_null)
+            w.bytes(nulls);
+
+        if (kind <= 1)
+            encode_ints(w, ints);
+        else if (kind == 2)
+            encode_doubles(w, doubles);
+        else
+            encode_texts(w, texts);
+    }
+
+    static void decode_chunk(Reader &r, vector<Row> &block, int kind)
+    {
+        size_t n(block.size());
+        string nulls;
+        if (r.u8())
+            nulls = r.bytes((n + 7) / 8);
+
+        auto is_null = [&](size_t i)
+        { return !nulls.empty() && (nulls[i / 8] >> (i % 8)) & 1; };
+
+        size_t present(0);
+        for (size_t i(0); i < n; ++i)
+            present += !is_null(i);
+
+        vector<int64_t> ints;
+        vector<double> doubles;
+        vector<string> texts;
+        if (kind <= 1)
+            ints = decode_ints(r, present);
+        else if (kind == 2)
+            doubles = decode_doubles(r, present);
+        else
+            texts = decode_texts(r, present);
+
+        for (size_t i(0), k(0); i < n; ++i)
+        {
+            vector<Value> &vals(block[i].values());
+            if (is_null(i))
+                vals.emplace_back();
+            else if (kind == 0)
+                vals.emplace_back((Int)ints[k++]);
+            else if (kind == 1)
+                vals.emplace_back(key_date(ints[k++]));
+            else if (kind == 2)
+                vals.emplace_back(doubles[k++]);
+            else
+                vals.emplace_back(move(texts[k++]));
+        }
+    }
+
+    static vector<int> type_classes(const vector<Column> &columns)
+    {
+        vector<int> kinds;
+        for (const auto &col : columns)
+            kinds.push_back(type_class(col.get_type()));
+        return kinds;
+    }
+
+    static uint64_t write_header(ostream &file, size_t column_count, uint64_t row_count, uint64_t epoch)
+    {
+        Writer header;
+        header.u32(MAGIC);
+        header.u32(VERSION);
+        header.u64(epoch);
+        header.u32(column_count);
+        header.u64(row_count);
+        file.write(header.buf.data(), header.buf.size());
+        return header.buf.size();
+    }
+
+    static uint64_t write_block(ostream &file, const vector<Row> &rows, size_t from, size_t to, const vector<int> &kinds)
+    {
+        Writer block;
+        block.u32(to - from);
+        for (int c(0); c < kinds.size(); ++c)
+        {
+            Writer chunk;
+            encode_chunk(chunk, rows, from, to, c, kinds[c]);
+            block.u32(chunk.buf.size());
+            block.bytes(chunk.buf);
+        }
+        file.write(block.buf.data(), block.buf.size());
+        return block.buf.size();
+    }
+
+public:
+    // Streams rows into a column image at the current position of `file`, one block at a time;
+    // finish() patches the row count into the header
+    class Builder
+    {
+        ostream &file;
+        vector<int> kinds;
+        vector<Row> pending;
+        streampos header_at;
+        uint64_t rows = 0;
+        uint64_t written = 0;
+
+        void flush()
+        {
+            if (pending.empty())
+                return;
+            written += write_block(file, pending, 0, pending.size(), kinds);
+            rows += pending.size();
+            pending.clear();
+        }
+
+    public:
+        Builder(ostream &out, const vector<Column> &columns, uint64_t epoch)
+            : file(out), kinds(type_classes(columns)), header_at(out.tellp())
+        {
+            written = write_header(file, columns.size(), 0, epoch);
+        }
+
+        void add(const Row &row)
+        {
+            pending.push_back(row);
+            if (pending.size() == BLOCK_ROWS)
+                flush();
+        }
+
+        uint64_t finish() // bytes written
+        {
+            flush();
+            streampos end(file.tellp());
+            file.seekp(header_at + streamoff(20));
+            file.write((const char *)&rows, 8);
+            file.seekp(end);
+            return written;
+        }
+    };
+
+    // Writes every row of `rows`; the caller makes the file visible with an atomic rename
+    static uint64_t write(const fs::path &path, const vector<Column> &columns, const vector<Row> &rows, uint64_t epoch)
+    {
+        ofstream file(path, ios::binary | ios::trunc);
+        uint64_t written(write_header(file, columns.size(), rows.size(), epoch));
+
+        vector<int> kinds(type_classes(columns));
+        for (size_t from(0); from < rows.size(); from += BLOCK_ROWS)
+            written += write_block(file, rows, from, min(rows.size(), from + (size_t)BLOCK_ROWS), kinds);
+
+        file.close();
+        if (!file)
+            throw runtime_error("cannot write " + path.string());
+        return written;
+    }
+
+    static uint64_t read_epoch(const fs::path &path)
+    {
+        ifstream file(path, ios::binary);
+        char header[16];
+        if (!file.read(header, sizeof(header)))
+            return 0;
+        Reader r(header, sizeof(header));
+        if (r.u32() != MAGIC || r.u32() != VERSION)
+            return 0;
+        return r.u64();
+    }
+
+    // Decodes a column image held in memory and hands each row to fn(Row&&) in order;
+    // returns the bytes it took up, so the image can be embedded in a larger file
+    static size_t read(const char *data, size_t size, const vector<Column> &columns, const function<void(Row &&)> &fn)
+    {
+        Reader r(data, size);
+
+        if (r.u32() != MAGIC || r.u32() != VERSION)
+            throw runtime_error("not a column image");
+        r.u64(); // epoch
+        if (r.u32() != columns.size())
+            throw runtime_error("column image does not match the table schema");
+        uint64_t remaining(r.u64());
+
+        vector<int> kinds(type_classes(columns));
+        while (remaining)
+        {
+            vector<Row> block(r.u32());
+            if (block.empty() || block.size() > remaining)
+                throw runtime_error("column image has a bad block header");
+            for (auto &row : block)
+                row.values().reserve(columns.size());
+
+            for (int c(0); c < columns.size(); ++c)
+            {
+                uint32_t chunk_size(r.u32());
+                Reader cr(r.skip(chunk_size), chunk_size);
+                decode_chunk(cr, block, kinds[c]);
+            }
+
+            remaining -= block.size();
+            for (auto &row : block)
+                fn(move(row));
+        }
+        return r.position();
+    }
+
+    // Length of a column image held in memory, found from its block headers without decoding
+    static size_t image_size(const char *data, size_t size)
+    {
+        Reader r(data, size);
+        if (r.u32() != MAGIC || r.u32() != VERSION)
+            throw runtime_error("not a column image");
+        r.u64(); // epoch
+        uint32_t columns(r.u32());
+        uint64_t remaining(r.u64());
+        while (remaining)
+        {
+            uint32_t n(r.u32());
+            if (!n || n > remaining)
+                throw runtime_error("column image has a bad block header");
+            for (uint32_t c(0); c < columns; ++c)
+                r.skip(r.u32());
+            remaining -= n;
+        }
+        return r.position();
+    }
+
+    // Decodes the whole file with one bulk read
+    static void read(const fs::path &path, const vector<Column> &columns, const function<void(Row &&)> &fn)
+    {
+        ifstream file(path, ios::binary);
+        string data((istreambuf_iterator<char>(file)), istreambuf_iterator<char>());
+        try
+        {
+            read(data.data(), data.size(), columns, fn);
+        }
+        catch (const exception &e)
+        {
+            throw runtime_error(string(e.what()) + ": " + path.string());
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,125 @@
+#ifndef COMPACTOR
+#define COMPACTOR
+
+#include "models.cpp"
+#include "Helper.cpp"
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+
+class Compactor
+{
+    Catalog *_catalog;
+    double _dead_ratio;
+    uintmax_t _max_log_bytes;
+    chrono::milliseconds _interval;
+    atomic<bool> _running;
+    mutex _wait_mutex;
+    condition_variable _wake;
+    thread _worker;
+
+    bool needs_compaction(const Table *table) const
+    {
+        int dead(table->dead_row_count());
+        if (dead && dead >= table->row_count() * _dead_ratio)
+            return true;
+
+        error_code ec;
+        uintmax_t log_bytes(fs::file_size(Helper::log_path(table->get_name()), ec));
+        if (!ec && log_bytes > _max_log_bytes)
+            return true;
+
+        // Rows appended as csv move into the compressed column file once the csv outgrows it,
+        // so each row is rewritten a bounded number of times as the table grows
+        uintmax_t csv_bytes(fs::file_size(Helper::csv_path(table->get_name()), ec));
+        if (ec)
+            return false;
+        uintmax_t cols_bytes(fs::file_size(Helper::cols_path(table->get_name()), ec));
+        return csv_bytes > max<uintmax_t>(_max_log_bytes, ec ? 0 : cols_bytes);
+    }
+
+    void run()
+    {
+        while (_running)
+        {
+            {
+                unique_lock<mutex> lock(_wait_mutex);
+                _wake.wait_for(lock, _interval, [this]
+                               { return !_running; });
+            }
+            if (!_running)
+                break;
+
+            compact_all();
+        }
+    }
+
+public:
+    Compactor(Catalog *cat, double dead_ratio = 0.2, chrono::milliseconds interval = chrono::seconds(5),
+              uintmax_t max_log_bytes = 4 << 20)
+        : _catalog(cat), _dead_ratio(dead_ratio), _max_log_bytes(max_log_bytes), _interval(interval), _running(false) {}
+
+    ~Compactor() { stop(); }
+
+    void start()
+    {
+        if (_running)
+            return;
+        _running = true;
+        _worker = thread(&Compactor::run, this);
+    }
+
+    void stop()
+    {
+        if (!_running)
+            return;
+        {
+            lock_guard<mutex> lock(_wait_mutex);
+            _running = false;
+        }
+        _wake.notify_all();
+        if (_worker.joinable())
+            _worker.join();
+    }
+
+    // Tables busy with a statement are skipped and retried on the next tick. The new column file
+    // is written while statements go on; they only wait while it is swapped in, and a transaction
+    // begun meanwhile has it given up
+    int compact_all()
+    {
+        int compacted(0);
+        _catalog->release_retired(); // dropped partitions no statement holds any more
+        Catalog::Pin pin(_catalog);
+        for (Table *table : _catalog->all_tables())
+        {
+            vector<bool> kept;
+            vector<Row> image;
+            {
+                unique_lock<mutex> writer(table->get_mutex(), try_to_lock);
+                if (!writer.owns_lock() || table->in_transaction() || table->is_dropped())
+                    continue;
+                table->collect_versions();
+                if (!needs_compaction(table))
+                    continue;
+                image = Helper::compaction_image(table, kept);
+            }
+
+            uint64_t epoch(chrono::system_clock::now().time_since_epoch().count() | 1);
+            Helper::write_compacted_image(table, image, epoch);
+
+            unique_lock<shared_mutex> exclusive(table->get_statement_lock()); // statements are short; the image is not
+            if (table->in_transaction() || table->is_dropped())
+            {
+                Helper::discard_compacted_files(table->get_name());
+                continue;
+            }
+            Helper::swap_compacted_files(table, kept, image, epoch);
+            Metrics::add(Metrics::COMPACTIONS);
+            ++compacted;
+        }
+        return compacted;
+    }
+};
+
+#endif
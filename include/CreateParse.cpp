@@ -3,10 +3,156 @@
 
 #include "models.cpp"
 #include "Helper.cpp"
+#include "QueryProfile.cpp"
+#include "MaterializedView.cpp"
+#include "Operators.cpp"
 
 class CreateParser
 {
-    Catalog _catalog;
+    Catalog _own_catalog;
+    Catalog *_catalog;
+    ostream &_out;
+    QueryProfile *_profile;
+
+    static bool is_identifier(const string &name)
+    {
+        return !name.empty() && all_of(name.begin(), name.end(), [](char c)
+                                       { return isalnum((unsigned char)c) || c == '_'; });
+    }
+
+    // One change to any table's partitions or indexes at a time
+    static mutex &schema_mutex()
+    {
+        static mutex changing;
+        return changing;
+    }
+
+    // Names are folded to lower case, but a quoted literal such as a partition bound keeps its case
+    static string lower_outside_quotes(const string &str)
+    {
+        string result(str);
+        char quote(0);
+        for (char &c : result)
+        {
+            if (quote)
+                quote = c == quote ? 0 : quote;
+            else if (c == '\'' || c == '"')
+                quote = c;
+            else
+                c = tolower(c);
+        }
+        return result;
+    }
+
+    // The bound of `PARTITION name VALUES LESS THAN (value | MAXVALUE)`; false when malformed
+    static bool parse_range_partition(const string &def, const Column &col, string &name, Value &bound)
+    {
+        auto words(Helper::split_spaces_respecting_quotes(def));
+        string lower(Helper::to_lower(def));
+        int than(lower.find(" than "));
+        if (words.size() < 6 || Helper::to_lower(words[0]) != "partition" || Helper::to_lower(words[2]) != "values" ||
+            Helper::to_lower(words[3]) != "less" || than == string::npos)
+            return false;
+
+        name = words[1];
+        string literal(Helper::trim(def.substr(than + 6)));
+        if (!literal.empty() && literal.front() == '(' && literal.back() == ')')
+            literal = Helper::trim(literal.substr(1, literal.size() - 2));
+        if (literal.empty())
+            return false;
+        bound = Helper::to_lower(literal) == "maxvalue" ? Value() : Comparison::literal(col, literal);
+        return is_identifier(name);
+    }
+
+    // PARTITION BY RANGE(col) (PARTITION p VALUES LESS THAN (v), ...) or PARTITION BY HASH(col, n);
+    // false with a message when the clause does not fit the table
+    bool parse_partitioning(const string &clause, const vector<Column> &columns, const vector<Text> &pk_columns, Partitioning &scheme)
+    {
+        string rest(Helper::trim(clause.substr(12)));
+        string kind(Helper::to_lower(rest.substr(0, rest.find('('))));
+        auto key_parens(Helper::find_top_level_parens(rest));
+        if (key_parens.first < 0 || (Helper::trim(kind) != "range" && Helper::trim(kind) != "hash"))
+        {
+            _out << "\nPartitioning is PARTITION BY RANGE(column) (...) or PARTITION BY HASH(column, partitions)\n";
+            return false;
+        }
+        scheme.kind = Helper::trim(kind) == "hash" ? Partitioning::HASH : Partitioning::RANGE;
+        auto key(Helper::split_commas_respecting_quotes(rest.substr(key_parens.first + 1, key_parens.second - key_parens.first - 1)));
+        if (key.empty() || key.size() != (scheme.kind == Partitioning::HASH ? 2 : 1))
+        {
+            _out << "\nPartitioning is PARTITION BY RANGE(column) (...) or PARTITION BY HASH(column, partitions)\n";
+            return false;
+        }
+
+        scheme.column = key[0];
+        for (int i(0); i < columns.size(); ++i)
+        {
+            if (columns[i].get_name() == scheme.column)
+                scheme.column_index = i;
+        }
+        if (scheme.column_index == NOT_FOUND)
+        {
+            _out << "\nPartition column '" << scheme.column << "' not found\n";
+            return false;
+        }
+        const Column &col(columns[scheme.column_index]);
+        scheme.column_type = col.get_type();
+        scheme.ops = ValueOps::for_column(col);
+        if (!pk_columns.empty() && find(pk_columns.begin(), pk_columns.end(), scheme.column) == pk_columns.end())
+        {
+            _out << "\nThe primary key must include the partition column '" << scheme.column << "'\n";
+            return false;
+        }
+
+        if (scheme.kind == Partitioning::HASH)
+        {
+            int count(atoi(key[1].c_str()));
+            if (count < 1 || count > Partitioning::MAX_PARTITIONS || !Helper::trim(rest.substr(key_parens.second + 1)).empty())
+            {
+                _out << "\nA table is hashed into 1 to " << Partitioning::MAX_PARTITIONS << " partitions\n";
+                return false;
+            }
+            for (int i(0); i < count; ++i)
+                scheme.names.push_back("p" + to_string(i));
+            return true;
+        }
+
+        string defs(Helper::trim(rest.substr(key_parens.second + 1)));
+        auto list_parens(Helper::find_top_level_parens(defs));
+        if (list_parens.first != 0 || list_parens.second != defs.size() - 1)
+        {
+            _out << "\nList the partitions: PARTITION BY RANGE(column) (PARTITION name VALUES LESS THAN (value), ...)\n";
+            return false;
+        }
+        for (const auto &def : Helper::split_commas_respecting_quotes(defs.substr(1, defs.size() - 2)))
+        {
+            string name;
+            Value bound;
+            if (!parse_range_partition(def, col, name, bound))
+            {
+                _out << "\nInvalid partition '" << def << "': PARTITION name VALUES LESS THAN (value | MAXVALUE)\n";
+                return false;
+            }
+            if (scheme.find(name) != NOT_FOUND)
+            {
+                _out << "\nPartition '" << name << "' is listed twice\n";
+                return false;
+            }
+            if (!scheme.bounds.empty() && (scheme.bounds.back().is_null() || (!bound.is_null() && scheme.ops.compare(scheme.bounds.back(), bound) >= 0)))
+            {
+                _out << "\nPartition bounds must increase: '" << name << "'\n";
+                return false;
+            }
+            scheme.names.push_back(name);
+            scheme.bounds.push_back(bound);
+        }
+        if (scheme.names.empty() || scheme.names.size() > Partitioning::MAX_PARTITIONS)
+        {
+            _out << "\nA table has 1 to " << Partitioning::MAX_PARTITIONS << " partitions\n";
+            return false;
+        }
+        return true;
+    }
 
     bool parse_create_internal(const string &s, AST &out_ast)
     {
@@ -116,6 +262,22 @@ class CreateParser
             columns.emplace_back(col_name, col_type, is_primary, char_len, is_nullable);
         }
 
+        string rest(Helper::trim(s.substr(parens.second + 1)));
+        if (Helper::starts_with_prefix(rest, "partition by"))
+        {
+            vector<Text> key_columns(pk_columns);
+            for (const auto &c : columns)
+            {
+                if (c.is_pk())
+                    key_columns.push_back(c.get_name());
+            }
+            auto scheme(make_shared<Partitioning>());
+            scheme->table = table_name_clean;
+            if (!parse_partitioning(rest, columns, key_columns, *scheme))
+                return false;
+            node.partitioning = scheme;
+        }
+
         node.columns = move(columns);
         node.pk_columns = move(pk_columns);
         ast.node = move(node);
@@ -123,10 +285,67 @@ class CreateParser
         return true;
     }
 
+    // A partition's files and table, empty, with the bitmap indexes its siblings have; false when
+    // its directory cannot be set up
+    bool create_partition(const Text &name, const vector<Column> &columns, const vector<string> &col_names, const vector<Text> &pkcols,
+                          const vector<BitmapIndex::Definition> &bitmap_indexes = {})
+    {
+        fs::remove_all(Helper::table_dir(name)); // left behind by a drop that did not finish
+        if (!Helper::create_csv_header(name, col_names) || !Helper::write_meta(name, columns, pkcols))
+            return false;
+        Table *t(new Table(name, columns, pkcols));
+        for (const auto &index : bitmap_indexes)
+        {
+            Helper::append_bitmap_index(name, index);
+            t->add_bitmap_index(index.name, t->get_column_index(index.column), index.kind);
+        }
+        if (!_catalog->add_if_absent(t))
+            delete t;
+        return true;
+    }
+
+    // The table's .meta names its partitions; each is a table of its own in a directory inside
+    // the table's, registered before the table so no statement finds one missing
+    bool create_partitioned(const AST_Create &node, const vector<string> &col_names, const vector<Text> &pkcols, int create_op, int persist_op)
+    {
+        const Partitioning &scheme(*node.partitioning);
+        QueryProfile::Timer timer(_profile, create_op);
+        if (_catalog->exists(node.table_name) || !Helper::write_meta(node.table_name, node.columns, pkcols, &scheme))
+        {
+            _out << "\nTable '" << node.table_name << "' already exists\n";
+            return true;
+        }
+        for (int i(0); i < scheme.names.size(); ++i)
+        {
+            if (!create_partition(scheme.partition_table(i), node.columns, col_names, pkcols))
+                throw runtime_error("cannot create partition " + scheme.partition_table(i));
+        }
+        _catalog->add_partitioned(node.table_name, node.partitioning);
+        timer.stop();
+
+        if (_profile)
+        {
+            uint64_t written(QueryProfile::file_bytes(Helper::meta_path(node.table_name)));
+            for (int i(0); i < scheme.names.size(); ++i)
+                written += QueryProfile::file_bytes(Helper::csv_path(scheme.partition_table(i))) +
+                           QueryProfile::file_bytes(Helper::meta_path(scheme.partition_table(i)));
+            _profile->stat(create_op, "partitions", scheme.names.size());
+            _profile->stat(create_op, "catalog_tables", _catalog->all_tables().size());
+            _profile->stat(persist_op, "bytes_written", written);
+        }
+        _out << "\nTable '" << node.table_name << "' created with " << scheme.names.size() << " partitions\n";
+        return true;
+    }
+
 public:
+    CreateParser(Catalog *cat = nullptr, ostream &out = cout)
+        : _catalog(cat ? cat : &_own_catalog), _out(out), _profile(nullptr) {}
+
+    void set_profile(QueryProfile *profile) { _profile = profile; }
+
     bool parse_create_statement(const string &input, AST &out_ast)
     {
-        string s(Helper::to_lower(input));
+        string s(lower_outside_quotes(input));
         if (s.empty())
             return false;
 
@@ -144,6 +363,7 @@ public:
     }
     bool parse_and_create(const string &line, AST &out_ast)
     {
+        Metrics::Timer statement_timer(Metrics::CREATE_STATEMENT);
         if (!parse_create_statement(line, out_ast))
             return false;
 
@@ -165,23 +385,386 @@ public:
             }
         }
 
+        if (Partitioning::is_partition(node->table_name))
+        {
+            _out << "\nA table name cannot contain '.'\n";
+            return false;
+        }
+        if (_catalog->is_view(node->table_name))
+        {
+            _out << "\nA view named '" << node->table_name << "' already exists\n";
+            return false;
+        }
+
+        int create_op(NOT_FOUND), persist_op(NOT_FOUND);
+        if (_profile)
+        {
+            string pk_list;
+            for (const auto &pk : pkcols)
+                pk_list += (pk_list.empty() ? "" : ", ") + pk;
+
+            create_op = _profile->add("Create Table " + node->table_name, to_string(col_names.size()) + " columns" +
+                                                                              (pk_list.empty() ? "" : ", primary key " + pk_list));
+            persist_op = _profile->add("Persist", node->partitioning ? "write " + node->table_name + ".meta and " + to_string(node->partitioning->names.size()) + " partitions"
+                                                                     : "write " + node->table_name + ".csv header and " + node->table_name + ".meta");
+            if (!_profile->analyze())
+                return true;
+        }
+
+        if (node->partitioning)
+            return create_partitioned(*node, col_names, pkcols, create_op, persist_op);
+
+        QueryProfile::Timer persist_timer(_profile, persist_op);
         bool csv_created(Helper::create_csv_header(node->table_name, col_names)),
             meta_created(Helper::write_meta(node->table_name, node->columns, pkcols));
+        persist_timer.stop();
+
+        {
+            QueryProfile::Timer timer(_profile, create_op);
+            if (!_catalog->exists(node->table_name))
+            {
+                Table *t(new Table(node->table_name, node->columns, pkcols));
+                if (!_catalog->add_if_absent(t)) // another session created it first
+                    delete t;
+            }
+        }
 
-        if (!_catalog.exists(node->table_name))
+        if (_profile)
         {
-            Table *t(new Table(node->table_name, node->columns, pkcols));
-            _catalog.addTable(t);
+            _profile->stat(create_op, "catalog_tables", _catalog->all_tables().size());
+            uint64_t written(0);
+            if (csv_created && meta_created)
+                written = QueryProfile::file_bytes(Helper::csv_path(node->table_name)) +
+                          QueryProfile::file_bytes(Helper::meta_path(node->table_name));
+            _profile->stat(persist_op, "bytes_written", written);
         }
 
         if (csv_created && meta_created)
-            cout << "\nTable '" << node->table_name << "' created\n";
+            _out << "\nTable '" << node->table_name << "' created\n";
+        else
+            _out << "\nTable '" << node->table_name << "' already exists\n";
+
+        return true;
+    }
+
+    // CREATE MATERIALIZED VIEW name AS SELECT ... FROM table GROUP BY ...
+    bool parse_and_create_view(const string &line, AST &/*out_ast*/)
+    {
+        Metrics::Timer statement_timer(Metrics::CREATE_STATEMENT);
+        string s(Helper::trim(line));
+        if (!s.empty() && s.back() == ';')
+            s.pop_back();
+
+        auto words(Helper::split_spaces_respecting_quotes(s));
+        int as_pos(Helper::to_lower(s).find(" as "));
+        if (words.size() < 6 || Helper::to_lower(words[4]) != "as" || as_pos == string::npos)
+            return false;
+
+        string view_name(words[3]), definition(Helper::trim(s.substr(as_pos + 4))), error;
+        vector<string> items, group_by;
+        Text base;
+        if (!MaterializedView::parse_definition(definition, items, base, group_by, error))
+        {
+            _out << "\n" << error << "\n";
+            return false;
+        }
+        if (_catalog->exists(view_name))
+        {
+            _out << "\nTable or view '" << view_name << "' already exists\n";
+            return false;
+        }
+        if (Partitioning::is_partition(base) || _catalog->partitioning(base))
+        {
+            _out << "\nA materialized view cannot be kept on a partitioned table or a partition: '" << base << "'\n";
+            return false;
+        }
+        Table *table(_catalog->getTable(base));
+        if (!table)
+        {
+            _out << "\nTable '" << base << "' not found\n";
+            return false;
+        }
+        unique_ptr<MaterializedView> check;
+        if (!MaterializedView::compile(view_name, definition, table, check, error))
+        {
+            _out << "\n" << error << "\n";
+            return false;
+        }
+
+        int create_op(NOT_FOUND), build_op(NOT_FOUND);
+        if (_profile)
+        {
+            create_op = _profile->add("Create Materialized View " + view_name, "on " + base + ", " + to_string(group_by.size()) + " group by columns");
+            build_op = _profile->add("Seq Scan on " + base, "initial build", 1);
+            if (!_profile->analyze())
+                return true;
+        }
+
+        QueryProfile::Timer timer(_profile, create_op);
+        if (!_catalog->add_view(view_name, base, definition))
+        {
+            _out << "\nTable or view '" << view_name << "' already exists\n";
+            return false;
+        }
+        Helper::write_view(view_name, base, definition);
+
+        QueryProfile::Timer build_timer(_profile, build_op);
+        MaterializedView *view(MaterializedView::open(_catalog, view_name, error));
+        build_timer.stop();
+        if (!view)
+        {
+            _out << "\n" << error << "\n";
+            return false;
+        }
+
+        if (_profile)
+        {
+            _profile->rows(build_op, table->live_row_count(), view->group_count());
+            _profile->stat(create_op, "groups", view->group_count());
+            _profile->stat(create_op, "bytes", view->bytes());
+            _profile->stat(create_op, "bytes_written", QueryProfile::file_bytes(Helper::view_path(view_name)));
+        }
+        _out << "\nMaterialized view '" << view_name << "' created (" << view->group_count() << " groups)\n";
+        return true;
+    }
+
+    // CREATE BITMAP INDEX name ON table (column) keeps a bitmap of the rows holding each distinct
+    // value of the column, for WHERE conditions on it to find rows without reading the others.
+    // CREATE INDEX name ON table (column) USING TRIGRAM keeps a bitmap per trigram of the column's
+    // text instead, for LIKE and ILIKE to read only the rows holding every trigram of the pattern;
+    // USING BITMAP is the former. A partitioned table has the index in each partition, and its
+    // partitions added later get one too
+    bool parse_and_create_index(const string &line, AST &/*out_ast*/)
+    {
+        Metrics::Timer statement_timer(Metrics::CREATE_STATEMENT);
+        string s(Helper::trim(Helper::to_lower(line)));
+        if (!s.empty() && s.back() == ';')
+            s.pop_back();
+
+        auto words(Helper::split_spaces_respecting_quotes(s));
+        auto parens(Helper::find_top_level_parens(s));
+        bool bitmap(words.size() > 1 && words[1] == "bitmap");
+        int name_word(bitmap ? 3 : 2), on(s.find(" on "));
+        string tail(parens.first < 0 ? "" : Helper::trim(s.substr(parens.second + 1)));
+        BitmapIndex::Kind kind(tail == "using trigram" ? BitmapIndex::TRIGRAMS : BitmapIndex::VALUES);
+        if (words.size() < name_word + 3 || words[name_word + 1] != "on" || on == string::npos || parens.first < on ||
+            !(bitmap ? tail.empty() : tail == "using trigram" || tail == "using bitmap"))
+        {
+            _out << "\nExpected CREATE BITMAP INDEX name ON table (column)\n"
+                 << "      or CREATE INDEX name ON table (column) USING BITMAP | TRIGRAM\n";
+            return false;
+        }
+        string label(kind == BitmapIndex::VALUES ? "Bitmap" : "Trigram");
+        BitmapIndex::Definition definition{words[name_word], Helper::trim(s.substr(parens.first + 1, parens.second - parens.first - 1)), kind};
+        string table_name(Helper::trim(s.substr(on + 4, parens.first - on - 4)));
+        if (!is_identifier(definition.name))
+        {
+            _out << "\nInvalid index name '" << definition.name << "'\n";
+            return false;
+        }
+
+        lock_guard<mutex> changing(schema_mutex());
+        shared_ptr<const Partitioning> scheme(_catalog->partitioning(table_name));
+        vector<Text> targets;
+        if (scheme)
+        {
+            for (int i(0); i < scheme->names.size(); ++i)
+                targets.push_back(scheme->partition_table(i));
+        }
         else
-            cout << "\nTable '" << node->table_name << "' already exists\n";
+            targets.push_back(table_name);
+        Table *first(_catalog->is_view(table_name) ? nullptr : _catalog->getTable(targets[0]));
+        if (!first)
+        {
+            _out << "\nTable '" << table_name << "' not found\n";
+            return false;
+        }
+        int column_index(first->get_column_index(definition.column));
+        if (column_index == NOT_FOUND)
+        {
+            _out << "\nColumn '" << definition.column << "' not found\n";
+            return false;
+        }
+        for (const auto &index : first->bitmap_index_definitions())
+        {
+            if (index.name == definition.name || (index.column == definition.column && index.kind == kind))
+            {
+                _out << "\nIndex '" << index.name << "' already exists on '" << table_name << "' (" << index.column << ")\n";
+                return false;
+            }
+        }
+
+        int create_op(NOT_FOUND), build_op(NOT_FOUND);
+        if (_profile)
+        {
+            create_op = _profile->add("Create " + label + " Index " + definition.name, "on " + table_name + " (" + definition.column + ")");
+            build_op = _profile->add("Seq Scan on " + table_name, "index build", 1);
+            if (!_profile->analyze())
+                return true;
+        }
+
+        // each partition is indexed under its writer lock, so no statement changes rows meanwhile
+        QueryProfile::Timer timer(_profile, create_op);
+        uint64_t rows(0), keys(0), bytes(0), written(0);
+        for (const auto &target : targets)
+        {
+            Table *t(_catalog->getTable(target));
+            if (!t)
+                throw runtime_error("cannot read " + target);
+            Table::WriteGuard guard(t);
+            if (!guard.acquired())
+                continue;
+            {
+                QueryProfile::Timer build_timer(_profile, build_op);
+                t->add_bitmap_index(definition.name, column_index, kind);
+            }
+            Helper::append_bitmap_index(target, definition);
+            t->inspect_bitmap_indexes([&]
+                                      {
+                const BitmapIndex *index(t->bitmap_index(column_index, kind));
+                keys += index->distinct();
+                bytes += index->bytes(); });
+            rows += t->live_row_count();
+            written += QueryProfile::file_bytes(Helper::meta_path(target));
+        }
+        timer.stop();
+
+        string unit(kind == BitmapIndex::VALUES ? "values" : "trigrams");
+        if (_profile)
+        {
+            _profile->rows(build_op, rows, keys);
+            _profile->stat(create_op, unit, keys);
+            _profile->stat(create_op, "bytes", bytes);
+            _profile->stat(create_op, "meta_bytes", written);
+        }
+        _out << "\n" << label << " index '" << definition.name << "' created on '" << table_name << "' (" << keys << " " << unit;
+        if (scheme)
+            _out << " in " << targets.size() << " partitions";
+        _out << ")\n";
+        return true;
+    }
+
+    // ALTER TABLE t ADD PARTITION p VALUES LESS THAN (value | MAXVALUE) appends a range above the
+    // last; ALTER TABLE t DROP PARTITION p forgets one with its rows: the next range takes its
+    // values from then on. Either only touches the table's .meta and the one partition's files
+    bool parse_and_alter(const string &line, AST &/*out_ast*/)
+    {
+        string s(Helper::trim(lower_outside_quotes(line)));
+        if (!s.empty() && s.back() == ';')
+            s.pop_back();
+
+        auto words(Helper::split_spaces_respecting_quotes(s));
+        if (words.size() < 6 || words[1] != "table" || (words[3] != "add" && words[3] != "drop") || words[4] != "partition")
+            return false;
+
+        lock_guard<mutex> altering(schema_mutex());
+        string table_name(words[2]), name(words[5]);
+        shared_ptr<const Partitioning> scheme(_catalog->partitioning(table_name));
+        if (!scheme)
+        {
+            _out << "\nTable '" << table_name << "' is not partitioned\n";
+            return false;
+        }
+        if (scheme->kind != Partitioning::RANGE)
+        {
+            _out << "\nPartitions are added and dropped by range; '" << table_name << "' is hashed\n";
+            return false;
+        }
+        Table *schema(_catalog->resident(scheme->partition_table(0)));
+        Catalog::TableStub stub;
+        if (schema)
+            stub = {schema->get_columns(), schema->pk_column_names(), schema->bitmap_index_definitions()};
+        else if (!Helper::read_meta(Helper::meta_path(scheme->partition_table(0)), stub))
+        {
+            _out << "\nCannot read partition '" << scheme->names[0] << "' of '" << table_name << "'\n";
+            return false;
+        }
 
+        auto changed(make_shared<Partitioning>(*scheme));
+        if (words[3] == "add")
+        {
+            Value bound;
+            if (!parse_range_partition(s.substr(s.find(" partition ") + 1), stub.columns[scheme->column_index], name, bound))
+                return false;
+            if (scheme->find(name) != NOT_FOUND)
+            {
+                _out << "\nPartition '" << name << "' already exists\n";
+                return false;
+            }
+            if (scheme->bounds.back().is_null() || (!bound.is_null() && scheme->ops.compare(scheme->bounds.back(), bound) >= 0))
+            {
+                _out << "\nA new partition goes above the last one, '" << scheme->names.back() << "'\n";
+                return false;
+            }
+            if (scheme->names.size() >= Partitioning::MAX_PARTITIONS)
+            {
+                _out << "\nA table has 1 to " << Partitioning::MAX_PARTITIONS << " partitions\n";
+                return false;
+            }
+            changed->names.push_back(name);
+            changed->bounds.push_back(bound);
+            vector<string> col_names;
+            for (const auto &c : stub.columns)
+                col_names.push_back(c.get_name());
+            if (!create_partition(changed->partition_table(changed->names.size() - 1), stub.columns, col_names, stub.pk_columns, stub.bitmap_indexes))
+                throw runtime_error("cannot create partition " + changed->partition_table(changed->names.size() - 1));
+            Helper::write_meta(table_name, stub.columns, stub.pk_columns, changed.get(), true);
+            _catalog->set_partitioning(table_name, changed);
+            _out << "\nPartition '" << name << "' added to '" << table_name << "'\n";
+            return true;
+        }
+
+        int index(scheme->find(name));
+        if (index == NOT_FOUND)
+        {
+            _out << "\nPartition '" << name << "' not found in '" << table_name << "'\n";
+            return false;
+        }
+        if (scheme->names.size() == 1)
+        {
+            _out << "\nThe last partition of '" << table_name << "' cannot be dropped\n";
+            return false;
+        }
+        changed->names.erase(changed->names.begin() + index);
+        changed->bounds.erase(changed->bounds.begin() + index);
+
+        // a partition in memory is dropped once no statement uses it; one that is not was never read
+        string partition(scheme->partition_table(index));
+        Table *table(_catalog->resident(partition));
+        unique_lock<shared_mutex> exclusive;
+        unique_lock<mutex> writer;
+        if (table)
+        {
+            exclusive = unique_lock<shared_mutex>(table->get_statement_lock());
+            writer = unique_lock<mutex>(table->get_mutex());
+            if (table->in_transaction())
+            {
+                _out << "\nPartition '" << name << "' is in use by a transaction\n";
+                return false;
+            }
+        }
+        Helper::write_meta(table_name, stub.columns, stub.pk_columns, changed.get(), true);
+        _catalog->set_partitioning(table_name, changed);
+        Table *retired(_catalog->retire_table(partition));
+        if (retired && !table) // read in since
+        {
+            table = retired;
+            exclusive = unique_lock<shared_mutex>(table->get_statement_lock());
+            writer = unique_lock<mutex>(table->get_mutex());
+        }
+        if (table)
+        {
+            table->mark_dropped();
+            writer.unlock();
+            exclusive.unlock();
+        }
+        WriteQueue::instance().flush(); // its last records may still be queued
+        error_code ec;
+        fs::remove_all(Helper::table_dir(partition), ec);
+        _out << "\nPartition '" << name << "' dropped from '" << table_name << "'\n";
         return true;
     }
 
-    Catalog &catalog() { return _catalog; }
+    Catalog &catalog() { return *_catalog; }
 };
 #endif
\ No newline at end of file
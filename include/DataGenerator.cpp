@@ -0,0 +1,128 @@
+#ifndef DATA_GENERATOR
+#define DATA_GENERATOR
+
+#include "Helper.cpp"
+#include <random>
+#include <cmath>
+
+// Zipfian ranks in [0, n) as in YCSB (Gray et al.), rank 0 is the hottest item
+class ZipfGenerator
+{
+    uint64_t n;
+    double theta, alpha, zetan, eta;
+
+    static double zeta(uint64_t count, double theta)
+    {
+        double sum(0);
+        for (uint64_t i(1); i <= count; ++i)
+            sum += 1.0 / pow((double)i, theta);
+        return sum;
+    }
+
+public:
+    ZipfGenerator(uint64_t items, double skew = 0.99) : n(items ? items : 1), theta(skew)
+    {
+        alpha = 1.0 / (1.0 - theta);
+        zetan = zeta(n, theta);
+        eta = (1.0 - pow(2.0 / n, 1.0 - theta)) / (1.0 - zeta(2, theta) / zetan);
+    }
+
+    template <typename Rng>
+    uint64_t next(Rng &rng) const
+    {
+        double u(uniform_real_distribution<double>(0.0, 1.0)(rng)),
+            uz(u * zetan);
+
+        if (uz < 1.0)
+            return 0;
+        if (uz < 1.0 + pow(0.5, theta))
+            return 1;
+        return min<uint64_t>(n - 1, (uint64_t)(n * pow(eta * u - eta + 1.0, alpha)));
+    }
+};
+
+// Picks keys in [0, n) either uniformly or Zipf-skewed, the two distributions the benchmarks compare
+class KeyChooser
+{
+    uint64_t n;
+    bool skewed;
+    ZipfGenerator zipf;
+
+public:
+    KeyChooser(uint64_t items, bool zipfian, double theta = 0.99)
+        : n(items ? items : 1), skewed(zipfian), zipf(zipfian ? items : 1, theta) {}
+
+    template <typename Rng>
+    uint64_t next(Rng &rng) const
+    {
+        if (skewed)
+            return zipf.next(rng);
+        return uniform_int_distribution<uint64_t>(0, n - 1)(rng);
+    }
+};
+
+// Synthetic `orders`-style table used by the benchmark and workload tools:
+//   id INT PRIMARY KEY, category VARCHAR(16), amount DOUBLE, qty INT, created DATE
+class DataGenerator
+{
+    uint64_t _rows;
+    KeyChooser _categories;
+    mt19937_64 _rng;
+
+public:
+    static const int CATEGORY_COUNT = 16;
+
+    DataGenerator(uint64_t rows, bool zipfian, uint64_t seed = 42)
+        : _rows(rows), _categories(CATEGORY_COUNT, zipfian), _rng(seed) {}
+
+    static string create_statement(const string &table_name)
+    {
+        return "CREATE TABLE " + table_name +
+               " (id INT PRIMARY KEY, category VARCHAR(16), amount DOUBLE, qty INT, created DATE)";
+    }
+
+    static string category_name(int idx) { return "cat_" + to_string(idx); }
+
+    Row make_row(int id)
+    {
+        uniform_int_distribution<int> cents(100, 99999), qty(1, 100), day(0, 3652);
+        int days(day(_rng));
+        Date created(2015 + days / 366, 1 + (days % 366) / 31, 1 + (days % 31) % 28);
+
+        Row row;
+        row.push_back(Value(id));
+        row.push_back(Value(category_name(_categories.next(_rng))));
+        row.push_back(Value(cents(_rng) / 100.0));
+        row.push_back(Value(qty(_rng)));
+        row.push_back(Value(created));
+        return row;
+    }
+
+    string insert_statement(const string &table_name, int id)
+    {
+        Row row(make_row(id));
+        return "INSERT INTO " + table_name + " VALUES (" + row[0].to_string() + ", '" + row[1].to_string() + "', " +
+               row[2].to_string() + ", " + row[3].to_string() + ", '" + row[4].to_string() + "')";
+    }
+
+    // Writes the table's files directly (much faster than INSERT per row); the engine loads them as usual
+    void write_table(const string &table_name)
+    {
+        vector<Column> columns = {Column("id", "INT", true), Column("category", "VARCHAR", false, 16),
+                                  Column("amount", "DOUBLE"), Column("qty", "INT"), Column("created", "DATE")};
+        vector<string> names;
+        for (const auto &col : columns)
+            names.push_back(col.get_name());
+
+        fs::remove_all(Helper::data_dir() / table_name);
+        Helper::create_csv_header(table_name, names);
+        Helper::write_meta(table_name, columns, {"id"});
+
+        ofstream file(Helper::csv_path(table_name), ios::app);
+        for (uint64_t id(0); id < _rows; ++id)
+            Helper::write_row(file, make_row(id));
+        file.close();
+    }
+};
+
+#endif
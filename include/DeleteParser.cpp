@@ -3,11 +3,16 @@
 
 #include "models.cpp"
 #include "Helper.cpp"
+#include "QueryProfile.cpp"
+#include "Transaction.cpp"
 #include <fstream>
 
 class DeleteParser
 {
     Catalog *_catalog;
+    ostream &_out;
+    QueryProfile *_profile;
+    Transaction *_transaction; // statements persist on their own unless it is open
 
     Value parse_value(const string &val_str, const string &type)
     {
@@ -54,96 +59,32 @@ class DeleteParser
         return NOT_FOUND;
     }
 
-    bool evaluate_condition(const Row &row, const Table *table, const string &condition)
+    static bool compare(const Value &row_value, const string &op, const Value &cond_value)
     {
-        if (condition.empty())
-            return true;
-
-        vector<string> operators = {"!=", ">=", "<=", "=", ">", "<"};
-        string op;
-        int op_pos = -1;
-
-        for (const auto &o : operators)
-        {
-            int pos = condition.find(o);
-            if (pos != string::npos)
-            {
-                op = o;
-                op_pos = pos;
-                break;
-            }
-        }
-
-        if (op_pos == -1)
-            return true;
-
-        string col_name_str(Helper::trim(condition.substr(0, op_pos)));
-        string value_str(Helper::trim(condition.substr(op_pos + op.size())));
-
-        if (!value_str.empty() && (value_str.front() == '\'' || value_str.front() == '"'))
-            value_str = value_str.substr(1, value_str.size() - 2);
-
-        int col_idx = find_column_index(table, col_name_str);
-        if (col_idx == -1)
-            return false;
-
-        auto &cols(table->get_columns());
-        const Column &col = cols[col_idx];
-        string type = col.get_type();
-
-        Value row_value = row[col_idx];
-        Value cond_value = parse_value(value_str, type);
-
-        bool result = false;
         if (op == "=")
-            result = row_value == cond_value;
-        else if (op == "!=")
-            result = !(row_value == cond_value);
-        else if (op == ">")
-            result = row_value > cond_value;
-        else if (op == "<")
-            result = row_value < cond_value;
-        else if (op == ">=")
-            result = row_value > cond_value || row_value == cond_value;
-        else if (op == "<=")
-            result = row_value < cond_value || row_value == cond_value;
-
-        return result;
-    }
-
-    void rewrite_csv(Table *table)
-    {
-        fs::path csv_file(Helper::csv_path(table->get_name()));
-        ofstream file(csv_file.string(), ios::trunc);
-
-        auto &cols(table->get_columns());
-        for (size_t i(0); i < cols.size(); ++i)
-        {
-            file << cols[i].get_name();
-            if (i + 1 < cols.size())
-                file << ",";
-        }
-        file << "\n";
-
-        auto &rows(table->get_rows());
-        for (const auto &row : rows)
-        {
-            for (size_t i(0); i < row.size(); ++i)
-            {
-                file << row.at(i).to_string();
-                if (i + 1 < row.size())
-                    file << ",";
-            }
-            file << "\n";
-        }
-        file.close();
+            return row_value == cond_value;
+        if (op == "!=")
+            return !(row_value == cond_value);
+        if (op == ">")
+            return row_value > cond_value;
+        if (op == "<")
+            return row_value < cond_value;
+        if (op == ">=")
+            return row_value > cond_value || row_value == cond_value;
+        if (op == "<=")
+            return row_value < cond_value || row_value == cond_value;
+        return false;
     }
 
 public:
-    DeleteParser(Catalog *cat) : _catalog(cat) {}
+    DeleteParser(Catalog *cat, ostream &out = cout) : _catalog(cat), _out(out), _profile(nullptr), _transaction(nullptr) {}
+
+    void set_profile(QueryProfile *profile) { _profile = profile; }
+    void set_transaction(Transaction *transaction) { _transaction = transaction; }
 
     bool parse_and_delete(const string &line, AST &out_ast)
     {
+        Metrics::Timer statement_timer(Metrics::DELETE_STATEMENT);
         string s(Helper::trim(line));
         if (s.empty())
             return false;
@@ -178,39 +119,65 @@ public:
 
         ast_delete.table_name = table_name;
 
+        if (Partitioning::is_partition(table_name))
+        {
+            _out << "\nPartition '" << table_name << "' is written through its table\n";
+            return false;
+        }
         Table *table(_catalog->getTable(table_name));
+        shared_ptr<const Partitioning> scheme(table ? nullptr : _catalog->partitioning(table_name));
+        if (scheme) // every partition has the table's columns
+            table = _catalog->getTable(scheme->partition_table(0));
         if (!table)
         {
-            cout << "\nTable '" << table_name << "' not found\n";
+            _out << "\nTable '" << table_name << "' not found\n";
             return false;
         }
 
         while (pos < s.size() && isspace(s[pos]))
             ++pos;
 
-        vector<int> rows_to_delete;
-        string where_clause;
-
-        if (pos < s.size() && lower.substr(pos, 5) == "where")
+        // Parse the WHERE condition; its literal is parsed once, and on a partitioned table it
+        // leaves out the partitions that cannot hold a matching row
+        bool filtered(pos < s.size() && lower.substr(pos, 5) == "where");
+        string op;
+        int where_idx(NOT_FOUND);
+        Value where_value;
+        LikePattern pattern;
+        bool like(false), negated(false); // col [NOT] LIKE | ILIKE pattern
+        if (filtered)
         {
             pos += 5;
             while (pos < s.size() && isspace(s[pos]))
                 ++pos;
 
-            where_clause = s.substr(pos);
-            
-            // Parse WHERE condition for AST
+            string where_clause(s.substr(pos));
             vector<string> operators = {"!=", ">=", "<=", "=", ">", "<"};
-            string op;
-            int op_pos = -1;
+            int op_pos(-1), val_pos(-1);
+            size_t like_pos(Helper::find_word(where_clause, "like")), ilike_pos(Helper::find_word(where_clause, "ilike"));
+            if (like_pos != string::npos || ilike_pos != string::npos)
+            {
+                like = true;
+                op = like_pos < ilike_pos ? "LIKE" : "ILIKE";
+                op_pos = min(like_pos, ilike_pos);
+                val_pos = op_pos + op.size();
+                size_t not_pos(Helper::find_word(where_clause.substr(0, op_pos), "not"));
+                if (not_pos != string::npos)
+                {
+                    negated = true;
+                    op = "NOT " + op;
+                    op_pos = not_pos;
+                }
+            }
 
             for (const auto &o : operators)
             {
                 int p = where_clause.find(o);
-                if (p != string::npos)
+                if (!like && p != string::npos)
                 {
                     op = o;
                     op_pos = p;
+                    val_pos = p + o.size();
                     break;
                 }
             }
@@ -219,7 +186,7 @@ public:
                 return false;
 
             string where_col(Helper::trim(where_clause.substr(0, op_pos)));
-            string where_val(Helper::trim(where_clause.substr(op_pos + op.size())));
+            string where_val(Helper::trim(where_clause.substr(val_pos)));
 
             // Add Condition to AST
             Condition cond;
@@ -228,73 +195,137 @@ public:
             cond.rhs = where_val;
             ast_delete.where.push_back(cond);
 
-            // Evaluate condition for each row
-            auto &rows(table->get_rows());
-            for (int i(0); i < rows.size(); ++i)
+            where_idx = find_column_index(table, where_col);
+            if (where_idx != NOT_FOUND)
             {
-                if (evaluate_condition(rows[i], table, where_clause))
-                    rows_to_delete.push_back(i);
+                if (!where_val.empty() && (where_val.front() == '\'' || where_val.front() == '"'))
+                    where_val = where_val.substr(1, where_val.size() - 2);
+                if (like)
+                    pattern = LikePattern(where_val, op.find("ILIKE") != string::npos);
+                else
+                    where_value = parse_value(where_val, table->get_column(where_idx).get_type());
             }
         }
-        else
+
+        vector<Table *> targets(1, table);
+        if (scheme)
+            targets = _catalog->get_partitions(*scheme, filtered && where_idx == scheme->column_index ? scheme->prune(op, where_value) : scheme->all());
+
+        int delete_op(NOT_FOUND), scan_op(NOT_FOUND), persist_op(NOT_FOUND);
+        if (_profile)
         {
-            for (int i(0); i < table->get_rows().size(); ++i)
-                rows_to_delete.push_back(i);
+            delete_op = _profile->add("Delete on " + table_name, "tombstone rows");
+            scan_op = _profile->add("Seq Scan on " + table_name, filtered ? "filter " + Helper::trim(s.substr(pos)) : "", 1);
+            persist_op = _profile->add("Persist", _transaction && _transaction->active() ? "deferred to COMMIT" : "append delete records to " + table_name + ".log");
+            if (!_profile->analyze())
+                return true;
         }
 
+        // partitions are taken in order, so statements on the same table cannot deadlock; one
+        // dropped meanwhile has no rows left to delete
+        // Partitions changed outside a transaction change as one: in a transaction of the statement's
+        // own, rolled back when one fails and committed once all are done
+        Transaction implicit;
+        bool own(targets.size() > 1 && !(_transaction && _transaction->active()));
+        if (own)
+            implicit.begin();
+        Transaction::Writes guards(own ? &implicit : _transaction, targets);
+        if (guards.busy())
+        {
+            _out << "\nTable '" << table_name << "' is in use by another transaction";
+            if (scheme)
+                _out << " (partition " << guards.busy()->get_name().substr(table_name.size() + 1) << ")";
+            _out << "; a transaction already writing other tables does not wait\n";
+            return false;
+        }
+
+        // A large table is scanned by several threads, and the partitions side by side, with no more
+        // threads in all than there are cores
+        QueryProfile::Timer scan_timer(_profile, scan_op);
+        vector<vector<int>> rows_to_delete(targets.size()); // ascending
+        vector<int> workers(targets.size(), 1);
+        int share(Partitioning::scan_share(targets.size()));
+        in_parallel(targets.size(), [&](size_t t)
+                    {
+            const Table *target(targets[t]);
+            if (!filtered)
+                rows_to_delete[t] = target->find_live([](const Row &)
+                                                      { return true; });
+            else if (where_idx != NOT_FOUND)
+            {
+                workers[t] = min(target->scan_workers(), share);
+                rows_to_delete[t] = target->find_live([&](const Row &row)
+                                                      { return like ? matches_like(pattern, row[where_idx]) != negated : compare(row[where_idx], op, where_value); },
+                                                      workers[t]);
+            } });
+
         // Populate the AST output
         out_ast.kind = ASTKind::_DELETE;
         out_ast.node = ast_delete;
 
-        if (rows_to_delete.empty())
+        scan_timer.stop();
+        size_t deleted(0), scanned(0), id_bytes(0);
+        int scan_threads(0);
+        for (size_t t(0); t < targets.size(); ++t)
         {
-            cout << "\n0 rows deleted\n";
-            return true;
+            deleted += rows_to_delete[t].size();
+            id_bytes += rows_to_delete[t].capacity() * sizeof(int);
+            scanned += targets[t]->row_count();
+            scan_threads += workers[t];
         }
-
-        sort(rows_to_delete.rbegin(), rows_to_delete.rend());
-
-        auto &rows(table->get_rows());
-        for (int idx : rows_to_delete)
+        Metrics::add(Metrics::ROWS_SCANNED, scanned);
+        if (_profile)
         {
-            if (idx >= rows.size())
-                continue;
-
-            int last(rows.size() - 1);
-            if (idx != last)
-                rows[idx] = move(rows[last]);
-            rows.pop_back();
+            _profile->rows(scan_op, scanned, deleted);
+            _profile->stat(scan_op, "bytes", id_bytes);
+            if (scheme)
+                _profile->stat(scan_op, "partitions", to_string(targets.size()) + "/" + to_string(scheme->names.size()));
+            if (scan_threads > 1)
+                _profile->stat(scan_op, "workers", scan_threads);
         }
 
-        if (table->has_pk())
+        if (!deleted)
         {
-            Table *new_table(new Table(table->get_name(), table->get_columns(), {}));
-            vector<string> pk_names;
-            auto &pk_indices(table->getpk_indices());
-            auto &cols(table->get_columns());
-            for (int pk_idx : pk_indices)
-                pk_names.push_back(cols[pk_idx].get_name());
-
-            new_table = new Table(table->get_name(), table->get_columns(), pk_names);
+            _out << "\n0 rows deleted\n";
+            return true;
+        }
 
-            for (const auto &row : table->get_rows())
+        uint64_t appended_before(WriteQueue::bytes_appended());
+        for (size_t t(0); t < targets.size(); ++t)
+        {
+            if (rows_to_delete[t].empty())
+                continue;
             {
-                try
-                {
-                    new_table->insert_row(row);
-                }
-                catch (const exception &e)
-                {
-                }
+                QueryProfile::Timer timer(_profile, delete_op);
+                targets[t]->erase_rows(rows_to_delete[t]); // tombstoned; the compactor reclaims the slots later
+            }
+            if (!guards.deferred())
+            {
+                QueryProfile::Timer timer(_profile, persist_op);
+                Helper::append_delete_log(targets[t]->get_name(), rows_to_delete[t]);
             }
+        }
 
-            *table = *new_table;
-            delete new_table;
+        if (own)
+        {
+            QueryProfile::Timer timer(_profile, persist_op);
+            guards.release();
+            implicit.commit();
         }
 
-        rewrite_csv(table);
+        if (_profile)
+        {
+            int dead(0);
+            for (const Table *target : targets)
+                dead += target->dead_row_count();
+            _profile->rows(delete_op, deleted, deleted);
+            _profile->stat(delete_op, "dead_rows", dead);
+            _profile->rows(persist_op, deleted, deleted);
+            _profile->stat(persist_op, "bytes_written", WriteQueue::bytes_appended() - appended_before);
+        }
 
-        cout << "\n" << rows_to_delete.size() << " row(s) deleted\n";
+        Metrics::add(Metrics::ROWS_DELETED, deleted);
+        _out << "\n" << deleted << " row(s) deleted\n";
         return true;
     }
 };
@@ -0,0 +1,375 @@
+#ifndef EXTERNAL_SORT
+#define EXTERNAL_SORT
+
+#include "models.cpp"
+#include "QueryProfile.cpp"
+#include <thread>
+#include <atomic>
+#include <algorithm>
+
+// Sorts any number of rows within a memory budget. Rows are buffered until they fill the budget;
+// the buffer is then cut into one chunk per core, the chunks are sorted in parallel, and a loser
+// tree merges them into a run file. finish() merges the run files, plus whatever is still
+// buffered, k at a time; only when there are more runs than read buffers fit in the budget does
+// it need intermediate passes. Input that fits in the budget never touches disk.
+class ExternalSort
+{
+public:
+    struct Key
+    {
+        int column;
+        bool descending;
+        ValueOps ops = ValueOps(); // of the column's type when known
+    };
+
+    struct Stats
+    {
+        uint64_t rows = 0;
+        uint64_t runs = 0; // sorted runs written to disk
+        uint64_t spilled_bytes = 0;
+        uint64_t merges = 0;     // intermediate merges of run files before the final one
+        uint64_t fan_in = 0;     // runs merged by the final pass
+        uint64_t peak_bytes = 0; // largest buffer held
+    };
+
+    static const size_t BLOCK_BYTES = 64 << 10; // encoded rows per block of a run file
+    static const int MAX_FAN_IN = 256;           // open run files per merge
+    static const size_t MIN_CHUNK_ROWS = 16384;  // smaller buffers are sorted on one core
+
+private:
+    // One sorted input of a merge
+    class Run
+    {
+    public:
+        virtual ~Run() {}
+        virtual bool done() const = 0;
+        virtual Row &row() = 0;
+        virtual void next() = 0;
+    };
+
+    class MemoryRun : public Run
+    {
+        vector<Row>::iterator at, end;
+
+    public:
+        MemoryRun(vector<Row>::iterator b, vector<Row>::iterator e) : at(b), end(e) {}
+        bool done() const override { return at == end; }
+        Row &row() override { return *at; }
+        void next() override { ++at; }
+    };
+
+    // Blocks of PagedRows::encode images, each preceded by its byte length
+    class RunWriter
+    {
+        ofstream file;
+        RowPage block;
+        string buf;
+        size_t block_bytes = 0;
+        uint64_t written = 0;
+        fs::path path;
+
+        void flush()
+        {
+            if (block.rows.empty())
+                return;
+            buf.assign(4, '\0');
+            PagedRows::encode(buf, block);
+            uint32_t len(buf.size() - 4);
+            memcpy(&buf[0], &len, 4);
+            file.write(buf.data(), buf.size());
+            written += buf.size();
+            block.rows.clear();
+            block_bytes = 0;
+        }
+
+    public:
+        RunWriter(const fs::path &p) : file(p, ios::binary | ios::trunc), path(p)
+        {
+            if (!file.is_open())
+                throw runtime_error("cannot create sort run " + p.string());
+        }
+
+        void add(Row &&row)
+        {
+            block_bytes += QueryProfile::row_bytes(row);
+            block.rows.push_back(move(row));
+            if (block_bytes >= BLOCK_BYTES)
+                flush();
+        }
+
+        uint64_t finish()
+        {
+            flush();
+            file.close();
+            if (!file)
+                throw runtime_error("cannot write sort run " + path.string());
+            return written;
+        }
+    };
+
+    class FileRun : public Run
+    {
+        ifstream file;
+        RowPage block;
+        size_t at = 0;
+        string buf;
+
+        void load()
+        {
+            block.rows.clear();
+            at = 0;
+            uint32_t len;
+            if (!file.read((char *)&len, 4))
+                return;
+            buf.resize(len);
+            if (!file.read(&buf[0], len))
+                throw runtime_error("sort run is truncated");
+            PagedRows::decode(buf.data(), buf.data() + buf.size(), block);
+        }
+
+    public:
+        FileRun(const fs::path &p) : file(p, ios::binary)
+        {
+            if (!file.is_open())
+                throw runtime_error("cannot open sort run " + p.string());
+            load();
+        }
+        bool done() const override { return at == block.rows.size(); }
+        Row &row() override { return block.rows[at]; }
+        void next() override
+        {
+            if (++at == block.rows.size())
+                load();
+        }
+    };
+
+    // Tournament over k runs: each inner node keeps the loser of the match played there, so
+    // replacing the winner replays only its path to the root, log2(k) comparisons per row
+    template <typename Less>
+    class LoserTree
+    {
+        vector<Run *> runs;
+        vector<int> tree; // tree[0] is the winner
+        const Less &less;
+
+        bool beats(int a, int b) const // exhausted runs lose; ties go to the earlier run
+        {
+            if (runs[a]->done())
+                return false;
+            if (runs[b]->done())
+                return true;
+            if (less(runs[a]->row(), runs[b]->row()))
+                return true;
+            return !less(runs[b]->row(), runs[a]->row()) && a < b;
+        }
+
+    public:
+        LoserTree(vector<Run *> r, const Less &l) : runs(move(r)), tree(runs.size()), less(l)
+        {
+            int k(runs.size());
+            vector<int> winner(2 * k);
+            for (int i(0); i < k; ++i)
+                winner[k + i] = i;
+            for (int p(k - 1); p >= 1; --p)
+            {
+                int a(winner[2 * p]), b(winner[2 * p + 1]);
+                winner[p] = beats(a, b) ? a : b;
+                tree[p] = winner[p] == a ? b : a;
+            }
+            if (k)
+                tree[0] = k == 1 ? 0 : winner[1];
+        }
+
+        bool done() const { return tree.empty() || runs[tree[0]]->done(); }
+        Row &top() { return runs[tree[0]]->row(); }
+
+        void pop()
+        {
+            int k(runs.size()), w(tree[0]);
+            runs[w]->next();
+            for (int p((w + k) / 2); p >= 1; p /= 2)
+            {
+                if (beats(tree[p], w))
+                    swap(tree[p], w);
+            }
+            tree[0] = w;
+        }
+    };
+
+    struct RowLess
+    {
+        const vector<Key> *keys;
+        bool operator()(const Row &a, const Row &b) const
+        {
+            for (const auto &key : *keys)
+            {
+                int c(key.ops.compare(a[key.column], b[key.column]));
+                if (c != 0 && c != Value::UNORDERED)
+                    return key.descending ? c > 0 : c < 0;
+            }
+            return false;
+        }
+    };
+
+    vector<Key> _keys;
+    RowLess _less;
+    size_t _budget;
+    int _threads;
+    vector<Row> _buffer;
+    size_t _buffer_bytes = 0;
+    vector<fs::path> _files;
+    Stats _stats;
+
+    static atomic<size_t> &default_budget_ref()
+    {
+        static atomic<size_t> budget(256 << 20);
+        return budget;
+    }
+
+    fs::path next_run_path()
+    {
+        static atomic<uint64_t> sequence(0);
+        return fs::temp_directory_path() /
+               ("mini_db_sort_" + to_string(chrono::steady_clock::now().time_since_epoch().count()) + "_" +
+                to_string(sequence++));
+    }
+
+    size_t fan_in() const
+    {
+        size_t buffers(_budget / (4 * BLOCK_BYTES)); // a decoded block runs to a few times its encoding
+        return min<size_t>(MAX_FAN_IN, max<size_t>(2, buffers));
+    }
+
+    // Sorts the buffer as one chunk per core; returns the chunks as runs over the buffer
+    vector<unique_ptr<Run>> sort_buffer()
+    {
+        size_t chunks(min<size_t>(_threads, max<size_t>(1, _buffer.size() / MIN_CHUNK_ROWS)));
+        size_t per_chunk((_buffer.size() + chunks - 1) / max<size_t>(1, chunks));
+
+        vector<unique_ptr<Run>> runs;
+        vector<thread> workers;
+        for (size_t from(0); from < _buffer.size(); from += per_chunk)
+        {
+            auto b(_buffer.begin() + from), e(_buffer.begin() + min(_buffer.size(), from + per_chunk));
+            runs.push_back(make_unique<MemoryRun>(b, e));
+            if (chunks == 1)
+                sort(b, e, _less);
+            else
+                workers.emplace_back([this, b, e]
+                                     { sort(b, e, _less); });
+        }
+        for (auto &w : workers)
+            w.join();
+        return runs;
+    }
+
+    template <typename Emit>
+    void merge(vector<unique_ptr<Run>> &runs, Emit emit)
+    {
+        vector<Run *> inputs;
+        for (auto &r : runs)
+            inputs.push_back(r.get());
+        LoserTree<RowLess> tree(inputs, _less);
+        for (; !tree.done(); tree.pop())
+            emit(move(tree.top()));
+    }
+
+    fs::path write_run(vector<unique_ptr<Run>> &runs)
+    {
+        fs::path path(next_run_path());
+        _files.push_back(path); // removed by the destructor even if writing fails
+        RunWriter writer(path);
+        merge(runs, [&](Row &&row)
+              { writer.add(move(row)); });
+        uint64_t bytes(writer.finish());
+
+        ++_stats.runs;
+        _stats.spilled_bytes += bytes;
+        Metrics::add(Metrics::SORT_SPILLED_RUNS);
+        Metrics::add(Metrics::SORT_SPILLED_BYTES, bytes);
+        Metrics::add(Metrics::BYTES_WRITTEN, bytes);
+        return path;
+    }
+
+    void spill()
+    {
+        vector<unique_ptr<Run>> chunks(sort_buffer());
+        write_run(chunks);
+        chunks.clear();
+        vector<Row>().swap(_buffer);
+        _buffer_bytes = 0;
+    }
+
+public:
+    // Memory for buffered rows of each sort that does not name its own budget
+    static void set_default_budget(size_t bytes) { default_budget_ref() = max<size_t>(bytes, 1 << 20); }
+    static size_t default_budget() { return default_budget_ref(); }
+
+    ExternalSort(vector<Key> keys, size_t budget = default_budget(), int threads = thread::hardware_concurrency())
+        : _keys(move(keys)), _budget(max<size_t>(budget, 64 << 10)), _threads(max(1, threads))
+    {
+        _less.keys = &_keys;
+    }
+
+    ~ExternalSort()
+    {
+        for (const auto &path : _files)
+        {
+            error_code ec;
+            fs::remove(path, ec);
+        }
+    }
+
+    ExternalSort(const ExternalSort &) = delete;
+    ExternalSort &operator=(const ExternalSort &) = delete;
+
+    void add(Row &&row)
+    {
+        _buffer_bytes += QueryProfile::row_bytes(row);
+        _buffer.push_back(move(row));
+        ++_stats.rows;
+        _stats.peak_bytes = max<uint64_t>(_stats.peak_bytes, _buffer_bytes + _buffer.capacity() * sizeof(Row));
+        if (_buffer_bytes + _buffer.capacity() * sizeof(Row) >= _budget)
+            spill();
+    }
+
+    // Hands every row to `emit` in key order; the sorter is spent afterwards
+    template <typename Emit>
+    void finish(Emit emit)
+    {
+        size_t ways(fan_in());
+        if (!_files.empty() && _files.size() + 1 > ways) // the buffer would need a slot of its own
+            spill();
+
+        vector<fs::path> pending(_files);
+        while (pending.size() > ways)
+        {
+            vector<unique_ptr<Run>> inputs;
+            for (size_t i(0); i < ways; ++i)
+                inputs.push_back(make_unique<FileRun>(pending[i]));
+            fs::path merged(write_run(inputs));
+            inputs.clear();
+            for (size_t i(0); i < ways; ++i)
+            {
+                error_code ec;
+                fs::remove(pending[i], ec);
+            }
+            pending.erase(pending.begin(), pending.begin() + ways);
+            pending.push_back(merged);
+            ++_stats.merges;
+        }
+
+        vector<unique_ptr<Run>> inputs(sort_buffer());
+        for (const auto &path : pending)
+            inputs.push_back(make_unique<FileRun>(path));
+        _stats.fan_in = inputs.size();
+        merge(inputs, emit);
+        inputs.clear();
+        vector<Row>().swap(_buffer);
+        _buffer_bytes = 0;
+    }
+
+    const Stats &stats() const { return _stats; }
+};
+
+#endif
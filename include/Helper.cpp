@@ -4,7 +4,11 @@
 #include <fstream>
 #include <filesystem>
 #include <algorithm>
+#include <chrono>
 #include "models.cpp"
+#include "ColumnStore.cpp"
+#include "TableSnapshot.cpp"
+#include "WriteQueue.cpp"
 
 using namespace std;
 namespace fs = filesystem;
@@ -101,6 +105,24 @@ public:
 
         return {-1, -1};
     }
+    // Position of `word` (lower case) standing on its own between spaces outside quotes, matched
+    // without regard to case; string::npos when it does not
+    static size_t find_word(const string &str, const string &word)
+    {
+        char quote(0);
+        for (size_t i(0); i < str.size(); ++i)
+        {
+            char c(str[i]);
+            if (quote)
+                quote = c == quote ? 0 : quote;
+            else if (c == '\'' || c == '"')
+                quote = c;
+            else if (i && isspace(str[i - 1]) && i + word.size() < str.size() && isspace(str[i + word.size()]) &&
+                     to_lower(str.substr(i, word.size())) == word)
+                return i;
+        }
+        return string::npos;
+    }
     static vector<string> split_commas_respecting_quotes(const string &str)
     {
         vector<string> result;
@@ -203,26 +225,60 @@ public:
 
         return columns;
     }
+    static fs::path &data_dir() // ../data unless a tool points it elsewhere
+    {
+        static fs::path dir("../data");
+        return dir;
+    }
+    // A table's own directory; a partition, named <table>.<partition>, gets one inside its table's
+    static fs::path table_dir(const string &table_name)
+    {
+        int dot(table_name.find('.'));
+        if (dot == string::npos)
+            return data_dir() / table_name;
+        return data_dir() / table_name.substr(0, dot) / table_name.substr(dot + 1);
+    }
     static fs::path csv_path(const string &table_name)
     {
-        return fs::path("../data") / table_name / (table_name + ".csv");
+        return table_dir(table_name) / (table_name + ".csv");
     }
     static fs::path meta_path(const string &table_name)
     {
-        return fs::path("../data") / table_name / (table_name + ".meta");
+        return table_dir(table_name) / (table_name + ".meta");
+    }
+    static fs::path log_path(const string &table_name)
+    {
+        return table_dir(table_name) / (table_name + ".log");
+    }
+    static fs::path cols_path(const string &table_name)
+    {
+        return table_dir(table_name) / (table_name + ".cols");
+    }
+    static fs::path view_path(const string &view_name)
+    {
+        return data_dir() / view_name / (view_name + ".view");
+    }
+    static fs::path checkpoint_manifest_path()
+    {
+        return data_dir() / "checkpoint.manifest";
+    }
+    static uint64_t stored_bytes(const fs::path &path) // 0 for a missing file
+    {
+        error_code ec;
+        uintmax_t size(fs::file_size(path, ec));
+        return ec ? 0 : size;
     }
     static void ensure_data_dir()
     {
-        fs::path data_dir("../data");
-        if (!fs::exists(data_dir))
-            fs::create_directory(data_dir);
+        if (!fs::exists(data_dir()))
+            fs::create_directories(data_dir());
     }
     static bool create_csv_header(const string &table_name, const vector<string> &columns)
     {
         ensure_data_dir();
-        fs::path table_dir(fs::path("../data") / table_name);
-        if (!fs::exists(table_dir))
-            fs::create_directories(table_dir);
+        fs::path dir(table_dir(table_name));
+        if (!fs::exists(dir))
+            fs::create_directories(dir);
 
         fs::path path(csv_path(table_name));
 
@@ -243,24 +299,27 @@ public:
                 file << ",";
         }
         file << "\n";
+        count_write(file.tellp());
         file.close();
 
         return true;
     }
+    // A partitioned table's .meta ends with its scheme, and is replaced as partitions come and go
     static bool write_meta(const string &table_name, const vector<Column> &columns,
-                           const vector<string> &primary_key_cols)
+                           const vector<string> &primary_key_cols, const Partitioning *scheme = nullptr, bool replace = false)
     {
         ensure_data_dir();
-        fs::path table_dir(fs::path("../data") / table_name);
-        if (!fs::exists(table_dir))
-            fs::create_directories(table_dir);
+        fs::path dir(table_dir(table_name));
+        if (!fs::exists(dir))
+            fs::create_directories(dir);
 
-        fs::path path(meta_path(table_name));
+        fs::path path(meta_path(table_name)),
+            target(replace ? fs::path(path.string() + ".tmp") : path);
 
-        if (fs::exists(path))
+        if (!replace && fs::exists(path))
             return false;
 
-        ofstream file(path);
+        ofstream file(target, ios::trunc);
         if (!file.is_open())
             return false;
 
@@ -281,19 +340,501 @@ public:
                 file << ",";
         }
         file << "\n";
+        if (scheme)
+        {
+            file << "partition:" << (scheme->kind == Partitioning::RANGE ? "range" : "hash") << "|" << scheme->column;
+            if (scheme->kind == Partitioning::HASH)
+                file << "|" << (scheme->hash_function == Partitioning::FNV1A ? "fnv1a" : "std");
+            file << "\n";
+            for (int i(0); i < scheme->names.size(); ++i)
+            {
+                file << "part:" << scheme->names[i];
+                if (scheme->kind == Partitioning::RANGE)
+                    file << "|" << (scheme->bounds[i].is_null() ? "MAXVALUE" : scheme->bounds[i].to_storage_string());
+                file << "\n";
+            }
+        }
+        count_write(file.tellp());
         file.close();
+        if (!file)
+            return false;
 
+        if (replace)
+            fs::rename(target, path);
         return true;
     }
-    static void show_help()
+    // A materialized view is only its definition on disk; its rows are rebuilt from the base table
+    static bool write_view(const string &view_name, const string &base, const string &definition)
+    {
+        ensure_data_dir();
+        fs::create_directories(data_dir() / view_name);
+        fs::path path(view_path(view_name));
+        if (fs::exists(path))
+            return false;
+
+        ofstream file(path);
+        if (!file.is_open())
+            return false;
+        file << "base:" << base << "\n"
+             << "select:" << definition << "\n";
+        count_write(file.tellp());
+        file.close();
+        return bool(file);
+    }
+    static bool read_view(const fs::path &view_file, string &base, string &definition)
+    {
+        ifstream file(view_file);
+        string line;
+        while (getline(file, line))
+        {
+            if (line.find("base:") == 0)
+                base = line.substr(5);
+            else if (line.find("select:") == 0)
+                definition = line.substr(7);
+        }
+        return !base.empty() && !definition.empty();
+    }
+    static void write_row(ostream &out, const Row &row)
+    {
+        for (int i(0); i < row.size(); ++i)
+        {
+            out << row.at(i).to_storage_string();
+            if (i + 1 < row.size())
+                out << ",";
+        }
+        out << "\n";
+    }
+    static void count_write(uint64_t bytes)
+    {
+        Metrics::add(Metrics::BYTES_WRITTEN, bytes);
+        Metrics::add(Metrics::FILE_WRITES);
+    }
+    // Written by the WriteQueue, behind the statement once the queue runs
+    static void append_to(const fs::path &path, string data) { WriteQueue::instance().append(path, move(data)); }
+    static void append_csv_row(const string &table_name, const Row &row)
+    {
+        Metrics::Timer timer(Metrics::CSV_APPEND);
+        ostringstream line;
+        write_row(line, row);
+        append_to(csv_path(table_name), line.str());
+    }
+    static void append_delete_log(const string &table_name, const vector<int> &row_ids)
+    {
+        Metrics::Timer timer(Metrics::LOG_APPEND);
+        ostringstream records;
+        for (int id : row_ids)
+            records << "D," << id << "\n";
+        append_to(log_path(table_name), records.str());
+    }
+    static void flush_dirty_rows(Table *table)
+    {
+        vector<int> dirty(table->take_dirty_rows());
+        if (dirty.empty())
+            return;
+
+        Metrics::Timer timer(Metrics::LOG_APPEND);
+        ostringstream records;
+        for (int id : dirty)
+        {
+            records << "U," << id << ",";
+            write_row(records, table->row_at(id));
+        }
+        append_to(log_path(table->get_name()), records.str());
+    }
+    // Everything a transaction changed in the table, one append per file: the rows it added go to
+    // the csv, then the final values of older rows it updated and every row it deleted to the log.
+    // The caller holds the writer lock.
+    static void write_transaction(Table *table)
+    {
+        const string &name(table->get_name());
+        int first(table->transaction_first_slot());
+        ostringstream rows, records;
+        for (int id(first); id < table->row_count(); ++id)
+            write_row(rows, table->row_at(id)); // deleted ones too: row ids must keep matching the csv
+
+        vector<int> updated, deleted;
+        for (const auto &change : table->transaction_changes())
+        {
+            if (change.kind == Table::Change::ERASE)
+                deleted.push_back(change.row);
+            else if (change.kind == Table::Change::UPDATE && change.row < first && table->is_live(change.row))
+                updated.push_back(change.row);
+        }
+        sort(updated.begin(), updated.end());
+        updated.erase(unique(updated.begin(), updated.end()), updated.end());
+        for (int id : updated)
+        {
+            records << "U," << id << ",";
+            write_row(records, table->row_at(id));
+        }
+        for (int id : deleted)
+            records << "D," << id << "\n";
+
+        if (rows.tellp() > 0)
+        {
+            Metrics::Timer timer(Metrics::CSV_APPEND);
+            append_to(csv_path(name), rows.str());
+        }
+        if (records.tellp() > 0)
+        {
+            Metrics::Timer timer(Metrics::LOG_APPEND);
+            append_to(log_path(name), records.str());
+        }
+    }
+    static Row parse_stored_row(const vector<string> &values, const vector<Column> &columns)
+    {
+        Row row;
+        for (int i(0); i < values.size(); ++i)
+        {
+            string val(trim(values[i]));
+            string type(columns[i].get_type());
+
+            if (val == "NULL")
+                row.push_back(Value());
+            else if (type == "INT")
+                row.push_back(Value(stoi(val)));
+            else if (type == "DOUBLE")
+                row.push_back(Value(stod(val)));
+            else if (type == "DATE")
+            {
+                int y(0), m(0), d(0);
+                sscanf(val.c_str(), "%d-%d-%d", &y, &m, &d);
+                row.push_back(Value(Date(y, m, d)));
+            }
+            else
+                row.push_back(Value(val));
+        }
+        return row;
+    }
+    // The csv after a compaction only holds rows appended since; its "#base" line names the column
+    // file it continues, so a csv left over from before the column file was replaced is recognised
+    static void write_csv_tail(const fs::path &file_path, const vector<Column> &cols, uint64_t epoch, const string &rows = "")
+    {
+        ofstream file(file_path, ios::trunc);
+        for (int i(0); i < cols.size(); ++i)
+        {
+            file << cols[i].get_name();
+            if (i + 1 < cols.size())
+                file << ",";
+        }
+        file << "\n#base " << epoch << "\n"
+             << rows;
+        count_write(file.tellp());
+        file.close();
+        if (!file)
+            throw runtime_error("cannot write " + file_path.string());
+    }
+    static void reset_csv_tail(const string &table_name, const vector<Column> &cols, uint64_t epoch)
+    {
+        fs::path csv_file(csv_path(table_name)),
+            tmp_file(csv_file.string() + ".tmp");
+        write_csv_tail(tmp_file, cols, epoch);
+        fs::rename(tmp_file, csv_file);
+    }
+    static uint64_t csv_tail_base(const fs::path &csv_file) // 0 when it names no column file
+    {
+        ifstream csv(csv_file);
+        string header, marker;
+        getline(csv, header);
+        getline(csv, marker);
+        return marker.rfind("#base ", 0) == 0 ? strtoull(marker.c_str() + 6, nullptr, 10) : 0;
+    }
+
+    // A compaction runs in three steps, so statements only wait for the last one. Under the writer
+    // lock, compaction_image takes the rows the new column file will hold, the live ones as of
+    // then; `kept` marks their slots
+    static vector<Row> compaction_image(const Table *table, vector<bool> &kept)
+    {
+        kept.assign(table->row_count(), false);
+        vector<Row> image;
+        image.reserve(table->live_row_count());
+        table->for_each_live([&](int idx, const Row &row)
+                             {
+            kept[idx] = true;
+            image.push_back(row); });
+        return image;
+    }
+    // With no lock held, write_compacted_image encodes them next to the column file
+    static void write_compacted_image(const Table *table, const vector<Row> &image, uint64_t epoch)
+    {
+        fs::path tmp_file(cols_path(table->get_name()).string() + ".tmp");
+        ofstream file(tmp_file, ios::binary | ios::trunc);
+        ColumnStore::Builder builder(file, table->get_columns(), epoch);
+        for (const Row &row : image)
+            builder.add(row);
+        count_write(builder.finish());
+        file.close();
+        if (!file)
+            throw runtime_error("cannot write " + tmp_file.string());
+    }
+    // Under the exclusive statement lock, swap_compacted_files drops from the table the rows the
+    // image left out and puts the image in place of the column file. The rows changed, deleted or
+    // added since the image was taken go to a new csv and log, against the ids they have now;
+    // both are written before any rename, so a crash part way is finished by the loader
+    static void swap_compacted_files(Table *table, const vector<bool> &kept, const vector<Row> &image, uint64_t epoch)
+    {
+        Metrics::Timer timer(Metrics::TABLE_REWRITE);
+        WriteQueue::instance().flush(); // queued records address the rows before compaction
+        table->compact(&kept);
+
+        ostringstream rows, records;
+        for (int id(0); id < image.size(); ++id)
+        {
+            if (!table->is_live(id))
+                records << "D," << id << "\n";
+            else
+            {
+                Row row(table->row_at(id));
+                if (row.values() != image[id].values())
+                {
+                    records << "U," << id << ",";
+                    write_row(records, row);
+                }
+            }
+        }
+        for (int id(image.size()); id < table->row_count(); ++id)
+        {
+            write_row(rows, table->row_at(id)); // deleted ones too: row ids must keep matching the csv
+            if (!table->is_live(id))
+                records << "D," << id << "\n";
+        }
+
+        const string &name(table->get_name());
+        fs::path cols_file(cols_path(name)), csv_file(csv_path(name)), log_file(log_path(name)),
+            csv_tmp(csv_file.string() + ".tmp"), log_tmp(log_file.string() + ".tmp");
+        write_csv_tail(csv_tmp, table->get_columns(), epoch, rows.str());
+        {
+            ofstream log(log_tmp, ios::trunc);
+            log << records.str();
+            count_write(log.tellp());
+            log.close();
+            if (!log)
+                throw runtime_error("cannot write " + log_tmp.string());
+        }
+
+        // log before csv: until the csv is renamed its marker is stale, and the loader renames both
+        fs::rename(cols_file.string() + ".tmp", cols_file);
+        fs::rename(log_tmp, log_file);
+        fs::rename(csv_tmp, csv_file);
+    }
+    // The files of a compaction given up before its swap
+    static void discard_compacted_files(const string &table_name)
+    {
+        for (const fs::path &file : {cols_path(table_name), csv_path(table_name), log_path(table_name)})
+            fs::remove(file.string() + ".tmp");
+    }
+    // A compaction interrupted between its renames left the csv and log it wrote last next to
+    // the column file they continue; they replace the stale ones. Leftovers of one given up before
+    // its swap are removed
+    static void finish_compaction(const string &table_name, uint64_t base_epoch)
+    {
+        fs::path csv_file(csv_path(table_name)), log_file(log_path(table_name)),
+            csv_tmp(csv_file.string() + ".tmp"), log_tmp(log_file.string() + ".tmp");
+        if (base_epoch && fs::exists(csv_tmp) && csv_tail_base(csv_tmp) == base_epoch &&
+            csv_tail_base(csv_file) != base_epoch)
+        {
+            if (fs::exists(log_tmp))
+                fs::rename(log_tmp, log_file);
+            fs::rename(csv_tmp, csv_file);
+        }
+        discard_compacted_files(table_name);
+    }
+    // Applies the log from `from` on: only its net effect, every row's last values and the rows
+    // it deletes, so the order its records changed keys in cannot make rows collide on the way.
+    // The values are set without the primary key index; returns whether keys changed, so the
+    // caller rebuilds it. Records that cannot be applied are reported, never dropped silently
+    static bool replay_log(Table *table, const fs::path &log_file, uint64_t from = 0)
+    {
+        ifstream log(log_file);
+        log.seekg(from);
+        string line;
+        map<int, Row> updated; // row id -> last values
+        vector<int> deleted;
+        int skipped(0);
+        while (getline(log, line))
+        {
+            if (line.empty())
+                continue;
+            size_t comma(line.find(',', 2));
+            if (line.size() >= 3 && line[0] == 'D' && line[1] == ',')
+                deleted.push_back(atoi(line.c_str() + 2));
+            else if (line.size() >= 3 && line[0] == 'U' && line[1] == ',' && comma != string::npos) // U,<row_id>,<values...>
+            {
+                auto values(split_commas_respecting_quotes(line.substr(comma + 1)));
+                if (values.size() == table->get_column_count())
+                    updated[atoi(line.c_str() + 2)] = parse_stored_row(values, table->get_columns());
+                else
+                    ++skipped;
+            }
+            else
+                ++skipped;
+        }
+
+        for (int id : deleted)
+        {
+            updated.erase(id);
+            if (!table->erase_at(id))
+                ++skipped;
+        }
+        bool rekeyed(false);
+        for (const auto &update : updated)
+        {
+            if (update.first < 0 || update.first >= table->row_count() || !table->is_live(update.first))
+            {
+                ++skipped;
+                continue;
+            }
+            rekeyed = rekeyed || table->primary_key_of(table->row_at(update.first)) != table->primary_key_of(update.second);
+            table->restore_row(update.first, update.second);
+        }
+        if (skipped)
+            cerr << "Replaying " << log_file.string() << ": " << skipped << " record(s) could not be applied\n";
+        return rekeyed && table->has_pk();
+    }
+    static map<string, string> read_checkpoint_manifest() // table name -> snapshot file
+    {
+        map<string, string> snapshots;
+        ifstream file(checkpoint_manifest_path());
+        string line;
+        if (!getline(file, line) || line.rfind("checkpoint ", 0) != 0)
+            return snapshots;
+
+        while (getline(file, line))
+        {
+            int space(line.rfind(' '));
+            if (space != string::npos)
+                snapshots[line.substr(0, space)] = line.substr(space + 1);
+        }
+        return snapshots;
+    }
+    // Image of one table between two statements; one that still matches the table is kept as is.
+    // A table inside an open transaction keeps its previous image, if any: its slots already hold
+    // rows the files do not
+    static string checkpoint_table(Table *table, uint64_t id, const string &previous)
+    {
+        const string &name(table->get_name());
+        Table::ReadView view(table);
+        TableSnapshot::Position pos;
+        {
+            // with no writer running and their queued records written, the snapshot, the row ids
+            // and the file sizes all describe the same moment
+            lock_guard<mutex> writer(table->get_mutex());
+            if (table->is_dropped())
+                return "";
+            if (table->in_transaction())
+                return previous;
+            WriteQueue::instance().flush();
+            view.advance();
+            pos.slots = table->row_count();
+            pos.csv_bytes = stored_bytes(csv_path(name));
+            pos.log_bytes = stored_bytes(log_path(name));
+            pos.base_epoch = fs::exists(cols_path(name)) ? ColumnStore::read_epoch(cols_path(name)) : 0;
+        }
+
+        TableSnapshot::Position current;
+        if (!previous.empty() && TableSnapshot::peek(table_dir(name) / previous, current) && current == pos)
+            return previous;
+
+        string file(name + "." + to_string(id) + ".snap");
+        fs::path snap_file(table_dir(name) / file),
+            tmp_file(snap_file.string() + ".tmp");
+        count_write(TableSnapshot::write(tmp_file, table, view, pos));
+        fs::rename(tmp_file, snap_file);
+        return file;
+    }
+    // Images every table, then publishes them together by replacing the manifest; returns the
+    // number of tables the new checkpoint covers
+    static int write_checkpoint(Catalog *catalog)
     {
-        cout << "\n================================================================\n";
-        cout << "         Mini Database Engine - Command Reference\n";
-        cout << "================================================================\n\n";
+        static mutex checkpoint_mutex; // the schedule and CHECKPOINT statements take turns
+        lock_guard<mutex> serial(checkpoint_mutex);
+        Catalog::Pin pin(catalog);
+        Metrics::Timer timer(Metrics::CHECKPOINT_WRITE);
 
-        cout << "--- SQL COMMANDS -----------------------------------------------\n\n";
+        ensure_data_dir();
+        map<string, string> previous(read_checkpoint_manifest()), current;
+        uint64_t id(chrono::system_clock::now().time_since_epoch().count());
+        for (Table *table : catalog->all_tables())
+        {
+            const string &name(table->get_name());
+            try
+            {
+                auto it(previous.find(name));
+                string file(checkpoint_table(table, id, it == previous.end() ? "" : it->second));
+                if (!file.empty())
+                    current[name] = file;
+            }
+            catch (const exception &e)
+            {
+                cerr << "Checkpoint of '" << name << "' failed: " << e.what() << "\n";
+            }
+        }
+        // tables not in memory have not changed since; their image (or files) still say it all
+        for (const auto &entry : previous)
+        {
+            if (!current.count(entry.first) && catalog->exists(entry.first))
+                current.insert(entry);
+        }
 
-        cout << ">> CREATE TABLE - Create a new table schema\n"
+        fs::path manifest(checkpoint_manifest_path()),
+            tmp_file(manifest.string() + ".tmp");
+        {
+            ofstream file(tmp_file, ios::trunc);
+            file << "checkpoint " << id << "\n";
+            for (const auto &entry : current)
+                file << entry.first << " " << entry.second << "\n";
+            count_write(file.tellp());
+        }
+        fs::rename(tmp_file, manifest);
+
+        // older images go only once the manifest no longer names them
+        for (Table *table : catalog->all_tables())
+        {
+            auto kept(current.find(table->get_name()));
+            error_code ec;
+            for (const auto &entry : fs::directory_iterator(table_dir(table->get_name()), ec))
+            {
+                string file(entry.path().filename().string());
+                bool image(entry.path().extension() == ".snap" ||
+                           (file.size() > 9 && file.compare(file.size() - 9, 9, ".snap.tmp") == 0));
+                if (image && (kept == current.end() || kept->second != file))
+                    fs::remove(entry.path(), ec);
+            }
+        }
+
+        Metrics::add(Metrics::CHECKPOINTS);
+        return current.size();
+    }
+    // Loads the table from its checkpoint image, unless the image no longer lines up with the
+    // files (a compaction replaced the column file since) or cannot be read
+    static bool restore_snapshot(Table *table, const fs::path &snap_file, uint64_t base_epoch, TableSnapshot::Position &pos)
+    {
+        const string &name(table->get_name());
+        TableSnapshot::Position header;
+        if (!TableSnapshot::peek(snap_file, header) || header.base_epoch != base_epoch ||
+            header.csv_bytes > stored_bytes(csv_path(name)) || header.log_bytes > stored_bytes(log_path(name)))
+            return false;
+
+        try
+        {
+            pos = TableSnapshot::read(snap_file, table);
+            return true;
+        }
+        catch (const exception &e)
+        {
+            cerr << "Ignoring checkpoint of '" << name << "': " << e.what() << "\n";
+            return false;
+        }
+    }
+    static void show_help(ostream &out = cout)
+    {
+        out << "\n================================================================\n";
+        out << "         Mini Database Engine - Command Reference\n";
+        out << "================================================================\n\n";
+
+        out << "--- SQL COMMANDS -----------------------------------------------\n\n";
+
+        out << ">> CREATE TABLE - Create a new table schema\n"
              << "  Syntax:\n"
              << "    CREATE TABLE table_name (\n"
              << "      col_name TYPE [NOT NULL] [PRIMARY KEY],\n"
@@ -308,7 +849,51 @@ public:
              << "    CREATE TABLE orders (user_id INT, order_id INT, PRIMARY KEY(user_id, order_id));\n"
              << "    CREATE TABLE users (username CHAR(20) PRIMARY KEY, email VARCHAR(100));\n\n";
 
-        cout << ">> INSERT - Add new rows to a table\n"
+        out << ">> PARTITION BY - Split a table into partitions by one column\n"
+             << "  Syntax:\n"
+             << "    CREATE TABLE ... (...) PARTITION BY RANGE(col) (\n"
+             << "      PARTITION name VALUES LESS THAN (value | MAXVALUE), ...);\n"
+             << "    CREATE TABLE ... (...) PARTITION BY HASH(col, partitions);\n"
+             << "    ALTER TABLE table_name ADD PARTITION name VALUES LESS THAN (value | MAXVALUE);\n"
+             << "    ALTER TABLE table_name DROP PARTITION name;\n\n"
+             << "  Features:\n"
+             << "    * The primary key must include the partition column\n"
+             << "    * WHERE on the partition column scans only the partitions that can match\n"
+             << "    * Read one partition as table_name.partition; DROP PARTITION deletes its rows at once\n\n"
+             << "  Examples:\n"
+             << "    CREATE TABLE sales (id INT, day DATE, PRIMARY KEY(id, day)) PARTITION BY RANGE(day) (\n"
+             << "      PARTITION p2024 VALUES LESS THAN ('2025-01-01'), PARTITION pmax VALUES LESS THAN (MAXVALUE));\n"
+             << "    ALTER TABLE sales DROP PARTITION p2024;\n\n";
+
+        out << ">> CREATE BITMAP INDEX - Index a low-cardinality column, or the text of one\n"
+             << "  Syntax:\n"
+             << "    CREATE BITMAP INDEX index_name ON table_name (col);\n"
+             << "    CREATE INDEX index_name ON table_name (col) USING BITMAP | TRIGRAM;\n\n"
+             << "  Features:\n"
+             << "    * Keeps a compressed bitmap of rows per distinct value, maintained by every write\n"
+             << "    * WHERE conditions on indexed columns combine bitmaps with AND, OR and NOT\n"
+             << "      and read only the rows they leave; COUNT(*) may not read rows at all\n"
+             << "    * A TRIGRAM index keeps a bitmap per three-letter run of the text instead,\n"
+             << "      so LIKE, ILIKE and = read only the rows holding the pattern's trigrams\n"
+             << "    * Kept in each partition of a partitioned table\n\n"
+             << "  Examples:\n"
+             << "    CREATE BITMAP INDEX major_idx ON students (major);\n"
+             << "    CREATE INDEX name_trgm ON students (name) USING TRIGRAM;\n"
+             << "    SELECT COUNT(*) FROM students WHERE major = 'CS' AND NOT year = 1;\n\n";
+
+        out << ">> CREATE MATERIALIZED VIEW - Keep a GROUP BY result up to date\n"
+             << "  Syntax:\n"
+             << "    CREATE MATERIALIZED VIEW view_name AS\n"
+             << "      SELECT col1, ..., aggregate1, ... FROM table_name GROUP BY col1, ...;\n\n"
+             << "  Features:\n"
+             << "    * Every INSERT, UPDATE and DELETE on the table updates the view's groups\n"
+             << "    * Aggregates: COUNT, COUNT(DISTINCT col), SUM, AVG, MIN, MAX\n"
+             << "    * Read with SELECT * | cols FROM view_name [ORDER BY ...] [LIMIT n]\n\n"
+             << "  Examples:\n"
+             << "    CREATE MATERIALIZED VIEW by_major AS SELECT major, COUNT(*), AVG(gpa) FROM students GROUP BY major;\n"
+             << "    SELECT * FROM by_major ORDER BY major;\n\n";
+
+        out << ">> INSERT - Add new rows to a table\n"
              << "  Syntax:\n"
              << "    INSERT INTO table_name VALUES (value1, value2, ...);\n\n"
              << "  Features:\n"
@@ -320,26 +905,36 @@ public:
              << "    INSERT INTO students VALUES (2, 'Bob');           -- gpa becomes NULL\n"
              << "    INSERT INTO orders VALUES (101, 5001, '2025-12-25', 'Laptop');\n\n";
 
-        cout << ">> SELECT - Query and retrieve data\n"
+        out << ">> SELECT - Query and retrieve data\n"
              << "  Syntax:\n"
              << "    SELECT * | col1, col2, ... FROM table_name \n"
              << "      [WHERE condition]\n"
              << "      [GROUP BY col1, col2, ...]\n"
-             << "      [HAVING aggregate_condition];\n\n"
+             << "      [HAVING aggregate_condition]\n"
+             << "      [ORDER BY col1 [ASC|DESC], col2 [ASC|DESC], ...]\n"
+             << "      [LIMIT n];\n\n"
              << "  Features:\n"
              << "    * Use * to select all columns\n"
              << "    * Specify column names for partial selection\n"
-             << "    * WHERE clause filters rows before grouping\n"
+             << "    * WHERE clause filters rows before grouping; combine comparisons with\n"
+             << "      AND, OR, NOT and parentheses\n"
+             << "    * col [NOT] LIKE | ILIKE 'pattern' matches text; % is any run of characters,\n"
+             << "      _ any one character and \\ escapes them; ILIKE ignores case\n"
              << "    * GROUP BY groups rows by column values\n"
              << "    * HAVING filters groups after aggregation\n"
+             << "    * ORDER BY sorts the result; large results spill to temp files\n"
+             << "    * LIMIT returns the first n rows and stops the scan once they are found\n"
              << "    * Results displayed in formatted table view\n\n"
              << "  Examples:\n"
              << "    SELECT * FROM students;\n"
              << "    SELECT name, gpa FROM students WHERE gpa > 3.5;\n"
+             << "    SELECT name, gpa FROM students ORDER BY gpa DESC, name;\n"
+             << "    SELECT name, gpa FROM students ORDER BY gpa DESC LIMIT 3;\n"
              << "    SELECT * FROM orders WHERE user_id = 101;\n"
-             << "    SELECT username FROM users WHERE email = 'alice@example.com';\n\n";
+             << "    SELECT username FROM users WHERE email = 'alice@example.com';\n"
+             << "    SELECT * FROM users WHERE email LIKE '%@example.com';\n\n";
 
-        cout << ">> UPDATE - Modify existing rows\n"
+        out << ">> UPDATE - Modify existing rows\n"
              << "  Syntax:\n"
              << "    UPDATE table_name SET col1=val1, col2=val2, ... WHERE condition;\n\n"
              << "  Features:\n"
@@ -352,7 +947,7 @@ public:
              << "    UPDATE students SET name = 'Robert', gpa = 4.0 WHERE id = 2;\n"
              << "    UPDATE orders SET status = 'shipped' WHERE order_id > 5000;\n\n";
 
-        cout << ">> DELETE - Remove rows from a table\n"
+        out << ">> DELETE - Remove rows from a table\n"
              << "  Syntax:\n"
              << "    DELETE FROM table_name WHERE condition;\n\n"
              << "  Features:\n"
@@ -364,7 +959,7 @@ public:
              << "    DELETE FROM orders WHERE status = 'cancelled';\n"
              << "    DELETE FROM users WHERE gpa < 2.0;\n\n";
 
-        cout << ">> GROUP BY & HAVING - Aggregate and group data\n"
+        out << ">> GROUP BY & HAVING - Aggregate and group data\n"
              << "  Syntax:\n"
              << "    SELECT col1, AGG_FUNC(col2), ... FROM table_name\n"
              << "      [WHERE condition]\n"
@@ -373,6 +968,9 @@ public:
              << "  Aggregate Functions:\n"
              << "    COUNT(*)      Count all rows in group\n"
              << "    COUNT(col)    Count non-NULL values in column\n"
+             << "    COUNT(DISTINCT col)          Count distinct non-NULL values\n"
+             << "    APPROX_COUNT_DISTINCT(col)   Distinct count estimate (HyperLogLog, ~1%)\n"
+             << "    APPROX_PERCENTILE(col, p)    Estimated p-quantile, 0 <= p <= 1 (t-digest)\n"
              << "    SUM(col)      Sum numeric values\n"
              << "    AVG(col)      Average of numeric values\n"
              << "    MIN(col)      Minimum value\n"
@@ -388,15 +986,44 @@ public:
              << "    SELECT department, AVG(salary) FROM employees \n"
              << "      GROUP BY department HAVING AVG(salary) > 55000;\n"
              << "    SELECT category, COUNT(*), SUM(price) FROM products GROUP BY category;\n"
+             << "    SELECT major, COUNT(DISTINCT gpa), APPROX_PERCENTILE(gpa, 0.9) FROM students GROUP BY major;\n"
              << "    SELECT major, AVG(gpa) FROM students \n"
              << "      GROUP BY major HAVING AVG(gpa) >= 3.5;\n"
              << "    SELECT customer_name, SUM(total_price) FROM orders \n"
              << "      WHERE order_date > '2025-01-01'\n"
              << "      GROUP BY customer_name HAVING SUM(total_price) > 500;\n\n";
 
-        cout << "----------------------------------------------------------------\n\n";
+        out << ">> EXPLAIN - Show how a statement is executed\n"
+             << "  Syntax:\n"
+             << "    EXPLAIN statement;\n"
+             << "    EXPLAIN ANALYZE statement;\n\n"
+             << "  Features:\n"
+             << "    * EXPLAIN prints the operator tree without running the statement\n"
+             << "    * EXPLAIN ANALYZE runs it, then adds per-operator time, rows in/out,\n"
+             << "      blocks scanned and skipped, hash table sizes, bytes built or written\n"
+             << "    * Works for CREATE, INSERT, SELECT, UPDATE and DELETE\n\n"
+             << "  Examples:\n"
+             << "    EXPLAIN SELECT * FROM students WHERE gpa > 3.5;\n"
+             << "    EXPLAIN ANALYZE SELECT major, AVG(gpa) FROM students GROUP BY major;\n"
+             << "    EXPLAIN ANALYZE UPDATE students SET gpa = 4.0 WHERE id = 2;\n\n";
+
+        out << ">> BEGIN / COMMIT / ROLLBACK - Group statements into a transaction\n"
+             << "  Syntax:\n"
+             << "    BEGIN;  statements...  COMMIT;  |  ROLLBACK;\n\n"
+             << "  Features:\n"
+             << "    * Other sessions see none of the changes until COMMIT\n"
+             << "    * COMMIT writes each table's changes to disk in one batch\n"
+             << "    * ROLLBACK restores every row the transaction touched\n"
+             << "    * A table written by a transaction is locked to it until it ends\n\n"
+             << "  Examples:\n"
+             << "    BEGIN;\n"
+             << "    UPDATE accounts SET balance -= 100 WHERE id = 1;\n"
+             << "    UPDATE accounts SET balance += 100 WHERE id = 2;\n"
+             << "    COMMIT;\n\n";
+
+        out << "----------------------------------------------------------------\n\n";
 
-        cout << "--- DATA TYPES -------------------------------------------------\n\n"
+        out << "--- DATA TYPES -------------------------------------------------\n\n"
              << "  INT          Integer numbers (e.g., 42, -10, 0)\n"
              << "  DOUBLE       Decimal numbers (e.g., 3.14, 99.99, -0.5)\n"
              << "  VARCHAR(n)   Variable-length strings (e.g., VARCHAR(50))\n"
@@ -405,7 +1032,7 @@ public:
              << "  DATE         Date values in YYYY-MM-DD format (e.g., '2025-12-31')\n"
              << "  Note: CHAR, VARCHAR, and TEXT are all normalized to VARCHAR in storage\n\n";
 
-        cout << "--- WHERE CLAUSE OPERATORS -------------------------------------\n\n"
+        out << "--- WHERE CLAUSE OPERATORS -------------------------------------\n\n"
              << "  =            Equal to                  (e.g., id = 5)\n"
              << "  !=           Not equal to              (e.g., status != 'pending')\n"
              << "  >            Greater than              (e.g., price > 100)\n"
@@ -413,145 +1040,306 @@ public:
              << "  >=           Greater than or equal     (e.g., gpa >= 3.0)\n"
              << "  <=           Less than or equal        (e.g., quantity <= 50)\n\n";
 
-        cout << "--- SPECIAL COMMANDS -------------------------------------------\n\n"
+        out << "--- SPECIAL COMMANDS -------------------------------------------\n\n"
              << "  help, ?      Display this help message\n"
+             << "  show stats   Engine counters and latency percentiles\n"
+             << "  checkpoint   Snapshot every table now, so the next startup loads fast\n"
+             << "  set durability enqueue | flush\n"
+             << "               Acknowledge writes once queued for the disk, or once written\n"
              << "  exit, quit   Exit the database engine\n\n";
 
-        cout << "--- IMPORTANT NOTES --------------------------------------------\n\n"
+        out << "--- IMPORTANT NOTES --------------------------------------------\n\n"
              << "  * Strings must be enclosed in single quotes: 'text'\n"
              << "  * Dates must be in YYYY-MM-DD format: '2025-12-31'\n"
              << "  * Commands are case-insensitive: CREATE = create\n"
              << "  * Semicolons are optional at end of statements\n"
              << "  * Columns are nullable by default (use NOT NULL to require values)\n"
              << "  * Omitted INSERT values default to NULL (for nullable columns only)\n"
-             << "  * Data is automatically persisted to ../data/table_name/ directory\n"
-             << "  * Tables are auto-loaded from disk on engine startup\n"
+             << "  * Data is automatically persisted to ../data/table_name/ directory, by a\n"
+             << "    background writer; exit writes out whatever is still queued\n"
+             << "  * Tables are loaded from disk when a statement first uses them, from the\n"
+             << "    latest checkpoint plus the changes made after it\n"
              << "  * Primary keys enforce uniqueness (single or composite keys supported)\n\n";
 
-        cout << "================================================================\n";
-        cout << "Version: 1.0 | Features: CREATE, INSERT, SELECT, UPDATE, DELETE, NOT NULL\n";
+        out << "================================================================\n";
+        out << "Version: 1.0 | Features: CREATE, INSERT, SELECT, UPDATE, DELETE, NOT NULL\n";
     }
 
-    static void load_existing_tables(Catalog *catalog)
+    static bool read_meta(const fs::path &meta_file, Catalog::TableStub &stub)
     {
-        fs::path data_dir("../data");
-        if (!fs::exists(data_dir) || !fs::is_directory(data_dir))
-            return;
+        ifstream file(meta_file);
+        if (!file.is_open())
+            return false;
+
+        vector<Column> &columns(stub.columns);
+        vector<string> &pk_cols(stub.pk_columns);
+        string line;
 
-        for (const auto &entry : fs::directory_iterator(data_dir))
+        while (getline(file, line))
         {
-            if (!entry.is_directory())
+            if (line == "columns:")
                 continue;
 
-            string table_name(entry.path().filename().string());
-            fs::path meta_file(entry.path() / (table_name + ".meta"));
+            if (line.find("pk:") == 0)
+            {
+                string pk_list(line.substr(3));
+                pk_cols = Helper::split_commas_respecting_quotes(pk_list);
+                for (auto &pk : pk_cols)
+                    pk = Helper::trim(pk);
+                break;
+            }
 
-            if (!fs::exists(meta_file))
-                continue;
+            int pos1(line.find('|')),
+                pos2(line.find('|', pos1 + 1)),
+                pos3(line.find('|', pos2 + 1));
+            if (pos1 != string::npos && pos2 != string::npos)
+            {
+                string name(Helper::trim(line.substr(0, pos1)));
+                string type(Helper::trim(line.substr(pos1 + 1, pos2 - pos1 - 1)));
+                string len_str(Helper::trim(line.substr(pos2 + 1, pos3 != string::npos ? pos3 - pos2 - 1 : string::npos)));
+                int len(stoi(len_str));
+                if (!len)
+                    len = 1;
+
+                bool is_nullable(true);
+                if (pos3 != string::npos)
+                {
+                    string null_str(Helper::trim(line.substr(pos3 + 1)));
+                    is_nullable = (null_str == "1");
+                }
 
-            ifstream file(meta_file);
-            if (!file.is_open())
+                columns.emplace_back(name, type, false, len, is_nullable);
+            }
+        }
+        while (getline(file, line))
+        {
+            int colon(line.find(':')), bar(line.find('|'));
+            string kind(line.substr(0, colon == string::npos ? 0 : colon));
+            if ((kind == "bitmap" || kind == "trigram") && bar != string::npos && bar > colon)
+                stub.bitmap_indexes.push_back({line.substr(colon + 1, bar - colon - 1), line.substr(bar + 1),
+                                               kind == "bitmap" ? BitmapIndex::VALUES : BitmapIndex::TRIGRAMS});
+        }
+        return !stub.columns.empty();
+    }
+    // A bitmap index is a `bitmap:name|column` line at the end of its table's .meta, a trigram
+    // index a `trigram:name|column` line
+    static void append_bitmap_index(const string &table_name, const BitmapIndex::Definition &index)
+    {
+        ofstream file(meta_path(table_name), ios::app);
+        file << (index.kind == BitmapIndex::VALUES ? "bitmap:" : "trigram:") << index.name << "|" << index.column << "\n";
+        file.close();
+        if (!file)
+            throw runtime_error("cannot write " + meta_path(table_name).string());
+    }
+    // The scheme at the end of a partitioned table's .meta; false for any other table. Throws
+    // when the rows were spread by a hash this build does not know
+    static bool read_partitioning(const fs::path &meta_file, const string &table_name, const vector<Column> &columns, Partitioning &scheme)
+    {
+        ifstream file(meta_file);
+        string line;
+        while (getline(file, line) && line.find("partition:") != 0)
+            ;
+        int bar(line.find('|'));
+        if (line.empty() || bar == string::npos)
+            return false;
+
+        scheme.table = table_name;
+        scheme.kind = line.substr(10, bar - 10) == "hash" ? Partitioning::HASH : Partitioning::RANGE;
+        int hash_bar(line.find('|', bar + 1)); // a hash scheme names its function; none is the old one
+        string hash_function(hash_bar == string::npos ? "std" : line.substr(hash_bar + 1));
+        if (hash_function != "std" && hash_function != "fnv1a")
+            throw runtime_error("unknown partition hash '" + hash_function + "'");
+        scheme.hash_function = hash_function == "fnv1a" ? Partitioning::FNV1A : Partitioning::STD_HASH;
+        scheme.column = line.substr(bar + 1, hash_bar == string::npos ? string::npos : hash_bar - bar - 1);
+        for (int i(0); i < columns.size(); ++i)
+        {
+            if (columns[i].get_name() == scheme.column)
+                scheme.column_index = i;
+        }
+        if (scheme.column_index == NOT_FOUND)
+            return false;
+        scheme.column_type = columns[scheme.column_index].get_type();
+        scheme.ops = ValueOps::for_column(columns[scheme.column_index]);
+
+        while (getline(file, line))
+        {
+            if (line.find("part:") != 0)
+                continue;
+            bar = line.find('|');
+            scheme.names.push_back(line.substr(5, bar == string::npos ? string::npos : bar - 5));
+            if (scheme.kind == Partitioning::HASH)
                 continue;
+            string bound(bar == string::npos ? "MAXVALUE" : line.substr(bar + 1));
+            scheme.bounds.push_back(bound == "MAXVALUE" ? Value() : parse_stored_row({bound}, {columns[scheme.column_index]})[0]);
+        }
+        return !scheme.names.empty();
+    }
+    // Reads one table from its checkpoint image or column file, then the csv rows and log records
+    // that follow; nullptr when the table cannot be read
+    static Table *load_table(const string &table_name, const Catalog::TableStub &stub)
+    {
+        fs::path dir(table_dir(table_name)),
+            meta_file(meta_path(table_name));
+        const vector<Column> &columns(stub.columns);
+        map<string, string> snapshots(read_checkpoint_manifest());
+
+        Metrics::Timer timer(Metrics::TABLE_LOAD);
+        WriteQueue::instance().flush(); // an evicted table's last changes may still be queued
+        Table *t(new Table(table_name, columns, stub.pk_columns));
+
+        fs::path cols_file(dir / (table_name + ".cols"));
+        uint64_t base_epoch(fs::exists(cols_file) ? ColumnStore::read_epoch(cols_file) : 0);
+        finish_compaction(table_name, base_epoch);
+
+        // a checkpoint image stands in for the column file and the part of the csv and log it covers
+        TableSnapshot::Position restored;
+        auto snapshot(snapshots.find(table_name));
+        fs::path snap_file(snapshot == snapshots.end() ? fs::path() : dir / snapshot->second);
+        bool from_snapshot(!snap_file.empty() && restore_snapshot(t, snap_file, base_epoch, restored));
+        if (!from_snapshot && t->row_count()) // a damaged image got part of the way in
+        {
+            delete t;
+            t = new Table(table_name, columns, stub.pk_columns);
+        }
 
-            vector<Column> columns;
-            vector<string> pk_cols;
-            string line;
+        if (!from_snapshot && fs::exists(cols_file))
+        {
+            try
+            {
+                ColumnStore::read(cols_file, columns, [t](Row &&row)
+                                  {
+                    try
+                    {
+                        t->insert_row(row);
+                    }
+                    catch (const exception &e)
+                    {
+                        t->append_tombstone();
+                    } });
+            }
+            catch (const exception &e)
+            {
+                cerr << "Skipping table '" << table_name << "': " << e.what() << "\n";
+                delete t;
+                return nullptr;
+            }
+        }
 
-            while (getline(file, line))
+        fs::path csv_file(dir / (table_name + ".csv"));
+        bool stale_tail(false), reindex(false);
+        if (fs::exists(csv_file))
+        {
+            ifstream csv(csv_file);
+            if (from_snapshot)
+                csv.seekg(restored.csv_bytes);
+            else
             {
-                if (line == "columns:")
-                    continue;
+                string header;
+                getline(csv, header);
 
-                if (line.find("pk:") == 0)
+                if (base_epoch)
                 {
-                    string pk_list(line.substr(3));
-                    pk_cols = Helper::split_commas_respecting_quotes(pk_list);
-                    for (auto &pk : pk_cols)
-                        pk = Helper::trim(pk);
-                    break;
+                    string marker;
+                    getline(csv, marker);
+                    stale_tail = marker != "#base " + to_string(base_epoch);
                 }
+            }
 
-                int pos1(line.find('|')),
-                    pos2(line.find('|', pos1 + 1)),
-                    pos3(line.find('|', pos2 + 1));
-                if (pos1 != string::npos && pos2 != string::npos)
+            string data_line;
+            while (!stale_tail && getline(csv, data_line))
+            {
+                if (data_line.empty())
+                    continue;
+
+                auto values(Helper::split_commas_respecting_quotes(data_line));
+                if (values.size() != columns.size())
                 {
-                    string name(Helper::trim(line.substr(0, pos1)));
-                    string type(Helper::trim(line.substr(pos1 + 1, pos2 - pos1 - 1)));
-                    string len_str(Helper::trim(line.substr(pos2 + 1, pos3 != string::npos ? pos3 - pos2 - 1 : string::npos)));
-                    int len(stoi(len_str));
-                    if (!len)
-                        len = 1;
-
-                    bool is_nullable(true);
-                    if (pos3 != string::npos)
-                    {
-                        string null_str(Helper::trim(line.substr(pos3 + 1)));
-                        is_nullable = (null_str == "1");
-                    }
+                    t->append_tombstone();
+                    continue;
+                }
 
-                    columns.emplace_back(name, type, false, len, is_nullable);
+                // a key the log later moves off an older row may still be taken here: the row
+                // goes in without it, and the index is rebuilt once the log is replayed
+                Row row(parse_stored_row(values, columns));
+                try
+                {
+                    t->insert_row(row);
+                }
+                catch (const exception &e)
+                {
+                    t->restore_slot(row, false);
+                    reindex = true;
                 }
             }
-            file.close();
+            csv.close();
+        }
 
-            if (!columns.empty())
-            {
-                Table *t(new Table(table_name, columns, pk_cols));
+        fs::path log_file(dir / (table_name + ".log"));
+        if (stale_tail) // interrupted compaction: the column file already holds all of it
+        {
+            fs::remove(log_file);
+            reset_csv_tail(table_name, columns, base_epoch);
+        }
+        else if (fs::exists(log_file))
+            reindex = replay_log(t, log_file, restored.log_bytes) || reindex;
+        int dropped(reindex ? t->rebuild_index() : 0);
+        if (dropped)
+            cerr << "Loading '" << table_name << "': " << dropped << " row(s) left out for a duplicate primary key\n";
 
-                fs::path csv_file(entry.path() / (table_name + ".csv"));
-                if (fs::exists(csv_file))
-                {
-                    ifstream csv(csv_file);
-                    string header;
-                    getline(csv, header);
+        for (const auto &index : stub.bitmap_indexes)
+        {
+            int column(t->get_column_index(index.column));
+            if (column != NOT_FOUND)
+                t->add_bitmap_index(index.name, column, index.kind);
+        }
 
-                    string data_line;
-                    while (getline(csv, data_line))
-                    {
-                        if (data_line.empty())
-                            continue;
-
-                        auto values(Helper::split_commas_respecting_quotes(data_line));
-                        if (values.size() != columns.size())
-                            continue;
-
-                        Row row;
-                        for (int i(0); i < values.size(); ++i)
-                        {
-                            string val(Helper::trim(values[i]));
-                            string type(columns[i].get_type());
-
-                            if (val == "NULL")
-                                row.push_back(Value());
-                            else if (type == "INT")
-                                row.push_back(Value(stoi(val)));
-                            else if (type == "DOUBLE")
-                                row.push_back(Value(stod(val)));
-                            else if (type == "DATE")
-                            {
-                                int y(0), m(0), d(0);
-                                sscanf(val.c_str(), "%d-%d-%d", &y, &m, &d);
-                                row.push_back(Value(Date(y, m, d)));
-                            }
-                            else
-                                row.push_back(Value(val));
-                        }
-
-                        try
-                        {
-                            t->insert_row(row);
-                        }
-                        catch (const exception &e)
-                        {
-                            continue;
-                        }
-                    }
-                    csv.close();
-                }
+        uint64_t read(stored_bytes(meta_file) + stored_bytes(from_snapshot ? snap_file : cols_file) +
+                      stored_bytes(csv_file) - restored.csv_bytes + stored_bytes(log_file) - restored.log_bytes);
+        Metrics::add(Metrics::BYTES_READ, read);
+
+        return t;
+    }
+    // Registers every table on disk from its .meta file only; Catalog::getTable reads a table in on first use
+    static void load_existing_tables(Catalog *catalog)
+    {
+        catalog->set_loader(load_table);
+        if (!fs::exists(data_dir()) || !fs::is_directory(data_dir()))
+            return;
 
-                catalog->addTable(t);
+        for (const auto &entry : fs::directory_iterator(data_dir()))
+        {
+            if (!entry.is_directory())
+                continue;
+
+            string table_name(entry.path().filename().string()), base, definition;
+            Catalog::TableStub stub;
+            fs::path meta_file(entry.path() / (table_name + ".meta"));
+            auto scheme(make_shared<Partitioning>());
+            bool partitioned(false);
+            try
+            {
+                partitioned = read_meta(meta_file, stub) && read_partitioning(meta_file, table_name, stub.columns, *scheme);
+            }
+            catch (const exception &e)
+            {
+                cerr << "Skipping table '" << table_name << "': " << e.what() << "\n";
+                continue;
+            }
+            if (partitioned)
+            {
+                catalog->add_partitioned(table_name, scheme);
+                for (int i(0); i < scheme->names.size(); ++i)
+                {
+                    string partition(scheme->partition_table(i));
+                    Catalog::TableStub part;
+                    if (read_meta(meta_path(partition), part))
+                        catalog->add_stub(partition, move(part));
+                }
             }
+            else if (!stub.columns.empty())
+                catalog->add_stub(table_name, move(stub));
+            else if (read_view(view_path(table_name), base, definition))
+                catalog->add_view(table_name, base, definition);
         }
     }
 };
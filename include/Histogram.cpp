@@ -0,0 +1,94 @@
+#ifndef HISTOGRAM
+#define HISTOGRAM
+
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+
+using namespace std;
+
+// HDR-style log-linear latency histogram: exact below 2^SUB_BITS, then 2^(SUB_BITS-1) linear
+// sub-buckets per power of two, so every recorded value keeps ~0.4% relative precision.
+// Recording is a shift and an increment; histograms from different threads merge by addition.
+class Histogram
+{
+    static const int SUB_BITS = 8;
+    static const uint64_t SUB_COUNT = 1ull << SUB_BITS;
+    static const uint64_t HALF = SUB_COUNT / 2;
+
+    vector<uint64_t> counts;
+    uint64_t total;
+    uint64_t min_value;
+    uint64_t max_value;
+    long double sum;
+
+    static int msb(uint64_t value) { return 63 - __builtin_clzll(value | 1); }
+
+    static int index_of(uint64_t value)
+    {
+        int bits(msb(value));
+        if (bits < SUB_BITS)
+            return value;
+        int shift(bits - SUB_BITS + 1);
+        return shift * HALF + (value >> shift);
+    }
+
+    static uint64_t highest_in(int index) // largest value that lands in the bucket
+    {
+        if (index < SUB_COUNT)
+            return index;
+        int shift(index / HALF - 1);
+        uint64_t sub(index - shift * HALF);
+        return ((sub + 1) << shift) - 1;
+    }
+
+public:
+    Histogram() : total(0), min_value(UINT64_MAX), max_value(0), sum(0) {}
+
+    void record(uint64_t value)
+    {
+        if (counts.empty()) // buckets are allocated on first use, idle histograms stay small
+            counts.assign((64 - SUB_BITS + 2) * HALF, 0);
+        ++counts[index_of(value)];
+        ++total;
+        sum += value;
+        min_value = min(min_value, value);
+        max_value = max(max_value, value);
+    }
+
+    void merge(const Histogram &other)
+    {
+        if (!other.total)
+            return;
+        if (counts.empty())
+            counts.assign(other.counts.size(), 0);
+        for (int i(0); i < counts.size(); ++i)
+            counts[i] += other.counts[i];
+        total += other.total;
+        sum += other.sum;
+        min_value = min(min_value, other.min_value);
+        max_value = max(max_value, other.max_value);
+    }
+
+    uint64_t count() const { return total; }
+    uint64_t lowest() const { return total ? min_value : 0; }
+    uint64_t highest() const { return max_value; }
+    double mean() const { return total ? (double)(sum / total) : 0.0; }
+
+    uint64_t percentile(double p) const // p in [0, 100]
+    {
+        if (!total)
+            return 0;
+
+        uint64_t rank(max<uint64_t>(1, (uint64_t)(p / 100.0 * total + 0.5))), seen(0);
+        for (int i(0); i < counts.size(); ++i)
+        {
+            seen += counts[i];
+            if (seen >= rank)
+                return min(highest_in(i), max_value);
+        }
+        return max_value;
+    }
+};
+
+#endif
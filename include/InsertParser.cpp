@@ -3,11 +3,16 @@
 
 #include "models.cpp"
 #include "Helper.cpp"
+#include "QueryProfile.cpp"
+#include "Transaction.cpp"
 #include <fstream>
 
 class InsertParser
 {
     Catalog *_catalog;
+    ostream &_out;
+    QueryProfile *_profile;
+    Transaction *_transaction; // statements persist on their own unless it is open
 
     Value parse_value(const string &val_str, const Column &col)
     {
@@ -66,10 +71,14 @@ class InsertParser
     }
 
 public:
-    InsertParser(Catalog *cat) : _catalog(cat) {}
+    InsertParser(Catalog *cat, ostream &out = cout) : _catalog(cat), _out(out), _profile(nullptr), _transaction(nullptr) {}
+
+    void set_profile(QueryProfile *profile) { _profile = profile; }
+    void set_transaction(Transaction *transaction) { _transaction = transaction; }
 
     bool parse_and_insert(const string &line, AST &out_ast)
     {
+        Metrics::Timer statement_timer(Metrics::INSERT_STATEMENT);
         string s(Helper::trim(line));
         if (s.empty())
             return false;
@@ -125,20 +134,39 @@ public:
         out_ast.kind = ASTKind::INSERT;
         out_ast.node = insert_node;
 
+        if (Partitioning::is_partition(table_name))
+        {
+            _out << "\nPartition '" << table_name << "' is written through its table\n";
+            return false;
+        }
         Table *table(_catalog->getTable(table_name));
+        shared_ptr<const Partitioning> scheme(table ? nullptr : _catalog->partitioning(table_name));
+        if (scheme) // every partition has the table's columns
+            table = _catalog->getTable(scheme->partition_table(0));
         if (!table)
         {
-            cout << "\nTable '" << table_name << "' not found\n";
+            _out << "\nTable '" << table_name << "' not found\n";
             return false;
         }
 
         auto &cols(table->get_columns());
         if (values.size() > cols.size())
         {
-            cout << "\nToo many values: expected " << cols.size() << ", got " << values.size() << "\n";
+            _out << "\nToo many values: expected " << cols.size() << ", got " << values.size() << "\n";
             return false;
         }
 
+        int insert_op(NOT_FOUND), values_op(NOT_FOUND), persist_op(NOT_FOUND);
+        if (_profile)
+        {
+            insert_op = _profile->add("Insert on " + table_name, table->has_pk() ? "primary key check on hash index" : "");
+            values_op = _profile->add("Values", to_string(values.size()) + " of " + to_string(cols.size()) + " columns", 1);
+            persist_op = _profile->add("Persist", _transaction && _transaction->active() ? "deferred to COMMIT" : "append to " + table_name + ".csv");
+            if (!_profile->analyze())
+                return true;
+        }
+
+        QueryProfile::Timer values_timer(_profile, values_op);
         Row row;
         for (int i(0); i < cols.size(); ++i)
         {
@@ -150,7 +178,7 @@ public:
 
                     if (holds_alternative<NullType>(parsed_value.raw()) && !cols[i].is_null())
                     {
-                        cout << "\nColumn '" << cols[i].get_name() << "' cannot be NULL\n";
+                        _out << "\nColumn '" << cols[i].get_name() << "' cannot be NULL\n";
                         return false;
                     }
 
@@ -158,7 +186,7 @@ public:
                 }
                 catch (const invalid_argument &e)
                 {
-                    cout << "\nSyntax error: " << e.what() << "\n";
+                    _out << "\nSyntax error: " << e.what() << "\n";
                     return false;
                 }
             }
@@ -168,33 +196,70 @@ public:
                     row.push_back(Value());
                 else
                 {
-                    cout << "\nColumn '" << cols[i].get_name() << "' cannot be NULL\n";
+                    _out << "\nColumn '" << cols[i].get_name() << "' cannot be NULL\n";
                     return false;
                 }
             }
         }
 
+        values_timer.stop();
+        if (_profile)
+        {
+            _profile->rows(values_op, 1, 1);
+            _profile->stat(values_op, "bytes", QueryProfile::row_bytes(row));
+        }
+
+        if (scheme)
+        {
+            const Value &key(row[scheme->column_index]);
+            int partition(scheme->route(key));
+            table = partition == NOT_FOUND ? nullptr : _catalog->getTable(scheme->partition_table(partition));
+            if (!table)
+            {
+                _out << "\nNo partition of '" << table_name << "' takes " << scheme->column << " = " << key.to_string() << "\n";
+                return false;
+            }
+            if (_profile)
+                _profile->stat(insert_op, "partition", scheme->names[partition]);
+        }
+
+        Transaction::Write guard(_transaction, table);
+        if (!guard.acquired())
+        {
+            if (table->is_dropped())
+                _out << "\nPartition '" << table->get_name() << "' was dropped\n";
+            else
+                _out << "\nTable '" << table_name << "' is in use by another transaction\n";
+            return false;
+        }
         try
         {
+            QueryProfile::Timer timer(_profile, insert_op);
             table->insert_row(row);
         }
         catch (const exception &e)
         {
-            cout << "\nError: " << e.what() << "\n";
+            _out << "\nError: " << e.what() << "\n";
             return false;
         }
 
-        ofstream file(Helper::csv_path(table_name), ios::app);
-        for (int i(0); i < row.size(); ++i)
+        uint64_t appended_before(WriteQueue::bytes_appended());
+        if (!guard.deferred())
+        {
+            QueryProfile::Timer timer(_profile, persist_op);
+            Helper::append_csv_row(table->get_name(), row);
+        }
+
+        if (_profile)
         {
-            file << row.at(i).to_string();
-            if (i + 1 < row.size())
-                file << ",";
+            _profile->rows(insert_op, 1, 1);
+            _profile->stat(insert_op, "table_rows", table->row_count());
+            _profile->rows(persist_op, 1, 1);
+            _profile->stat(persist_op, "bytes_written", WriteQueue::bytes_appended() - appended_before);
         }
-        file << "\n";
-        file.close();
 
-        cout << "\n1 row inserted\n";
+        Metrics::add(Metrics::ROWS_INSERTED);
+        _out << "\n1 row inserted\n";
         return true;
     }
 };
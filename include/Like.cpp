@@ -0,0 +1,203 @@
+#ifndef LIKE_PATTERN
+#define LIKE_PATTERN
+
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdint>
+#include <algorithm>
+
+using namespace std;
+
+// Trigrams of a text: its windows of three bytes, folded to lower case. The text is framed by two
+// START bytes before it and one END byte after, so its first characters and its end have
+// trigrams of their own and a prefix or suffix can be looked up as well as a substring
+struct Trigrams
+{
+    static const char START = '\1', END = '\2';
+
+    static char fold(char c) { return c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c; }
+
+    // Appends the trigrams of `run`, framed at the start and the end as asked; a run too short
+    // for a window adds none
+    static void of_run(const string &run, bool at_start, bool at_end, vector<uint32_t> &out)
+    {
+        string framed;
+        if (at_start)
+            framed.append(2, START);
+        for (char c : run)
+            framed += fold(c);
+        if (at_end)
+            framed += END;
+        for (size_t i(0); i + 3 <= framed.size(); ++i)
+            out.push_back((uint32_t)(uint8_t)framed[i] << 16 | (uint32_t)(uint8_t)framed[i + 1] << 8 | (uint8_t)framed[i + 2]);
+    }
+
+    // The distinct trigrams of a whole text, ascending
+    static vector<uint32_t> of(const string &text)
+    {
+        vector<uint32_t> out;
+        of_run(text, true, true, out);
+        sort(out.begin(), out.end());
+        out.erase(unique(out.begin(), out.end()), out.end());
+        return out;
+    }
+};
+
+// A LIKE pattern compiled once: `%` matches any run of characters, `_` any one character, and `\`
+// makes the next character literal. The pattern is cut at each `%` into pieces of fixed length; a
+// text matches when the first piece starts it, the last ends it and the others occur in between
+// in order, each found leftmost. A plain piece is found with memmem, one holding `_` by memchr on
+// one of its literal characters. ILIKE folds ASCII case on both sides
+class LikePattern
+{
+    struct Piece
+    {
+        string chars;
+        vector<bool> any; // the positions of `_`, empty when there are none
+        int literal = -1; // a position that is not `_`, -1 when all are
+
+        bool at(const char *s) const
+        {
+            if (any.empty())
+                return !memcmp(s, chars.data(), chars.size());
+            for (size_t i(0); i < chars.size(); ++i)
+            {
+                if (!any[i] && s[i] != chars[i])
+                    return false;
+            }
+            return true;
+        }
+
+        // Where the piece first occurs in s[from, to), or string::npos
+        size_t find(const char *s, size_t from, size_t to) const
+        {
+            if (to < from || to - from < chars.size())
+                return string::npos;
+            if (chars.empty() || literal < 0)
+                return from;
+            size_t last(to - chars.size()); // the last start that fits
+            if (any.empty())
+            {
+                const void *hit(memmem(s + from, to - from, chars.data(), chars.size()));
+                return hit ? (const char *)hit - s : string::npos;
+            }
+            for (size_t start(from); start <= last;)
+            {
+                const void *hit(memchr(s + start + literal, chars[literal], last - start + 1));
+                if (!hit)
+                    return string::npos;
+                start = (const char *)hit - s - literal;
+                if (at(s + start))
+                    return start;
+                ++start;
+            }
+            return string::npos;
+        }
+    };
+
+    vector<Piece> pieces; // one more than the pattern has `%`
+    bool fold = false;
+    size_t anchored = 0; // characters of the first and last pieces, the least a match is long
+
+public:
+    LikePattern() : pieces(1) {}
+    LikePattern(const string &pattern, bool ignore_case) : pieces(1), fold(ignore_case)
+    {
+        for (size_t i(0); i < pattern.size(); ++i)
+        {
+            char c(pattern[i]);
+            if (c == '%')
+            {
+                pieces.emplace_back();
+                continue;
+            }
+            Piece &p(pieces.back());
+            bool wild(c == '_');
+            if (c == '\\' && i + 1 < pattern.size())
+                c = pattern[++i];
+            p.any.push_back(wild);
+            p.chars += fold ? Trigrams::fold(c) : c;
+        }
+        for (auto &p : pieces)
+        {
+            if (find(p.any.begin(), p.any.end(), true) == p.any.end())
+                p.any.clear();
+            for (size_t i(0); i < p.chars.size() && p.literal < 0; ++i)
+            {
+                if (p.any.empty() || !p.any[i])
+                    p.literal = i;
+            }
+        }
+        anchored = pieces.front().chars.size() + (pieces.size() > 1 ? pieces.back().chars.size() : 0);
+    }
+
+    bool ignores_case() const { return fold; }
+
+    bool matches(const char *s, size_t n) const
+    {
+        if (fold)
+        {
+            static thread_local string lowered;
+            lowered.assign(s, n);
+            for (char &c : lowered)
+                c = Trigrams::fold(c);
+            s = lowered.data();
+        }
+        const Piece &first(pieces.front()), &last(pieces.back());
+        if (pieces.size() == 1)
+            return n == first.chars.size() && first.at(s);
+        if (n < anchored || !first.at(s) || !last.at(s + n - last.chars.size()))
+            return false;
+        size_t pos(first.chars.size()), end(n - last.chars.size());
+        for (size_t i(1); i + 1 < pieces.size(); ++i)
+        {
+            size_t at(pieces[i].find(s, pos, end));
+            if (at == string::npos)
+                return false;
+            pos = at + pieces[i].chars.size();
+        }
+        return true;
+    }
+    bool matches(const string &s) const { return matches(s.data(), s.size()); }
+
+    // The characters every match starts with, up to the first wildcard; with `exact` set when
+    // the pattern has none, so only that text matches
+    string prefix(bool &exact) const
+    {
+        const Piece &first(pieces.front());
+        size_t n(first.any.empty() ? first.chars.size() : find(first.any.begin(), first.any.end(), true) - first.any.begin());
+        exact = pieces.size() == 1 && n == first.chars.size();
+        return first.chars.substr(0, n);
+    }
+
+    // The trigrams every match holds (Trigrams), from the pattern's runs of literal characters;
+    // none when no run is long enough to tell
+    vector<uint32_t> trigrams() const
+    {
+        vector<uint32_t> out;
+        for (size_t i(0); i < pieces.size(); ++i)
+        {
+            const Piece &p(pieces[i]);
+            string run;
+            bool run_at_start(i == 0);
+            for (size_t j(0); j <= p.chars.size(); ++j)
+            {
+                if (j < p.chars.size() && (p.any.empty() || !p.any[j]))
+                {
+                    run += p.chars[j];
+                    continue;
+                }
+                bool run_at_end(i + 1 == pieces.size() && j == p.chars.size());
+                Trigrams::of_run(run, run_at_start, run_at_end, out);
+                run.clear();
+                run_at_start = false;
+            }
+        }
+        sort(out.begin(), out.end());
+        out.erase(unique(out.begin(), out.end()), out.end());
+        return out;
+    }
+};
+
+#endif
@@ -0,0 +1,250 @@
+#ifndef MATERIALIZED_VIEW
+#define MATERIALIZED_VIEW
+
+#include "models.cpp"
+#include "Helper.cpp"
+#include "Aggregate.cpp"
+
+// Result of `SELECT ... FROM base GROUP BY ...` kept up to date as the base table changes. Every
+// group holds a retractable state per aggregate: an inserted row is added to its group, a deleted
+// one taken back out, an updated one both, so reading the view costs O(groups) however large the
+// base is. After a restart the state is rebuilt by one scan of the base on the view's first read.
+class MaterializedView : public Table::Listener
+{
+    struct Output
+    {
+        bool aggregate;
+        int index; // position in the group key, or aggregate slot
+    };
+    struct Group
+    {
+        uint64_t rows = 0;
+        vector<AggregateState> states;
+    };
+
+    Text name;
+    vector<Text> column_names;
+    vector<Output> outputs;
+    vector<AggregateSpec> specs;
+    GroupTable<Group> groups;
+    mutable mutex view_mutex; // innermost: writers reach it under the base table's latch
+
+    void add(const Row &row)
+    {
+        Group &g(groups.find_or_add(row, [&]
+                                    {
+            Group made;
+            made.states.reserve(specs.size());
+            for (const auto &spec : specs)
+                made.states.emplace_back(spec, true);
+            return made; }));
+        ++g.rows;
+        for (auto &state : g.states)
+            state.add(row);
+    }
+
+    void remove(const Row &row)
+    {
+        auto it(groups.find(row));
+        if (it == groups.end())
+            return;
+        Group &g(it->second.group);
+        if (!--g.rows)
+        {
+            groups.erase(it);
+            return;
+        }
+        for (auto &state : g.states)
+            state.remove(row);
+    }
+
+    MaterializedView(const Text &view_name, vector<int> group_cols, vector<ValueOps> key_ops)
+        : name(view_name), groups(move(group_cols), move(key_ops)) {}
+
+public:
+    // Splits a definition into its parts; false with a message when it is not a plain GROUP BY query
+    static bool parse_definition(const string &definition, vector<string> &items, Text &base, vector<string> &group_by, string &error)
+    {
+        string s(Helper::trim(definition));
+        if (!s.empty() && s.back() == ';')
+            s.pop_back();
+        string lower(Helper::to_lower(s));
+        int from_pos(lower.find(" from ")), group_pos(lower.find(" group by "));
+        if (lower.find("select ") != 0 || from_pos == string::npos)
+        {
+            error = "A materialized view is defined by SELECT ... FROM table GROUP BY ...";
+            return false;
+        }
+        if (group_pos == string::npos || group_pos < from_pos)
+        {
+            error = "A materialized view needs a GROUP BY";
+            return false;
+        }
+        for (const char *clause : {" where ", " having ", " order by "})
+        {
+            if (lower.find(clause) != string::npos)
+            {
+                error = "A materialized view supports only SELECT, FROM and GROUP BY";
+                return false;
+            }
+        }
+
+        items = Helper::split_commas_respecting_quotes(s.substr(7, from_pos - 7));
+        base = Helper::trim(s.substr(from_pos + 6, group_pos - from_pos - 6));
+        group_by = Helper::split_commas_respecting_quotes(s.substr(group_pos + 10));
+        for (auto &item : items)
+            item = Helper::trim(item);
+        for (auto &col : group_by)
+            col = Helper::trim(col);
+        if (base.empty() || base.find(' ') != string::npos || items.empty() || group_by.empty())
+        {
+            error = "A materialized view is defined by SELECT ... FROM table GROUP BY ...";
+            return false;
+        }
+        return true;
+    }
+
+    // An empty view over `base`; false with a message when the definition does not fit the table
+    static bool compile(const Text &name, const string &definition, const Table *base, unique_ptr<MaterializedView> &view, string &error)
+    {
+        vector<string> items, group_by;
+        Text base_name;
+        if (!parse_definition(definition, items, base_name, group_by, error))
+            return false;
+
+        vector<int> group_cols;
+        vector<ValueOps> key_ops;
+        for (const auto &col : group_by)
+        {
+            int idx(base->get_column_index(col));
+            if (idx == NOT_FOUND)
+            {
+                error = "Column '" + col + "' not found in GROUP BY";
+                return false;
+            }
+            group_cols.push_back(idx);
+            key_ops.push_back(ValueOps::for_column(base->get_column(idx)));
+        }
+        unique_ptr<MaterializedView> v(new MaterializedView(name, group_cols, key_ops));
+
+        for (const auto &item : items)
+        {
+            if (AggregateSpec::is_aggregate(item))
+            {
+                AggregateSpec spec;
+                if (!AggregateSpec::parse(item, base, spec, error))
+                    return false;
+                if (!spec.retractable())
+                {
+                    error = "'" + item + "' cannot be maintained incrementally";
+                    return false;
+                }
+                v->outputs.push_back({true, (int)v->specs.size()});
+                v->specs.push_back(spec);
+            }
+            else
+            {
+                int idx(base->get_column_index(item));
+                auto pos(find(group_cols.begin(), group_cols.end(), idx));
+                if (idx == NOT_FOUND || pos == group_cols.end())
+                {
+                    error = "Column '" + item + "' must be in the GROUP BY of a materialized view";
+                    return false;
+                }
+                v->outputs.push_back({false, (int)(pos - group_cols.begin())});
+            }
+            v->column_names.push_back(item);
+        }
+        view = move(v);
+        return true;
+    }
+
+    // The view's maintained state, built on its first use; nullptr when `name` is no view, or
+    // with a message in `error` when the view cannot be built
+    static MaterializedView *open(Catalog *catalog, const Text &name, string &error)
+    {
+        static mutex build_mutex; // one build at a time, so a view is never built twice
+        Text base, definition;
+        Table::Listener *state(nullptr);
+        if (!catalog->get_view(name, base, definition, state))
+            return nullptr;
+        if (state)
+            return static_cast<MaterializedView *>(state);
+
+        lock_guard<mutex> building(build_mutex);
+        catalog->get_view(name, base, definition, state);
+        if (state) // built while this thread waited
+            return static_cast<MaterializedView *>(state);
+
+        Table *table(catalog->getTable(base));
+        if (!table)
+        {
+            error = "Base table '" + base + "' of view '" + name + "' not found";
+            return nullptr;
+        }
+        unique_ptr<MaterializedView> view;
+        if (!compile(name, definition, table, view, error))
+            return nullptr;
+
+        {
+            // no statement writes the base between the scan and the listener taking over
+            shared_lock<shared_mutex> statement(table->get_statement_lock());
+            lock_guard<mutex> writer(table->get_mutex());
+            table->for_each_live([&](int, const Row &row)
+                                 { view->add(row); });
+            table->add_listener(view.get());
+        }
+        MaterializedView *built(view.get());
+        catalog->set_view_state(name, move(view));
+        return built;
+    }
+
+    void row_changed(const Row *before, const Row *after) override
+    {
+        lock_guard<mutex> guard(view_mutex);
+        if (before)
+            remove(*before);
+        if (after)
+            add(*after);
+    }
+
+    const vector<Text> &columns() const { return column_names; }
+
+    size_t group_count() const
+    {
+        lock_guard<mutex> guard(view_mutex);
+        return groups.size();
+    }
+
+    // One row per group, in the view's column order
+    vector<Row> rows()
+    {
+        lock_guard<mutex> guard(view_mutex);
+        vector<Row> result;
+        result.reserve(groups.size());
+        for (auto &entry : groups)
+        {
+            Group &g(entry.second.group);
+            Row row;
+            for (const auto &out : outputs)
+                row.push_back(out.aggregate ? g.states[out.index].result() : entry.second.keys[out.index]);
+            result.push_back(move(row));
+        }
+        return result;
+    }
+
+    size_t bytes() const
+    {
+        lock_guard<mutex> guard(view_mutex);
+        size_t total(sizeof(*this) + groups.bucket_count() * sizeof(void *));
+        for (const auto &entry : groups)
+        {
+            total += sizeof(entry) + entry.second.keys.size() * sizeof(Value);
+            for (const auto &state : entry.second.group.states)
+                total += state.bytes();
+        }
+        return total;
+    }
+};
+
+#endif
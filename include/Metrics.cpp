@@ -0,0 +1,325 @@
+#ifndef METRICS
+#define METRICS
+
+#include "Histogram.cpp"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <string>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <condition_variable>
+#include <filesystem>
+
+using namespace std;
+
+// Engine-wide counters and latency histograms. Every thread records into its own shard, so the hot
+// path is a relaxed atomic add (counters) or an uncontended lock (histograms); readers merge shards.
+class Metrics
+{
+public:
+    enum Counter
+    {
+        STATEMENT_ERRORS,
+        ROWS_SCANNED,
+        ROWS_RETURNED,
+        ROWS_INSERTED,
+        ROWS_UPDATED,
+        ROWS_DELETED,
+        PK_LOOKUPS,
+        BYTES_WRITTEN,
+        BYTES_READ,
+        FILE_WRITES,
+        COMPACTIONS,
+        CHECKPOINTS,
+        BUFFER_HITS,
+        BUFFER_MISSES,
+        BUFFER_EVICTIONS,
+        BUFFER_WRITEBACKS,
+        SORT_SPILLED_RUNS,
+        SORT_SPILLED_BYTES,
+        TRANSACTIONS_COMMITTED,
+        TRANSACTIONS_ROLLED_BACK,
+        WRITE_BATCHES,
+        COUNTER_COUNT
+    };
+
+    enum Latency
+    {
+        CREATE_STATEMENT,
+        INSERT_STATEMENT,
+        SELECT_STATEMENT,
+        UPDATE_STATEMENT,
+        DELETE_STATEMENT,
+        CSV_APPEND,
+        LOG_APPEND,
+        TABLE_REWRITE,
+        TABLE_LOAD,
+        CHECKPOINT_WRITE,
+        COMMIT,
+        WRITE_BATCH,
+        LATENCY_COUNT
+    };
+
+    // Times its scope into one latency series
+    class Timer
+    {
+        Latency series;
+        chrono::steady_clock::time_point start;
+
+    public:
+        Timer(Latency l) : series(l), start(chrono::steady_clock::now()) {}
+        ~Timer() { record(series, chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count()); }
+        Timer(const Timer &) = delete;
+        Timer &operator=(const Timer &) = delete;
+    };
+
+    struct Snapshot
+    {
+        uint64_t counters[COUNTER_COUNT] = {};
+        Histogram latencies[LATENCY_COUNT];
+    };
+
+private:
+    struct Shard
+    {
+        atomic<uint64_t> counters[COUNTER_COUNT] = {};
+        mutex histogram_mutex; // only contended while a reader merges
+        Histogram latencies[LATENCY_COUNT];
+    };
+
+    // Owns the calling thread's shard and folds it into the retired totals when the thread exits
+    struct LocalShard
+    {
+        Shard *shard;
+        LocalShard();
+        ~LocalShard();
+    };
+
+    mutex _registry_mutex;
+    vector<unique_ptr<Shard>> _shards;
+    Snapshot _retired;
+
+    static Metrics &registry()
+    {
+        static Metrics instance;
+        return instance;
+    }
+
+    static Shard &local()
+    {
+        thread_local LocalShard holder;
+        return *holder.shard;
+    }
+
+    static void fold(const Shard &shard, Snapshot &into)
+    {
+        for (int i(0); i < COUNTER_COUNT; ++i)
+            into.counters[i] += shard.counters[i].load(memory_order_relaxed);
+        for (int i(0); i < LATENCY_COUNT; ++i)
+            into.latencies[i].merge(shard.latencies[i]);
+    }
+
+public:
+    static const char *counter_name(int c)
+    {
+        static const char *names[COUNTER_COUNT] = {
+            "statement_errors", "rows_scanned", "rows_returned", "rows_inserted", "rows_updated",
+            "rows_deleted", "pk_lookups", "bytes_written", "bytes_read", "file_writes", "compactions",
+            "checkpoints", "buffer_hits", "buffer_misses", "buffer_evictions", "buffer_writebacks",
+            "sort_spilled_runs", "sort_spilled_bytes", "transactions_committed", "transactions_rolled_back",
+            "write_batches"};
+        return names[c];
+    }
+
+    static const char *latency_name(int l)
+    {
+        static const char *names[LATENCY_COUNT] = {
+            "create", "insert", "select", "update", "delete",
+            "csv_append", "log_append", "table_rewrite", "table_load", "checkpoint", "commit", "write_batch"};
+        return names[l];
+    }
+
+    static void add(Counter c, uint64_t n = 1)
+    {
+        atomic<uint64_t> &slot(local().counters[c]);
+        slot.store(slot.load(memory_order_relaxed) + n, memory_order_relaxed); // single writer per shard
+    }
+
+    static void record(Latency l, uint64_t nanos)
+    {
+        Shard &shard(local());
+        lock_guard<mutex> lock(shard.histogram_mutex);
+        shard.latencies[l].record(nanos);
+    }
+
+    static Snapshot snapshot()
+    {
+        Metrics &m(registry());
+        Snapshot snap;
+        lock_guard<mutex> lock(m._registry_mutex);
+        fold_retired(m, snap);
+        for (const auto &shard : m._shards)
+        {
+            lock_guard<mutex> shard_lock(shard->histogram_mutex);
+            fold(*shard, snap);
+        }
+        return snap;
+    }
+
+    // SHOW STATS output, in the same `a | b` layout as query results
+    static void write_table(ostream &out)
+    {
+        Snapshot snap(snapshot());
+        ios::fmtflags flags(out.flags());
+        streamsize precision(out.precision());
+
+        out << "\nmetric | value\n";
+        for (int i(0); i < COUNTER_COUNT; ++i)
+            out << counter_name(i) << " | " << snap.counters[i] << "\n";
+
+        out << "\nlatency | count | mean_us | p50_us | p99_us | p999_us | max_us\n" << fixed << setprecision(1);
+        for (int i(0); i < LATENCY_COUNT; ++i)
+        {
+            const Histogram &h(snap.latencies[i]);
+            out << latency_name(i) << " | " << h.count() << " | " << h.mean() / 1000.0
+                << " | " << h.percentile(50) / 1000.0 << " | " << h.percentile(99) / 1000.0
+                << " | " << h.percentile(99.9) / 1000.0 << " | " << h.highest() / 1000.0 << "\n";
+        }
+
+        out.flags(flags);
+        out.precision(precision);
+    }
+
+    // Prometheus text exposition format; latencies are summaries in seconds
+    static void write_prometheus(ostream &out)
+    {
+        Snapshot snap(snapshot());
+        out << setprecision(9);
+
+        for (int i(0); i < COUNTER_COUNT; ++i)
+        {
+            out << "# TYPE minidb_" << counter_name(i) << "_total counter\n"
+                << "minidb_" << counter_name(i) << "_total " << snap.counters[i] << "\n";
+        }
+
+        const char *groups[2] = {"minidb_statement_duration_seconds", "minidb_io_duration_seconds"};
+        for (int g(0); g < 2; ++g)
+        {
+            out << "# TYPE " << groups[g] << " summary\n";
+            for (int i(g ? CSV_APPEND : 0); i < (g ? LATENCY_COUNT : CSV_APPEND); ++i)
+            {
+                const Histogram &h(snap.latencies[i]);
+                string label(string(g ? "{op=\"" : "{statement=\"") + latency_name(i) + "\"");
+                for (double q : {0.5, 0.99, 0.999})
+                    out << groups[g] << label << ",quantile=\"" << q << "\"} " << h.percentile(q * 100) / 1e9 << "\n";
+                out << groups[g] << "_sum" << label << "} " << h.mean() * h.count() / 1e9 << "\n"
+                    << groups[g] << "_count" << label << "} " << h.count() << "\n";
+            }
+        }
+    }
+
+private:
+    static void fold_retired(Metrics &m, Snapshot &snap)
+    {
+        for (int i(0); i < COUNTER_COUNT; ++i)
+            snap.counters[i] += m._retired.counters[i];
+        for (int i(0); i < LATENCY_COUNT; ++i)
+            snap.latencies[i].merge(m._retired.latencies[i]);
+    }
+};
+
+inline Metrics::LocalShard::LocalShard()
+{
+    Metrics &m(registry());
+    lock_guard<mutex> lock(m._registry_mutex);
+    m._shards.push_back(make_unique<Shard>());
+    shard = m._shards.back().get();
+}
+
+inline Metrics::LocalShard::~LocalShard()
+{
+    Metrics &m(registry());
+    lock_guard<mutex> lock(m._registry_mutex);
+    fold(*shard, m._retired);
+    for (int i(0); i < m._shards.size(); ++i)
+    {
+        if (m._shards[i].get() == shard)
+        {
+            m._shards.erase(m._shards.begin() + i);
+            break;
+        }
+    }
+}
+
+// Rewrites a Prometheus text file every interval (tmp + rename, so scrapers never see half a file)
+class MetricsExporter
+{
+    filesystem::path _path;
+    chrono::milliseconds _interval;
+    atomic<bool> _running;
+    mutex _wait_mutex;
+    condition_variable _wake;
+    thread _worker;
+
+    void run()
+    {
+        while (_running)
+        {
+            {
+                unique_lock<mutex> lock(_wait_mutex);
+                _wake.wait_for(lock, _interval, [this]
+                               { return !_running; });
+            }
+            write_now();
+        }
+    }
+
+public:
+    MetricsExporter(const filesystem::path &path, chrono::milliseconds interval = chrono::seconds(10))
+        : _path(path), _interval(interval), _running(false) {}
+
+    ~MetricsExporter() { stop(); }
+
+    void start()
+    {
+        if (_running)
+            return;
+        _running = true;
+        _worker = thread(&MetricsExporter::run, this);
+    }
+
+    void stop() // writes a final file on the way out
+    {
+        if (!_running)
+            return;
+        {
+            lock_guard<mutex> lock(_wait_mutex);
+            _running = false;
+        }
+        _wake.notify_all();
+        if (_worker.joinable())
+            _worker.join();
+    }
+
+    void write_now()
+    {
+        error_code ec;
+        filesystem::create_directories(_path.parent_path(), ec);
+
+        filesystem::path tmp(_path.string() + ".tmp");
+        {
+            ofstream file(tmp, ios::trunc);
+            if (!file.is_open())
+                return;
+            Metrics::write_prometheus(file);
+        }
+        filesystem::rename(tmp, _path, ec);
+    }
+};
+
+#endif
@@ -0,0 +1,1145 @@
+#ifndef OPERATORS
+#define OPERATORS
+
+#include "models.cpp"
+#include "Helper.cpp"
+#include "QueryProfile.cpp"
+#include "ExternalSort.cpp"
+#include "Aggregate.cpp"
+#include <numeric>
+#include <functional>
+#include <thread>
+#include <exception>
+
+// Physical operators a SELECT runs as. A plan is a chain from a source (a table or view scan)
+// through filter, project, aggregate, sort and limit to a sink. Batches of up to Batch::CAPACITY
+// rows are pushed down the chain, so an operator runs one tight loop per batch rather than being
+// called per row; aggregate and sort hold their input and emit batches of their own once it ends.
+
+// Rows moving between operators. A scan hands out rows where they lie, valid only while the
+// batch is pushed; `sel` lists the positions still selected and `cols`, when set, maps the
+// batch's columns onto the rows' own, so neither filtering nor projecting copies a value
+struct Batch
+{
+    static const int CAPACITY = Table::SCAN_BATCH;
+
+    vector<const Row *> rows;
+    vector<int> sel;
+    const vector<int> *cols = nullptr;
+    uint64_t origin = 0; // scan position of rows[0]; rows[i] is at origin + i, for scan order across batches
+
+    const Value &at(int pos, int col) const { return (*rows[pos])[cols ? (*cols)[col] : col]; }
+    void select_all()
+    {
+        sel.resize(rows.size());
+        iota(sel.begin(), sel.end(), 0);
+    }
+};
+
+// `lhs op rhs` as written in WHERE and HAVING
+struct Comparison
+{
+    enum Op
+    {
+        NONE,
+        EQ,
+        NE,
+        GT,
+        LT,
+        GE,
+        LE,
+        LIKE,
+        ILIKE
+    };
+
+    // Splits at LIKE or ILIKE, else at the first operator found, two-character ones tried first;
+    // NONE when there is none
+    static Op split(const string &cond, string &lhs, string &rhs)
+    {
+        for (Op op : {LIKE, ILIKE})
+        {
+            string word(op == LIKE ? "like" : "ilike");
+            size_t pos(Helper::find_word(cond, word));
+            if (pos != string::npos)
+            {
+                lhs = Helper::trim(cond.substr(0, pos));
+                rhs = Helper::trim(cond.substr(pos + word.size()));
+                return op;
+            }
+        }
+        static const vector<pair<string, Op>> ops = {{">=", GE}, {"<=", LE}, {"!=", NE}, {"=", EQ}, {">", GT}, {"<", LT}};
+        for (const auto &o : ops)
+        {
+            size_t pos(cond.find(o.first));
+            if (pos != string::npos)
+            {
+                lhs = Helper::trim(cond.substr(0, pos));
+                rhs = Helper::trim(cond.substr(pos + o.first.size()));
+                return o.second;
+            }
+        }
+        return NONE;
+    }
+
+    static const char *symbol(Op op)
+    {
+        static const char *symbols[] = {"", "=", "!=", ">", "<", ">=", "<=", "LIKE", "ILIKE"};
+        return symbols[op];
+    }
+
+    static string unquote(const string &val)
+    {
+        if (!val.empty() && (val.front() == '\'' || val.front() == '"'))
+            return val.substr(1, val.size() - 2);
+        return val;
+    }
+
+    // The right side of a condition on `col`, a value of the column's type
+    static Value literal(const Column &col, string val)
+    {
+        val = unquote(val);
+        if (val == "NULL")
+            return Value();
+        const string &type(col.get_type());
+        if (type == "INT")
+            return Value(atoi(val.c_str()));
+        if (type == "DOUBLE")
+            return Value(atof(val.c_str()));
+        if (type == "DATE")
+        {
+            int y(0), m(0), d(0);
+            sscanf(val.c_str(), "%d-%d-%d", &y, &m, &d);
+            return Value(Date(y, m, d));
+        }
+        return Value(val);
+    }
+
+    static bool is_like(Op op) { return op == LIKE || op == ILIKE; }
+
+    // Whether a three-way result (Value::compare) satisfies the operator; values that do not
+    // compare are only ever unequal. LIKE and ILIKE match a pattern instead (LikePattern)
+    static bool holds(Op op, int c)
+    {
+        switch (op)
+        {
+        case EQ:
+            return c == 0;
+        case NE:
+            return c != 0;
+        case GT:
+            return c > 0 && c != Value::UNORDERED;
+        case LT:
+            return c < 0;
+        case GE:
+            return c == 0 || (c > 0 && c != Value::UNORDERED);
+        case LE:
+            return c <= 0;
+        default:
+            return true;
+        }
+    }
+};
+
+// A WHERE condition: comparisons joined by AND and OR and negated by NOT, grouped by parentheses.
+// NOT binds tightest, then AND, then OR. A comparison without an operator holds for every row
+struct Predicate
+{
+    enum Kind
+    {
+        LEAF,
+        AND,
+        OR,
+        NOT
+    };
+    Kind kind = LEAF;
+    string condition; // LEAF: the comparison as written
+    vector<Predicate> children;
+
+    // Whether `s` starts with the keyword `word` (lower case), followed by a space or parenthesis
+    static bool starts_with_word(const string &s, const string &word)
+    {
+        return s.size() > word.size() && Helper::to_lower(s.substr(0, word.size())) == word &&
+               (isspace(s[word.size()]) || s[word.size()] == '(');
+    }
+
+    // Splits at the keyword `word` (lower case) wherever it stands outside quotes and parentheses
+    static vector<string> split_at(const string &s, const string &word)
+    {
+        vector<string> parts;
+        int depth(0), from(0);
+        char quote(0);
+        for (int i(0); i < s.size(); ++i)
+        {
+            char c(s[i]);
+            if (quote)
+                quote = c == quote ? 0 : quote;
+            else if (c == '\'' || c == '"')
+                quote = c;
+            else if (c == '(')
+                ++depth;
+            else if (c == ')')
+                --depth;
+            else if (!depth && i && (isspace(s[i - 1]) || s[i - 1] == ')') && starts_with_word(s.substr(i), word))
+            {
+                parts.push_back(s.substr(from, i - from));
+                from = i + word.size();
+                i = from - 1;
+            }
+        }
+        parts.push_back(s.substr(from));
+        return parts;
+    }
+
+    static Predicate parse(const string &text)
+    {
+        string s(Helper::trim(text));
+        Predicate p;
+        for (Kind joined : {OR, AND})
+        {
+            vector<string> parts(split_at(s, joined == OR ? "or" : "and"));
+            if (parts.size() < 2)
+                continue;
+            p.kind = joined;
+            for (const auto &part : parts)
+                p.children.push_back(parse(part));
+            return p;
+        }
+        if (starts_with_word(s, "not"))
+        {
+            p.kind = NOT;
+            p.children.push_back(parse(s.substr(3)));
+            return p;
+        }
+        auto parens(Helper::find_top_level_parens(s));
+        if (parens.first == 0 && parens.second == s.size() - 1)
+            return parse(s.substr(1, s.size() - 2));
+        size_t negated(Helper::find_word(s, "not")); // col NOT LIKE pattern
+        if (negated != string::npos && (Helper::find_word(s, "like") != string::npos || Helper::find_word(s, "ilike") != string::npos))
+        {
+            p.kind = NOT;
+            p.children.push_back(parse(s.substr(0, negated) + s.substr(negated + 4)));
+            return p;
+        }
+        p.condition = s;
+        return p;
+    }
+};
+
+// A Predicate resolved against a table: each comparison's column and its literal, typed, or for
+// LIKE and ILIKE its pattern, compiled
+struct BoundPredicate
+{
+    Predicate::Kind kind = Predicate::LEAF;
+    Comparison::Op cmp = Comparison::NONE;
+    int column = NOT_FOUND; // an unknown column holds for no row
+    Value literal;
+    ValueOps ops; // of the column's type
+    LikePattern like;
+    vector<BoundPredicate> children;
+
+    BoundPredicate(const Predicate &p, const Table *table) : kind(p.kind)
+    {
+        for (const auto &child : p.children)
+            children.emplace_back(child, table);
+        if (kind != Predicate::LEAF)
+            return;
+
+        string col, val;
+        cmp = Comparison::split(p.condition, col, val);
+        if (cmp == Comparison::NONE)
+            return;
+        column = table->get_column_index(col);
+        if (column == NOT_FOUND)
+            return;
+        ops = ValueOps::for_column(table->get_column(column));
+        if (Comparison::is_like(cmp))
+            like = LikePattern(Comparison::unquote(val), cmp == Comparison::ILIKE);
+        else
+            literal = Comparison::literal(table->get_column(column), val);
+    }
+
+    // Whether the comparison holds for a value of its column
+    bool holds(const Value &v) const
+    {
+        return Comparison::is_like(cmp) ? matches_like(like, v) : Comparison::holds(cmp, ops.compare(v, literal));
+    }
+
+    bool holds(const Batch &batch, int pos) const
+    {
+        switch (kind)
+        {
+        case Predicate::LEAF:
+            return cmp == Comparison::NONE || (column != NOT_FOUND && holds(batch.at(pos, column)));
+        case Predicate::AND:
+            for (const auto &child : children)
+            {
+                if (!child.holds(batch, pos))
+                    return false;
+            }
+            return true;
+        case Predicate::OR:
+            for (const auto &child : children)
+            {
+                if (child.holds(batch, pos))
+                    return true;
+            }
+            return false;
+        default:
+            return !children[0].holds(batch, pos);
+        }
+    }
+};
+
+// The rows a BoundPredicate may hold for, from a table's bitmap indexes alone: a comparison on an
+// indexed column unites the bitmaps of the values it holds for, AND intersects, OR unites and NOT
+// takes the complement among the live rows. A LIKE, ILIKE or = on a column with a trigram index
+// instead takes the rows holding every trigram the pattern or text has. A comparison on a column
+// without either leaves any row possible; the rows are then a superset the Filter still narrows,
+// as they are from trigrams. The caller holds the table's latch through
+// Table::read_bitmap_indexes, or its writer lock
+struct BitmapMatch
+{
+    Bitmap rows;
+    bool all = true;   // nothing narrowed the rows down, and `rows` is unset
+    bool exact = true; // the rows are exactly those the condition holds for
+
+    // Without `evaluate` only `all` and `exact` are worked out, and the indexes used named, to plan
+    static BitmapMatch of(const BoundPredicate &c, const Table &table, bool evaluate, vector<Text> *used = nullptr)
+    {
+        BitmapMatch m;
+        switch (c.kind)
+        {
+        case Predicate::LEAF:
+        {
+            if (c.cmp == Comparison::NONE)
+                return m;
+            m.all = false;
+            const BitmapIndex *index(c.column == NOT_FOUND ? nullptr : table.bitmap_index(c.column));
+            const BitmapIndex *trigrams(c.column == NOT_FOUND || index ? nullptr : table.bitmap_index(c.column, BitmapIndex::TRIGRAMS));
+            vector<uint32_t> grams;
+            if (trigrams)
+                grams = trigrams_of(c);
+            if (c.column != NOT_FOUND && !index && grams.empty())
+            {
+                m.all = true;
+                m.exact = false;
+                return m;
+            }
+            if (trigrams)
+            {
+                index = trigrams;
+                m.exact = false;
+            }
+            if (index && used && find(used->begin(), used->end(), index->name()) == used->end())
+                used->push_back(index->name());
+            if (index && evaluate)
+                m.rows = trigrams ? index->rows_with(grams) : leaf_rows(c, *index, table);
+            return m;
+        }
+        case Predicate::AND:
+            for (const auto &child : c.children)
+            {
+                BitmapMatch part(of(child, table, evaluate, used));
+                m.exact = m.exact && part.exact;
+                if (part.all)
+                    continue;
+                if (evaluate)
+                    m.rows = m.all ? move(part.rows) : Bitmap::intersect(m.rows, part.rows);
+                m.all = false;
+            }
+            return m;
+        case Predicate::OR:
+            m.all = false;
+            for (const auto &child : c.children)
+            {
+                BitmapMatch part(of(child, table, evaluate, used));
+                m.exact = m.exact && part.exact;
+                m.all = m.all || part.all;
+                if (!m.all && evaluate)
+                    m.rows = Bitmap::unite(m.rows, part.rows);
+            }
+            if (m.all)
+                m.rows.clear();
+            return m;
+        default:
+        {
+            BitmapMatch part(of(c.children[0], table, evaluate, used));
+            if (!part.exact) // the complement of a superset says nothing
+            {
+                m.exact = false;
+                return m;
+            }
+            m.all = false;
+            if (evaluate && !part.all)
+                m.rows = Bitmap::subtract(table.indexed_live_rows(), part.rows);
+            return m;
+        }
+        }
+    }
+
+private:
+    // The trigrams a value must have for the comparison to hold; none when it tells nothing
+    static vector<uint32_t> trigrams_of(const BoundPredicate &c)
+    {
+        if (Comparison::is_like(c.cmp))
+            return c.like.trigrams();
+        const Text *text(get_if<Text>(&c.literal.raw()));
+        return c.cmp == Comparison::EQ && text ? Trigrams::of(*text) : vector<uint32_t>();
+    }
+
+    static Bitmap leaf_rows(const BoundPredicate &c, const BitmapIndex &index, const Table &table)
+    {
+        if (c.cmp == Comparison::EQ || c.cmp == Comparison::NE)
+        {
+            // a literal equal to no value, such as NaN, finds no bitmap
+            const Bitmap *equal(c.ops.compare(c.literal, c.literal) ? nullptr : index.find(c.literal));
+            if (c.cmp == Comparison::EQ)
+                return equal ? *equal : Bitmap();
+            return equal ? Bitmap::subtract(table.indexed_live_rows(), *equal) : table.indexed_live_rows();
+        }
+        return index.rows_where([&](const Value &v)
+                                { return c.holds(v); });
+    }
+};
+
+class Operator;
+
+// What operators and sources share: the operator fed, and the profile entry with the rows taken
+// in and given out and the time of the stage's own work, without that of the operators it feeds
+class Stage
+{
+protected:
+    Operator *next;
+    QueryProfile *profile;
+    int op;
+    uint64_t rows_in = 0, rows_out = 0;
+    double ms = 0;
+
+    // Adds the time of its scope to a total, or with sign -1 takes it back out
+    class Clock
+    {
+        double &total;
+        double sign;
+        chrono::steady_clock::time_point start;
+
+    public:
+        Clock(double &t, double s = 1) : total(t), sign(s), start(chrono::steady_clock::now()) {}
+        ~Clock() { total += sign * chrono::duration<double, milli>(chrono::steady_clock::now() - start).count(); }
+    };
+
+    bool profiled() const { return profile && op != NOT_FOUND; }
+
+    // Hands a batch on; false once nothing more is wanted downstream
+    bool emit(Batch &batch);
+    // Hands on rows the stage made itself
+    bool emit_rows(const vector<Row> &rows, Batch &batch)
+    {
+        batch.rows.clear();
+        for (const auto &row : rows)
+            batch.rows.push_back(&row);
+        batch.cols = nullptr;
+        batch.select_all();
+        return emit(batch);
+    }
+    void emit_finish();
+
+    // Adds to the profile entry, which the copies of an operator in parallel workers share
+    void record()
+    {
+        if (!profiled())
+            return;
+        QueryProfile::Operator &o(profile->op(op));
+        o.rows_in += rows_in;
+        o.rows_out += rows_out;
+        o.ms += ms;
+    }
+
+public:
+    Stage(Operator *downstream, QueryProfile *p, int id) : next(downstream), profile(p), op(id) {}
+    virtual ~Stage() {}
+    Stage(const Stage &) = delete;
+    Stage &operator=(const Stage &) = delete;
+};
+
+class Operator : public Stage
+{
+protected:
+    virtual bool consume(Batch &batch) = 0; // false once no more input is wanted
+    virtual void flush() { emit_finish(); } // the input has ended
+
+public:
+    using Stage::Stage;
+
+    bool push(Batch &batch)
+    {
+        Clock clock(ms);
+        return consume(batch);
+    }
+    void finish()
+    {
+        {
+            Clock clock(ms);
+            flush();
+        }
+        record();
+    }
+};
+
+inline bool Stage::emit(Batch &batch)
+{
+    Clock downstream(ms, -1);
+    rows_out += batch.sel.size();
+    return next->push(batch);
+}
+
+inline void Stage::emit_finish()
+{
+    Clock downstream(ms, -1);
+    next->finish();
+}
+
+// Owns a chain of operators, built from the sink up
+class Pipeline
+{
+    vector<unique_ptr<Operator>> ops;
+
+public:
+    // Puts an operator in front of the chain built so far, feeding it
+    template <typename Op, typename... Args>
+    Op *add(Args &&...args)
+    {
+        ops.push_back(make_unique<Op>(head(), forward<Args>(args)...));
+        return static_cast<Op *>(ops.back().get());
+    }
+    Operator *head() const { return ops.empty() ? nullptr : ops.back().get(); }
+};
+
+// Rows of a table visible to a snapshot, one block of slots per batch. Run in parallel, each
+// worker thread claims the next unscanned block (a morsel) whenever it is done with its last and
+// pushes it down a chain of its own; those chains keep what they build (partial aggregates), and
+// the operator the scan feeds takes over once every worker has finished
+class TableScan : public Stage
+{
+public:
+    // One table read, such as a partition of a partitioned table
+    struct Source
+    {
+        const Table *table;
+        const Table::ReadView *view;
+        const Bitmap *rows = nullptr; // only these slots, when set
+    };
+
+private:
+    vector<Source> sources; // scanned in order; a source's rows are at origin source << 32 | slot
+
+public:
+    TableScan(Operator *downstream, QueryProfile *p, int id, const Table *t, const Table::ReadView &v)
+        : Stage(downstream, p, id), sources{{t, &v}} {}
+    TableScan(Operator *downstream, QueryProfile *p, int id, vector<Source> s)
+        : Stage(downstream, p, id), sources(move(s)) {}
+
+    // Scans with one thread per chain in `workers`, or on this thread into the operator fed when
+    // none. The workers share each source's blocks, and move on to the next source together
+    void run(const vector<Operator *> &workers = {})
+    {
+        vector<Operator *> heads(workers);
+        if (heads.empty())
+            heads.push_back(next);
+        int n(heads.size());
+        vector<Table::ScanStats> stats(n);
+        vector<double> worker_ms(n, 0);
+        vector<uint64_t> worker_rows(n, 0);
+        vector<exception_ptr> errors(n);
+        vector<atomic<int>> next_block(sources.size());
+
+        auto scan([&](int w)
+                  {
+            try
+            {
+                Clock clock(worker_ms[w]);
+                Table::BlockScan blocks;
+                Batch batch;
+                uint64_t source(0);
+                int start(0);
+                auto push([&](vector<const Row *> &rows)
+                          {
+                    batch.rows.assign(rows.begin(), rows.end());
+                    batch.select_all();
+                    batch.origin = source << 32 | start;
+                    worker_rows[w] += rows.size();
+                    Clock downstream(worker_ms[w], -1);
+                    return heads[w]->push(batch); });
+                for (; source < sources.size() && blocks.more; ++source)
+                {
+                    const Source &from(sources[source]);
+                    do
+                        start = next_block[source]++ * Table::SCAN_BATCH;
+                    while (from.table->scan_block(*from.view, start, blocks, push, profile ? &stats[w] : nullptr, from.rows) && blocks.more);
+                }
+            }
+            catch (...)
+            {
+                errors[w] = current_exception();
+            } });
+
+        if (n == 1)
+            scan(0);
+        else
+        {
+            vector<thread> threads;
+            for (int w(0); w < n; ++w)
+                threads.emplace_back(scan, w);
+            for (auto &t : threads)
+                t.join();
+        }
+        for (auto &error : errors)
+        {
+            if (error)
+                rethrow_exception(error);
+        }
+
+        for (Operator *worker : workers)
+            worker->finish();
+        {
+            Clock clock(ms);
+            emit_finish();
+        }
+        if (!profiled())
+            return;
+        Table::ScanStats total;
+        for (int w(0); w < n; ++w)
+        {
+            ms += worker_ms[w];
+            rows_out += worker_rows[w];
+            total.blocks += stats[w].blocks;
+            total.empty_blocks += stats[w].empty_blocks;
+            total.slots += stats[w].slots;
+        }
+        rows_in = total.slots;
+        record();
+        profile->stat(op, "blocks", total.blocks);
+        profile->stat(op, "blocks_skipped", total.empty_blocks);
+        if (!workers.empty())
+            profile->stat(op, "workers", n);
+        if (sources.size() == 1)
+            profile->stat(op, "snapshot", sources[0].view->snapshot());
+    }
+};
+
+// Rows produced all at once, such as a materialized view's groups
+class RowsScan : public Stage
+{
+    function<vector<Row>()> fetch;
+
+public:
+    RowsScan(Operator *downstream, QueryProfile *p, int id, function<vector<Row>()> f)
+        : Stage(downstream, p, id), fetch(move(f)) {}
+
+    void run()
+    {
+        {
+            Clock clock(ms);
+            vector<Row> rows(fetch());
+            rows_in = rows.size();
+            Batch batch;
+            vector<Row> chunk;
+            for (size_t from(0); from < rows.size(); from += Batch::CAPACITY)
+            {
+                chunk.assign(make_move_iterator(rows.begin() + from),
+                             make_move_iterator(rows.begin() + min<size_t>(rows.size(), from + Batch::CAPACITY)));
+                if (!emit_rows(chunk, batch))
+                    break;
+            }
+            emit_finish();
+        }
+        record();
+    }
+};
+
+// Keeps the rows meeting a WHERE condition. The condition is compiled once, each literal parsed
+// by its column's type and compared with that type's ValueOps. A comparison, alone or under AND,
+// narrows the selection in one loop per batch with the operator chosen outside it; OR and NOT
+// test row by row
+class Filter : public Operator
+{
+    BoundPredicate condition;
+
+    template <typename Test>
+    static void keep(const BoundPredicate &c, Batch &batch, Test test)
+    {
+        size_t kept(0);
+        for (int pos : batch.sel)
+        {
+            if (test(c.ops.compare(batch.at(pos, c.column), c.literal)))
+                batch.sel[kept++] = pos;
+        }
+        batch.sel.resize(kept);
+    }
+
+    static void narrow(const BoundPredicate &c, Batch &batch)
+    {
+        if (c.kind == Predicate::AND)
+        {
+            for (const auto &child : c.children)
+            {
+                if (batch.sel.empty())
+                    return;
+                narrow(child, batch);
+            }
+            return;
+        }
+        if (c.kind != Predicate::LEAF || Comparison::is_like(c.cmp))
+        {
+            size_t kept(0);
+            for (int pos : batch.sel)
+            {
+                if (c.holds(batch, pos))
+                    batch.sel[kept++] = pos;
+            }
+            batch.sel.resize(kept);
+            return;
+        }
+        if (c.cmp == Comparison::NONE)
+            return;
+        if (c.column == NOT_FOUND)
+        {
+            batch.sel.clear();
+            return;
+        }
+
+        switch (c.cmp)
+        {
+        case Comparison::EQ:
+            keep(c, batch, [](int r)
+                 { return r == 0; });
+            break;
+        case Comparison::NE:
+            keep(c, batch, [](int r)
+                 { return r != 0; });
+            break;
+        case Comparison::GT:
+            keep(c, batch, [](int r)
+                 { return r > 0 && r != Value::UNORDERED; });
+            break;
+        case Comparison::LT:
+            keep(c, batch, [](int r)
+                 { return r < 0; });
+            break;
+        case Comparison::GE:
+            keep(c, batch, [](int r)
+                 { return r == 0 || (r > 0 && r != Value::UNORDERED); });
+            break;
+        case Comparison::LE:
+            keep(c, batch, [](int r)
+                 { return r <= 0; });
+            break;
+        default:
+            break;
+        }
+    }
+
+protected:
+    bool consume(Batch &batch) override
+    {
+        rows_in += batch.sel.size();
+        narrow(condition, batch);
+        return batch.sel.empty() || emit(batch);
+    }
+
+public:
+    Filter(Operator *downstream, QueryProfile *p, int id, const Table *table, const string &where)
+        : Operator(downstream, p, id), condition(Predicate::parse(where), table) {}
+};
+
+// Narrows and reorders the columns by composing the batch's column map; no value is copied
+class Project : public Operator
+{
+    vector<int> cols, mapped;
+
+protected:
+    bool consume(Batch &batch) override
+    {
+        rows_in += batch.sel.size();
+        mapped.resize(cols.size());
+        for (size_t i(0); i < cols.size(); ++i)
+            mapped[i] = batch.cols ? (*batch.cols)[cols[i]] : cols[i];
+        const vector<int> *outer(batch.cols);
+        batch.cols = &mapped;
+        bool more(emit(batch));
+        batch.cols = outer;
+        return more;
+    }
+
+public:
+    Project(Operator *downstream, QueryProfile *p, int id, vector<int> columns)
+        : Operator(downstream, p, id), cols(move(columns)) {}
+};
+
+// Rows of one GROUP BY group (or of the whole input without one) as the first row, for plain
+// columns, and the running state of each aggregate the statement uses
+struct Group
+{
+    Row first;
+    uint64_t first_at = 0; // scan position of `first`
+    bool empty = true;
+    vector<AggregateState> states;
+};
+
+// The aggregate calls of a statement, each computed once however often it is named
+struct AggregatePlan
+{
+    vector<AggregateSpec> specs;
+    vector<string> exprs;
+
+    int slot(const string &expr) const
+    {
+        auto it(find(exprs.begin(), exprs.end(), expr));
+        return it == exprs.end() ? NOT_FOUND : it - exprs.begin();
+    }
+
+    Group new_group() const
+    {
+        Group g;
+        g.states.reserve(specs.size());
+        for (const auto &spec : specs)
+            g.states.emplace_back(spec);
+        return g;
+    }
+
+    static void add(Group &g, const Row &row, uint64_t at)
+    {
+        if (g.empty)
+        {
+            g.first = row;
+            g.first_at = at;
+            g.empty = false;
+        }
+        for (auto &state : g.states)
+            state.add(row);
+    }
+
+    // Folds in the same group aggregated over other rows; the first row is the earlier one
+    static void merge(Group &into, Group &from)
+    {
+        if (!from.empty && (into.empty || from.first_at < into.first_at))
+        {
+            into.first = move(from.first);
+            into.first_at = from.first_at;
+            into.empty = false;
+        }
+        for (size_t i(0); i < into.states.size(); ++i)
+            into.states[i].merge(from.states[i]);
+    }
+
+    static size_t bytes(const Group &g)
+    {
+        size_t total(sizeof(Group) + (g.empty ? 0 : QueryProfile::row_bytes(g.first) - sizeof(Row)));
+        for (const auto &state : g.states)
+            total += state.bytes();
+        return total;
+    }
+};
+
+// GROUP BY with a hash table of groups, or without group columns a single group over the whole
+// input. Takes table rows as the scan hands them out; emits one row per group passing HAVING.
+// In a parallel scan each worker feeds a Partial with a table of its own. The partial tables are
+// merged at the end: into one table while there are few groups, otherwise split by hash into one
+// partition per worker first, so each partition is merged by a thread of its own (radix merge)
+class HashAggregate : public Operator
+{
+public:
+    static const size_t RADIX_MIN_GROUPS = 1 << 14; // fewer partial groups are merged on one thread
+
+    // An output column: an aggregate's slot in the plan, else a column of the group's first row
+    struct Output
+    {
+        int slot = NOT_FOUND;
+        int column = NOT_FOUND;
+    };
+    struct Having
+    {
+        Comparison::Op cmp = Comparison::NONE;
+        Output lhs, rhs;
+        bool rhs_output = false; // else the literal
+        Value literal;
+        LikePattern like; // for LIKE and ILIKE, in place of the right side
+    };
+
+    // One worker's share of the input, grouped into its own table; its rows and time count
+    // toward the HashAggregate's profile entry
+    class Partial : public Operator
+    {
+        friend class HashAggregate;
+        const AggregatePlan &plan;
+        GroupTable<Group> groups;
+
+    protected:
+        bool consume(Batch &batch) override
+        {
+            rows_in += batch.sel.size();
+            add_rows(plan, groups, batch);
+            return true;
+        }
+        void flush() override {}
+
+    public:
+        Partial(Operator *, HashAggregate &owner)
+            : Operator(nullptr, owner.profile, owner.op), plan(owner.plan), groups(owner.group_cols, owner.key_ops)
+        {
+            owner.partials.push_back(this);
+        }
+    };
+
+private:
+    const AggregatePlan &plan;
+    bool grouped;
+    vector<int> group_cols;
+    vector<ValueOps> key_ops;
+    vector<Output> outputs;
+    Having having;
+    GroupTable<Group> groups;
+    vector<Partial *> partials;
+
+    static Value value_of(Group &g, const Output &out)
+    {
+        if (out.slot != NOT_FOUND)
+            return g.states[out.slot].result();
+        return out.column != NOT_FOUND && !g.empty ? g.first[out.column] : Value();
+    }
+
+    static void add_rows(const AggregatePlan &plan, GroupTable<Group> &groups, const Batch &batch)
+    {
+        auto make([&]
+                  { return plan.new_group(); });
+        for (int pos : batch.sel)
+        {
+            const Row &row(*batch.rows[pos]);
+            AggregatePlan::add(groups.find_or_add(row, make), row, batch.origin + pos);
+        }
+    }
+
+    // The workers' partial tables merged, as one table or as partitions by hash
+    vector<GroupTable<Group>> merge_partials()
+    {
+        size_t total(0);
+        for (Partial *partial : partials)
+            total += partial->groups.size();
+        size_t parts(total >= RADIX_MIN_GROUPS ? partials.size() : 1);
+        auto empty_tables([&]
+                          {
+            vector<GroupTable<Group>> tables;
+            for (size_t p(0); p < parts; ++p)
+                tables.push_back(groups.keys_table());
+            return tables; });
+
+        vector<vector<GroupTable<Group>>> split;
+        for (size_t w(0); w < partials.size(); ++w)
+            split.push_back(empty_tables());
+        in_parallel(partials.size(), [&](size_t w)
+                    { partials[w]->groups.split(split[w]); });
+
+        vector<GroupTable<Group>> merged(empty_tables());
+        in_parallel(parts, [&](size_t p)
+                    {
+            for (auto &worker : split)
+                merged[p].absorb(worker[p], AggregatePlan::merge); });
+        if (profiled())
+        {
+            profile->stat(op, "workers", partials.size());
+            profile->stat(op, "partial_groups", total);
+            profile->stat(op, "merge_partitions", parts);
+        }
+        return merged;
+    }
+
+protected:
+    bool consume(Batch &batch) override
+    {
+        rows_in += batch.sel.size();
+        add_rows(plan, groups, batch);
+        return true;
+    }
+
+    void flush() override
+    {
+        vector<GroupTable<Group>> tables;
+        if (partials.empty())
+            tables.push_back(move(groups));
+        else
+            tables = merge_partials();
+        if (!grouped && !tables[0].size()) // no rows still make one group
+            tables[0].find_or_add(Row(), [&]
+                                  { return plan.new_group(); });
+
+        Batch batch;
+        vector<Row> chunk;
+        bool more(true);
+        for (auto &table : tables)
+        {
+            for (auto &entry : table)
+            {
+                Group &g(entry.second.group);
+                if (having.cmp != Comparison::NONE && Comparison::is_like(having.cmp) && !matches_like(having.like, value_of(g, having.lhs)))
+                    continue;
+                if (having.cmp != Comparison::NONE && !Comparison::is_like(having.cmp) &&
+                    !Comparison::holds(having.cmp, value_of(g, having.lhs).compare(having.rhs_output ? value_of(g, having.rhs) : having.literal)))
+                    continue;
+
+                Row row;
+                for (const auto &out : outputs) // an empty input shows plain columns blank
+                    row.push_back(g.empty && out.slot == NOT_FOUND ? Value(Text()) : value_of(g, out));
+                chunk.push_back(move(row));
+                if (chunk.size() == Batch::CAPACITY)
+                {
+                    more = more && emit_rows(chunk, batch);
+                    chunk.clear();
+                }
+            }
+        }
+        if (!chunk.empty() && more)
+            emit_rows(chunk, batch);
+
+        if (profiled())
+        {
+            uint64_t bytes(0);
+            if (grouped)
+            {
+                size_t group_count(0), buckets(0);
+                for (const auto &table : tables)
+                {
+                    group_count += table.size();
+                    buckets += table.bucket_count();
+                    bytes += table.bucket_count() * sizeof(void *);
+                    for (const auto &entry : table)
+                        bytes += sizeof(entry) + QueryProfile::row_bytes(entry.second.keys) - sizeof(Row) + AggregatePlan::bytes(entry.second.group) - sizeof(Group);
+                }
+                profile->stat(op, "groups", group_count);
+                profile->stat(op, "buckets", buckets);
+            }
+            else
+                bytes = AggregatePlan::bytes(tables[0].begin()->second.group);
+            profile->stat(op, "bytes", bytes);
+        }
+        emit_finish();
+    }
+
+public:
+    HashAggregate(Operator *downstream, QueryProfile *p, int id, const AggregatePlan &aggregates,
+                  vector<int> group_columns, vector<ValueOps> ops, vector<Output> outs, Having cond)
+        : Operator(downstream, p, id), plan(aggregates), grouped(!group_columns.empty()), group_cols(move(group_columns)),
+          key_ops(move(ops)), outputs(move(outs)), having(move(cond)), groups(group_cols, key_ops) {}
+};
+
+// ORDER BY through an ExternalSort, which spills to disk beyond its memory budget
+class Sort : public Operator
+{
+    ExternalSort sorter;
+    int width;
+
+protected:
+    bool consume(Batch &batch) override
+    {
+        rows_in += batch.sel.size();
+        for (int pos : batch.sel)
+        {
+            Row row;
+            row.values().reserve(width);
+            for (int col(0); col < width; ++col)
+                row.push_back(batch.at(pos, col));
+            sorter.add(move(row));
+        }
+        return true;
+    }
+
+    // A run file that cannot be written or read throws like any other file error
+    void flush() override
+    {
+        Batch batch;
+        vector<Row> chunk;
+        chunk.reserve(Batch::CAPACITY);
+        bool more(true);
+        sorter.finish([&](Row &&row)
+                      {
+            if (!more)
+                return;
+            chunk.push_back(move(row));
+            if (chunk.size() == Batch::CAPACITY)
+            {
+                more = emit_rows(chunk, batch);
+                chunk.clear();
+            } });
+        if (!chunk.empty() && more)
+            emit_rows(chunk, batch);
+
+        if (profiled())
+        {
+            const ExternalSort::Stats &stats(sorter.stats());
+            profile->stat(op, "method", stats.runs ? "external merge" : "in memory");
+            profile->stat(op, "runs", stats.runs);
+            profile->stat(op, "spilled_bytes", stats.spilled_bytes);
+            profile->stat(op, "merges", stats.merges);
+            profile->stat(op, "fan_in", stats.fan_in);
+            profile->stat(op, "bytes", stats.peak_bytes);
+        }
+        emit_finish();
+    }
+
+public:
+    // Sorts rows of the batch's first `columns` columns on `keys`, positions among them
+    Sort(Operator *downstream, QueryProfile *p, int id, vector<ExternalSort::Key> keys, int columns)
+        : Operator(downstream, p, id), sorter(move(keys)), width(columns) {}
+};
+
+// Passes the first `count` rows on, then stops the operators upstream
+class Limit : public Operator
+{
+    uint64_t remaining;
+
+protected:
+    bool consume(Batch &batch) override
+    {
+        rows_in += batch.sel.size();
+        if (batch.sel.size() > remaining)
+            batch.sel.resize(remaining);
+        remaining -= batch.sel.size();
+        if (!batch.sel.empty() && !emit(batch))
+            return false;
+        return remaining > 0;
+    }
+
+public:
+    Limit(Operator *downstream, QueryProfile *p, int id, uint64_t count) : Operator(downstream, p, id), remaining(count) {}
+};
+
+// Prints the first `width` columns of each row, the statement's result
+class PrintSink : public Operator
+{
+    ostream &out;
+    int width;
+    uint64_t printed = 0;
+
+protected:
+    bool consume(Batch &batch) override
+    {
+        for (int pos : batch.sel)
+        {
+            for (int col(0); col < width; ++col)
+            {
+                out << batch.at(pos, col).to_string();
+                if (col + 1 < width)
+                    out << " | ";
+            }
+            out << "\n";
+        }
+        printed += batch.sel.size();
+        return true;
+    }
+    void flush() override {}
+
+public:
+    PrintSink(Operator *, ostream &o, int columns) : Operator(nullptr, nullptr, NOT_FOUND), out(o), width(columns) {}
+
+    uint64_t rows() const { return printed; }
+};
+
+#endif
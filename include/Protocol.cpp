@@ -0,0 +1,186 @@
+#ifndef PROTOCOL
+#define PROTOCOL
+
+#include <string>
+#include <cstring>
+#include <cstdint>
+#include <stdexcept>
+#include <unistd.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+using namespace std;
+
+// Wire format: every request and response is a 4-byte big-endian length followed by that many bytes.
+// A request carries one SQL statement, the response carries everything the statement printed.
+class Protocol
+{
+public:
+    static const uint32_t MAX_FRAME = 64u << 20;
+
+    static string encode(const string &payload)
+    {
+        uint32_t len(payload.size());
+        string frame(4, '\0');
+        frame[0] = (char)(len >> 24);
+        frame[1] = (char)(len >> 16);
+        frame[2] = (char)(len >> 8);
+        frame[3] = (char)len;
+        frame += payload;
+        return frame;
+    }
+
+    static bool decode(string &buffer, string &payload) // pops one complete frame off the front of buffer
+    {
+        if (buffer.size() < 4)
+            return false;
+
+        uint32_t len(((uint32_t)(unsigned char)buffer[0] << 24) | ((uint32_t)(unsigned char)buffer[1] << 16) |
+                     ((uint32_t)(unsigned char)buffer[2] << 8) | (uint32_t)(unsigned char)buffer[3]);
+        if (len > MAX_FRAME)
+            throw length_error("frame too large");
+        if (buffer.size() < 4 + len)
+            return false;
+
+        payload.assign(buffer, 4, len);
+        buffer.erase(0, 4 + len);
+        return true;
+    }
+
+    static bool send_all(int fd, const string &data)
+    {
+        size_t sent(0);
+        while (sent < data.size())
+        {
+            ssize_t n(::send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL));
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                return false;
+            sent += n;
+        }
+        return true;
+    }
+
+    static bool send_frame(int fd, const string &payload) { return send_all(fd, encode(payload)); }
+
+    static bool recv_frame(int fd, string &payload) // blocking, for clients
+    {
+        string buffer;
+        char chunk[4096];
+        while (!decode(buffer, payload))
+        {
+            ssize_t n(::recv(fd, chunk, sizeof(chunk), 0));
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                return false;
+            buffer.append(chunk, n);
+        }
+        return true;
+    }
+
+    static bool set_nonblocking(int fd)
+    {
+        int flags(fcntl(fd, F_GETFL, 0));
+        return flags >= 0 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0;
+    }
+
+    static int listen_tcp(const string &host, int port)
+    {
+        int fd(::socket(AF_INET, SOCK_STREAM, 0));
+        if (fd < 0)
+            return -1;
+
+        int yes(1);
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        if (inet_pton(AF_INET, host.c_str(), &addr.sin_addr) != 1 ||
+            ::bind(fd, (sockaddr *)&addr, sizeof(addr)) < 0 || ::listen(fd, SOMAXCONN) < 0)
+        {
+            ::close(fd);
+            return -1;
+        }
+        return fd;
+    }
+
+    static int listen_unix(const string &path)
+    {
+        sockaddr_un addr{};
+        if (path.size() >= sizeof(addr.sun_path))
+            return -1;
+
+        int fd(::socket(AF_UNIX, SOCK_STREAM, 0));
+        if (fd < 0)
+            return -1;
+
+        addr.sun_family = AF_UNIX;
+        strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+        ::unlink(path.c_str());
+        if (::bind(fd, (sockaddr *)&addr, sizeof(addr)) < 0 || ::listen(fd, SOMAXCONN) < 0)
+        {
+            ::close(fd);
+            return -1;
+        }
+        return fd;
+    }
+
+    static int connect_tcp(const string &host, int port)
+    {
+        addrinfo hints{}, *res(nullptr);
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        if (getaddrinfo(host.c_str(), to_string(port).c_str(), &hints, &res) != 0)
+            return -1;
+
+        int fd(-1);
+        for (addrinfo *ai(res); ai; ai = ai->ai_next)
+        {
+            fd = ::socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+            if (fd < 0)
+                continue;
+            if (::connect(fd, ai->ai_addr, ai->ai_addrlen) == 0)
+                break;
+            ::close(fd);
+            fd = -1;
+        }
+        freeaddrinfo(res);
+
+        if (fd >= 0)
+        {
+            int yes(1);
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+        }
+        return fd;
+    }
+
+    static int connect_unix(const string &path)
+    {
+        sockaddr_un addr{};
+        if (path.size() >= sizeof(addr.sun_path))
+            return -1;
+
+        int fd(::socket(AF_UNIX, SOCK_STREAM, 0));
+        if (fd < 0)
+            return -1;
+
+        addr.sun_family = AF_UNIX;
+        strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+        if (::connect(fd, (sockaddr *)&addr, sizeof(addr)) < 0)
+        {
+            ::close(fd);
+            return -1;
+        }
+        return fd;
+    }
+};
+
+#endif
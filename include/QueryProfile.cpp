@@ -0,0 +1,130 @@
+#ifndef QUERY_PROFILE
+#define QUERY_PROFILE
+
+#include "models.cpp"
+#include <chrono>
+#include <filesystem>
+
+namespace fs = std::filesystem;
+
+// Plan of one statement as a tree of operators, filled in by the parsers when run under EXPLAIN.
+// With ANALYZE the statement really executes and each operator also gets its wall time, row
+// counts and the sizes of what it built; without it the parsers stop after planning.
+class QueryProfile
+{
+public:
+    struct Operator
+    {
+        string name;
+        string detail;
+        int depth;
+        double ms = 0;
+        uint64_t rows_in = 0;
+        uint64_t rows_out = 0;
+        vector<pair<string, string>> stats;
+    };
+
+    // Adds the elapsed time of its scope to one operator; a null profile makes it a no-op
+    class Timer
+    {
+        QueryProfile *profile;
+        int id;
+        chrono::steady_clock::time_point start;
+
+    public:
+        Timer(QueryProfile *p, int op) : profile(p), id(op), start(chrono::steady_clock::now()) {}
+        ~Timer() { stop(); }
+        void stop()
+        {
+            if (profile && id != NOT_FOUND)
+                profile->_ops[id].ms += chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+            profile = nullptr;
+        }
+        Timer(const Timer &) = delete;
+        Timer &operator=(const Timer &) = delete;
+    };
+
+private:
+    bool _analyze;
+    vector<Operator> _ops;
+    chrono::steady_clock::time_point _started;
+
+public:
+    QueryProfile(bool analyze) : _analyze(analyze), _started(chrono::steady_clock::now()) {}
+
+    bool analyze() const { return _analyze; }
+    bool empty() const { return _ops.empty(); }
+
+    int add(const string &name, const string &detail = "", int depth = 0)
+    {
+        _ops.push_back({name, detail, depth, 0, 0, 0, {}});
+        return _ops.size() - 1;
+    }
+    Operator &op(int id) { return _ops.at(id); }
+
+    void rows(int id, uint64_t in, uint64_t out)
+    {
+        _ops.at(id).rows_in = in;
+        _ops.at(id).rows_out = out;
+    }
+    template <typename T>
+    void stat(int id, const string &key, const T &value)
+    {
+        ostringstream ss;
+        ss << value;
+        _ops.at(id).stats.emplace_back(key, ss.str());
+    }
+
+    // Approximate heap footprint of a materialized row, used for the "bytes" figures
+    static uint64_t row_bytes(const Row &row)
+    {
+        uint64_t bytes(sizeof(Row) + row.values().capacity() * sizeof(Value));
+        for (const auto &val : row.values())
+        {
+            const Text *text(get_if<Text>(&val.raw()));
+            if (text && text->capacity() > 15) // beyond the small-string buffer
+                bytes += text->capacity() + 1;
+        }
+        return bytes;
+    }
+
+    static uint64_t file_bytes(const fs::path &path)
+    {
+        error_code ec;
+        uint64_t size(fs::file_size(path, ec));
+        return ec ? 0 : size;
+    }
+
+    void print(ostream &out) const
+    {
+        ios::fmtflags flags(out.flags());
+        streamsize precision(out.precision());
+
+        out << "\nQUERY PLAN\n";
+        for (const auto &o : _ops)
+        {
+            out << string(o.depth * 4, ' ') << "-> " << o.name;
+            if (!o.detail.empty())
+                out << " (" << o.detail << ")";
+            out << "\n";
+
+            if (!_analyze)
+                continue;
+
+            string indent(o.depth * 4 + 6, ' ');
+            out << indent << fixed << setprecision(3) << "time=" << o.ms << " ms"
+                << "  rows in=" << o.rows_in << " out=" << o.rows_out;
+            for (const auto &s : o.stats)
+                out << "  " << s.first << "=" << s.second;
+            out << "\n";
+        }
+
+        if (_analyze)
+            out << fixed << setprecision(3) << "Execution time: "
+                << chrono::duration<double, milli>(chrono::steady_clock::now() - _started).count() << " ms\n";
+        out.flags(flags);
+        out.precision(precision);
+    }
+};
+
+#endif
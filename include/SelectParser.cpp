@@ -3,327 +3,366 @@
 
 #include "models.cpp"
 #include "Helper.cpp"
+#include "QueryProfile.cpp"
+#include "ExternalSort.cpp"
+#include "Aggregate.cpp"
+#include "Operators.cpp"
+#include "MaterializedView.cpp"
+#include "Transaction.cpp"
 #include <iomanip>
 
 class SelectParser
 {
     Catalog *_catalog;
+    ostream &_out;
+    QueryProfile *_profile;
+    Transaction *_transaction; // an open one sees its own changes
 
-    bool evaluate_condition(const Row &row, const Table *table, const string &condition)
+    void print_header(const vector<string> &col_names)
     {
-        if (condition.empty())
-            return true;
-
-        vector<string> operators = {">=", "<=", "!=", "=", ">", "<"};
-        string op;
-        int op_pos = -1;
-
-        for (const auto &o : operators)
+        for (int i(0); i < col_names.size(); ++i)
         {
-            int pos = condition.find(o);
-            if (pos != string::npos)
-            {
-                op = o;
-                op_pos = pos;
-                break;
-            }
+            _out << col_names[i];
+            if (i + 1 < col_names.size())
+                _out << " | ";
         }
+        _out << "\n";
+    }
 
-        if (op_pos == -1)
-            return true;
-
-        string col_name_str(Helper::trim(condition.substr(0, op_pos)));
-        string value_str(Helper::trim(condition.substr(op_pos + op.size())));
-
-        if (!value_str.empty() && (value_str.front() == '\'' || value_str.front() == '"'))
-            value_str = value_str.substr(1, value_str.size() - 2);
-
-        int col_idx = table->get_column_index(col_name_str);
-        if (col_idx == -1)
-            return false;
+    void print_footer(uint64_t row_count)
+    {
+        _out << "\n"
+             << row_count << " row(s) returned\n";
+        Metrics::add(Metrics::ROWS_RETURNED, row_count);
+    }
 
-        const Column &col = table->get_column(col_idx);
-        string type = col.get_type();
+    bool is_aggregate_function(const string &col_expr) { return AggregateSpec::is_aggregate(col_expr); }
 
-        Value row_value = row[col_idx];
-        Value cond_value;
+    // Every aggregate in the select list and HAVING clause; false with a message when one is malformed
+    bool plan_aggregates(const vector<string> &col_names, const string &having_cond, const Table *table, AggregatePlan &plan)
+    {
+        vector<string> exprs(col_names);
+        string lhs, rhs;
+        if (Comparison::split(having_cond, lhs, rhs) != Comparison::NONE)
+        {
+            exprs.push_back(lhs);
+            exprs.push_back(rhs);
+        }
 
-        if (value_str == "NULL")
-            cond_value = Value();
-        else if (type == "INT")
-            cond_value = Value(atoi(value_str.c_str()));
-        else if (type == "DOUBLE")
-            cond_value = Value(atof(value_str.c_str()));
-        else if (type == "DATE")
+        for (const auto &expr : exprs)
         {
-            int y(0), m(0), d(0);
-            sscanf(value_str.c_str(), "%d-%d-%d", &y, &m, &d);
-            cond_value = Value(Date(y, m, d));
+            if (!is_aggregate_function(expr) || plan.slot(expr) != NOT_FOUND)
+                continue;
+            AggregateSpec spec;
+            string error;
+            if (!AggregateSpec::parse(expr, table, spec, error))
+            {
+                _out << "\n" << error << "\n";
+                return false;
+            }
+            plan.specs.push_back(spec);
+            plan.exprs.push_back(expr);
         }
-        else
-            cond_value = Value(value_str);
-
-        bool result = false;
-        if (op == "=")
-            result = row_value == cond_value;
-        else if (op == "!=")
-            result = !(row_value == cond_value);
-        else if (op == ">")
-            result = row_value > cond_value;
-        else if (op == "<")
-            result = row_value < cond_value;
-        else if (op == ">=")
-            result = row_value > cond_value || row_value == cond_value;
-        else if (op == "<=")
-            result = row_value < cond_value || row_value == cond_value;
-
-        return result;
+        return true;
     }
 
-    void print_header(const vector<string> &col_names, const Table *table)
+    // A select item or HAVING operand: an aggregate of the plan, else a column of the table
+    static HashAggregate::Output aggregate_output(const AggregatePlan &plan, const string &expr, const Table *table)
     {
-        for (int i(0); i < col_names.size(); ++i)
-        {
-            cout << col_names[i];
-            if (i + 1 < col_names.size())
-                cout << " | ";
-        }
-        cout << "\n";
+        HashAggregate::Output out;
+        out.slot = plan.slot(expr);
+        if (out.slot == NOT_FOUND)
+            out.column = table->get_column_index(expr);
+        return out;
     }
 
-    void print_row(const Row &row, const vector<int> &col_indices, const Table *table)
+    // HAVING compiled against the plan; its right side is a literal unless it is an aggregate
+    static HashAggregate::Having compile_having(const string &having_cond, const AggregatePlan &plan, const Table *table)
     {
-        for (int i(0); i < col_indices.size(); ++i)
+        HashAggregate::Having having;
+        string lhs, rhs;
+        having.cmp = Comparison::split(having_cond, lhs, rhs);
+        if (having.cmp == Comparison::NONE)
+            return having;
+
+        having.lhs = aggregate_output(plan, lhs, table);
+        if (Comparison::is_like(having.cmp))
+            having.like = LikePattern(Comparison::unquote(rhs), having.cmp == Comparison::ILIKE);
+        else if (rhs == "NULL")
+            having.literal = Value();
+        else if (AggregateSpec::is_aggregate(rhs))
         {
-            int idx = col_indices[i];
-            cout << row[idx].to_string();
-            if (i + 1 < col_indices.size())
-                cout << " | ";
+            having.rhs = aggregate_output(plan, rhs, table);
+            having.rhs_output = true;
         }
-        cout << "\n";
+        else if (rhs.find('.') != string::npos)
+            having.literal = Value(atof(rhs.c_str()));
+        else if (isdigit(rhs[0]) || rhs[0] == '-')
+            having.literal = Value(atoi(rhs.c_str()));
+        else
+            having.literal = Value(rhs);
+        return having;
     }
 
-    vector<Condition> parse_conditions(const string &cond_str)
+    static string join_names(const vector<string> &names)
     {
-        vector<Condition> conds;
-        if (cond_str.empty())
-            return conds;
-
-        string s = Helper::trim(cond_str);
-        vector<string> operators = {">=", "<=", "!=", "=", ">", "<"};
-        string op;
-        int op_pos = -1;
+        string joined;
+        for (int i(0); i < names.size(); ++i)
+            joined += (i ? ", " : "") + names[i];
+        return joined;
+    }
 
-        for (const auto &o : operators)
+    // "col [ASC|DESC], ..." into (column, descending) pairs
+    bool parse_order_by(const string &order_str, vector<pair<string, bool>> &order_by)
+    {
+        for (const auto &item : Helper::split_commas_respecting_quotes(order_str))
         {
-            int pos = s.find(o);
-            if (pos != string::npos)
+            istringstream words(item);
+            string col, dir, extra;
+            words >> col >> dir >> extra;
+            string lower_dir(Helper::to_lower(dir));
+            if (col.empty() || !extra.empty() || (!dir.empty() && lower_dir != "asc" && lower_dir != "desc"))
             {
-                op = o;
-                op_pos = pos;
-                break;
+                _out << "\nInvalid ORDER BY item '" << Helper::trim(item) << "'\n";
+                return false;
             }
+            order_by.emplace_back(col, lower_dir == "desc");
         }
-
-        if (op_pos == -1)
-            return conds;
-
-        string lhs(Helper::trim(s.substr(0, op_pos)));
-        string rhs(Helper::trim(s.substr(op_pos + op.size())));
-
-        if (!rhs.empty() && (rhs.front() == '\'' || rhs.front() == '"'))
-            rhs = rhs.substr(1, rhs.size() - 2);
-
-        Condition c;
-        c.lhs = lhs;
-        c.op = op;
-        c.rhs = rhs;
-        conds.push_back(c);
-        return conds;
+        return !order_by.empty();
     }
 
-    bool is_aggregate_function(const string &col_expr)
+    static string order_by_detail(const vector<pair<string, bool>> &order_by)
     {
-        string lower_expr = Helper::to_lower(col_expr);
-        return lower_expr.find("count(") != string::npos ||
-               lower_expr.find("sum(") != string::npos ||
-               lower_expr.find("avg(") != string::npos ||
-               lower_expr.find("min(") != string::npos ||
-               lower_expr.find("max(") != string::npos;
+        vector<string> items;
+        for (const auto &key : order_by)
+            items.push_back(key.first + (key.second ? " DESC" : ""));
+        return join_names(items);
     }
 
-    Value compute_aggregate(const string &func_expr, const vector<Row> &group_rows, const Table *table)
+    bool parse_limit(const string &limit_str, int &limit)
     {
-        string lower_expr = Helper::to_lower(func_expr);
-        string func_name;
-        string col_expr;
-
-        // Extract function name and column
-        int paren_pos = func_expr.find('(');
-        if (paren_pos != string::npos)
+        if (limit_str.empty() || limit_str.size() > 9 || !all_of(limit_str.begin(), limit_str.end(), ::isdigit))
         {
-            func_name = Helper::to_lower(Helper::trim(func_expr.substr(0, paren_pos)));
-            int close_paren = func_expr.find(')', paren_pos);
-            col_expr = Helper::trim(func_expr.substr(paren_pos + 1, close_paren - paren_pos - 1));
+            _out << "\nInvalid LIMIT '" << limit_str << "'\n";
+            return false;
         }
+        limit = stoi(limit_str);
+        return true;
+    }
 
-        if (func_name == "count")
+    // Sort keys as positions among the output columns, for rows that are sorted once computed
+    bool output_sort_keys(const vector<pair<string, bool>> &order_by, const vector<string> &columns, vector<ExternalSort::Key> &sort_keys)
+    {
+        for (const auto &key : order_by)
         {
-            if (col_expr == "*")
-                return Value((int)group_rows.size());
-
-            int col_idx = table->get_column_index(col_expr);
-            if (col_idx == -1)
-                return Value(0);
-
-            int count(0);
-            for (const auto &row : group_rows)
+            int idx(NOT_FOUND);
+            for (int i(0); i < columns.size() && idx == NOT_FOUND; ++i)
+            {
+                if (Helper::to_lower(columns[i]) == Helper::to_lower(key.first))
+                    idx = i;
+            }
+            if (idx == NOT_FOUND)
             {
-                if (!holds_alternative<NullType>(row[col_idx].raw()))
-                    count++;
+                _out << "\nColumn '" << key.first << "' not found in ORDER BY\n";
+                return false;
             }
-            return Value(count);
+            sort_keys.push_back({idx, key.second});
         }
-        else if (func_name == "sum" || func_name == "avg")
-        {
-            int col_idx = table->get_column_index(col_expr);
-            if (col_idx == -1)
-                return Value();
+        return true;
+    }
+
+    // Profile entries of the LIMIT and ORDER BY every plan may end with, from the top down
+    void plan_top(int limit, const vector<pair<string, bool>> &order_by, int &limit_op, int &sort_op, int &depth)
+    {
+        if (limit != NOT_FOUND)
+            limit_op = _profile->add("Limit", to_string(limit), depth++);
+        if (!order_by.empty())
+            sort_op = _profile->add("Sort", order_by_detail(order_by), depth++);
+    }
 
-            double sum(0);
-            int count(0);
-            for (const auto &row : group_rows)
+    // The sink printing `width` columns and the LIMIT and ORDER BY feeding it
+    PrintSink *build_top(Pipeline &pipeline, int width, int limit, int limit_op,
+                         const vector<ExternalSort::Key> &sort_keys, int sort_width, int sort_op)
+    {
+        PrintSink *sink(pipeline.add<PrintSink>(_out, width));
+        if (limit != NOT_FOUND)
+            pipeline.add<Limit>(_profile, limit_op, limit);
+        if (!sort_keys.empty())
+            pipeline.add<Sort>(_profile, sort_op, sort_keys, sort_width);
+        return sink;
+    }
+
+    // Reads a materialized view's maintained groups; the view is already aggregated, so only
+    // projection, ORDER BY and LIMIT apply
+    bool select_from_view(MaterializedView *view, const string &view_name, const string &select_part,
+                          const vector<string> &col_names, const vector<pair<string, bool>> &order_by, int limit)
+    {
+        const vector<Text> &columns(view->columns());
+        auto column_index([&](const string &name)
+                          {
+            for (int i(0); i < columns.size(); ++i)
             {
-                const Value &val = row[col_idx];
-                if (holds_alternative<Int>(val.raw()))
-                {
-                    sum += get<Int>(val.raw());
-                    count++;
-                }
-                else if (holds_alternative<Double>(val.raw()))
-                {
-                    sum += get<Double>(val.raw());
-                    count++;
-                }
+                if (Helper::to_lower(columns[i]) == Helper::to_lower(name))
+                    return i;
             }
+            return (int)NOT_FOUND; });
 
-            if (func_name == "sum")
-                return Value(sum);
-            else // avg
-                return count > 0 ? Value(sum / count) : Value();
+        vector<string> display_col_names;
+        vector<int> sort_indices; // projected columns, then any key column not among them
+        for (const auto &name : select_part == "*" ? columns : col_names)
+        {
+            int idx(column_index(name));
+            if (idx == NOT_FOUND)
+            {
+                _out << "\nColumn '" << name << "' not found in view '" << view_name << "'\n";
+                return false;
+            }
+            sort_indices.push_back(idx);
+            display_col_names.push_back(columns[idx]);
         }
-        else if (func_name == "min" || func_name == "max")
+        vector<ExternalSort::Key> sort_keys;
+        for (const auto &key : order_by)
         {
-            int col_idx = table->get_column_index(col_expr);
-            if (col_idx == -1 || group_rows.empty())
-                return Value();
-
-            Value result = group_rows[0][col_idx];
-            for (int i = 1; i < group_rows.size(); ++i)
+            int idx(column_index(key.first));
+            if (idx == NOT_FOUND)
             {
-                const Value &val = group_rows[i][col_idx];
-                if (func_name == "min")
-                {
-                    if (val < result)
-                        result = val;
-                }
-                else // max
-                {
-                    if (val > result)
-                        result = val;
-                }
+                _out << "\nColumn '" << key.first << "' not found in ORDER BY\n";
+                return false;
             }
-            return result;
+            int pos(find(sort_indices.begin(), sort_indices.end(), idx) - sort_indices.begin());
+            if (pos == sort_indices.size())
+                sort_indices.push_back(idx);
+            sort_keys.push_back({pos, key.second});
         }
 
-        return Value();
-    }
+        int limit_op(NOT_FOUND), sort_op(NOT_FOUND), project_op(NOT_FOUND), scan_op(NOT_FOUND);
+        if (_profile)
+        {
+            int depth(0);
+            plan_top(limit, order_by, limit_op, sort_op, depth);
+            project_op = _profile->add("Project", select_part, depth++);
+            scan_op = _profile->add("View Scan on " + view_name, "", depth);
+            if (!_profile->analyze())
+                return true;
+        }
 
-    string get_group_key(const Row &row, const vector<int> &group_col_indices)
-    {
-        string key;
-        for (int i(0); i < group_col_indices.size(); ++i)
+        Pipeline pipeline;
+        PrintSink *sink(build_top(pipeline, display_col_names.size(), limit, limit_op, sort_keys, sort_indices.size(), sort_op));
+        pipeline.add<Project>(_profile, project_op, sort_indices);
+
+        print_header(display_col_names);
+        RowsScan scan(pipeline.head(), _profile, scan_op, [&]
+                      { return view->rows(); });
+        scan.run();
+        print_footer(sink->rows());
+        if (_profile)
         {
-            if (i > 0)
-                key += "|";
-            key += row[group_col_indices[i]].to_string();
+            _profile->stat(scan_op, "groups", view->group_count());
+            _profile->stat(scan_op, "bytes", view->bytes());
         }
-        return key;
+        return true;
     }
 
-    bool evaluate_having(const vector<Row> &group_rows, const Table *table, const string &having_cond)
+    // The partitions `column LIKE pattern` may find rows in: those of the texts starting with the
+    // pattern's literal prefix, which range from the prefix up to before its successor. ILIKE, a
+    // pattern starting with a wildcard and a column that is not text leave all of them
+    static vector<int> prune_like(const Partitioning &scheme, Comparison::Op cmp, const string &pattern)
     {
-        if (having_cond.empty())
-            return true;
-
-        // Parse the having condition to check if it involves aggregate functions
-        vector<string> operators = {">=", "<=", "!=", "=", ">", "<"};
-        string op;
-        int op_pos = -1;
+        bool exact(false);
+        string prefix(LikePattern(Comparison::unquote(pattern), false).prefix(exact));
+        if (cmp == Comparison::ILIKE || prefix.empty() || scheme.column_type != "VARCHAR")
+            return scheme.all();
+        if (exact)
+            return scheme.prune("=", Value(prefix));
+        vector<int> kept(scheme.prune(">=", Value(prefix))), below, merged;
+        string successor(prefix);
+        while (!successor.empty() && (unsigned char)successor.back() == 0xFF)
+            successor.pop_back();
+        if (successor.empty())
+            return kept;
+        ++successor.back();
+        below = scheme.prune("<", Value(successor));
+        set_intersection(kept.begin(), kept.end(), below.begin(), below.end(), back_inserter(merged));
+        return merged;
+    }
 
-        for (const auto &o : operators)
+    // The partitions a WHERE condition may find rows in, in partition order: a comparison on the
+    // partition column narrows them down, AND keeps those every part leaves and OR those any part
+    // leaves. Any other comparison, and NOT, leaves all of them
+    static vector<int> prune(const Partitioning &scheme, const Predicate &where)
+    {
+        vector<int> kept, part, merged;
+        switch (where.kind)
+        {
+        case Predicate::LEAF:
         {
-            int pos = having_cond.find(o);
-            if (pos != string::npos)
+            string lhs, rhs;
+            Comparison::Op cmp(Comparison::split(where.condition, lhs, rhs));
+            if (cmp == Comparison::NONE || lhs != scheme.column)
+                return scheme.all();
+            if (Comparison::is_like(cmp))
+                return prune_like(scheme, cmp, rhs);
+            return scheme.prune(Comparison::symbol(cmp), Comparison::literal(Column(scheme.column, scheme.column_type), rhs));
+        }
+        case Predicate::AND:
+            kept = scheme.all();
+            for (const auto &child : where.children)
+            {
+                part = prune(scheme, child);
+                merged.clear();
+                set_intersection(kept.begin(), kept.end(), part.begin(), part.end(), back_inserter(merged));
+                kept.swap(merged);
+            }
+            return kept;
+        case Predicate::OR:
+            for (const auto &child : where.children)
             {
-                op = o;
-                op_pos = pos;
-                break;
+                part = prune(scheme, child);
+                merged.clear();
+                set_union(kept.begin(), kept.end(), part.begin(), part.end(), back_inserter(merged));
+                kept.swap(merged);
             }
+            return kept;
+        default:
+            return scheme.all();
         }
+    }
 
-        if (op_pos == -1)
-            return true;
-
-        string lhs_str = Helper::trim(having_cond.substr(0, op_pos));
-        string rhs_str = Helper::trim(having_cond.substr(op_pos + op.size()));
-
-        Value lhs_value;
-        if (is_aggregate_function(lhs_str))
-            lhs_value = compute_aggregate(lhs_str, group_rows, table);
-        else
+    // Whether a plain COUNT(*) list can be answered with the sizes of the bitmaps a WHERE condition
+    // the indexes answer exactly leaves, without reading a row
+    static bool counts_rows_only(const AggregatePlan &plan, const vector<HashAggregate::Output> &outputs)
+    {
+        for (const auto &spec : plan.specs)
         {
-            int col_idx = table->get_column_index(lhs_str);
-            if (col_idx > -1 && !group_rows.empty())
-                lhs_value = group_rows[0][col_idx];
+            if (spec.kind != AggregateSpec::COUNT_ROWS)
+                return false;
         }
-
-        Value rhs_value;
-        if (rhs_str == "NULL")
-            rhs_value = Value();
-        else if (is_aggregate_function(rhs_str))
-            rhs_value = compute_aggregate(rhs_str, group_rows, table);
-        else
+        for (const auto &output : outputs)
         {
-            if (rhs_str.find('.') != string::npos)
-                rhs_value = Value(atof(rhs_str.c_str()));
-            else if (isdigit(rhs_str[0]) || rhs_str[0] == '-')
-                rhs_value = Value(atoi(rhs_str.c_str()));
-            else
-                rhs_value = Value(rhs_str);
+            if (output.slot == NOT_FOUND)
+                return false;
         }
+        return !outputs.empty();
+    }
 
-        if (op == "=")
-            return lhs_value == rhs_value;
-        else if (op == "!=")
-            return !(lhs_value == rhs_value);
-        else if (op == ">")
-            return lhs_value > rhs_value;
-        else if (op == "<")
-            return lhs_value < rhs_value;
-        else if (op == ">=")
-            return lhs_value > rhs_value || lhs_value == rhs_value;
-        else if (op == "<=")
-            return lhs_value < rhs_value || lhs_value == rhs_value;
-
-        return true;
+    static string partitions_detail(const Partitioning &scheme, const vector<Table *> &partitions)
+    {
+        vector<string> names;
+        for (const Table *t : partitions)
+            names.push_back(t->get_name().substr(scheme.table.size() + 1));
+        return to_string(partitions.size()) + " of " + to_string(scheme.names.size()) + " partitions" +
+               (names.empty() ? "" : ": " + join_names(names));
     }
 
 public:
-    SelectParser(Catalog *cat) : _catalog(cat) {}
+    SelectParser(Catalog *cat, ostream &out = cout) : _catalog(cat), _out(out), _profile(nullptr), _transaction(nullptr) {}
+
+    void set_profile(QueryProfile *profile) { _profile = profile; }
+    void set_transaction(Transaction *transaction) { _transaction = transaction; }
 
-    bool parse_and_select(const string &line, AST &out_ast)
+    bool parse_and_select(const string &line, AST &/*out_ast*/)
     {
+        Metrics::Timer statement_timer(Metrics::SELECT_STATEMENT);
         string s(Helper::trim(line));
         if (s.empty())
             return false;
@@ -373,14 +412,29 @@ public:
         string where_condition;
         vector<string> group_by_cols;
         string having_condition;
+        vector<pair<string, bool>> order_by;
+        int limit(NOT_FOUND);
 
         int where_pos(lower.find("where", pos)),
             group_by_pos(lower.find("group by", pos)),
-            having_pos(lower.find("having"));
+            having_pos(lower.find("having")),
+            order_by_pos(lower.find("order by", pos)),
+            limit_pos(lower.find(" limit ", pos));
+        if (limit_pos != string::npos)
+            ++limit_pos;
+        auto clause_end([&](int from)
+                        {
+            int end(s.size());
+            for (int next : {group_by_pos, having_pos, order_by_pos, limit_pos})
+            {
+                if (next != string::npos && next > from && next < end)
+                    end = next;
+            }
+            return end; });
 
         if (where_pos != string::npos)
         {
-            int where_end((group_by_pos != string::npos && group_by_pos > where_pos) ? group_by_pos : s.size());
+            int where_end(clause_end(where_pos));
             where_condition = Helper::trim(s.substr(where_pos + 5, where_end - where_pos - 5));
         }
 
@@ -390,7 +444,7 @@ public:
             while (group_start < s.size() && isspace(s[group_start]))
                 ++group_start;
 
-            int group_end((having_pos != string::npos && having_pos > group_by_pos) ? having_pos : s.size());
+            int group_end(clause_end(group_by_pos));
             string group_by_str = Helper::trim(s.substr(group_start, group_end - group_start));
 
             if (!group_by_str.empty())
@@ -406,17 +460,44 @@ public:
             int having_start(having_pos + 6);
             while (having_start < s.size() && isspace(s[having_start]))
                 ++having_start;
-            having_condition = Helper::trim(s.substr(having_start));
+            having_condition = Helper::trim(s.substr(having_start, clause_end(having_pos) - having_start));
         }
 
+        if (order_by_pos != string::npos &&
+            !parse_order_by(Helper::trim(s.substr(order_by_pos + 8, clause_end(order_by_pos) - order_by_pos - 8)), order_by))
+            return false;
+
+        if (limit_pos != string::npos &&
+            !parse_limit(Helper::trim(s.substr(limit_pos + 5, clause_end(limit_pos) - limit_pos - 5)), limit))
+            return false;
+
+        // A partitioned table is read from the partitions its WHERE condition leaves; the first
+        // stands in for the table where only the columns matter
+        Predicate where(Predicate::parse(where_condition));
         Table *table(_catalog->getTable(table_name));
+        shared_ptr<const Partitioning> scheme(table ? nullptr : _catalog->partitioning(table_name));
+        vector<Table *> partitions;
+        if (scheme)
+        {
+            partitions = _catalog->get_partitions(*scheme, prune(*scheme, where));
+            table = partitions.empty() ? _catalog->getTable(scheme->partition_table(0)) : partitions[0];
+        }
         if (!table)
         {
-            cout << "\nTable '" << table_name << "' not found\n";
+            string error;
+            MaterializedView *view(MaterializedView::open(_catalog, table_name, error));
+            if (!error.empty())
+                _out << "\n" << error << "\n";
+            else if (!view)
+                _out << "\nTable '" << table_name << "' not found\n";
+            else if (!where_condition.empty() || !group_by_cols.empty() || !having_condition.empty())
+                _out << "\nA materialized view is read with SELECT ... FROM view [ORDER BY ...] [LIMIT n]\n";
+            else
+                return select_from_view(view, table_name, select_part, col_names, order_by, limit);
             return false;
         }
 
-        // Check if we have aggregates without GROUP BY
+        // Aggregates without GROUP BY treat the entire table as one group
         bool has_aggregates_no_groupby = false;
         if (group_by_cols.empty() && select_part != "*")
         {
@@ -429,183 +510,227 @@ public:
                 }
             }
         }
+        bool aggregating(has_aggregates_no_groupby || !group_by_cols.empty());
 
-        // Handle aggregates without GROUP BY (treat entire table as one group)
-        if (has_aggregates_no_groupby)
-        {
-            vector<Row> all_rows;
-            for (const auto &row : table->get_rows())
-            {
-                if (!where_condition.empty() && !evaluate_condition(row, table, where_condition))
-                    continue;
-                all_rows.push_back(row);
-            }
+        if (has_aggregates_no_groupby) // a single row is already in order
+            order_by.clear();
 
-            // Print header
-            for (int i(0); i < col_names.size(); ++i)
-            {
-                cout << col_names[i];
-                if (i + 1 < col_names.size())
-                    cout << " | ";
-            }
-            cout << "\n";
-
-            // Print single row with aggregate results
-            for (int i(0); i < col_names.size(); ++i)
-            {
-                if (is_aggregate_function(col_names[i]))
-                {
-                    Value agg_result(compute_aggregate(col_names[i], all_rows, table));
-                    cout << agg_result.to_string();
-                }
-                else
-                {
-                    // Non-aggregate column without GROUP BY - use first row value
-                    int col_idx(table->get_column_index(col_names[i]));
-                    if (col_idx > -1 && !all_rows.empty())
-                        cout << all_rows[0][col_idx].to_string();
-                }
-
-                if (i + 1 < col_names.size())
-                    cout << " | ";
-            }
-            cout << "\n\n1 row(s) returned\n";
-            return true;
-        }
-
-        if (!group_by_cols.empty())
+        // Resolve every name the plan uses before anything runs
+        vector<string> display_col_names;
+        vector<int> sort_indices; // a plain select projects its columns, then any sort column not among them
+        vector<int> group_col_indices;
+        vector<ValueOps> group_ops;
+        vector<HashAggregate::Output> outputs;
+        vector<ExternalSort::Key> sort_keys;
+        AggregatePlan plan;
+        if (aggregating)
         {
-            vector<int> group_col_indices;
+            if (!plan_aggregates(col_names, having_condition, table, plan))
+                return false;
             for (const auto &col : group_by_cols)
             {
                 int idx(table->get_column_index(col));
-                if (idx == -1)
+                if (idx == NOT_FOUND)
                 {
-                    cout << "\nColumn '" << col << "' not found in GROUP BY\n";
+                    _out << "\nColumn '" << col << "' not found in GROUP BY\n";
                     return false;
                 }
                 group_col_indices.push_back(idx);
+                group_ops.push_back(ValueOps::for_column(table->get_column(idx)));
             }
 
-            unordered_map<string, vector<Row>> groups;
-            for (const auto &row : table->get_rows())
+            display_col_names = select_part == "*" ? group_by_cols : col_names;
+            for (const auto &col : display_col_names)
+                outputs.push_back(aggregate_output(plan, col, table));
+            // grouped rows are sorted on their output columns
+            if (!output_sort_keys(order_by, display_col_names, sort_keys))
+                return false;
+            for (auto &key : sort_keys)
             {
-                if (!where_condition.empty() && !evaluate_condition(row, table, where_condition))
-                    continue;
-
-                string key(get_group_key(row, group_col_indices));
-                groups[key].push_back(row);
+                if (outputs[key.column].slot == NOT_FOUND && outputs[key.column].column != NOT_FOUND)
+                    key.ops = ValueOps::for_column(table->get_column(outputs[key.column].column));
             }
-
-            vector<string> display_col_names;
-            bool has_aggregates(false);
-
+        }
+        else
+        {
             if (select_part == "*")
             {
-                for (const auto &col : group_by_cols)
-                    display_col_names.push_back(col);
+                for (int i(0); i < table->get_column_count(); ++i)
+                {
+                    sort_indices.push_back(i);
+                    display_col_names.push_back(table->get_column(i).get_name());
+                }
             }
             else
             {
                 for (const auto &col : col_names)
                 {
+                    int idx(table->get_column_index(col));
+                    if (idx == NOT_FOUND)
+                    {
+                        _out << "\nColumn '" << col << "' not found\n";
+                        return false;
+                    }
+                    sort_indices.push_back(idx);
                     display_col_names.push_back(col);
-                    if (is_aggregate_function(col))
-                        has_aggregates = true;
                 }
             }
 
-            print_header(display_col_names, table);
-
-            int row_count(0);
-            for (const auto &group_pair : groups)
+            for (const auto &key : order_by)
             {
-                const vector<Row> &group_rows = group_pair.second;
-
-                if (!having_condition.empty() && !evaluate_having(group_rows, table, having_condition))
-                    continue;
-
-                if (select_part == "*")
+                int idx(table->get_column_index(key.first));
+                if (idx == NOT_FOUND)
                 {
-                    for (int i(0); i < group_col_indices.size(); ++i)
-                    {
-                        cout << group_rows[0][group_col_indices[i]].to_string();
-                        if (i + 1 < group_col_indices.size())
-                            cout << " | ";
-                    }
-                    cout << "\n";
-                }
-                else
-                {
-                    for (int i(0); i < col_names.size(); ++i)
-                    {
-                        if (is_aggregate_function(col_names[i]))
-                        {
-                            Value agg_result(compute_aggregate(col_names[i], group_rows, table));
-                            cout << agg_result.to_string();
-                        }
-                        else
-                        {
-                            int col_idx(table->get_column_index(col_names[i]));
-                            if (col_idx > -1)
-                                cout << group_rows[0][col_idx].to_string();
-                        }
-
-                        if (i + 1 < col_names.size())
-                            cout << " | ";
-                    }
-                    cout << "\n";
+                    _out << "\nColumn '" << key.first << "' not found in ORDER BY\n";
+                    return false;
                 }
-                ++row_count;
+                int pos(find(sort_indices.begin(), sort_indices.end(), idx) - sort_indices.begin());
+                if (pos == sort_indices.size())
+                    sort_indices.push_back(idx);
+                sort_keys.push_back({pos, key.second, ValueOps::for_column(table->get_column(idx))});
             }
-
-            cout << '\n'
-                 << row_count
-                 << " row(s) returned\n";
-            return true;
         }
 
-        vector<int> col_indices;
-        vector<string> display_col_names;
-
-        if (select_part == "*")
+        // Where the WHERE condition's comparisons are on columns with bitmap indexes, the indexes
+        // pick the rows to read; the Filter then only checks what they cannot answer exactly
+        BoundPredicate bound(where, table);
+        vector<Text> indexes_used;
+        BitmapMatch planned;
+        table->inspect_bitmap_indexes([&]
+                                      { planned = BitmapMatch::of(bound, *table, false, &indexes_used); });
+        bool bitmap_scan(!where_condition.empty() && !planned.all && !indexes_used.empty());
+        // WHERE <primary key> = literal reads the one row the key index names, when it can
+        bool pk_lookup(!bitmap_scan && bound.kind == Predicate::LEAF && bound.cmp == Comparison::EQ &&
+                       bound.column != NOT_FOUND && table->is_single_pk() &&
+                       table->pk_column_names()[0] == table->get_column(bound.column).get_name());
+        bool exact(bitmap_scan && planned.exact);
+        bool count_only(exact && has_aggregates_no_groupby && having_condition.empty() && counts_rows_only(plan, outputs));
+
+        int limit_op(NOT_FOUND), sort_op(NOT_FOUND), top_op(NOT_FOUND), filter_op(NOT_FOUND), scan_op(NOT_FOUND);
+        if (_profile)
         {
-            for (int i(0); i < table->get_column_count(); ++i)
-            {
-                col_indices.push_back(i);
-                display_col_names.push_back(table->get_column(i).get_name());
-            }
+            int depth(0);
+            plan_top(limit, order_by, limit_op, sort_op, depth);
+            if (has_aggregates_no_groupby)
+                top_op = _profile->add("Aggregate", select_part, depth++);
+            else if (aggregating)
+                top_op = _profile->add("HashAggregate", "group by " + join_names(group_by_cols) +
+                                                            (having_condition.empty() ? "" : ", having " + having_condition),
+                                       depth++);
+            else
+                top_op = _profile->add("Project", select_part, depth++);
+            if (!where_condition.empty() && !exact)
+                filter_op = _profile->add("Filter", where_condition, depth++);
+            string detail(scheme ? partitions_detail(*scheme, partitions) : "");
+            if (bitmap_scan)
+                detail = "using " + join_names(indexes_used) + (detail.empty() ? "" : ", " + detail);
+            else if (pk_lookup)
+                detail = "using primary key" + (detail.empty() ? "" : ", " + detail);
+            scan_op = _profile->add((bitmap_scan ? "Bitmap Scan on " : pk_lookup ? "Index Scan on " : "Seq Scan on ") + table_name, detail, depth);
+            if (!_profile->analyze())
+                return true;
         }
-        else
+
+        print_header(display_col_names);
+        // readers see the last committed statement, writers are not blocked. A partition dropped
+        // since it was looked up has no rows any more
+        if (!scheme)
+            partitions.push_back(table);
+        vector<unique_ptr<Table::ReadView>> views;
+        vector<TableScan::Source> sources;
+        int64_t slots(0);
+        // A bitmap scan reads the rows the indexes leave, plus those changed since the snapshot,
+        // whose indexed values may be newer than the ones it sees. Those are checked again, as are
+        // a source's rows when its indexes cannot serve the snapshot
+        vector<Bitmap> candidates(partitions.size());
+        bool recheck(!where_condition.empty() && !exact);
+        uint64_t bitmap_rows(0), changed_rows(0), pk_lookups(0);
+        for (Table *partition : partitions)
         {
-            for (const auto &col : col_names)
+            views.emplace_back(new Table::ReadView(partition, _transaction ? _transaction->id() : 0));
+            if (partition->is_dropped())
+                continue;
+            TableScan::Source source{partition, views.back().get()};
+            if (bitmap_scan)
             {
-                int idx(table->get_column_index(col));
-                if (idx == -1)
+                BitmapMatch match;
+                Bitmap changed;
+                if (!partition->read_bitmap_indexes(*views.back(), [&]
+                                                    { match = BitmapMatch::of(bound, *partition, true); }, changed) ||
+                    match.all)
+                    recheck = true;
+                else
                 {
-                    cout << "\nColumn '" << col << "' not found\n";
-                    return false;
+                    bitmap_rows += match.rows.cardinality();
+                    changed_rows += changed.cardinality();
+                    recheck = recheck || !changed.empty();
+                    candidates[sources.size()] = changed.empty() ? move(match.rows) : Bitmap::unite(match.rows, changed);
+                    source.rows = &candidates[sources.size()];
                 }
-                col_indices.push_back(idx);
-                display_col_names.push_back(col);
             }
+            int found(NOT_FOUND);
+            if (pk_lookup && partition->find_by_pk(*views.back(), bound.column, bound.literal, found))
+            {
+                if (found != NOT_FOUND)
+                    candidates[sources.size()].add(found);
+                source.rows = &candidates[sources.size()];
+                ++pk_lookups;
+            }
+            sources.push_back(source);
+            slots += source.rows ? source.rows->cardinality() : partition->scan_slots();
         }
 
-        print_header(display_col_names, table);
-
-        int row_count(0);
-        for (const auto &row : table->get_rows())
+        // The indexes alone give COUNT(*) when every source could take its rows from them unchanged
+        if (count_only && !recheck)
         {
-            if (!where_condition.empty() && !evaluate_condition(row, table, where_condition))
-                continue;
-
-            print_row(row, col_indices, table);
-            ++row_count;
+            uint64_t total(0);
+            for (const auto &source : sources)
+                total += source.rows->cardinality();
+            Pipeline pipeline;
+            PrintSink *sink(build_top(pipeline, display_col_names.size(), limit, limit_op, sort_keys, display_col_names.size(), sort_op));
+            RowsScan counts(pipeline.head(), _profile, top_op, [&]
+                            { return vector<Row>{Row(vector<Value>(outputs.size(), Value((int)total)))}; });
+            counts.run();
+            print_footer(sink->rows());
+            if (_profile)
+                _profile->stat(scan_op, "counted", total);
+            return true;
         }
 
-        cout << "\n"
-             << row_count << " row(s) returned\n";
-
+        // Operators from the sink up; the scan then pushes the table through them a block at a time.
+        // A large table is aggregated by several workers, each through a filter and table of its own
+        Pipeline pipeline;
+        int width(display_col_names.size());
+        PrintSink *sink(build_top(pipeline, width, limit, limit_op, sort_keys, aggregating ? width : sort_indices.size(), sort_op));
+        int workers(aggregating ? Table::scan_workers(slots) : 1);
+        vector<Pipeline> worker_pipelines(workers > 1 ? workers : 0);
+        vector<Operator *> worker_heads;
+        if (aggregating)
+        {
+            HashAggregate *agg(pipeline.add<HashAggregate>(_profile, top_op, plan, group_col_indices, group_ops, outputs, compile_having(having_condition, plan, table)));
+            for (auto &worker : worker_pipelines)
+            {
+                worker.add<HashAggregate::Partial>(*agg);
+                if (recheck)
+                    worker.add<Filter>(_profile, filter_op, table, where_condition);
+                worker_heads.push_back(worker.head());
+            }
+        }
+        else
+            pipeline.add<Project>(_profile, top_op, sort_indices);
+        if (recheck && worker_heads.empty())
+            pipeline.add<Filter>(_profile, filter_op, table, where_condition);
+
+        TableScan scan(pipeline.head(), _profile, scan_op, move(sources));
+        scan.run(worker_heads);
+        print_footer(sink->rows());
+        if (_profile && bitmap_scan)
+        {
+            _profile->stat(scan_op, "bitmap_rows", bitmap_rows);
+            _profile->stat(scan_op, "changed_rows", changed_rows);
+        }
+        if (_profile && pk_lookup) // the rest were scanned: written to since the snapshot
+            _profile->stat(scan_op, "pk_lookups", pk_lookups);
         return true;
     }
 };
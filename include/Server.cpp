@@ -0,0 +1,303 @@
+#ifndef SERVER
+#define SERVER
+
+#include "Session.cpp"
+#include "ThreadPool.cpp"
+#include "Protocol.cpp"
+#include <memory>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+// One epoll thread owns every socket; statements run on the worker pool against the shared Catalog.
+// A connection has at most one statement in flight so its responses come back in request order.
+// Its Session lives as long as it does, so a transaction can span statements run by different workers.
+class Server
+{
+    struct Connection
+    {
+        int fd;
+        string inbuf;
+        string outbuf;
+        deque<string> pending;
+        bool busy = false;
+        bool closing = false;     // peer went away, close once the running statement returns
+        bool close_after = false; // client said exit, close once the goodbye is flushed
+        ostringstream out;        // the session's output, one statement at a time
+        unique_ptr<Session> session;
+    };
+
+    Catalog *_catalog;
+    ThreadPool _pool;
+    int _epoll_fd;
+    int _wake_fd;
+    vector<int> _listen_fds;
+    unordered_map<int, shared_ptr<Connection>> _conns; // fd -> connection
+    mutex _done_mutex;
+    vector<pair<shared_ptr<Connection>, string>> _done; // finished statements waiting to be sent
+    atomic<bool> _running;
+
+    void watch(int fd, uint32_t events, int op)
+    {
+        epoll_event ev{};
+        ev.events = events;
+        ev.data.fd = fd;
+        epoll_ctl(_epoll_fd, op, fd, &ev);
+    }
+
+    bool is_listener(int fd) const
+    {
+        return find(_listen_fds.begin(), _listen_fds.end(), fd) != _listen_fds.end();
+    }
+
+    void accept_all(int listen_fd)
+    {
+        while (true)
+        {
+            int fd(accept4(listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC));
+            if (fd < 0)
+                return;
+
+            int yes(1);
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+
+            auto conn(make_shared<Connection>());
+            conn->fd = fd;
+            _conns[fd] = conn;
+            watch(fd, EPOLLIN | EPOLLRDHUP, EPOLL_CTL_ADD);
+        }
+    }
+
+    // An open transaction is rolled back on a worker: it may wait for table locks, the event loop must not
+    void release_session(const shared_ptr<Connection> &conn)
+    {
+        if (conn->session && conn->session->in_transaction())
+            _pool.submit([conn]()
+                         { conn->session.reset(); });
+    }
+
+    void close_connection(const shared_ptr<Connection> &conn)
+    {
+        if (conn->closing)
+            return;
+
+        epoll_ctl(_epoll_fd, EPOLL_CTL_DEL, conn->fd, nullptr);
+        conn->closing = true;
+        conn->pending.clear();
+        if (conn->busy) // the fd stays open so it cannot be reused before the worker reports back
+            return;
+
+        ::close(conn->fd);
+        release_session(conn);
+        _conns.erase(conn->fd);
+    }
+
+    void flush(const shared_ptr<Connection> &conn)
+    {
+        while (!conn->outbuf.empty())
+        {
+            ssize_t n(::send(conn->fd, conn->outbuf.data(), conn->outbuf.size(), MSG_NOSIGNAL));
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                break;
+            if (n <= 0)
+            {
+                close_connection(conn);
+                return;
+            }
+            conn->outbuf.erase(0, n);
+        }
+
+        if (!conn->outbuf.empty())
+            watch(conn->fd, EPOLLIN | EPOLLOUT | EPOLLRDHUP, EPOLL_CTL_MOD);
+        else if (conn->close_after)
+            close_connection(conn);
+        else
+            watch(conn->fd, EPOLLIN | EPOLLRDHUP, EPOLL_CTL_MOD);
+    }
+
+    void dispatch_next(const shared_ptr<Connection> &conn)
+    {
+        if (conn->busy || conn->closing || conn->close_after || conn->pending.empty())
+            return;
+
+        string statement(move(conn->pending.front()));
+        conn->pending.pop_front();
+
+        if (Session::is_exit(statement))
+        {
+            conn->close_after = true;
+            conn->outbuf += Protocol::encode("\nGoodbye!\n");
+            flush(conn);
+            return;
+        }
+
+        conn->busy = true;
+        _pool.submit([this, conn, statement]()
+                     {
+            ostringstream &out(conn->out);
+            out.str("");
+            if (!conn->session)
+                conn->session = make_unique<Session>(_catalog, out);
+            try
+            {
+                conn->session->execute(statement);
+            }
+            catch (const exception &e)
+            {
+                out << "\nError: " << e.what() << "\n";
+            }
+
+            {
+                lock_guard<mutex> lock(_done_mutex);
+                _done.emplace_back(conn, out.str());
+            }
+            uint64_t one(1);
+            ssize_t ignored(::write(_wake_fd, &one, sizeof(one)));
+            (void)ignored; });
+    }
+
+    void read_from(const shared_ptr<Connection> &conn)
+    {
+        char chunk[16384];
+        while (true)
+        {
+            ssize_t n(::recv(conn->fd, chunk, sizeof(chunk), 0));
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                break;
+            if (n <= 0)
+            {
+                close_connection(conn);
+                return;
+            }
+            conn->inbuf.append(chunk, n);
+        }
+
+        try
+        {
+            string statement;
+            while (Protocol::decode(conn->inbuf, statement))
+                conn->pending.push_back(move(statement));
+        }
+        catch (const length_error &e)
+        {
+            close_connection(conn);
+            return;
+        }
+        dispatch_next(conn);
+    }
+
+    void drain_finished()
+    {
+        uint64_t count(0);
+        ssize_t ignored(::read(_wake_fd, &count, sizeof(count)));
+        (void)ignored;
+
+        vector<pair<shared_ptr<Connection>, string>> finished;
+        {
+            lock_guard<mutex> lock(_done_mutex);
+            finished.swap(_done);
+        }
+
+        for (auto &item : finished)
+        {
+            auto &conn(item.first);
+            conn->busy = false;
+            if (conn->closing)
+            {
+                ::close(conn->fd);
+                release_session(conn);
+                _conns.erase(conn->fd);
+                continue;
+            }
+            conn->outbuf += Protocol::encode(item.second);
+            flush(conn);
+            dispatch_next(conn);
+        }
+    }
+
+public:
+    Server(Catalog *catalog, int threads)
+        : _catalog(catalog), _pool(threads), _epoll_fd(epoll_create1(EPOLL_CLOEXEC)),
+          _wake_fd(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)), _running(false)
+    {
+        if (_epoll_fd < 0 || _wake_fd < 0)
+            throw runtime_error("server: cannot create epoll/eventfd");
+        watch(_wake_fd, EPOLLIN, EPOLL_CTL_ADD);
+    }
+
+    ~Server()
+    {
+        _pool.shutdown();
+        for (auto &entry : _conns)
+            ::close(entry.first);
+        for (int fd : _listen_fds)
+            ::close(fd);
+        ::close(_wake_fd);
+        ::close(_epoll_fd);
+    }
+
+    bool listen_tcp(const string &host, int port)
+    {
+        int fd(Protocol::listen_tcp(host, port));
+        if (fd < 0 || !Protocol::set_nonblocking(fd))
+            return false;
+        _listen_fds.push_back(fd);
+        watch(fd, EPOLLIN, EPOLL_CTL_ADD);
+        return true;
+    }
+
+    bool listen_unix(const string &path)
+    {
+        int fd(Protocol::listen_unix(path));
+        if (fd < 0 || !Protocol::set_nonblocking(fd))
+            return false;
+        _listen_fds.push_back(fd);
+        watch(fd, EPOLLIN, EPOLL_CTL_ADD);
+        return true;
+    }
+
+    void run(const atomic<bool> &stop_requested)
+    {
+        _running = true;
+        epoll_event events[64];
+
+        while (_running && !stop_requested)
+        {
+            int n(epoll_wait(_epoll_fd, events, 64, 500));
+            for (int i(0); i < n; ++i)
+            {
+                int fd(events[i].data.fd);
+
+                if (fd == _wake_fd)
+                {
+                    drain_finished();
+                    continue;
+                }
+                if (is_listener(fd))
+                {
+                    accept_all(fd);
+                    continue;
+                }
+
+                auto it(_conns.find(fd));
+                if (it == _conns.end())
+                    continue;
+                shared_ptr<Connection> conn(it->second);
+
+                if (events[i].events & EPOLLOUT)
+                    flush(conn);
+                if (!conn->closing && events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+                    read_from(conn);
+            }
+        }
+
+        _running = false;
+    }
+
+    void stop() { _running = false; }
+};
+
+#endif
@@ -0,0 +1,246 @@
+#ifndef SESSION
+#define SESSION
+
+#include "CreateParse.cpp"
+#include "InsertParser.cpp"
+#include "SelectParser.cpp"
+#include "UpdateParser.cpp"
+#include "DeleteParser.cpp"
+#include "Transaction.cpp"
+
+// Dispatches one statement to the matching parser; every client (REPL or socket) gets its own Session,
+// which holds the client's open transaction and rolls it back if the client goes away
+class Session
+{
+    Catalog *_catalog;
+    ostream &_out;
+    Transaction _transaction;
+    WriteQueue::Durability _durability;
+    CreateParser create_parser;
+    InsertParser insert_parser;
+    SelectParser select_parser;
+    UpdateParser update_parser;
+    DeleteParser delete_parser;
+
+    void set_profile(QueryProfile *profile)
+    {
+        create_parser.set_profile(profile);
+        insert_parser.set_profile(profile);
+        select_parser.set_profile(profile);
+        update_parser.set_profile(profile);
+        delete_parser.set_profile(profile);
+    }
+
+    bool dispatch(const string &cmd)
+    {
+        AST ast;
+        bool success(false);
+
+        if (Helper::starts_with_prefix(cmd, "create materialized view"))
+            success = create_parser.parse_and_create_view(cmd, ast);
+        else if (Helper::starts_with_prefix(cmd, "create bitmap index") || Helper::starts_with_prefix(cmd, "create index"))
+        {
+            if (_transaction.active())
+            {
+                Metrics::add(Metrics::STATEMENT_ERRORS);
+                _out << "\nCREATE INDEX cannot run inside a transaction\n";
+                return false;
+            }
+            success = create_parser.parse_and_create_index(cmd, ast);
+        }
+        else if (Helper::starts_with_prefix(cmd, "create"))
+            success = create_parser.parse_and_create(cmd, ast);
+        else if (Helper::starts_with_prefix(cmd, "alter"))
+        {
+            if (_transaction.active())
+            {
+                Metrics::add(Metrics::STATEMENT_ERRORS);
+                _out << "\nALTER TABLE cannot run inside a transaction\n";
+                return false;
+            }
+            success = create_parser.parse_and_alter(cmd, ast);
+        }
+        else if (Helper::starts_with_prefix(cmd, "insert"))
+            success = insert_parser.parse_and_insert(cmd, ast);
+        else if (Helper::starts_with_prefix(cmd, "select"))
+            success = select_parser.parse_and_select(cmd, ast);
+        else if (Helper::starts_with_prefix(cmd, "update"))
+            success = update_parser.parse_and_update(cmd, ast);
+        else if (Helper::starts_with_prefix(cmd, "delete"))
+            success = delete_parser.parse_and_delete(cmd, ast);
+        else
+        {
+            Metrics::add(Metrics::STATEMENT_ERRORS);
+            _out << "\nUnknown SQL command: '" << cmd << "'\n"
+                 << "Type 'help' to see available commands\n";
+            return false;
+        }
+
+        if (!success)
+        {
+            Metrics::add(Metrics::STATEMENT_ERRORS);
+            _out << "Syntax error. Type 'help' for correct syntax\n";
+        }
+
+        return success;
+    }
+
+    // BEGIN, COMMIT and ROLLBACK; false when `cmd` is none of them
+    bool transaction_command(const string &cmd, bool &success)
+    {
+        success = false;
+        if (cmd == "begin" || cmd == "begin transaction" || cmd == "start transaction")
+        {
+            if (_transaction.active())
+                _out << "\nA transaction is already in progress\n";
+            else
+            {
+                _transaction.begin();
+                _out << "\nTransaction started\n";
+                success = true;
+            }
+        }
+        else if (cmd == "commit" || cmd == "rollback")
+        {
+            if (!_transaction.active())
+                _out << "\nNo transaction in progress\n";
+            else if (cmd == "commit")
+            {
+                int tables(_transaction.commit());
+                _out << "\nTransaction committed: " << tables << " table(s) written\n";
+                success = true;
+            }
+            else
+            {
+                _transaction.rollback();
+                _out << "\nTransaction rolled back\n";
+                success = true;
+            }
+        }
+        else
+            return false;
+
+        if (!success)
+            Metrics::add(Metrics::STATEMENT_ERRORS);
+        return true;
+    }
+
+    // EXPLAIN only plans the statement, EXPLAIN ANALYZE runs it and reports what each operator did
+    bool explain(const string &cmd)
+    {
+        string stmt(Helper::trim(cmd.substr(7)));
+        bool analyze(Helper::starts_with_prefix(stmt, "analyze") && (stmt.size() == 7 || isspace(stmt[7])));
+        if (analyze)
+            stmt = Helper::trim(stmt.substr(7));
+
+        QueryProfile profile(analyze);
+        set_profile(&profile);
+        bool success(false);
+        try
+        {
+            success = dispatch(stmt);
+        }
+        catch (...)
+        {
+            set_profile(nullptr);
+            throw;
+        }
+        set_profile(nullptr);
+
+        if (success && !profile.empty())
+            profile.print(_out);
+        return success;
+    }
+
+public:
+    Session(Catalog *catalog, ostream &out = cout)
+        : _catalog(catalog),
+          _out(out),
+          _durability(WriteQueue::instance().get_default_durability()),
+          create_parser(catalog, out),
+          insert_parser(catalog, out),
+          select_parser(catalog, out),
+          update_parser(catalog, out),
+          delete_parser(catalog, out)
+    {
+        insert_parser.set_transaction(&_transaction);
+        select_parser.set_transaction(&_transaction);
+        update_parser.set_transaction(&_transaction);
+        delete_parser.set_transaction(&_transaction);
+    }
+
+    static bool is_exit(const string &cmd)
+    {
+        string lower(Helper::to_lower(Helper::trim(cmd)));
+        return lower == "exit" || lower == "quit";
+    }
+
+    bool in_transaction() const { return _transaction.active(); }
+
+    // Runs one statement; with FLUSH durability it returns once the statement's changes are written
+    bool execute(const string &line)
+    {
+        bool success(run(line));
+        if (_durability == WriteQueue::FLUSH)
+            WriteQueue::instance().flush_own();
+        return success;
+    }
+
+private:
+    bool run(const string &line)
+    {
+        string cmd(Helper::trim(line));
+        if (cmd.empty())
+            return true;
+
+        // the commands below are matched whole, without the statement's trailing ';'
+        string lower(Helper::to_lower(cmd));
+        if (lower.back() == ';')
+            lower = Helper::trim(lower.substr(0, lower.size() - 1));
+        Catalog::Pin pin(_catalog); // tables this statement touches stay loaded until it ends
+
+        if (lower == "help" || lower == "?")
+        {
+            Helper::show_help(_out);
+            return true;
+        }
+
+        if (lower == "show stats")
+        {
+            Metrics::write_table(_out);
+            return true;
+        }
+
+        if (Helper::starts_with_prefix(lower, "set durability"))
+        {
+            string mode(Helper::trim(lower.substr(14)));
+            if (mode == "enqueue" || mode == "flush")
+            {
+                _durability = mode == "flush" ? WriteQueue::FLUSH : WriteQueue::ENQUEUE;
+                _out << "\nDurability: " << mode << "\n";
+                return true;
+            }
+            Metrics::add(Metrics::STATEMENT_ERRORS);
+            _out << "\nDurability is ENQUEUE or FLUSH\n";
+            return false;
+        }
+
+        if (lower == "checkpoint")
+        {
+            int tables(Helper::write_checkpoint(_catalog));
+            _out << "\nCheckpoint written: " << tables << " table(s)\n";
+            return true;
+        }
+
+        bool success(false);
+        if (transaction_command(lower, success))
+            return success;
+
+        if (Helper::starts_with_prefix(cmd, "explain") && (cmd.size() == 7 || isspace(cmd[7])))
+            return explain(cmd);
+
+        return dispatch(cmd);
+    }
+};
+
+#endif
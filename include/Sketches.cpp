@@ -0,0 +1,187 @@
+#ifndef SKETCHES
+#define SKETCHES
+
+#include <vector>
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+
+using namespace std;
+
+// Distinct-value estimate in 2^PRECISION one-byte registers (16 KB, about 0.8% standard error)
+// however many values go in. Each value is added by a 64-bit hash. Sketches merge by keeping the
+// larger register, so partial sketches of groups, partitions or threads combine into exactly the
+// sketch one pass over every value would have built.
+class HyperLogLog
+{
+public:
+    static const int PRECISION = 14;
+    static const uint32_t REGISTERS = 1u << PRECISION;
+
+private:
+    vector<uint8_t> registers; // allocated by the first value
+
+public:
+    // Spreads a weak hash (such as std::hash of a short string) over all 64 bits
+    static uint64_t mix(uint64_t h)
+    {
+        h ^= h >> 30;
+        h *= 0xbf58476d1ce4e5b9ULL;
+        h ^= h >> 27;
+        h *= 0x94d049bb133111ebULL;
+        return h ^ (h >> 31);
+    }
+
+    void add_hash(uint64_t hash)
+    {
+        if (registers.empty())
+            registers.assign(REGISTERS, 0);
+        uint32_t idx(hash >> (64 - PRECISION));
+        uint64_t rest(hash << PRECISION);
+        uint8_t rank(rest ? __builtin_clzll(rest) + 1 : 64 - PRECISION + 1);
+        registers[idx] = max(registers[idx], rank);
+    }
+
+    void merge(const HyperLogLog &o)
+    {
+        if (o.registers.empty())
+            return;
+        if (registers.empty())
+        {
+            registers = o.registers;
+            return;
+        }
+        for (uint32_t i(0); i < REGISTERS; ++i)
+            registers[i] = max(registers[i], o.registers[i]);
+    }
+
+    uint64_t estimate() const
+    {
+        if (registers.empty())
+            return 0;
+        double m(REGISTERS), sum(0);
+        uint32_t zeros(0);
+        for (uint8_t r : registers)
+        {
+            sum += ldexp(1.0, -r);
+            zeros += r == 0;
+        }
+        double e(0.7213 / (1 + 1.079 / m) * m * m / sum);
+        if (e <= 2.5 * m && zeros) // small cardinalities: linear counting over the empty registers
+            e = m * log(m / zeros);
+        return llround(e);
+    }
+
+    size_t bytes() const { return sizeof(*this) + registers.capacity(); }
+};
+
+// Quantile estimate over any number of values in a bounded set of centroids (merging t-digest).
+// The k1 scale function keeps centroids near both tails small, so p99 and p999 stay accurate
+// while the middle of the distribution is summarised coarsely. New values collect in a buffer
+// that is folded into the centroids when it fills; digests merge by pooling their centroids.
+class TDigest
+{
+public:
+    static constexpr double COMPRESSION = 200; // about COMPRESSION / 2 centroids after a compression
+
+private:
+    struct Centroid
+    {
+        double mean;
+        double weight;
+    };
+
+    vector<Centroid> centroids; // sorted by mean
+    vector<Centroid> buffer;
+    double total = 0;
+    double min_value = INFINITY, max_value = -INFINITY;
+
+    static double scale(double q) { return COMPRESSION / (2 * acos(-1.0)) * asin(2 * min(1.0, max(0.0, q)) - 1); }
+
+    void compress()
+    {
+        if (buffer.empty())
+            return;
+        buffer.insert(buffer.end(), centroids.begin(), centroids.end());
+        sort(buffer.begin(), buffer.end(), [](const Centroid &a, const Centroid &b)
+             { return a.mean < b.mean; });
+
+        vector<Centroid> merged;
+        Centroid current(buffer[0]);
+        double before(0), k_low(scale(0));
+        for (size_t i(1); i < buffer.size(); ++i)
+        {
+            const Centroid &next(buffer[i]);
+            if (scale((before + current.weight + next.weight) / total) - k_low <= 1)
+            {
+                current.weight += next.weight;
+                current.mean += (next.mean - current.mean) * next.weight / current.weight;
+                continue;
+            }
+            merged.push_back(current);
+            before += current.weight;
+            k_low = scale(before / total);
+            current = next;
+        }
+        merged.push_back(current);
+        centroids.swap(merged);
+        buffer.clear();
+    }
+
+public:
+    void add(double x, double weight = 1)
+    {
+        buffer.push_back({x, weight});
+        total += weight;
+        min_value = min(min_value, x);
+        max_value = max(max_value, x);
+        if (buffer.size() >= 5 * COMPRESSION)
+            compress();
+    }
+
+    void merge(const TDigest &o)
+    {
+        if (!o.total)
+            return;
+        buffer.insert(buffer.end(), o.centroids.begin(), o.centroids.end());
+        buffer.insert(buffer.end(), o.buffer.begin(), o.buffer.end());
+        total += o.total;
+        min_value = min(min_value, o.min_value);
+        max_value = max(max_value, o.max_value);
+        compress();
+    }
+
+    bool empty() const { return !total; }
+
+    // Value below which a fraction p of the weight lies, interpolated between centroid centres
+    double quantile(double p)
+    {
+        compress();
+        if (centroids.empty())
+            return NAN;
+        if (centroids.size() == 1)
+            return centroids[0].mean;
+
+        double target(min(1.0, max(0.0, p)) * total);
+        const Centroid &first(centroids.front()), &last(centroids.back());
+        if (target < first.weight / 2)
+            return min_value + (first.mean - min_value) * target / (first.weight / 2);
+
+        double before(0);
+        for (size_t i(0); i + 1 < centroids.size(); ++i)
+        {
+            double left(before + centroids[i].weight / 2),
+                right(before + centroids[i].weight + centroids[i + 1].weight / 2);
+            if (target <= right)
+                return centroids[i].mean + (centroids[i + 1].mean - centroids[i].mean) * (target - left) / (right - left);
+            before += centroids[i].weight;
+        }
+
+        double last_centre(total - last.weight / 2);
+        return min(max_value, last.mean + (max_value - last.mean) * (target - last_centre) / (last.weight / 2));
+    }
+
+    size_t bytes() const { return sizeof(*this) + (centroids.capacity() + buffer.capacity()) * sizeof(Centroid); }
+};
+
+#endif
@@ -0,0 +1,68 @@
+#ifndef TABLE_EVICTOR
+#define TABLE_EVICTOR
+
+#include "models.cpp"
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+
+// Keeps the tables in memory under a byte budget by evicting the least recently used idle ones;
+// an evicted table is read back in by the next statement that names it
+class TableEvictor
+{
+    Catalog *_catalog;
+    size_t _budget;
+    chrono::milliseconds _idle;
+    chrono::milliseconds _interval;
+    atomic<bool> _running;
+    mutex _wait_mutex;
+    condition_variable _wake;
+    thread _worker;
+
+    void run()
+    {
+        while (_running)
+        {
+            {
+                unique_lock<mutex> lock(_wait_mutex);
+                _wake.wait_for(lock, _interval, [this]
+                               { return !_running; });
+            }
+            if (!_running)
+                break;
+
+            _catalog->evict_idle(_budget, _idle);
+        }
+    }
+
+public:
+    TableEvictor(Catalog *cat, size_t budget_bytes, chrono::milliseconds idle = chrono::seconds(60),
+                 chrono::milliseconds interval = chrono::seconds(5))
+        : _catalog(cat), _budget(budget_bytes), _idle(idle), _interval(interval), _running(false) {}
+
+    ~TableEvictor() { stop(); }
+
+    void start()
+    {
+        if (_running)
+            return;
+        _running = true;
+        _worker = thread(&TableEvictor::run, this);
+    }
+
+    void stop()
+    {
+        if (!_running)
+            return;
+        {
+            lock_guard<mutex> lock(_wait_mutex);
+            _running = false;
+        }
+        _wake.notify_all();
+        if (_worker.joinable())
+            _worker.join();
+    }
+};
+
+#endif
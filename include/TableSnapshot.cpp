@@ -0,0 +1,167 @@
+#ifndef TABLE_SNAPSHOT
+#define TABLE_SNAPSHOT
+
+#include "models.cpp"
+#include "ColumnStore.cpp"
+
+// Binary image of one table at a checkpoint. Restoring it is a bulk read and a block decode:
+//   header      magic, version, and the Position the image was taken at
+//   rows        the live rows as a column image (see ColumnStore)
+//   dead slots  bitmap over every row id, so ids keep matching the csv and the log
+//   pk index    key of each live row in row id order, so the hash index needs no key building
+class TableSnapshot
+{
+public:
+    static const uint32_t MAGIC = 0x4b43424d; // "MDBK"
+    static const uint32_t VERSION = 1;
+
+    // How far the table's files had grown when the image was taken; a restore replays only what follows
+    struct Position
+    {
+        uint64_t base_epoch = 0; // column file the csv continues, 0 without one
+        uint64_t csv_bytes = 0;
+        uint64_t log_bytes = 0;
+        uint64_t slots = 0; // row ids covered by the image
+
+        bool operator==(const Position &o) const
+        {
+            return base_epoch == o.base_epoch && csv_bytes == o.csv_bytes && log_bytes == o.log_bytes && slots == o.slots;
+        }
+    };
+
+private:
+    static const int HEADER_BYTES = 40;
+
+    static void write_position(ColumnStore::Writer &w, const Position &pos)
+    {
+        w.u64(pos.base_epoch);
+        w.u64(pos.csv_bytes);
+        w.u64(pos.log_bytes);
+        w.u64(pos.slots);
+    }
+
+    static Position read_position(ColumnStore::Reader &r)
+    {
+        if (r.u32() != MAGIC || r.u32() != VERSION)
+            throw runtime_error("not a table snapshot");
+        Position pos;
+        pos.base_epoch = r.u64();
+        pos.csv_bytes = r.u64();
+        pos.log_bytes = r.u64();
+        pos.slots = r.u64();
+        return pos;
+    }
+
+public:
+    // Writes the first pos.slots row ids as `view` sees them; returns bytes written
+    static uint64_t write(const fs::path &path, const Table *table, const Table::ReadView &view, const Position &pos)
+    {
+        ofstream file(path, ios::binary | ios::trunc);
+        ColumnStore::Writer header;
+        header.u32(MAGIC);
+        header.u32(VERSION);
+        write_position(header, pos);
+        file.write(header.buf.data(), header.buf.size());
+        uint64_t written(header.buf.size());
+
+        string dead((pos.slots + 7) / 8, '\0');
+        ColumnStore::Writer keys;
+        uint64_t live(0);
+        ColumnStore::Builder image(file, table->get_columns(), pos.base_epoch);
+
+        uint64_t next(0);
+        table->scan(view, [&](int idx, const Row &row)
+                    {
+            if (idx >= pos.slots) // appended after the snapshot position
+                return;
+            for (; next < idx; ++next)
+                dead[next / 8] |= 1 << (next % 8);
+            next = idx + 1;
+
+            image.add(row);
+            if (table->has_pk())
+                keys.text(table->primary_key_of(row));
+            ++live; });
+        for (; next < pos.slots; ++next)
+            dead[next / 8] |= 1 << (next % 8);
+        written += image.finish();
+
+        ColumnStore::Writer tail;
+        tail.bytes(dead);
+        tail.u64(table->has_pk() ? live : 0);
+        tail.bytes(keys.buf);
+        file.write(tail.buf.data(), tail.buf.size());
+        written += tail.buf.size();
+
+        file.close();
+        if (!file)
+            throw runtime_error("cannot write " + path.string());
+        return written;
+    }
+
+    // Only the header, to tell whether an existing image still describes the table
+    static bool peek(const fs::path &path, Position &pos)
+    {
+        ifstream file(path, ios::binary);
+        char header[HEADER_BYTES];
+        if (!file.read(header, sizeof(header)))
+            return false;
+        try
+        {
+            ColumnStore::Reader r(header, sizeof(header));
+            pos = read_position(r);
+            return true;
+        }
+        catch (const exception &e)
+        {
+            return false;
+        }
+    }
+
+    // Loads the image into an empty table with one bulk read; throws when the file is damaged or
+    // does not match the table's schema, and the caller then discards the partly filled table.
+    // Rows go into the table block by block, so the image is never held decoded in full.
+    static Position read(const fs::path &path, Table *table)
+    {
+        ifstream file(path, ios::binary);
+        string data((istreambuf_iterator<char>(file)), istreambuf_iterator<char>());
+        ColumnStore::Reader r(data);
+        Position pos(read_position(r));
+
+        const char *image(data.data() + r.position());
+        r.skip(ColumnStore::image_size(image, data.size() - r.position()));
+        const char *bitmap(r.skip((pos.slots + 7) / 8));
+        uint64_t key_count(r.u64());
+        if (key_count > data.size())
+            throw runtime_error("table snapshot has a bad index header");
+        vector<Text> keys(key_count);
+        for (auto &key : keys)
+            key = r.text();
+
+        auto dead([bitmap](uint64_t i)
+                  { return (bitmap[i / 8] >> (i % 8)) & 1; });
+        uint64_t next(0), live(0);
+        ColumnStore::read(image, bitmap - image, table->get_columns(), [&](Row &&row)
+                          {
+            for (; next < pos.slots && dead(next); ++next)
+                table->restore_slot(Row(), true);
+            if (next == pos.slots)
+                throw runtime_error("table snapshot has more rows than live slots");
+            table->restore_slot(row, false);
+            ++next;
+            ++live; });
+        for (; next < pos.slots; ++next)
+        {
+            if (!dead(next))
+                throw runtime_error("table snapshot has fewer rows than live slots");
+            table->restore_slot(Row(), true);
+        }
+
+        if (table->has_pk() && keys.size() != live)
+            throw runtime_error("table snapshot index does not cover its rows");
+        table->restore_index(move(keys));
+        return pos;
+    }
+};
+
+#endif
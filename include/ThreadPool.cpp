@@ -0,0 +1,78 @@
+#ifndef THREAD_POOL
+#define THREAD_POOL
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <deque>
+#include <vector>
+
+using namespace std;
+
+class ThreadPool
+{
+    vector<thread> workers;
+    deque<function<void()>> tasks;
+    mutex tasks_mutex;
+    condition_variable has_task;
+    bool stopping;
+
+    void work()
+    {
+        while (true)
+        {
+            function<void()> task;
+            {
+                unique_lock<mutex> lock(tasks_mutex);
+                has_task.wait(lock, [this]
+                              { return stopping || !tasks.empty(); });
+                if (tasks.empty())
+                    return;
+                task = move(tasks.front());
+                tasks.pop_front();
+            }
+            task();
+        }
+    }
+
+public:
+    ThreadPool(int threads = thread::hardware_concurrency()) : stopping(false)
+    {
+        if (threads < 1)
+            threads = 1;
+        for (int i(0); i < threads; ++i)
+            workers.emplace_back(&ThreadPool::work, this);
+    }
+
+    ~ThreadPool() { shutdown(); }
+
+    int size() const { return workers.size(); }
+
+    void submit(function<void()> task)
+    {
+        {
+            lock_guard<mutex> lock(tasks_mutex);
+            tasks.push_back(move(task));
+        }
+        has_task.notify_one();
+    }
+
+    void shutdown() // drains queued tasks, then joins
+    {
+        {
+            lock_guard<mutex> lock(tasks_mutex);
+            if (stopping)
+                return;
+            stopping = true;
+        }
+        has_task.notify_all();
+        for (auto &worker : workers)
+        {
+            if (worker.joinable())
+                worker.join();
+        }
+    }
+};
+
+#endif
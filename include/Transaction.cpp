@@ -0,0 +1,127 @@
+#ifndef TRANSACTION
+#define TRANSACTION
+
+#include "models.cpp"
+#include "Helper.cpp"
+
+// BEGIN ... COMMIT | ROLLBACK of one session. A table joins the transaction with its first write
+// and stays with it until the end: other writers wait, readers keep seeing the last commit. Nothing
+// reaches the files before COMMIT, which writes each table's changes in one batch; ROLLBACK walks
+// the tables' journals backwards and leaves no trace on disk.
+// Only a transaction that holds no table yet waits for one; with tables in hand it would risk a
+// deadlock, so the statement fails instead and the transaction can still be rolled back.
+class Transaction
+{
+    uint64_t _id = 0;        // 0 while no transaction is open
+    vector<Table *> _tables; // joined, in order
+
+    static uint64_t next_id()
+    {
+        static atomic<uint64_t> last(0);
+        return ++last;
+    }
+
+    // Whether a statement about to write may wait for its tables
+    static bool waits(const Transaction *transaction)
+    {
+        return !transaction || !transaction->active() || transaction->_tables.empty();
+    }
+
+public:
+    // One statement's write access to a table: a statement of its own outside a transaction,
+    // inside one the table joins it
+    class Write
+    {
+        Transaction *txn;
+        Table::WriteGuard guard;
+
+    public:
+        Write(Transaction *transaction, Table *table) : Write(transaction, table, waits(transaction)) {}
+        Write(Transaction *transaction, Table *table, bool wait)
+            : txn(transaction && transaction->active() ? transaction : nullptr),
+              guard(table, txn ? txn->_id : 0, wait)
+        {
+            if (txn && guard.acquired() && find(txn->_tables.begin(), txn->_tables.end(), table) == txn->_tables.end())
+                txn->_tables.push_back(table);
+        }
+        bool acquired() const { return guard.acquired(); }
+        bool deferred() const { return txn; } // persisted by COMMIT, not by the statement
+    };
+
+    // One statement's write access to all the partitions of a table, taken as one unit in
+    // partition order: a transaction holding no table before the statement waits for each of
+    // them. A partition dropped meanwhile is left out of `tables`; busy() is the one another
+    // transaction holds, which fails the statement
+    class Writes
+    {
+        vector<unique_ptr<Write>> writes;
+        Table *blocked = nullptr;
+
+    public:
+        Writes(Transaction *transaction, vector<Table *> &tables)
+        {
+            bool wait(waits(transaction));
+            for (size_t i(0); i < tables.size(); ++i)
+            {
+                writes.emplace_back(new Write(transaction, tables[i], wait));
+                if (writes.back()->acquired())
+                    continue;
+                writes.pop_back();
+                if (!tables[i]->is_dropped())
+                {
+                    blocked = tables[i];
+                    return;
+                }
+                tables.erase(tables.begin() + i--);
+            }
+        }
+        Table *busy() const { return blocked; }
+        bool deferred() const { return !writes.empty() && writes.front()->deferred(); }
+        void release() { writes.clear(); } // before the transaction commits or rolls back
+    };
+
+    Transaction() {}
+    ~Transaction()
+    {
+        if (active())
+            rollback();
+    }
+    Transaction(const Transaction &) = delete;
+    Transaction &operator=(const Transaction &) = delete;
+
+    bool active() const { return _id; }
+    uint64_t id() const { return _id; }
+
+    void begin() { _id = next_id(); }
+
+    // Writes and publishes each table in turn; returns the number of tables written
+    int commit()
+    {
+        Metrics::Timer timer(Metrics::COMMIT);
+        for (Table *table : _tables)
+        {
+            Table::WriteGuard guard(table, _id);
+            Helper::write_transaction(table);
+            table->commit_transaction();
+        }
+        int written(_tables.size());
+        _tables.clear();
+        _id = 0;
+        Metrics::add(Metrics::TRANSACTIONS_COMMITTED);
+        return written;
+    }
+
+    void rollback()
+    {
+        for (auto it(_tables.rbegin()); it != _tables.rend(); ++it)
+        {
+            Table::WriteGuard guard(*it, _id);
+            (*it)->rollback_transaction();
+        }
+        _tables.clear();
+        _id = 0;
+        Metrics::add(Metrics::TRANSACTIONS_ROLLED_BACK);
+    }
+};
+
+#endif
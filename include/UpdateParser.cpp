@@ -3,11 +3,16 @@
 
 #include "models.cpp"
 #include "Helper.cpp"
+#include "QueryProfile.cpp"
+#include "Transaction.cpp"
 #include <fstream>
 
 class UpdateParser
 {
     Catalog *_catalog;
+    ostream &_out;
+    QueryProfile *_profile;
+    Transaction *_transaction; // statements persist on their own unless it is open
 
     Value parse_value(const string &val_str, const string &type)
     {
@@ -43,107 +48,100 @@ class UpdateParser
         return Value(s);
     }
 
-    int find_column_index(const Table *table, const string &col_name) const
+    struct SetAction
     {
-        auto &cols(table->get_columns());
-        for (int i(0); i < cols.size(); ++i)
-        {
-            if (cols[i].get_name() == col_name)
-                return i;
-        }
-        return NOT_FOUND;
-    }
-
-    bool evaluate_condition(const Row &row, const Table *table, const string &condition)
+        int col_idx;
+        char op;        // '=' for plain assignment, otherwise + - * /
+        bool from_self; // left operand is the column's current value
+        Value left;
+        Value right;
+    };
+
+    SetAction compile_set(const Table *table, int col_idx, const string &expr, char compound_op)
     {
-        if (condition.empty())
-            return true;
+        const Column &col(table->get_column(col_idx));
+        SetAction act{col_idx, compound_op, compound_op != '=', Value(), Value()};
 
-        vector<string> operators = {"!=", ">=", "<=", "=", ">", "<"};
-        string op;
-        int op_pos(-1);
-
-        for (const auto &o : operators)
+        if (compound_op != '=')
         {
-            int pos(condition.find(o));
-            if (pos != string::npos)
-            {
-                op = o;
-                op_pos = pos;
-                break;
-            }
+            act.right = parse_value(expr, col.get_type());
+            return act;
         }
 
-        if (op_pos == -1)
-            return true;
-
-        string col_name_str(Helper::trim(condition.substr(0, op_pos))),
-            value_str(Helper::trim(condition.substr(op_pos + op.size())));
-
-        if (!value_str.empty() && (value_str.front() == '\'' || value_str.front() == '"'))
-            value_str = value_str.substr(1, value_str.size() - 2);
-
-        int col_idx(find_column_index(table, col_name_str));
-        if (col_idx == -1)
-            return false;
+        vector<char> arith_ops = {'+', '-', '*', '/'};
+        for (char c : arith_ops)
+        {
+            int pos(expr.find(c));
+            if (pos == string::npos)
+                continue;
+
+            string left_expr(Helper::trim(expr.substr(0, pos))),
+                right_expr(Helper::trim(expr.substr(pos + 1)));
+
+            act.op = c;
+            act.from_self = left_expr == col.get_name();
+            if (!act.from_self)
+                act.left = parse_value(left_expr, col.get_type());
+            act.right = parse_value(right_expr, col.get_type());
+            return act;
+        }
 
-        auto &cols(table->get_columns());
-        const Column &col = cols[col_idx];
-        string type(col.get_type());
+        act.right = parse_value(expr, col.get_type());
+        return act;
+    }
 
-        Value row_value(row[col_idx]),
-            cond_value(parse_value(value_str, type));
+    static Value apply_arithmetic(char op, const Value &left, const Value &right)
+    {
+        bool ints(holds_alternative<Int>(left.raw()) && holds_alternative<Int>(right.raw()));
+
+        if (op == '+')
+            return ints ? Value(left.get_int() + right.get_int()) : Value(left.get_double() + right.get_double());
+        if (op == '-')
+            return ints ? Value(left.get_int() - right.get_int()) : Value(left.get_double() - right.get_double());
+        if (op == '*')
+            return ints ? Value(left.get_int() * right.get_int()) : Value(left.get_double() * right.get_double());
+        if (op == '/')
+            return ints ? Value(left.get_int() / right.get_int()) : Value(left.get_double() / right.get_double());
+        return Value();
+    }
 
-        bool result(false);
+    static bool compare(const Value &row_value, const string &op, const Value &cond_value)
+    {
         if (op == "=")
-            result = row_value == cond_value;
-        else if (op == "!=")
-            result = !(row_value == cond_value);
-        else if (op == ">")
-            result = row_value > cond_value;
-        else if (op == "<")
-            result = row_value < cond_value;
-        else if (op == ">=")
-            result = row_value > cond_value || row_value == cond_value;
-        else if (op == "<=")
-            result = row_value < cond_value || row_value == cond_value;
-
-        return result;
+            return row_value == cond_value;
+        if (op == "!=")
+            return !(row_value == cond_value);
+        if (op == ">")
+            return row_value > cond_value;
+        if (op == "<")
+            return row_value < cond_value;
+        if (op == ">=")
+            return row_value > cond_value || row_value == cond_value;
+        if (op == "<=")
+            return row_value < cond_value || row_value == cond_value;
+        return false;
     }
 
-    void rewrite_csv(Table *table)
+    int find_column_index(const Table *table, const string &col_name) const
     {
-        fs::path csv_file(Helper::csv_path(table->get_name()));
-        ofstream file(csv_file.string(), ios::trunc);
-
         auto &cols(table->get_columns());
-        for (size_t i(0); i < cols.size(); ++i)
-        {
-            file << cols[i].get_name();
-            if (i + 1 < cols.size())
-                file << ",";
-        }
-        file << "\n";
-
-        auto &rows(table->get_rows());
-        for (const auto &row : rows)
+        for (int i(0); i < cols.size(); ++i)
         {
-            for (size_t i(0); i < row.size(); ++i)
-            {
-                file << row.at(i).to_string();
-                if (i + 1 < row.size())
-                    file << ",";
-            }
-            file << "\n";
+            if (cols[i].get_name() == col_name)
+                return i;
         }
-        file.close();
+        return NOT_FOUND;
     }
 
 public:
-    UpdateParser(Catalog *cat) : _catalog(cat) {}
+    UpdateParser(Catalog *cat, ostream &out = cout) : _catalog(cat), _out(out), _profile(nullptr), _transaction(nullptr) {}
+
+    void set_profile(QueryProfile *profile) { _profile = profile; }
+    void set_transaction(Transaction *transaction) { _transaction = transaction; }
 
     bool parse_and_update(const string &line, AST &out_ast)
     {
+        Metrics::Timer statement_timer(Metrics::UPDATE_STATEMENT);
         string s(Helper::trim(line));
         if (s.empty())
             return false;
@@ -171,10 +169,18 @@ public:
 
         ast_update.table_name = table_name;
 
+        if (Partitioning::is_partition(table_name))
+        {
+            _out << "\nPartition '" << table_name << "' is written through its table\n";
+            return false;
+        }
         Table *table(_catalog->getTable(table_name));
+        shared_ptr<const Partitioning> scheme(table ? nullptr : _catalog->partitioning(table_name));
+        if (scheme) // every partition has the table's columns
+            table = _catalog->getTable(scheme->partition_table(0));
         if (!table)
         {
-            cout << "\nTable '" << table_name << "' not found\n";
+            _out << "\nTable '" << table_name << "' not found\n";
             return false;
         }
 
@@ -195,14 +201,7 @@ public:
         string set_clause(s.substr(set_start, set_end - set_start));
         auto set_parts(Helper::split_commas_respecting_quotes(set_clause));
 
-        struct UpdateInfo
-        {
-            int col_idx;
-            Value placeholder;
-            string expression;
-            string op;
-        };
-        vector<UpdateInfo> updates;
+        vector<SetAction> actions;
         auto &cols(table->get_columns());
 
         for (const auto &part : set_parts)
@@ -244,7 +243,12 @@ public:
             int col_idx(find_column_index(table, col_name));
             if (col_idx == NOT_FOUND)
             {
-                cout << "\nColumn '" << col_name << "' not found\n";
+                _out << "\nColumn '" << col_name << "' not found\n";
+                return false;
+            }
+            if (scheme && col_idx == scheme->column_index) // the row would have to move
+            {
+                _out << "\nPartition column '" << col_name << "' cannot be updated\n";
                 return false;
             }
 
@@ -253,31 +257,49 @@ public:
             else
                 ast_update.sets.push_back({col_name, val_str});
 
-            updates.push_back({col_idx, Value(), val_str, is_compound ? compound_op.substr(0, 1) : ""});
+            actions.push_back(compile_set(table, col_idx, val_str, is_compound ? compound_op[0] : '='));
         }
 
-        vector<int> rows_to_update;
-        string where_clause;
-
+        // The WHERE literal is parsed once; on a partitioned table the condition leaves out the
+        // partitions that cannot hold a matching row
+        string op;
+        int where_idx(NOT_FOUND);
+        Value where_value;
+        LikePattern pattern;
+        bool like(false), negated(false); // col [NOT] LIKE | ILIKE pattern
         if (where_pos != string::npos)
         {
             pos = where_pos + 5;
             while (pos < s.size() && isspace(s[pos]))
                 ++pos;
 
-            where_clause = s.substr(pos);
-
+            string where_clause(s.substr(pos));
             vector<string> operators = {"!=", ">=", "<=", "=", ">", "<"};
-            string op;
-            int op_pos(-1);
+            int op_pos(-1), val_pos(-1);
+            size_t like_pos(Helper::find_word(where_clause, "like")), ilike_pos(Helper::find_word(where_clause, "ilike"));
+            if (like_pos != string::npos || ilike_pos != string::npos)
+            {
+                like = true;
+                op = like_pos < ilike_pos ? "LIKE" : "ILIKE";
+                op_pos = min(like_pos, ilike_pos);
+                val_pos = op_pos + op.size();
+                size_t not_pos(Helper::find_word(where_clause.substr(0, op_pos), "not"));
+                if (not_pos != string::npos)
+                {
+                    negated = true;
+                    op = "NOT " + op;
+                    op_pos = not_pos;
+                }
+            }
 
             for (const auto &o : operators)
             {
                 int p(where_clause.find(o));
-                if (p != string::npos)
+                if (!like && p != string::npos)
                 {
                     op = o;
                     op_pos = p;
+                    val_pos = p + o.size();
                     break;
                 }
             }
@@ -286,7 +308,7 @@ public:
                 return false;
 
             string where_col(Helper::trim(where_clause.substr(0, op_pos))),
-                where_val(Helper::trim(where_clause.substr(op_pos + op.size())));
+                where_val(Helper::trim(where_clause.substr(val_pos)));
 
             Condition cond;
             cond.lhs = where_col;
@@ -294,156 +316,169 @@ public:
             cond.rhs = where_val;
             ast_update.where.push_back(cond);
 
-            auto &rows(table->get_rows());
-            for (int i(0); i < rows.size(); ++i)
+            where_idx = find_column_index(table, where_col);
+            if (where_idx != NOT_FOUND)
             {
-                if (evaluate_condition(rows[i], table, where_clause))
-                    rows_to_update.push_back(i);
+                if (!where_val.empty() && (where_val.front() == '\'' || where_val.front() == '"'))
+                    where_val = where_val.substr(1, where_val.size() - 2);
+                if (like)
+                    pattern = LikePattern(where_val, op.find("ILIKE") != string::npos);
+                else
+                    where_value = parse_value(where_val, cols[where_idx].get_type());
             }
         }
-        else
+
+        vector<Table *> targets(1, table);
+        if (scheme)
+            targets = _catalog->get_partitions(*scheme, where_pos != string::npos && where_idx == scheme->column_index ? scheme->prune(op, where_value) : scheme->all());
+
+        int update_op(NOT_FOUND), scan_op(NOT_FOUND), persist_op(NOT_FOUND);
+        if (_profile)
         {
-            for (int i(0); i < table->get_rows().size(); ++i)
-                rows_to_update.push_back(i);
+            update_op = _profile->add("Update on " + table_name, "set " + Helper::trim(set_clause));
+            scan_op = _profile->add("Seq Scan on " + table_name,
+                                    where_pos == string::npos ? "" : "filter " + Helper::trim(s.substr(where_pos + 5)), 1);
+            persist_op = _profile->add("Persist", _transaction && _transaction->active() ? "deferred to COMMIT" : "append changed rows to " + table_name + ".log");
+            if (!_profile->analyze())
+                return true;
         }
 
+        // partitions are taken in order, so statements on the same table cannot deadlock; one
+        // dropped meanwhile has no rows left to update
+        // Partitions changed outside a transaction change as one: in a transaction of the statement's
+        // own, rolled back when one fails and committed once all are done
+        Transaction implicit;
+        bool own(targets.size() > 1 && !(_transaction && _transaction->active()));
+        if (own)
+            implicit.begin();
+        Transaction::Writes guards(own ? &implicit : _transaction, targets);
+        if (guards.busy())
+        {
+            _out << "\nTable '" << table_name << "' is in use by another transaction";
+            if (scheme)
+                _out << " (partition " << guards.busy()->get_name().substr(table_name.size() + 1) << ")";
+            _out << "; a transaction already writing other tables does not wait\n";
+            return false;
+        }
+
+        // A large table is scanned by several threads, and the partitions side by side, with no more
+        // threads in all than there are cores
+        QueryProfile::Timer scan_timer(_profile, scan_op);
+        vector<vector<int>> rows_to_update(targets.size()); // ascending
+        vector<int> workers(targets.size(), 1);
+        int share(Partitioning::scan_share(targets.size()));
+        in_parallel(targets.size(), [&](size_t t)
+                    {
+            const Table *target(targets[t]);
+            if (where_pos == string::npos)
+                rows_to_update[t] = target->find_live([](const Row &)
+                                                      { return true; });
+            else if (where_idx != NOT_FOUND)
+            {
+                workers[t] = min(target->scan_workers(), share);
+                rows_to_update[t] = target->find_live([&](const Row &row)
+                                                      { return like ? matches_like(pattern, row[where_idx]) != negated : compare(row[where_idx], op, where_value); },
+                                                      workers[t]);
+            } });
+
         out_ast.kind = ASTKind::UPDATE;
         out_ast.node = ast_update;
 
-        if (rows_to_update.empty())
+        scan_timer.stop();
+        size_t updated(0), scanned(0), id_bytes(0);
+        int scan_threads(0);
+        for (size_t t(0); t < targets.size(); ++t)
         {
-            cout << "\n0 rows updated\n";
-            return true;
+            updated += rows_to_update[t].size();
+            id_bytes += rows_to_update[t].capacity() * sizeof(int);
+            scanned += targets[t]->row_count();
+            scan_threads += workers[t];
+        }
+        Metrics::add(Metrics::ROWS_SCANNED, scanned);
+        if (_profile)
+        {
+            _profile->rows(scan_op, scanned, updated);
+            _profile->stat(scan_op, "bytes", id_bytes);
+            if (scheme)
+                _profile->stat(scan_op, "partitions", to_string(targets.size()) + "/" + to_string(scheme->names.size()));
+            if (scan_threads > 1)
+                _profile->stat(scan_op, "workers", scan_threads);
         }
 
-        for (int row_idx : rows_to_update)
+        if (!updated)
         {
-            Row new_row(table->row_at(row_idx));
+            _out << "\n0 rows updated\n";
+            return true;
+        }
 
-            for (const auto &upd : updates)
+        // Applied in row id order, a page at a time; the new values are worked out from the
+        // stored row in place. Each partition is written out once its rows are changed
+        vector<int> set_cols;
+        for (const auto &act : actions)
+            set_cols.push_back(act.col_idx);
+        auto cells([&](const Row &row, vector<pair<int, Value>> &cells)
+                   {
+            for (int a(0); a < actions.size(); ++a)
             {
-                int col_idx(upd.col_idx);
-                string expr(upd.expression),
-                    op(upd.op);
-
-                Value new_val;
-
-                if (!op.empty())
+                const SetAction &act(actions[a]);
+                if (act.op == '=')
                 {
-                    Value current(new_row.at(col_idx)),
-                        operand(parse_value(expr, cols[col_idx].get_type()));
-
-                    if (op == "+")
-                    {
-                        if (holds_alternative<Int>(current.raw()) && holds_alternative<Int>(operand.raw()))
-                            new_val = Value(current.get_int() + operand.get_int());
-                        else
-                            new_val = Value(current.get_double() + operand.get_double());
-                    }
-                    else if (op == "-")
-                    {
-                        if (holds_alternative<Int>(current.raw()) && holds_alternative<Int>(operand.raw()))
-                            new_val = Value(current.get_int() - operand.get_int());
-                        else
-                            new_val = Value(current.get_double() - operand.get_double());
-                    }
-                    else if (op == "*")
-                    {
-                        if (holds_alternative<Int>(current.raw()) && holds_alternative<Int>(operand.raw()))
-                            new_val = Value(current.get_int() * operand.get_int());
-                        else
-                            new_val = Value(current.get_double() * operand.get_double());
-                    }
-                    else if (op == "/")
-                    {
-                        if (holds_alternative<Int>(current.raw()) && holds_alternative<Int>(operand.raw()))
-                            new_val = Value(current.get_int() / operand.get_int());
-                        else
-                            new_val = Value(current.get_double() / operand.get_double());
-                    }
+                    cells.push_back({act.col_idx, act.right});
+                    continue;
                 }
-                else if (expr.find('+') != string::npos || expr.find('-') != string::npos ||
-                         expr.find('*') != string::npos || expr.find('/') != string::npos)
-                {
-                    char arith_op('=');
-                    int arith_pos(-1);
-                    vector<char> arith_ops = {'+', '-', '*', '/'};
 
-                    for (char c : arith_ops)
-                    {
-                        int pos(expr.find(c));
-                        if (pos != string::npos)
-                        {
-                            arith_op = c;
-                            arith_pos = pos;
-                            break;
-                        }
-                    }
-
-                    if (arith_pos != -1)
-                    {
-                        string left_expr(Helper::trim(expr.substr(0, arith_pos))),
-                            right_expr(Helper::trim(expr.substr(arith_pos + 1)));
-
-                        Value left_val;
-                        if (left_expr == cols[col_idx].get_name())
-                            left_val = new_row.at(col_idx);
-                        else
-                            left_val = parse_value(left_expr, cols[col_idx].get_type());
-
-                        Value right_val(parse_value(right_expr, cols[col_idx].get_type()));
-
-                        if (arith_op == '+')
-                        {
-                            if (holds_alternative<Int>(left_val.raw()) && holds_alternative<Int>(right_val.raw()))
-                                new_val = Value(left_val.get_int() + right_val.get_int());
-                            else
-                                new_val = Value(left_val.get_double() + right_val.get_double());
-                        }
-                        else if (arith_op == '-')
-                        {
-                            if (holds_alternative<Int>(left_val.raw()) && holds_alternative<Int>(right_val.raw()))
-                                new_val = Value(left_val.get_int() - right_val.get_int());
-                            else
-                                new_val = Value(left_val.get_double() - right_val.get_double());
-                        }
-                        else if (arith_op == '*')
-                        {
-                            if (holds_alternative<Int>(left_val.raw()) && holds_alternative<Int>(right_val.raw()))
-                                new_val = Value(left_val.get_int() * right_val.get_int());
-                            else
-                                new_val = Value(left_val.get_double() * right_val.get_double());
-                        }
-                        else if (arith_op == '/')
-                        {
-                            if (holds_alternative<Int>(left_val.raw()) && holds_alternative<Int>(right_val.raw()))
-                                new_val = Value(left_val.get_int() / right_val.get_int());
-                            else
-                                new_val = Value(left_val.get_double() / right_val.get_double());
-                        }
-                    }
+                const Value *current(&row[act.col_idx]);
+                for (int b(0); b < a; ++b) // an earlier SET of the same column wins
+                {
+                    if (cells[b].first == act.col_idx)
+                        current = &cells[b].second;
                 }
-                else
-                    new_val = parse_value(expr, cols[col_idx].get_type());
-
-                new_row.at(col_idx) = new_val;
-            }
+                cells.push_back({act.col_idx, apply_arithmetic(act.op, act.from_self ? *current : act.left, act.right)});
+            } });
 
+        uint64_t appended_before(WriteQueue::bytes_appended());
+        for (size_t t(0); t < targets.size(); ++t)
+        {
+            if (rows_to_update[t].empty())
+                continue;
+            Table *target(targets[t]);
             try
             {
-                table->update_row_at_index(row_idx, new_row);
+                QueryProfile::Timer update_timer(_profile, update_op);
+                target->assign_rows(rows_to_update[t], set_cols, cells);
             }
             catch (const exception &e)
             {
-                cout << "\nError updating row: " << e.what() << "\n";
+                if (!guards.deferred())
+                    Helper::flush_dirty_rows(target);
+                _out << "\nError updating row: " << e.what() << "\n";
                 return false;
             }
+            if (!guards.deferred())
+            {
+                QueryProfile::Timer timer(_profile, persist_op);
+                Helper::flush_dirty_rows(target);
+            }
         }
 
-        rewrite_csv(table);
+        if (own)
+        {
+            QueryProfile::Timer timer(_profile, persist_op);
+            guards.release();
+            implicit.commit();
+        }
+
+        if (_profile)
+        {
+            _profile->rows(update_op, updated, updated);
+            _profile->stat(update_op, "cells", updated * actions.size());
+            _profile->rows(persist_op, updated, updated);
+            _profile->stat(persist_op, "bytes_written", WriteQueue::bytes_appended() - appended_before);
+        }
 
-        cout << "\n"
-             << rows_to_update.size() << " row(s) updated\n";
+        Metrics::add(Metrics::ROWS_UPDATED, updated);
+        _out << "\n"
+             << updated << " row(s) updated\n";
         return true;
     }
 };
@@ -0,0 +1,192 @@
+#ifndef WRITE_QUEUE
+#define WRITE_QUEUE
+
+#include "Metrics.cpp"
+#include <vector>
+#include <filesystem>
+
+namespace fs = std::filesystem;
+
+// Appends to the table files, made behind the statements' backs once started: a statement hands
+// its records over and goes on, and a background thread takes everything queued since its last
+// pass and appends it in the order it was queued, one write per run of records for the same
+// file. Until it is started (tools, tests) every append is written at once by the caller.
+// Each session chooses when a statement is acknowledged: once its records are queued (ENQUEUE),
+// or once they are written (FLUSH). Stopping writes out whatever is still queued.
+class WriteQueue
+{
+public:
+    enum Durability
+    {
+        ENQUEUE,
+        FLUSH
+    };
+    static const size_t MAX_PENDING_BYTES = 64 << 20; // appenders wait for the writer beyond this
+
+private:
+    struct Record
+    {
+        fs::path path;
+        string data;
+    };
+
+    mutex queue_mutex;
+    condition_variable queued;   // records arrived, or stop
+    condition_variable progress; // the writer took or wrote a batch
+    vector<Record> pending;
+    size_t pending_bytes = 0;
+    uint64_t enqueued = 0, written = 0; // sequence numbers of records
+    bool running = false, stopping = false;
+    atomic<Durability> default_durability{ENQUEUE};
+    thread worker;
+
+    // The last record the calling thread queued
+    static uint64_t &last_queued()
+    {
+        thread_local uint64_t seq(0);
+        return seq;
+    }
+    static uint64_t &bytes_handed_over()
+    {
+        thread_local uint64_t bytes(0);
+        return bytes;
+    }
+
+    static void write_file(const fs::path &path, const string &data)
+    {
+        ofstream file(path, ios::app);
+        file << data;
+        file.close();
+        if (!file)
+            cerr << "Cannot append to " << path.string() << "\n";
+        Metrics::add(Metrics::BYTES_WRITTEN, data.size());
+        Metrics::add(Metrics::FILE_WRITES);
+    }
+
+    static void write_batch(vector<Record> &batch)
+    {
+        Metrics::Timer timer(Metrics::WRITE_BATCH);
+        // only records next to each other are joined: a later record for a file may depend on
+        // one for another file queued before it (a log naming the rows of a csv append)
+        vector<Record *> runs; // each run's first record, which collects the data of the others
+        for (auto &record : batch)
+        {
+            if (!runs.empty() && runs.back()->path == record.path)
+                runs.back()->data += record.data;
+            else
+                runs.push_back(&record);
+        }
+        for (Record *run : runs)
+            write_file(run->path, run->data);
+        Metrics::add(Metrics::WRITE_BATCHES);
+    }
+
+    void run()
+    {
+        unique_lock<mutex> lock(queue_mutex);
+        while (true)
+        {
+            queued.wait(lock, [this]
+                        { return stopping || !pending.empty(); });
+            if (pending.empty()) // stopping, and all written: appenders write for themselves again
+            {
+                running = false;
+                progress.notify_all();
+                return;
+            }
+
+            vector<Record> batch;
+            batch.swap(pending);
+            pending_bytes = 0;
+            uint64_t last(enqueued);
+            progress.notify_all();
+
+            lock.unlock();
+            write_batch(batch);
+            lock.lock();
+            written = last;
+            progress.notify_all();
+        }
+    }
+
+    WriteQueue() {}
+
+public:
+    static WriteQueue &instance()
+    {
+        static WriteQueue queue;
+        return queue;
+    }
+    ~WriteQueue() { stop(); }
+    WriteQueue(const WriteQueue &) = delete;
+    WriteQueue &operator=(const WriteQueue &) = delete;
+
+    void start()
+    {
+        lock_guard<mutex> lock(queue_mutex);
+        if (running)
+            return;
+        running = true;
+        stopping = false;
+        worker = thread(&WriteQueue::run, this);
+    }
+
+    // Writes out what is queued, then appends are written by their callers again
+    void stop()
+    {
+        {
+            lock_guard<mutex> lock(queue_mutex);
+            if (!running)
+                return;
+            stopping = true;
+        }
+        queued.notify_all();
+        worker.join();
+    }
+
+    void append(const fs::path &path, string data)
+    {
+        bytes_handed_over() += data.size();
+        unique_lock<mutex> lock(queue_mutex);
+        if (!running)
+        {
+            lock.unlock();
+            write_file(path, data);
+            return;
+        }
+        progress.wait(lock, [this]
+                      { return pending_bytes < MAX_PENDING_BYTES; });
+        bool idle(pending.empty()); // else the writer is already due to wake
+        pending_bytes += data.size();
+        pending.push_back({path, move(data)});
+        last_queued() = ++enqueued;
+        if (idle)
+            queued.notify_one();
+    }
+
+    // Waits until everything queued so far, by any thread, is written: before the files are read
+    // or replaced
+    void flush()
+    {
+        unique_lock<mutex> lock(queue_mutex);
+        uint64_t last(enqueued);
+        progress.wait(lock, [&]
+                      { return !running || written >= last; });
+    }
+
+    // Waits until the records the calling thread queued are written
+    void flush_own()
+    {
+        unique_lock<mutex> lock(queue_mutex);
+        progress.wait(lock, [this]
+                      { return !running || written >= last_queued(); });
+    }
+
+    // Bytes the calling thread has handed over to be appended, queued or written
+    static uint64_t bytes_appended() { return bytes_handed_over(); }
+
+    Durability get_default_durability() const { return default_durability; }
+    void set_default_durability(Durability d) { default_durability = d; }
+};
+
+#endif
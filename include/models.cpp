@@ -3,12 +3,37 @@
 #include <iostream>
 #include <sstream>
 #include <string>
+#include <string_view>
 #include <vector>
 #include <variant>
 #include <iomanip>
+#include <algorithm>
 #include <unordered_map>
+#include <mutex>
+#include <shared_mutex>
+#include <condition_variable>
+#include <atomic>
+#include <thread>
+#include <map>
+#include <set>
+#include <deque>
+#include <tuple>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <chrono>
+#include <fstream>
+#include <filesystem>
+#include <cstring>
+#include <memory>
+#include "Metrics.cpp"
+#include "BufferPool.cpp"
+#include "Bitmap.cpp"
+#include "Like.cpp"
 
 using namespace std;
+namespace fs = std::filesystem;
 
 class NullType
 {
@@ -120,78 +145,155 @@ public:
             return ""; }, data);
     }
 
-    bool operator==(const Value &other) const
+    // Like to_string, but doubles keep every significant digit so the file reads back the same value
+    Text to_storage_string() const
     {
-        if (holds_alternative<NullType>(data) && holds_alternative<NullType>(other.data))
-            return true;
-        if (holds_alternative<NullType>(data) || holds_alternative<NullType>(other.data))
-            return false;
-
-        if (holds_alternative<Int>(data) && holds_alternative<Int>(other.data))
-            return get<Int>(data) == get<Int>(other.data);
-        if (holds_alternative<Double>(data) && holds_alternative<Double>(other.data))
-            return get<Double>(data) == get<Double>(other.data);
+        const Double *d(get_if<Double>(&data));
+        if (!d)
+            return to_string();
 
-        if ((holds_alternative<Int>(data) || holds_alternative<Double>(data)) &&
-            (holds_alternative<Int>(other.data) || holds_alternative<Double>(other.data)))
+        char buf[32];
+        for (int digits(15); digits <= 17; ++digits)
         {
-            double val1(holds_alternative<Int>(data) ? (double)get<Int>(data) : get<Double>(data)),
-                val2(holds_alternative<Int>(other.data) ? (double)get<Int>(other.data) : get<Double>(other.data));
-            return val1 == val2;
+            snprintf(buf, sizeof(buf), "%.*g", digits, *d);
+            if (strtod(buf, nullptr) == *d)
+                break;
         }
+        return buf;
+    }
 
-        if (holds_alternative<Date>(data) && holds_alternative<Date>(other.data))
-            return get<Date>(data) == get<Date>(other.data);
-
-        if ((holds_alternative<Text>(data) || holds_alternative<Char>(data)) &&
-            (holds_alternative<Text>(other.data) || holds_alternative<Char>(other.data)))
-        {
-            string str1(holds_alternative<Text>(data) ? get<Text>(data) : string(1, get<Char>(data))),
-                str2(holds_alternative<Text>(other.data) ? get<Text>(other.data) : string(1, get<Char>(other.data)));
-            return str1 == str2;
-        }
+    // Results of compare beyond negative, zero and positive: the two kinds do not compare (a
+    // number and a text), so neither is less and they are not equal
+    static const int UNORDERED = 2;
 
-        return false;
+    static int three_way(Int a, Int b) { return (a > b) - (a < b); }
+    static int three_way(Double a, Double b) { return a < b ? -1 : b < a ? 1 : a == b ? 0 : UNORDERED; }
+    static int three_way(Char a, Char b) { return three_way(string_view(&a, 1), string_view(&b, 1)); }
+    static int three_way(const Date &a, const Date &b) { return a < b ? -1 : b < a ? 1 : 0; }
+    static int three_way(string_view a, string_view b) // bytes, no collation
+    {
+        int c(a.compare(b));
+        return (c > 0) - (c < 0);
     }
 
-    bool operator<(const Value &other) const
+    // Consistent with ==: equal numbers hash alike whatever their type, and so do a Char and a
+    // one-character Text
+    static size_t hash_of(Double d) { return std::hash<double>()(d == 0 ? 0.0 : d); }
+    static size_t hash_of(Int i) { return hash_of((Double)i); }
+    static size_t hash_of(Char c) { return std::hash<string_view>()(string_view(&c, 1)); }
+    static size_t hash_of(const Date &d) { return std::hash<int>()((d.get_year() * 16 + d.get_month()) * 32 + d.get_day()); }
+    static size_t hash_of(string_view t) { return std::hash<string_view>()(t); }
+
+    // Negative, zero or positive as this value sorts before, with or after the other, or
+    // UNORDERED. NULL equals NULL and sorts first; numbers compare by value, Char and Text as bytes
+    int compare(const Value &other) const
     {
-        bool this_null(holds_alternative<NullType>(data)),
-            other_null(holds_alternative<NullType>(other.data));
-
-        if (this_null && other_null)
-            return false;
-        if (this_null)
-            return true;
-        if (other_null)
-            return false;
-
-        if ((holds_alternative<Int>(data) || holds_alternative<Double>(data)) &&
-            (holds_alternative<Int>(other.data) || holds_alternative<Double>(other.data)))
+        size_t a(data.index()), b(other.data.index());
+        if (!a || !b)
+            return (a != 0) - (b != 0);
+        if (a == b)
         {
-            double val1(holds_alternative<Int>(data) ? (double)get<Int>(data) : get<Double>(data)),
-                val2(holds_alternative<Int>(other.data) ? (double)get<Int>(other.data) : get<Double>(other.data));
-            return val1 < val2;
+            switch (a)
+            {
+            case 1:
+                return three_way(get<Int>(data), get<Int>(other.data));
+            case 2:
+                return three_way(get<Double>(data), get<Double>(other.data));
+            case 3:
+                return three_way(get<Char>(data), get<Char>(other.data));
+            case 4:
+                return three_way(get<Date>(data), get<Date>(other.data));
+            default:
+                return three_way(string_view(get<Text>(data)), string_view(get<Text>(other.data)));
+            }
         }
+        if ((a == 1 || a == 2) && (b == 1 || b == 2))
+            return three_way(get_double(), other.get_double());
+        if ((a == 3 || a == 5) && (b == 3 || b == 5))
+            return three_way(a == 3 ? string_view(&get<Char>(data), 1) : string_view(get<Text>(data)),
+                             b == 3 ? string_view(&get<Char>(other.data), 1) : string_view(get<Text>(other.data)));
+        return UNORDERED;
+    }
 
-        if (holds_alternative<Date>(data) && holds_alternative<Date>(other.data))
-            return get<Date>(data) < get<Date>(other.data);
-
-        if ((holds_alternative<Text>(data) || holds_alternative<Char>(data)) &&
-            (holds_alternative<Text>(other.data) || holds_alternative<Char>(other.data)))
+    size_t hash() const
+    {
+        switch (data.index())
         {
-            string str1(holds_alternative<Text>(data) ? get<Text>(data) : string(1, get<Char>(data))),
-                str2(holds_alternative<Text>(other.data) ? get<Text>(other.data) : string(1, get<Char>(other.data)));
-            return str1 < str2;
+        case 0:
+            return 0x9e3779b97f4a7c15ULL;
+        case 1:
+            return hash_of(get<Int>(data));
+        case 2:
+            return hash_of(get<Double>(data));
+        case 3:
+            return hash_of(get<Char>(data));
+        case 4:
+            return hash_of(get<Date>(data));
+        default:
+            return hash_of(string_view(get<Text>(data)));
         }
-
-        return false;
     }
 
-    bool operator>(const Value &other) const
+    // A hash fixed by its definition, so it stays the same across builds and standard libraries,
+    // for what is stored by it: 64-bit FNV-1a over a kind byte and the value's bytes. Like hash,
+    // equal numbers hash alike whatever their type (as a double's bits, least significant byte
+    // first, with -0 as 0), and so do a Char and a one-character Text
+    uint64_t stable_hash() const
     {
-        return other < *this;
+        uint64_t h(0xcbf29ce484222325ULL);
+        auto add([&](const void *bytes, size_t n)
+                 {
+            for (size_t i(0); i < n; ++i)
+                h = (h ^ ((const uint8_t *)bytes)[i]) * 0x100000001b3ULL; });
+        auto add_word([&](uint64_t word, int n)
+                      {
+            for (int i(0); i < n; ++i)
+            {
+                uint8_t byte(word >> (8 * i));
+                add(&byte, 1);
+            } });
+        switch (data.index())
+        {
+        case 0:
+            add("0", 1);
+            break;
+        case 1:
+        case 2:
+        {
+            Double d(get_double());
+            uint64_t bits(0);
+            d = d == 0 ? 0.0 : d;
+            memcpy(&bits, &d, sizeof(bits));
+            add("n", 1);
+            add_word(bits, 8);
+            break;
+        }
+        case 3:
+            add("t", 1);
+            add(&get<Char>(data), 1);
+            break;
+        case 4:
+        {
+            const Date &date(get<Date>(data));
+            add("d", 1);
+            add_word((date.get_year() * 16 + date.get_month()) * 32 + date.get_day(), 4);
+            break;
+        }
+        default:
+            add("t", 1);
+            add(get<Text>(data).data(), get<Text>(data).size());
+        }
+        return h;
     }
+
+    bool operator==(const Value &other) const { return compare(other) == 0; }
+    bool operator<(const Value &other) const { return compare(other) < 0; }
+    bool operator>(const Value &other) const { return other < *this; }
+};
+
+struct ValueHash
+{
+    size_t operator()(const Value &v) const { return v.hash(); }
 };
 
 class Column
@@ -219,6 +321,48 @@ public:
     void set_char_length(int len) { char_length = len; }
 };
 
+// Three-way compare and hash for the values of one column, chosen when a plan is built. The
+// column's type fixes the alternative its non-NULL values hold, so the usual case is one check
+// and a direct comparison; NULLs and stray kinds fall back to Value::compare and Value::hash.
+struct ValueOps
+{
+    int (*compare)(const Value &, const Value &) = [](const Value &a, const Value &b)
+    { return a.compare(b); };
+    size_t (*hash)(const Value &) = [](const Value &v)
+    { return v.hash(); };
+
+    template <typename T>
+    static ValueOps typed()
+    {
+        ValueOps ops;
+        ops.compare = [](const Value &a, const Value &b)
+        {
+            const T *x(get_if<T>(&a.raw())), *y(get_if<T>(&b.raw()));
+            return x && y ? Value::three_way(*x, *y) : a.compare(b);
+        };
+        ops.hash = [](const Value &v)
+        {
+            const T *x(get_if<T>(&v.raw()));
+            return x ? Value::hash_of(*x) : v.hash();
+        };
+        return ops;
+    }
+
+    static ValueOps for_type(const Text &type)
+    {
+        if (type == "INT")
+            return typed<Int>();
+        if (type == "DOUBLE")
+            return typed<Double>();
+        if (type == "DATE")
+            return typed<Date>();
+        if (type == "CHAR" || type == "VARCHAR" || type == "TEXT")
+            return typed<Text>();
+        return ValueOps();
+    }
+    static ValueOps for_column(const Column &col) { return for_type(col.get_type()); }
+};
+
 class Row
 {
     vector<Value> vals;
@@ -237,13 +381,556 @@ public:
     void push_back(Value value) { vals.push_back(move(value)); }
 };
 
+// Whether a value's text matches a LIKE pattern; NULL matches none
+inline bool matches_like(const LikePattern &pattern, const Value &v)
+{
+    if (const Text *text = get_if<Text>(&v.raw()))
+        return pattern.matches(*text);
+    return !v.is_null() && pattern.matches(v.to_string());
+}
+
+// PAGE_ROWS consecutive row slots, the unit the buffer pool caches
+struct RowPage
+{
+    vector<Row> rows;
+
+    size_t bytes() const // estimated from a handful of rows
+    {
+        if (rows.empty())
+            return sizeof(RowPage);
+
+        size_t step(max<size_t>(1, rows.size() / 8)), sampled(0), total(0);
+        for (size_t i(0); i < rows.size(); i += step, ++sampled)
+        {
+            total += sizeof(Row) + rows[i].values().capacity() * sizeof(Value);
+            for (const auto &val : rows[i].values())
+            {
+                const Text *text(get_if<Text>(&val.raw()));
+                if (text && text->capacity() > 15) // beyond the small-string buffer
+                    total += text->capacity() + 1;
+            }
+        }
+        return sizeof(RowPage) + total / sampled * rows.size();
+    }
+};
+
+// Row slots of one table, held as pages in the shared buffer pool. A dirty page the pool evicts
+// goes to a scratch file that lives only as long as the table; the table's own files keep being
+// written by the statements as before.
+class PagedRows : public BufferPool<RowPage>::Source
+{
+public:
+    static const int PAGE_ROWS = 4096;
+    using Ref = BufferPool<RowPage>::Ref;
+
+private:
+    size_t count = 0;
+    vector<pair<uint64_t, uint32_t>> spilled; // page -> offset and capacity in the scratch file
+    fs::path scratch;
+    fstream file;
+
+    static BufferPool<RowPage> &pool() { return BufferPool<RowPage>::instance(); }
+    static size_t page_count_for(size_t slots) { return (slots + PAGE_ROWS - 1) / PAGE_ROWS; }
+
+    static void put(string &buf, const void *p, size_t n) { buf.append((const char *)p, n); }
+    static void get(const char *&p, const char *end, void *into, size_t n)
+    {
+        if (end - p < (ptrdiff_t)n)
+            throw runtime_error("scratch page is truncated");
+        memcpy(into, p, n);
+        p += n;
+    }
+
+public:
+    // Byte image of a page, also the block format of sort runs (see ExternalSort)
+    static void encode(string &buf, const RowPage &page)
+    {
+        uint32_t n(page.rows.size());
+        put(buf, &n, 4);
+        for (const auto &row : page.rows)
+        {
+            uint32_t width(row.size());
+            put(buf, &width, 4);
+            for (const auto &val : row.values())
+            {
+                uint8_t tag(val.raw().index());
+                put(buf, &tag, 1);
+                if (const Int *i = get_if<Int>(&val.raw()))
+                    put(buf, i, sizeof(Int));
+                else if (const Double *d = get_if<Double>(&val.raw()))
+                    put(buf, d, sizeof(Double));
+                else if (const Char *c = get_if<Char>(&val.raw()))
+                    put(buf, c, 1);
+                else if (const Date *date = get_if<Date>(&val.raw()))
+                {
+                    int32_t ymd[3] = {date->get_year(), date->get_month(), date->get_day()};
+                    put(buf, ymd, sizeof(ymd));
+                }
+                else if (const Text *t = get_if<Text>(&val.raw()))
+                {
+                    uint32_t len(t->size());
+                    put(buf, &len, 4);
+                    buf.append(*t);
+                }
+            }
+        }
+    }
+
+    static void decode(const char *p, const char *end, RowPage &page)
+    {
+        uint32_t n, width, len;
+        get(p, end, &n, 4);
+        page.rows.resize(n);
+        for (auto &row : page.rows)
+        {
+            get(p, end, &width, 4);
+            vector<Value> &vals(row.values());
+            vals.reserve(width);
+            for (uint32_t c(0); c < width; ++c)
+            {
+                uint8_t tag;
+                get(p, end, &tag, 1);
+                switch (tag)
+                {
+                case 0:
+                    vals.emplace_back();
+                    break;
+                case 1:
+                {
+                    Int i;
+                    get(p, end, &i, sizeof(i));
+                    vals.emplace_back(i);
+                    break;
+                }
+                case 2:
+                {
+                    Double d;
+                    get(p, end, &d, sizeof(d));
+                    vals.emplace_back(d);
+                    break;
+                }
+                case 3:
+                {
+                    Char ch;
+                    get(p, end, &ch, 1);
+                    vals.emplace_back(ch);
+                    break;
+                }
+                case 4:
+                {
+                    int32_t ymd[3];
+                    get(p, end, ymd, sizeof(ymd));
+                    vals.emplace_back(Date(ymd[0], ymd[1], ymd[2]));
+                    break;
+                }
+                default:
+                {
+                    get(p, end, &len, 4);
+                    if (end - p < (ptrdiff_t)len)
+                        throw runtime_error("scratch page is truncated");
+                    vals.emplace_back(Text(p, len));
+                    p += len;
+                }
+                }
+            }
+        }
+    }
+
+    PagedRows() = default;
+    PagedRows(const PagedRows &) = delete;
+    PagedRows &operator=(const PagedRows &) = delete;
+    ~PagedRows()
+    {
+        pool().discard(this);
+        if (file.is_open())
+        {
+            file.close();
+            error_code ec;
+            fs::remove(scratch, ec);
+        }
+    }
+
+    // Called by the pool under its lock, so the scratch file needs no lock of its own
+    void read_page(uint64_t id, RowPage &into) override
+    {
+        if (id >= spilled.size() || !spilled[id].second)
+            throw runtime_error("page was never written back");
+
+        string buf(spilled[id].second, '\0');
+        file.seekg(spilled[id].first);
+        file.read(&buf[0], buf.size());
+        if (!file)
+            throw runtime_error("cannot read scratch page");
+        decode(buf.data(), buf.data() + buf.size(), into);
+    }
+    void write_page(uint64_t id, const RowPage &from) override
+    {
+        if (!file.is_open())
+        {
+            scratch = fs::temp_directory_path() /
+                      ("mini_db_pages_" + to_string(chrono::steady_clock::now().time_since_epoch().count()) +
+                       "_" + to_string((uintptr_t)this));
+            file.open(scratch, ios::in | ios::out | ios::binary | ios::trunc);
+            if (!file.is_open())
+                throw runtime_error("cannot create scratch file " + scratch.string());
+        }
+
+        string buf;
+        encode(buf, from);
+        if (id >= spilled.size())
+            spilled.resize(id + 1, {0, 0});
+        if (buf.size() > spilled[id].second) // outgrew its slot: move to the end of the file
+        {
+            file.seekp(0, ios::end);
+            spilled[id] = {(uint64_t)file.tellp(), (uint32_t)buf.size()};
+        }
+        else
+            file.seekp(spilled[id].first);
+        file.write(buf.data(), buf.size());
+        if (!file)
+            throw runtime_error("cannot write scratch page");
+    }
+
+    size_t size() const { return count; }
+    size_t page_count() const { return page_count_for(count); }
+    Ref page(size_t page_no) const { return pool().fetch(const_cast<PagedRows *>(this), page_no); }
+    size_t resident_bytes() const { return pool().resident_bytes(this); }
+
+    void push_back(const Row &row)
+    {
+        Ref ref(pool().fetch(this, count / PAGE_ROWS, count % PAGE_ROWS == 0));
+        ref->rows.push_back(row);
+        ref.mark_dirty();
+        ++count;
+    }
+    void truncate(size_t n) // keeps the first n slots
+    {
+        if (n >= count)
+            return;
+        if (n % PAGE_ROWS)
+        {
+            Ref last(page(n / PAGE_ROWS));
+            last->rows.resize(n % PAGE_ROWS);
+            last.mark_dirty();
+        }
+        pool().discard(this, page_count_for(n));
+        spilled.resize(min(spilled.size(), page_count_for(n)));
+        count = n;
+    }
+};
+
+// Rows of one column by value, a bitmap of row ids per distinct value: for columns of few
+// distinct values, where a condition picks its rows by combining bitmaps instead of reading rows.
+// A trigram index instead keeps a bitmap per trigram of the column's text (Trigrams), narrowing
+// LIKE to the rows holding every trigram of its pattern, for columns of many distinct values.
+// Either follows the latest version of every live row, changed with the rows under the table's latch.
+class BitmapIndex
+{
+public:
+    enum Kind
+    {
+        VALUES,
+        TRIGRAMS
+    };
+    struct Definition
+    {
+        Text name;
+        Text column;
+        Kind kind;
+    };
+
+private:
+    struct KeyHash
+    {
+        ValueOps ops;
+        size_t operator()(const Value &v) const { return ops.hash(v); }
+    };
+    struct KeyEqual // values that never compare equal, such as NaN, still share a bitmap
+    {
+        ValueOps ops;
+        bool operator()(const Value &a, const Value &b) const
+        {
+            int c(ops.compare(a, b));
+            return !c || (c == Value::UNORDERED && ops.compare(a, a) && ops.compare(b, b));
+        }
+    };
+
+    Text index_name;
+    int column;
+    Kind index_kind;
+    ValueOps ops;
+    unordered_map<Value, Bitmap, KeyHash, KeyEqual> values; // VALUES
+    unordered_map<uint32_t, Bitmap> trigrams;               // TRIGRAMS
+
+    static vector<uint32_t> trigrams_of(const Row *row, int column)
+    {
+        if (!row || (*row)[column].is_null())
+            return {};
+        const Text *text(get_if<Text>(&(*row)[column].raw()));
+        return Trigrams::of(text ? *text : (*row)[column].to_string());
+    }
+
+public:
+    BitmapIndex(const Text &name, int col, ValueOps o, Kind kind = VALUES)
+        : index_name(name), column(col), index_kind(kind), ops(o), values(16, KeyHash{o}, KeyEqual{o}) {}
+
+    const Text &name() const { return index_name; }
+    int get_column() const { return column; }
+    Kind kind() const { return index_kind; }
+    const ValueOps &value_ops() const { return ops; }
+    size_t distinct() const { return index_kind == VALUES ? values.size() : trigrams.size(); }
+
+    void change(int row, const Row *before, const Row *after)
+    {
+        if (before && after && KeyEqual{ops}((*before)[column], (*after)[column]))
+            return;
+        if (index_kind == TRIGRAMS)
+        {
+            vector<uint32_t> gone(trigrams_of(before, column)), added(trigrams_of(after, column)), kept;
+            set_intersection(gone.begin(), gone.end(), added.begin(), added.end(), back_inserter(kept));
+            for (uint32_t gram : gone)
+            {
+                if (binary_search(kept.begin(), kept.end(), gram))
+                    continue;
+                auto it(trigrams.find(gram));
+                if (it == trigrams.end())
+                    continue;
+                it->second.remove(row);
+                if (it->second.empty())
+                    trigrams.erase(it);
+            }
+            for (uint32_t gram : added)
+            {
+                if (!binary_search(kept.begin(), kept.end(), gram))
+                    trigrams[gram].add(row);
+            }
+            return;
+        }
+        if (before)
+        {
+            auto it(values.find((*before)[column]));
+            if (it != values.end())
+            {
+                it->second.remove(row);
+                if (it->second.empty())
+                    values.erase(it);
+            }
+        }
+        if (after)
+            values[(*after)[column]].add(row);
+    }
+
+    void clear()
+    {
+        values.clear();
+        trigrams.clear();
+    }
+
+    // Rows holding `v`; nullptr when none does
+    const Bitmap *find(const Value &v) const
+    {
+        auto it(values.find(v));
+        return it == values.end() ? nullptr : &it->second;
+    }
+
+    // Rows whose value v has pred(v)
+    template <typename Pred>
+    Bitmap rows_where(Pred pred) const
+    {
+        Bitmap rows;
+        for (const auto &entry : values)
+        {
+            if (pred(entry.first))
+                rows = Bitmap::unite(rows, entry.second);
+        }
+        return rows;
+    }
+
+    // Rows whose text holds every one of `grams`, which are not none; the rarest are intersected first
+    Bitmap rows_with(const vector<uint32_t> &grams) const
+    {
+        vector<const Bitmap *> postings;
+        for (uint32_t gram : grams)
+        {
+            auto it(trigrams.find(gram));
+            if (it == trigrams.end())
+                return Bitmap();
+            postings.push_back(&it->second);
+        }
+        sort(postings.begin(), postings.end(), [](const Bitmap *a, const Bitmap *b)
+             { return a->cardinality() < b->cardinality(); });
+        Bitmap rows(*postings[0]);
+        for (size_t i(1); i < postings.size() && !rows.empty(); ++i)
+            rows = Bitmap::intersect(rows, *postings[i]);
+        return rows;
+    }
+
+    size_t bytes() const
+    {
+        size_t total(sizeof(*this) + values.bucket_count() * sizeof(void *) + trigrams.bucket_count() * sizeof(void *));
+        for (const auto &entry : values)
+            total += sizeof(entry) + entry.second.bytes();
+        for (const auto &entry : trigrams)
+            total += sizeof(entry) + entry.second.bytes();
+        return total;
+    }
+};
+
+// Threads one statement keeps busy at most: one per core
+inline int parallelism() { return max(1u, thread::hardware_concurrency()); }
+
+// Runs fn(0) to fn(n - 1) on at most `workers` threads, each taking the next index until none is
+// left; on the calling thread alone when one is enough
+template <typename Fn>
+void in_parallel(size_t n, Fn fn, int workers = parallelism())
+{
+    workers = min<size_t>(max(1, workers), n);
+    if (workers <= 1)
+    {
+        for (size_t i(0); i < n; ++i)
+            fn(i);
+        return;
+    }
+    atomic<size_t> next(0);
+    auto work([&]
+              {
+        for (size_t i(next++); i < n; i = next++)
+            fn(i); });
+    vector<thread> threads;
+    for (int w(0); w < workers; ++w)
+        threads.emplace_back(work);
+    for (auto &t : threads)
+        t.join();
+}
+
 class Table
 {
     Text name;
     vector<Column> columns;
-    vector<Row> rows;
+    PagedRows rows; // through the buffer pool; a page is pinned while its rows are in use
+    vector<bool> tombstones; // row_Idx -> deleted, reclaimed by compact()
+    int dead_rows = 0;
+    vector<int> dirty_rows; // updated in memory, not yet written to the log
     vector<int> pk_indices;
     unordered_map<Text, int> pk_map; // pk_value, row_Idx
+    mutable shared_mutex statement_lock; // shared by every statement, exclusive for maintenance (compaction)
+    mutable mutex table_mutex;           // one writing statement at a time
+    bool dropped = false;                // a dropped partition; set under both locks above
+
+    // MVCC: every row carries the statement timestamps that created and deleted it,
+    // overwritten cells are kept in an undo chain until no open snapshot can see them.
+    struct RowStamp
+    {
+        uint64_t begin;
+        uint64_t end;
+    };
+    struct UndoRecord
+    {
+        int row;
+        int col;
+        uint64_t ts; // statement that overwrote `old`
+        int prev;    // older record of the same row, NOT_FOUND at the end of the chain
+        Value old;
+    };
+    static const uint64_t LIVE = UINT64_MAX;
+    static const int UNDO_GC_THRESHOLD = 1 << 16;
+
+    vector<RowStamp> stamps;
+    vector<UndoRecord> undo;
+    vector<int> undo_head; // row_Idx -> newest undo record
+    atomic<uint64_t> committed_ts{0};
+    uint64_t write_ts = 0; // statement in progress, 0 outside of one
+    map<uint64_t, int> readers; // snapshot_ts, open views
+    mutable mutex readers_mutex;
+    mutable shared_mutex latch; // held shared per scan batch, exclusive per mutation
+
+public:
+    // One change of an open transaction, kept so ROLLBACK can take it back and COMMIT can write it
+    struct Change
+    {
+        enum Kind
+        {
+            INSERT,
+            ERASE,
+            UPDATE
+        };
+        Kind kind;
+        int row;
+        Row before; // UPDATE only
+    };
+
+private:
+    // Transactions: a table belongs to at most one open transaction, which keeps it between its
+    // statements. All its statements share one write timestamp, so readers see none of them until
+    // the commit publishes it, while the transaction's own reads use that timestamp as snapshot.
+    atomic<uint64_t> owner{0};   // transaction id, 0 when none; changed under table_mutex
+    condition_variable released; // the owner let go
+    int txn_first_slot = 0;      // slots from here on were appended by the transaction
+    vector<Change> journal;
+
+public:
+    // Told of each row a statement inserts, changes or deletes, under the latch as the change is
+    // applied: `before` is nullptr for an insert, `after` for a delete
+    class Listener
+    {
+    public:
+        virtual ~Listener() {}
+        virtual void row_changed(const Row *before, const Row *after) = 0;
+    };
+
+private:
+    vector<Listener *> listeners; // guarded by the latch
+
+    // Bitmap indexes, guarded by the latch like the rows. While there are any, each row change is
+    // also logged with its statement's timestamp until every open snapshot sees it: a reader takes
+    // its rows from the indexes, except the rows changed since its snapshot, which it checks itself
+    struct IndexChange
+    {
+        uint64_t ts;
+        int row;
+    };
+    vector<BitmapIndex> bitmap_indexes;
+    Bitmap indexed_rows;              // every live row, what NOT takes the complement in
+    deque<IndexChange> index_changes; // oldest first
+    uint64_t indexed_since = 0;       // changes before it were not logged, so older snapshots cannot use the indexes
+
+    bool observed() const { return !listeners.empty() || !bitmap_indexes.empty(); }
+    void notify(int idx, const Row *before, const Row *after)
+    {
+        if (!bitmap_indexes.empty())
+        {
+            for (auto &index : bitmap_indexes)
+                index.change(idx, before, after);
+            if (!before)
+                indexed_rows.add(idx);
+            else if (!after)
+                indexed_rows.remove(idx);
+            if (write_ts)
+                index_changes.push_back({write_ts, idx});
+        }
+        for (auto *listener : listeners)
+            listener->row_changed(before, after);
+    }
+    void rebuild_bitmap_indexes_locked() // after compaction renumbered the rows
+    {
+        indexed_rows.clear();
+        index_changes.clear();
+        for (auto &index : bitmap_indexes)
+            index.clear();
+        for (size_t p(0); p < rows.page_count(); ++p)
+        {
+            PagedRows::Ref page(rows.page(p));
+            int base(p * PagedRows::PAGE_ROWS);
+            for (int i(0); i < page->rows.size(); ++i)
+            {
+                if (tombstones[base + i])
+                    continue;
+                for (auto &index : bitmap_indexes)
+                    index.change(base + i, nullptr, &page->rows[i]);
+                indexed_rows.add(base + i);
+            }
+        }
+    }
 
     static const Text PK_SEP;
 
@@ -305,57 +992,691 @@ class Table
         return key;
     }
 
-public:
-    Table(const Text &tableName,
-          const vector<Column> &cols,
-          const vector<Text> &pkColNames = {})
-        : name(tableName), columns(cols)
+    PagedRows::Ref page_of(int idx) const { return rows.page(idx / PagedRows::PAGE_ROWS); }
+    void push_slot(const Row &row, bool dead)
     {
-        if (!pkColNames.empty())
+        rows.push_back(row);
+        tombstones.push_back(dead);
+        stamps.push_back({write_ts, dead ? write_ts : LIVE});
+        undo_head.push_back(NOT_FOUND);
+    }
+    void journal_change(Change::Kind kind, int idx, const Row *before = nullptr)
+    {
+        if (owner)
+            journal.push_back({kind, idx, before ? *before : Row()});
+    }
+    void record_undo(int idx, int col, const Value &old)
+    {
+        if (!write_ts)
+            return;
+        undo.push_back({idx, col, write_ts, undo_head[idx], old});
+        undo_head[idx] = undo.size() - 1;
+    }
+    // assign_rows when the cells change primary keys: the whole batch under one latch hold
+    template <typename Cells>
+    void assign_rows_rekeyed(const vector<int> &ids, Cells cells)
+    {
+        unique_lock<shared_mutex> guard(latch);
+        vector<vector<pair<int, Value>>> changes(ids.size());
+        vector<Text> old_keys, new_keys;
+        old_keys.reserve(ids.size());
+        new_keys.reserve(ids.size());
         {
-            for (const auto &pn : pkColNames)
+            PagedRows::Ref page;
+            for (size_t i(0); i < ids.size(); ++i)
             {
-                int found(NOT_FOUND);
-                for (int i(0); i < columns.size(); ++i)
-                {
-                    if (columns[i].get_name() == pn)
-                    {
-                        found = i;
-                        break;
-                    }
-                }
-                if (found == NOT_FOUND)
-                    throw runtime_error("PRIMARY KEY column not found: " + pn);
-
-                pk_indices.push_back(found);
+                if (!page || ids[i] / PagedRows::PAGE_ROWS != ids[i - 1] / PagedRows::PAGE_ROWS)
+                    page = page_of(ids[i]);
+                Row row(page->rows[ids[i] % PagedRows::PAGE_ROWS]);
+                old_keys.push_back(build_pk_by_row(row));
+                cells(row, changes[i]);
+                for (const auto &cell : changes[i])
+                    row[cell.first] = cell.second;
+                new_keys.push_back(build_pk_by_row(row));
             }
         }
-        else
+
+        // the batch's keys leave the index before the new ones go in, so rows may trade keys
+        Metrics::add(Metrics::PK_LOOKUPS, ids.size());
+        for (const auto &key : old_keys)
+            pk_map.erase(key);
+        for (size_t i(0); i < ids.size(); ++i)
         {
-            for (int i(0); i < columns.size(); ++i)
+            if (pk_map.emplace(new_keys[i], ids[i]).second)
+                continue;
+            for (size_t j(0); j < i; ++j)
+                pk_map.erase(new_keys[j]);
+            for (size_t j(0); j < ids.size(); ++j)
+                pk_map.emplace(move(old_keys[j]), ids[j]);
+            throw runtime_error("update would violate primary key uniqueness: " + new_keys[i]);
+        }
+
+        PagedRows::Ref page;
+        for (size_t i(0); i < ids.size(); ++i)
+        {
+            int idx(ids[i]);
+            if (!page || idx / PagedRows::PAGE_ROWS != ids[i - 1] / PagedRows::PAGE_ROWS)
             {
-                if (columns[i].is_pk())
-                    pk_indices.push_back(i);
+                page = page_of(idx);
+                page.mark_dirty();
+            }
+            Row &row(page->rows[idx % PagedRows::PAGE_ROWS]);
+            Row before;
+            if (observed() || owner)
+                before = row;
+            for (auto &cell : changes[i])
+            {
+                record_undo(idx, cell.first, row[cell.first]);
+                row[cell.first] = move(cell.second);
             }
+            dirty_rows.push_back(idx);
+            journal_change(Change::UPDATE, idx, &before);
+            if (observed())
+                notify(idx, &before, &row);
         }
     }
-    const string &get_name() const { return name; }
-    const vector<Column> &get_columns() const { return columns; }
-    vector<Column> &get_columns() { return columns; }
-    const vector<Row> &get_rows() const { return rows; }
-    vector<Row> &get_rows() { return rows; }
-    const vector<int> &getpk_indices() const { return pk_indices; }
-    int row_count() const { return rows.size(); }
-    const Row &row_at(int i) const { return rows.at(i); }
-    Row &row_at(int i) { return rows.at(i); }
-    bool has_pk() const { return !pk_indices.empty(); }
-    bool is_single_pk() const { return pk_indices.size() == 1; }
-
-    int get_column_count() const { return columns.size(); }
-    int get_column_index(const string &col_name) const
+    uint64_t register_reader() const
     {
-        for (int i(0); i < columns.size(); ++i)
-        {
+        lock_guard<mutex> guard(readers_mutex);
+        uint64_t ts(committed_ts.load());
+        ++const_cast<Table *>(this)->readers[ts];
+        return ts;
+    }
+    void release_reader(uint64_t ts) const
+    {
+        lock_guard<mutex> guard(readers_mutex);
+        auto &open(const_cast<Table *>(this)->readers);
+        auto it(open.find(ts));
+        if (it != open.end() && !--it->second)
+            open.erase(it);
+    }
+    uint64_t oldest_reader() const
+    {
+        lock_guard<mutex> guard(readers_mutex);
+        return readers.empty() ? LIVE : readers.begin()->first;
+    }
+    const Row *visible_row(const Row &stored, int idx, uint64_t snapshot, Row &scratch) const
+    {
+        const RowStamp &stamp(stamps[idx]);
+        if (stamp.begin > snapshot || stamp.end <= snapshot)
+            return nullptr;
+
+        int rec(undo_head[idx]);
+        if (rec == NOT_FOUND || undo[rec].ts <= snapshot)
+            return &stored;
+
+        scratch = stored;
+        for (; rec != NOT_FOUND && undo[rec].ts > snapshot; rec = undo[rec].prev)
+            scratch[undo[rec].col] = undo[rec].old;
+        return &scratch;
+    }
+    void begin_write() // under the latch, as find_by_pk reads it
+    {
+        unique_lock<shared_mutex> guard(latch);
+        write_ts = committed_ts.load() + 1;
+    }
+    void end_write()
+    {
+        unique_lock<shared_mutex> guard(latch);
+        committed_ts = write_ts;
+        write_ts = 0;
+        collect_versions_locked();
+
+        uint64_t seen(min(oldest_reader(), committed_ts.load())); // by every snapshot, open or to come
+        while (!index_changes.empty() && index_changes.front().ts <= seen)
+            index_changes.pop_front();
+    }
+    void begin_transaction(uint64_t txn)
+    {
+        owner = txn;
+        txn_first_slot = rows.size();
+        begin_write();
+    }
+    void release_transaction()
+    {
+        journal.clear();
+        dirty_rows.clear(); // the journal, not the dirty list, says what the commit writes
+        txn_first_slot = 0;
+        owner = 0;
+        released.notify_all();
+    }
+    void collect_versions_locked()
+    {
+        if (undo.empty() || write_ts) // an open transaction's versions are still needed
+            return;
+
+        uint64_t oldest(oldest_reader());
+        if (oldest == LIVE)
+        {
+            for (const auto &rec : undo)
+                undo_head[rec.row] = NOT_FOUND;
+            undo.clear();
+            return;
+        }
+        if (undo.size() < UNDO_GC_THRESHOLD)
+            return;
+
+        drop_versions([oldest](const UndoRecord &rec)
+                      { return rec.ts <= oldest; }); // every open snapshot already sees the newer value
+    }
+    template <typename Drop>
+    void drop_versions(Drop drop) // keeps the chains of the remaining records intact
+    {
+        vector<int> remap(undo.size(), NOT_FOUND);
+        vector<UndoRecord> kept;
+        for (int i(0); i < undo.size(); ++i)
+        {
+            if (undo[i].row < undo_head.size())
+                undo_head[undo[i].row] = NOT_FOUND;
+            if (drop(undo[i]))
+                continue;
+            remap[i] = kept.size();
+            kept.push_back(move(undo[i]));
+            UndoRecord &rec(kept.back());
+            rec.prev = rec.prev == NOT_FOUND ? NOT_FOUND : remap[rec.prev];
+        }
+        for (int i(0); i < kept.size(); ++i)
+            undo_head[kept[i].row] = i;
+        undo.swap(kept);
+    }
+
+public:
+    class ReadView
+    {
+        const Table *table;
+        shared_lock<shared_mutex> statement;
+        uint64_t ts;
+        uint64_t visible; // ts, or the write timestamp of the reader's own open transaction
+
+    public:
+        ReadView(const Table *t, uint64_t txn = 0)
+            : table(t), statement(t->statement_lock), ts(t->register_reader()),
+              visible(txn && t->owner == txn ? t->write_ts : ts) {}
+        ~ReadView() { table->release_reader(ts); }
+        ReadView(const ReadView &) = delete;
+        ReadView &operator=(const ReadView &) = delete;
+        uint64_t snapshot() const { return visible; }
+        void advance() // moves the snapshot up to the last committed statement
+        {
+            uint64_t latest(table->register_reader());
+            table->release_reader(ts);
+            ts = visible = latest;
+        }
+    };
+
+    // A writing statement's hold on the table. Inside transaction `txn` the table joins it on first
+    // use and stays with it between statements; other writers wait for the commit or rollback, or
+    // give up at once when `wait` is false. A dropped table is never acquired
+    class WriteGuard
+    {
+        Table *table;
+        uint64_t txn;
+        shared_lock<shared_mutex> statement;
+        unique_lock<mutex> lock;
+        bool held = true;
+
+    public:
+        WriteGuard(Table *t, uint64_t transaction = 0, bool wait = true)
+            : table(t), txn(transaction), statement(t->statement_lock), lock(t->table_mutex)
+        {
+            if (table->dropped)
+            {
+                held = false;
+                return;
+            }
+            while (table->owner && table->owner != txn)
+            {
+                if (!wait)
+                {
+                    held = false;
+                    return;
+                }
+                table->released.wait(lock);
+            }
+            if (!txn)
+                table->begin_write();
+            else if (!table->owner)
+                table->begin_transaction(txn);
+        }
+        ~WriteGuard()
+        {
+            if (held && !txn)
+                table->end_write();
+        }
+        WriteGuard(const WriteGuard &) = delete;
+        WriteGuard &operator=(const WriteGuard &) = delete;
+        bool acquired() const { return held; }
+    };
+
+    Table(const Text &tableName,
+          const vector<Column> &cols,
+          const vector<Text> &pkColNames = {})
+        : name(tableName), columns(cols)
+    {
+        if (!pkColNames.empty())
+        {
+            for (const auto &pn : pkColNames)
+            {
+                int found(NOT_FOUND);
+                for (int i(0); i < columns.size(); ++i)
+                {
+                    if (columns[i].get_name() == pn)
+                    {
+                        found = i;
+                        break;
+                    }
+                }
+                if (found == NOT_FOUND)
+                    throw runtime_error("PRIMARY KEY column not found: " + pn);
+
+                pk_indices.push_back(found);
+            }
+        }
+        else
+        {
+            for (int i(0); i < columns.size(); ++i)
+            {
+                if (columns[i].is_pk())
+                    pk_indices.push_back(i);
+            }
+        }
+    }
+    const string &get_name() const { return name; }
+    const vector<Column> &get_columns() const { return columns; }
+    vector<Column> &get_columns() { return columns; }
+    const vector<int> &getpk_indices() const { return pk_indices; }
+    int row_count() const { return rows.size(); }
+    int live_row_count() const { return rows.size() - dead_rows; }
+    int dead_row_count() const { return dead_rows; }
+    bool is_live(int i) const { return !tombstones[i]; }
+    mutex &get_mutex() const { return table_mutex; }
+    shared_mutex &get_statement_lock() const { return statement_lock; }
+    bool has_readers() const { return oldest_reader() != LIVE; }
+    bool in_transaction() const { return owner; }
+    // A dropped table takes no more writes; the caller holds the writer lock, and to drop it the
+    // statement lock exclusively as well
+    bool is_dropped() const { return dropped; }
+    void mark_dropped() { dropped = true; }
+    // What the open transaction changed, oldest first; the caller holds the writer lock
+    const vector<Change> &transaction_changes() const { return journal; }
+    int transaction_first_slot() const { return txn_first_slot; }
+    // Publishes the transaction's changes to readers and lets go of the table; the caller holds
+    // the writer lock and has written the changes out
+    void commit_transaction()
+    {
+        end_write();
+        release_transaction();
+    }
+    // Takes back every change of the open transaction, newest first, and lets go of the table
+    // without publishing a version; the caller holds the writer lock
+    void rollback_transaction()
+    {
+        {
+            unique_lock<shared_mutex> guard(latch);
+            // keys come off every row the transaction touched before any goes back, as one
+            // UPDATE may have shifted them onto each other (SET id = id + 1)
+            set<int> touched;
+            for (const Change &change : journal)
+                touched.insert(change.row);
+            if (has_pk())
+                for (int idx : touched)
+                    if (!tombstones[idx])
+                        pk_map.erase(build_pk_by_row(rows.page(idx / PagedRows::PAGE_ROWS)->rows[idx % PagedRows::PAGE_ROWS]));
+
+            for (auto it(journal.rbegin()); it != journal.rend(); ++it)
+            {
+                PagedRows::Ref page(page_of(it->row));
+                Row &row(page->rows[it->row % PagedRows::PAGE_ROWS]);
+                if (it->kind == Change::INSERT)
+                    notify(it->row, &row, nullptr);
+                else if (it->kind == Change::ERASE)
+                {
+                    tombstones[it->row] = false;
+                    stamps[it->row].end = LIVE;
+                    --dead_rows;
+                    notify(it->row, nullptr, &row);
+                }
+                else
+                {
+                    Row after(observed() ? row : Row());
+                    row = move(it->before);
+                    page.mark_dirty();
+                    if (observed())
+                        notify(it->row, &after, &row);
+                }
+            }
+
+            if (has_pk())
+                for (int idx : touched)
+                    if (idx < txn_first_slot && !tombstones[idx])
+                        pk_map.emplace(build_pk_by_row(rows.page(idx / PagedRows::PAGE_ROWS)->rows[idx % PagedRows::PAGE_ROWS]), idx);
+
+            // the appended slots go, so row ids keep matching the files, as do the versions
+            // the transaction left for readers: every row holds its old value again
+            rows.truncate(txn_first_slot);
+            tombstones.resize(txn_first_slot);
+            stamps.resize(txn_first_slot);
+            undo_head.resize(txn_first_slot);
+            uint64_t ts(write_ts);
+            drop_versions([ts](const UndoRecord &rec)
+                          { return rec.ts == ts; });
+            while (!index_changes.empty() && index_changes.back().ts == ts) // indexed as readers see them again
+                index_changes.pop_back();
+            write_ts = 0;
+        }
+        release_transaction();
+    }
+    // Listeners live until the table does; a table with any is never evicted
+    void add_listener(Listener *listener)
+    {
+        unique_lock<shared_mutex> guard(latch);
+        listeners.push_back(listener);
+    }
+    bool has_listeners() const
+    {
+        shared_lock<shared_mutex> guard(latch);
+        return !listeners.empty();
+    }
+    // Indexes the latest version of every live row by `column`; the caller holds the writer lock,
+    // so no statement is changing rows. The first index starts the change log, so snapshots taken
+    // before it cannot use any
+    void add_bitmap_index(const Text &index_name, int column, BitmapIndex::Kind kind = BitmapIndex::VALUES)
+    {
+        unique_lock<shared_mutex> guard(latch);
+        BitmapIndex index(index_name, column, ValueOps::for_column(columns[column]), kind);
+        bool first(bitmap_indexes.empty());
+        for (size_t p(0); p < rows.page_count(); ++p)
+        {
+            PagedRows::Ref page(rows.page(p));
+            int base(p * PagedRows::PAGE_ROWS);
+            for (int i(0); i < page->rows.size(); ++i)
+            {
+                if (tombstones[base + i])
+                    continue;
+                index.change(base + i, nullptr, &page->rows[i]);
+                if (first)
+                    indexed_rows.add(base + i);
+            }
+        }
+        bitmap_indexes.push_back(move(index));
+        if (first)
+            indexed_since = committed_ts;
+    }
+    // Runs fn() under the latch, so the bitmap indexes hold still while a plan looks at them
+    template <typename Fn>
+    void inspect_bitmap_indexes(Fn fn) const
+    {
+        shared_lock<shared_mutex> guard(latch);
+        fn();
+    }
+    // Name, column and kind of each bitmap index, in creation order
+    vector<BitmapIndex::Definition> bitmap_index_definitions() const
+    {
+        shared_lock<shared_mutex> guard(latch);
+        vector<BitmapIndex::Definition> defs;
+        for (const auto &index : bitmap_indexes)
+            defs.push_back({index.name(), columns[index.get_column()].get_name(), index.kind()});
+        return defs;
+    }
+    // The index of `column` of that kind, nullptr when it has none; the caller holds the latch, as
+    // in read_bitmap_indexes, or the writer lock
+    const BitmapIndex *bitmap_index(int column, BitmapIndex::Kind kind = BitmapIndex::VALUES) const
+    {
+        for (const auto &index : bitmap_indexes)
+        {
+            if (index.get_column() == column && index.kind() == kind)
+                return &index;
+        }
+        return nullptr;
+    }
+    const Bitmap &indexed_live_rows() const { return indexed_rows; } // as for bitmap_index
+    // Runs fn() under the latch, so the bitmap indexes hold still, and adds to `changed` the rows
+    // changed since the snapshot, whose indexed values may not be the ones it sees. False, without
+    // running fn, when there are no indexes or the snapshot is older than their change log
+    template <typename Fn>
+    bool read_bitmap_indexes(const ReadView &view, Fn fn, Bitmap &changed) const
+    {
+        shared_lock<shared_mutex> guard(latch);
+        if (bitmap_indexes.empty() || view.snapshot() < indexed_since)
+            return false;
+        fn();
+        for (auto it(index_changes.rbegin()); it != index_changes.rend() && it->ts > view.snapshot(); ++it)
+            changed.add(it->row);
+        return true;
+    }
+    vector<Text> pk_column_names() const
+    {
+        vector<Text> names;
+        for (int idx : pk_indices)
+            names.push_back(columns[idx].get_name());
+        return names;
+    }
+    // Approximate heap footprint: the pages the buffer pool holds for it plus the per-slot state
+    size_t estimated_bytes() const
+    {
+        shared_lock<shared_mutex> guard(latch);
+        size_t per_slot(sizeof(RowStamp) + sizeof(int) + 1);
+        size_t index(pk_map.bucket_count() * sizeof(void *) + pk_map.size() * (sizeof(Text) + 2 * sizeof(void *) + 16));
+        for (const auto &bitmaps : bitmap_indexes)
+            index += bitmaps.bytes();
+        if (!bitmap_indexes.empty())
+            index += indexed_rows.bytes() + index_changes.size() * sizeof(IndexChange);
+        return sizeof(Table) + rows.resident_bytes() + rows.size() * per_slot + index + undo.size() * sizeof(UndoRecord);
+    }
+
+    static const int SCAN_BATCH = 1024; // slots per block a scan holds the latch for
+    static_assert(PagedRows::PAGE_ROWS % SCAN_BATCH == 0, "a scan batch never spans two pages");
+
+    struct ScanStats
+    {
+        uint64_t blocks = 0;
+        uint64_t empty_blocks = 0; // no row visible to the snapshot
+        uint64_t slots = 0;
+        uint64_t visible = 0;
+    };
+
+    template <typename Fn>
+    void scan(const ReadView &view, Fn fn, ScanStats *stats = nullptr) const // fn(row_Idx, row) for rows visible to the snapshot
+    {
+        Row scratch;
+        uint64_t slots(0);
+        for (int start(0);; start += SCAN_BATCH)
+        {
+            shared_lock<shared_mutex> guard(latch);
+            int end(min<int>(rows.size(), start + SCAN_BATCH));
+            if (start >= end)
+                break;
+            slots += end - start;
+
+            PagedRows::Ref page(rows.page(start / PagedRows::PAGE_ROWS));
+            int base(start / PagedRows::PAGE_ROWS * PagedRows::PAGE_ROWS), seen(0);
+            for (int i(start); i < end; ++i)
+            {
+                const Row *row(visible_row(page->rows[i - base], i, view.snapshot(), scratch));
+                if (row)
+                {
+                    fn(i, *row);
+                    ++seen;
+                }
+            }
+
+            if (stats)
+            {
+                ++stats->blocks;
+                stats->empty_blocks += !seen;
+                stats->slots += end - start;
+                stats->visible += seen;
+            }
+        }
+        Metrics::add(Metrics::ROWS_SCANNED, slots);
+    }
+    // Buffers of one thread scanning block by block
+    struct BlockScan
+    {
+        vector<const Row *> visible;
+        vector<Row> versions; // older versions rebuilt for the snapshot, reserved so pointers hold
+        vector<int> slots;    // of the block, when only some are visited
+        Row scratch;
+        bool more = true; // the last fn's answer
+
+        BlockScan()
+        {
+            visible.reserve(SCAN_BATCH);
+            versions.reserve(SCAN_BATCH);
+        }
+    };
+
+    // fn(rows) with the rows of the block of slots from `start` (a multiple of SCAN_BATCH) visible
+    // to the snapshot, valid until it returns; fn returns whether to go on. False past the end.
+    // With `only` just the block's slots in it are visited, and a block with none is not read
+    template <typename Fn>
+    bool scan_block(const ReadView &view, int start, BlockScan &scan, Fn fn, ScanStats *stats = nullptr, const Bitmap *only = nullptr) const
+    {
+        shared_lock<shared_mutex> guard(latch);
+        int end(min<int>(rows.size(), start + SCAN_BATCH));
+        if (start >= end)
+            return false;
+        if (only)
+        {
+            scan.slots.clear();
+            only->collect(start, end, scan.slots);
+            if (scan.slots.empty())
+                return true;
+        }
+
+        PagedRows::Ref page(rows.page(start / PagedRows::PAGE_ROWS));
+        int base(start / PagedRows::PAGE_ROWS * PagedRows::PAGE_ROWS);
+        scan.visible.clear();
+        scan.versions.clear();
+        auto visit([&](int i)
+                   {
+            const Row *row(visible_row(page->rows[i - base], i, view.snapshot(), scan.scratch));
+            if (row == &scan.scratch)
+            {
+                scan.versions.push_back(move(scan.scratch));
+                row = &scan.versions.back();
+            }
+            if (row)
+                scan.visible.push_back(row); });
+        if (only)
+        {
+            for (int i : scan.slots)
+                visit(i);
+        }
+        else
+        {
+            for (int i(start); i < end; ++i)
+                visit(i);
+        }
+        if (!scan.visible.empty())
+            scan.more = fn(scan.visible);
+
+        int visited(only ? scan.slots.size() : end - start);
+        if (stats)
+        {
+            ++stats->blocks;
+            stats->empty_blocks += scan.visible.empty();
+            stats->slots += visited;
+            stats->visible += scan.visible.size();
+        }
+        Metrics::add(Metrics::ROWS_SCANNED, visited);
+        return true;
+    }
+
+    // Slots a scan would visit now, live or not
+    int scan_slots() const
+    {
+        shared_lock<shared_mutex> guard(latch);
+        return rows.size();
+    }
+    static const int PARALLEL_MIN_ROWS = 1 << 16; // slots per scanning thread
+    // Threads worth scanning the table with: one per PARALLEL_MIN_ROWS slots, up to one per core
+    int scan_workers() const { return scan_workers(scan_slots()); }
+    static int scan_workers(int64_t slots)
+    {
+        return max<int64_t>(1, min<int64_t>(parallelism(), slots / PARALLEL_MIN_ROWS));
+    }
+    void collect_versions()
+    {
+        unique_lock<shared_mutex> guard(latch);
+        collect_versions_locked();
+    }
+    // Visits the latest version of every live row in row id order; the caller holds the table's
+    // writer lock or the statement lock exclusively, so nothing changes underneath
+    template <typename Fn>
+    void for_each_live(Fn fn) const // fn(row_Idx, row)
+    {
+        for (size_t p(0); p < rows.page_count(); ++p)
+        {
+            shared_lock<shared_mutex> guard(latch);
+            PagedRows::Ref page(rows.page(p));
+            int base(p * PagedRows::PAGE_ROWS);
+            for (int i(0); i < page->rows.size(); ++i)
+            {
+                if (!tombstones[base + i])
+                    fn(base + i, page->rows[i]);
+            }
+        }
+    }
+    // Ids of the live rows, latest versions, for which pred(row) holds, ascending. With several
+    // workers each thread takes the next unvisited page when done with its last, so pred must be
+    // safe to call concurrently. The caller holds the writer lock, as for for_each_live
+    template <typename Pred>
+    vector<int> find_live(Pred pred, int workers = 1) const
+    {
+        int pages(rows.page_count());
+        vector<vector<int>> found(pages);
+        atomic<int> next_page(0);
+        auto scan([&]
+                  {
+            for (int p(next_page++); p < pages; p = next_page++)
+            {
+                shared_lock<shared_mutex> guard(latch);
+                PagedRows::Ref page(rows.page(p));
+                int base(p * PagedRows::PAGE_ROWS);
+                for (int i(0); i < page->rows.size(); ++i)
+                {
+                    if (!tombstones[base + i] && pred(page->rows[i]))
+                        found[p].push_back(base + i);
+                }
+            } });
+
+        workers = max(1, min(workers, pages));
+        if (workers == 1)
+            scan();
+        else
+        {
+            vector<thread> threads;
+            for (int w(0); w < workers; ++w)
+                threads.emplace_back(scan);
+            for (auto &t : threads)
+                t.join();
+        }
+
+        vector<int> ids;
+        size_t total(0);
+        for (const auto &part : found)
+            total += part.size();
+        ids.reserve(total);
+        for (const auto &part : found)
+            ids.insert(ids.end(), part.begin(), part.end());
+        return ids;
+    }
+    Row row_at(int i) const // a copy: the page holding it may be evicted once it is unpinned
+    {
+        shared_lock<shared_mutex> guard(latch);
+        if (i < 0 || i >= rows.size())
+            throw out_of_range("row index out of range");
+        return rows.page(i / PagedRows::PAGE_ROWS)->rows[i % PagedRows::PAGE_ROWS];
+    }
+    bool has_pk() const { return !pk_indices.empty(); }
+    bool is_single_pk() const { return pk_indices.size() == 1; }
+
+    int get_column_count() const { return columns.size(); }
+    int get_column_index(const string &col_name) const
+    {
+        for (int i(0); i < columns.size(); ++i)
+        {
             if (columns[i].get_name() == col_name)
                 return i;
         }
@@ -371,6 +1692,7 @@ public:
         if (pk_literals.size() != pk_indices.size())
             return NOT_FOUND;
 
+        Metrics::add(Metrics::PK_LOOKUPS);
         auto it(pk_map.find(build_pk_key_from_literals(pk_literals)));
 
         if (it == pk_map.end())
@@ -391,48 +1713,223 @@ public:
             return NOT_FOUND;
         return find_row_index_by_pk_literal(val.to_string());
     }
+    // The slot of the live row whose primary key `column` holds `key`, as the snapshot sees it.
+    // The index holds the latest keys, so it only answers while nothing has been written since
+    // the snapshot was taken; false when it cannot, `idx` NOT_FOUND when no row has the key
+    bool find_by_pk(const ReadView &view, int column, const Value &key, int &idx) const
+    {
+        shared_lock<shared_mutex> guard(latch);
+        if (!is_single_pk() || pk_indices[0] != column || key.is_null() || write_ts || view.snapshot() != committed_ts)
+            return false;
+        Metrics::add(Metrics::PK_LOOKUPS);
+        auto it(pk_map.find(escape_key(key.to_string())));
+        idx = it == pk_map.end() ? NOT_FOUND : it->second;
+        return true;
+    }
     void insert_row(const Row &row)
     {
+        unique_lock<shared_mutex> guard(latch);
         if (!has_pk())
         {
-            rows.push_back(row);
+            push_slot(row, false);
+            journal_change(Change::INSERT, rows.size() - 1);
+            notify(rows.size() - 1, nullptr, &row);
             return;
         }
 
         Text key(build_pk_by_row(row));
 
+        Metrics::add(Metrics::PK_LOOKUPS);
         if (pk_map.find(key) != pk_map.end())
             throw runtime_error("duplicate primary key: " + key);
 
         int idx(rows.size());
-        rows.push_back(row);
+        push_slot(row, false);
         pk_map.emplace(move(key), idx);
+        journal_change(Change::INSERT, idx);
+        notify(idx, nullptr, &row);
     }
-    bool delete_by_pk_literals(const vector<Text> &pk_literals)
+    Text primary_key_of(const Row &row) const { return build_pk_by_row(row); }
+    // Bulk load from a checkpoint: the slots arrive in row id order without building any key,
+    // then the stored primary keys of the live ones, in that same order, fill the index at once
+    void restore_slot(const Row &row, bool dead)
+    {
+        unique_lock<shared_mutex> guard(latch);
+        push_slot(row, dead);
+        dead_rows += dead;
+    }
+    void restore_index(vector<Text> &&keys)
+    {
+        unique_lock<shared_mutex> guard(latch);
+        pk_map.clear();
+        pk_map.reserve(keys.size());
+        int key(0);
+        for (int i(0); i < tombstones.size() && key < keys.size(); ++i)
+        {
+            if (!tombstones[i])
+                pk_map.emplace(move(keys[key++]), i);
+        }
+    }
+    // Load-time replacement of a live row's values, as a log replay finds them; the primary key
+    // index is left to rebuild_index
+    void restore_row(int idx, const Row &row)
+    {
+        unique_lock<shared_mutex> guard(latch);
+        if (idx < 0 || idx >= rows.size() || tombstones[idx])
+            throw out_of_range("row index out of range");
+        PagedRows::Ref page(page_of(idx));
+        page->rows[idx % PagedRows::PAGE_ROWS] = row;
+        page.mark_dirty();
+    }
+    // The primary key index built afresh from the live rows, once a load has put rows and keys
+    // in place out of order. A row whose key an earlier row already holds is tombstoned; returns
+    // how many were
+    int rebuild_index()
     {
+        unique_lock<shared_mutex> guard(latch);
         if (!has_pk())
+            return 0;
+        pk_map.clear();
+        int dropped(0);
+        for (size_t p(0); p < rows.page_count(); ++p)
+        {
+            PagedRows::Ref page(rows.page(p));
+            int base(p * PagedRows::PAGE_ROWS);
+            for (int i(0); i < page->rows.size(); ++i)
+            {
+                if (tombstones[base + i] || pk_map.emplace(build_pk_by_row(page->rows[i]), base + i).second)
+                    continue;
+                tombstones[base + i] = true;
+                ++dead_rows;
+                ++dropped;
+            }
+        }
+        return dropped;
+    }
+    void append_tombstone() // keeps row ids aligned with unreadable records on disk
+    {
+        unique_lock<shared_mutex> guard(latch);
+        push_slot(Row(), true);
+        ++dead_rows;
+    }
+    bool erase_at(int idx)
+    {
+        unique_lock<shared_mutex> guard(latch);
+        if (idx < 0 || idx >= rows.size() || tombstones[idx])
             return false;
 
-        int idx(find_row_index_by_pk_literals(pk_literals));
+        if (has_pk() || observed())
+        {
+            PagedRows::Ref page(page_of(idx));
+            const Row &row(page->rows[idx % PagedRows::PAGE_ROWS]);
+            if (has_pk())
+                pk_map.erase(build_pk_by_row(row));
+            notify(idx, &row, nullptr);
+        }
 
-        if (idx == NOT_FOUND)
-            return false;
+        tombstones[idx] = true;
+        stamps[idx].end = write_ts;
+        ++dead_rows;
+        journal_change(Change::ERASE, idx);
+        return true;
+    }
+    // erase_at for many rows, ids ascending: each page is latched and pinned once, and the primary
+    // key index loses the rows' keys on that same visit. Returns the number of rows tombstoned
+    int erase_rows(const vector<int> &ids)
+    {
+        int erased(0);
+        for (size_t i(0); i < ids.size();)
+        {
+            int p(ids[i] / PagedRows::PAGE_ROWS);
+            unique_lock<shared_mutex> guard(latch);
+            PagedRows::Ref page(page_of(ids[i]));
+            for (; i < ids.size() && ids[i] / PagedRows::PAGE_ROWS == p; ++i)
+            {
+                int idx(ids[i]);
+                if (idx >= rows.size() || tombstones[idx])
+                    continue;
+                const Row &row(page->rows[idx % PagedRows::PAGE_ROWS]);
+                if (has_pk())
+                    pk_map.erase(build_pk_by_row(row));
+                if (observed())
+                    notify(idx, &row, nullptr);
+                tombstones[idx] = true;
+                stamps[idx].end = write_ts;
+                ++dead_rows;
+                ++erased;
+                journal_change(Change::ERASE, idx);
+            }
+        }
+        return erased;
+    }
+    // Drops the dead rows; with `keep`, the slots below its size it does not mark instead, and
+    // every slot past it: a column file built from an earlier snapshot holds the rows it marks,
+    // deleted ones since included, which stay as tombstones.
+    // The caller holds the statement lock exclusively: open snapshots address rows by position
+    void compact(const vector<bool> *keep = nullptr)
+    {
+        unique_lock<shared_mutex> guard(latch);
+
+        for (const auto &rec : undo)
+            undo_head[rec.row] = NOT_FOUND;
+        undo.clear();
 
-        Text del_key(build_pk_by_row(rows[idx]));
-        pk_map.erase(del_key);
+        if (!keep && !dead_rows)
+            return;
 
-        int last(rows.size() - 1);
-        if (idx != last)
+        // slides the kept rows down page by page; at most the source and target pages are pinned
+        vector<int> remap(rows.size(), NOT_FOUND);
+        vector<bool> dead; // of the kept slots
+        int next(0);
+        PagedRows::Ref source, target;
+        for (int i(0); i < rows.size(); ++i)
         {
-            rows[idx] = move(rows[last]);
-            if (has_pk())
+            if (i % PagedRows::PAGE_ROWS == 0)
+                source = page_of(i);
+            if (keep ? i < keep->size() && !(*keep)[i] : tombstones[i])
+                continue;
+            if (i != next)
             {
-                Text moved_key(build_pk_by_row(rows[idx]));
-                pk_map[moved_key] = idx;
+                if (!target || next % PagedRows::PAGE_ROWS == 0)
+                    target = page_of(next);
+                target->rows[next % PagedRows::PAGE_ROWS] = move(source->rows[i % PagedRows::PAGE_ROWS]);
+                target.mark_dirty();
+                stamps[next] = stamps[i];
             }
+            dead.push_back(tombstones[i]);
+            remap[i] = next++;
         }
-        rows.pop_back();
-        return true;
+        source.release();
+        target.release();
+
+        rows.truncate(next);
+        stamps.resize(next);
+        stamps.shrink_to_fit();
+        undo_head.assign(next, NOT_FOUND);
+        undo_head.shrink_to_fit();
+        tombstones = move(dead);
+        tombstones.shrink_to_fit();
+        dead_rows = count(tombstones.begin(), tombstones.end(), true);
+
+        for (auto &entry : pk_map)
+            entry.second = remap[entry.second];
+        if (!bitmap_indexes.empty())
+            rebuild_bitmap_indexes_locked();
+
+        int kept(0);
+        for (int idx : dirty_rows)
+        {
+            if (remap[idx] != NOT_FOUND)
+                dirty_rows[kept++] = remap[idx];
+        }
+        dirty_rows.resize(kept);
+    }
+    bool delete_by_pk_literals(const vector<Text> &pk_literals)
+    {
+        if (!has_pk())
+            return false;
+
+        return erase_at(find_row_index_by_pk_literals(pk_literals));
     }
     bool delete_by_pk_literal(const Text &single_literal)
     {
@@ -442,65 +1939,573 @@ public:
     }
     void update_row_at_index(int idx, const Row &newRow)
     {
-        if (idx >= rows.size())
+        unique_lock<shared_mutex> guard(latch);
+        if (idx >= rows.size() || tombstones[idx])
             throw out_of_range("row index out of range");
 
-        if (!has_pk())
+        PagedRows::Ref page(page_of(idx));
+        Row &row(page->rows[idx % PagedRows::PAGE_ROWS]);
+        if (has_pk())
         {
-            rows[idx] = newRow;
-            return;
+            Text old_key(build_pk_by_row(row)),
+                new_key(build_pk_by_row(newRow));
+            if (old_key != new_key)
+            {
+                Metrics::add(Metrics::PK_LOOKUPS);
+                if (pk_map.find(new_key) != pk_map.end())
+                    throw runtime_error("update would violate primary key uniqueness: " + new_key);
+
+                pk_map.erase(old_key);
+                pk_map.emplace(move(new_key), idx);
+            }
         }
 
-        Text old_key(build_pk_by_row(rows[idx])),
-            new_key(build_pk_by_row(newRow));
-        if (old_key == new_key)
+        Row before;
+        if (observed() || owner)
+            before = row;
+        journal_change(Change::UPDATE, idx, &before);
+        for (int col(0); col < newRow.size(); ++col)
+            record_undo(idx, col, row[col]);
+        row = newRow;
+        page.mark_dirty();
+        if (observed())
+            notify(idx, &before, &row);
+    }
+    bool is_pk_column(int col_idx) const
+    {
+        for (int idx : pk_indices)
         {
-            rows[idx] = newRow;
+            if (idx == col_idx)
+                return true;
+        }
+        return false;
+    }
+    void assign_cells(int idx, const vector<pair<int, Value>> &cells) // col_Idx, new value
+    {
+        unique_lock<shared_mutex> guard(latch);
+        if (idx < 0 || idx >= rows.size() || tombstones[idx])
+            throw out_of_range("row index out of range");
+
+        PagedRows::Ref page(page_of(idx));
+        page.mark_dirty();
+        Row &row(page->rows[idx % PagedRows::PAGE_ROWS]);
+        Row before;
+        if (observed() || owner)
+            before = row;
+        bool touches_pk(false);
+        for (const auto &cell : cells)
+            touches_pk = touches_pk || is_pk_column(cell.first);
+
+        if (!touches_pk)
+        {
+            for (const auto &cell : cells)
+            {
+                record_undo(idx, cell.first, row[cell.first]);
+                row[cell.first] = cell.second;
+            }
+            dirty_rows.push_back(idx);
+            journal_change(Change::UPDATE, idx, &before);
+            if (observed())
+                notify(idx, &before, &row);
             return;
         }
 
-        if (pk_map.find(new_key) != pk_map.end())
-            throw runtime_error("update would violate primary key uniqueness: " + new_key);
+        Text old_key(build_pk_by_row(row));
+        vector<Value> previous;
+        previous.reserve(cells.size());
+        for (const auto &cell : cells)
+        {
+            previous.push_back(row[cell.first]);
+            row[cell.first] = cell.second;
+        }
+
+        auto restore([&]()
+                     {
+            for (int i(cells.size() - 1); i >= 0; --i)
+                row[cells[i].first] = move(previous[i]); });
+
+        Text new_key;
+        try
+        {
+            new_key = build_pk_by_row(row);
+        }
+        catch (...)
+        {
+            restore();
+            throw;
+        }
+
+        if (new_key != old_key)
+        {
+            Metrics::add(Metrics::PK_LOOKUPS);
+            if (pk_map.find(new_key) != pk_map.end())
+            {
+                restore();
+                throw runtime_error("update would violate primary key uniqueness: " + new_key);
+            }
+            pk_map.erase(old_key);
+            pk_map.emplace(move(new_key), idx);
+        }
+        for (int i(0); i < cells.size(); ++i)
+            record_undo(idx, cells[i].first, previous[i]);
+        dirty_rows.push_back(idx);
+        journal_change(Change::UPDATE, idx, &before);
+        if (observed())
+            notify(idx, &before, &row);
+    }
+    // assign_cells for many live rows, ids ascending: cells(row, out) puts the new values of the
+    // row's changed columns, all among `cols`, in `out`. Each page is latched and pinned once, and
+    // the values are set in place. When `cols` holds a primary key column the whole batch runs
+    // under one latch: the new keys are checked and the index changed in one pass, and a
+    // duplicate or NULL key throws before any row changes
+    template <typename Cells>
+    void assign_rows(const vector<int> &ids, const vector<int> &cols, Cells cells)
+    {
+        bool touches_pk(false);
+        for (int col : cols)
+            touches_pk = touches_pk || is_pk_column(col);
+        if (touches_pk)
+        {
+            assign_rows_rekeyed(ids, cells);
+            return;
+        }
 
-        pk_map.erase(old_key);
-        rows[idx] = newRow;
-        pk_map.emplace(move(new_key), idx);
+        vector<pair<int, Value>> out;
+        for (size_t i(0); i < ids.size();)
+        {
+            int p(ids[i] / PagedRows::PAGE_ROWS);
+            unique_lock<shared_mutex> guard(latch);
+            PagedRows::Ref page(page_of(ids[i]));
+            page.mark_dirty();
+            for (; i < ids.size() && ids[i] / PagedRows::PAGE_ROWS == p; ++i)
+            {
+                int idx(ids[i]);
+                Row &row(page->rows[idx % PagedRows::PAGE_ROWS]);
+                Row before;
+                if (observed() || owner)
+                    before = row;
+                out.clear();
+                cells(row, out);
+                for (auto &cell : out)
+                {
+                    record_undo(idx, cell.first, row[cell.first]);
+                    row[cell.first] = move(cell.second);
+                }
+                dirty_rows.push_back(idx);
+                journal_change(Change::UPDATE, idx, &before);
+                if (observed())
+                    notify(idx, &before, &row);
+            }
+        }
     }
-    const Row *get_single_row_pk_value(const Value &val) const
+    vector<int> take_dirty_rows()
     {
-        auto idx(find_row_index_by_pk_value(val));
-        if (idx == NOT_FOUND)
-            return nullptr;
-        return &rows[idx];
+        vector<int> taken;
+        taken.swap(dirty_rows);
+        return taken;
     }
 };
 
 const Text Table::PK_SEP = "|";
 
+// How a partitioned table spreads its rows over its partitions, tables of their own named
+// <table>.<partition>: by ranges of one column, each partition taking the values below its bound
+// the one before it does not, or by the column's hash. A table's scheme is replaced, never
+// changed, when partitions are added or dropped, so a statement keeps the one it started with.
+struct Partitioning
+{
+    enum Kind
+    {
+        RANGE,
+        HASH
+    };
+    // How HASH routes a value: by Value::stable_hash, or for tables from before it by the
+    // standard library's hash, which a different library may change
+    enum HashFunction
+    {
+        STD_HASH,
+        FNV1A
+    };
+    Text table;
+    Kind kind = RANGE;
+    HashFunction hash_function = FNV1A;
+    Text column;
+    Text column_type;
+    int column_index = NOT_FOUND;
+    ValueOps ops; // of the column's type
+    vector<Text> names;
+    vector<Value> bounds; // RANGE: each partition's exclusive upper bound, ascending; NULL for MAXVALUE
+
+    static const int MAX_PARTITIONS = 1024;
+
+    static bool is_partition(const Text &table_name) { return table_name.find('.') != Text::npos; }
+    Text partition_table(int i) const { return table + "." + names[i]; }
+
+    int find(const Text &name) const
+    {
+        for (int i(0); i < names.size(); ++i)
+        {
+            if (names[i] == name)
+                return i;
+        }
+        return NOT_FOUND;
+    }
+
+    vector<int> all() const
+    {
+        vector<int> every(names.size());
+        for (int i(0); i < every.size(); ++i)
+            every[i] = i;
+        return every;
+    }
+
+    // Scan threads each of `n` partitions scanned at once may start, so that all of them together
+    // stay within parallelism()
+    static int scan_share(size_t n)
+    {
+        return max<size_t>(1, parallelism() / max<size_t>(1, min<size_t>(n, parallelism())));
+    }
+
+    // The partition for rows whose partition column holds `v`; NOT_FOUND when no range takes it.
+    // NULL sorts first, so it belongs to the first range
+    int route(const Value &v) const
+    {
+        if (kind == HASH)
+            return (hash_function == FNV1A ? v.stable_hash() : ops.hash(v)) % names.size();
+        for (int i(0); i < bounds.size(); ++i)
+        {
+            if (bounds[i].is_null() || ops.compare(v, bounds[i]) < 0)
+                return i;
+        }
+        return NOT_FOUND;
+    }
+
+    // The partitions that may hold rows for which `column op literal` holds, the op one of
+    // = != < > <= >=, in partition order; all of them when the op does not narrow it down
+    vector<int> prune(const string &op, const Value &literal) const
+    {
+        vector<int> kept;
+        if (op == "=")
+        {
+            int p(route(literal));
+            if (p != NOT_FOUND)
+                kept.push_back(p);
+            return kept;
+        }
+        bool below(op == "<" || op == "<="), above(op == ">" || op == ">=");
+        for (int i(0); i < names.size(); ++i)
+        {
+            bool may(true);
+            if (kind == RANGE && !literal.is_null() && below && i) // the range starts at the bound before
+            {
+                int c(ops.compare(bounds[i - 1], literal));
+                may = op == "<" ? c < 0 : c <= 0;
+            }
+            else if (kind == RANGE && !literal.is_null() && above && !bounds[i].is_null())
+                may = ops.compare(bounds[i], literal) > 0;
+            if (may)
+                kept.push_back(i);
+        }
+        return kept;
+    }
+};
+
 class Catalog
 {
+public:
+    // A table that is on disk but not in memory: just what its .meta file says
+    struct TableStub
+    {
+        vector<Column> columns;
+        vector<Text> pk_columns;
+        vector<BitmapIndex::Definition> bitmap_indexes; // built once the table is read
+    };
+    using Loader = function<Table *(const Text &name, const TableStub &stub)>; // nullptr when unreadable
+
+    // Keeps every table handed out while it lives from being evicted. Statements and maintenance
+    // passes hold one; nesting on the same thread is free.
+    class Pin
+    {
+        const Catalog *catalog;
+
+        static int &depth()
+        {
+            thread_local int held(0);
+            return held;
+        }
+
+    public:
+        Pin(const Catalog *c) : catalog(c)
+        {
+            if (!depth()++)
+                catalog->pin_lock.lock_shared();
+        }
+        ~Pin()
+        {
+            if (!--depth())
+                catalog->pin_lock.unlock_shared();
+        }
+        Pin(const Pin &) = delete;
+        Pin &operator=(const Pin &) = delete;
+    };
+
 private:
-    unordered_map<Text, Table *> tables;
+    struct Entry
+    {
+        Table *table;
+        mutable atomic<int64_t> last_used; // steady_clock ticks
+        Entry(Table *t) : table(t), last_used(now()) {}
+    };
+
+    // A materialized view: its definition, and once first read the state its base table keeps up to date
+    struct ViewEntry
+    {
+        Text base;
+        Text definition;
+        unique_ptr<Table::Listener> state;
+    };
+
+    unordered_map<Text, Entry> tables;   // in memory
+    unordered_map<Text, TableStub> stubs; // on disk only, loaded on first access
+    unordered_map<Text, ViewEntry> views;
+    unordered_map<Text, shared_ptr<const Partitioning>> partitioned; // by table; the partitions are tables
+    vector<Table *> retired; // dropped, freed once no statement can still hold them
+    Loader loader;
+    mutable shared_mutex catalog_mutex; // lookups share it, only registering a table is exclusive
+    mutable shared_mutex pin_lock;      // shared by Pins, exclusive while evicting
+    mutex load_mutex;                   // one lazy load at a time, so a table is never read twice
+
+    static int64_t now() { return chrono::steady_clock::now().time_since_epoch().count(); }
+
+    int free_retired() // under the exclusive pin lock and the catalog lock
+    {
+        int freed(retired.size());
+        for (Table *t : retired)
+            delete t;
+        retired.clear();
+        return freed;
+    }
 
 public:
     Catalog() {}
+    void set_loader(Loader l) { loader = move(l); }
+    void add_stub(const Text &name, TableStub stub)
+    {
+        unique_lock<shared_mutex> guard(catalog_mutex);
+        if (tables.find(name) == tables.end())
+            stubs[name] = move(stub);
+    }
     void addTable(Table *t)
     {
         if (!t)
             throw invalid_argument("addTable: null pointer");
 
-        tables[t->get_name()] = t;
+        unique_lock<shared_mutex> guard(catalog_mutex);
+        stubs.erase(t->get_name());
+        tables.erase(t->get_name());
+        tables.emplace(t->get_name(), t);
+    }
+    bool add_if_absent(Table *t)
+    {
+        if (!t)
+            throw invalid_argument("add_if_absent: null pointer");
+
+        unique_lock<shared_mutex> guard(catalog_mutex);
+        if (stubs.count(t->get_name()) || views.count(t->get_name()) || partitioned.count(t->get_name()))
+            return false;
+        return tables.emplace(t->get_name(), t).second;
+    }
+    // Registers a partitioned table; its partitions are registered as tables of their own
+    bool add_partitioned(const Text &name, shared_ptr<const Partitioning> scheme)
+    {
+        unique_lock<shared_mutex> guard(catalog_mutex);
+        if (tables.count(name) || stubs.count(name) || views.count(name))
+            return false;
+        return partitioned.emplace(name, move(scheme)).second;
+    }
+    void set_partitioning(const Text &name, shared_ptr<const Partitioning> scheme)
+    {
+        unique_lock<shared_mutex> guard(catalog_mutex);
+        partitioned[name] = move(scheme);
+    }
+    // nullptr unless `name` is a partitioned table
+    shared_ptr<const Partitioning> partitioning(const Text &name) const
+    {
+        shared_lock<shared_mutex> guard(catalog_mutex);
+        auto it(partitioned.find(name));
+        return it == partitioned.end() ? nullptr : it->second;
     }
-    Table *getTable(const Text &name) const
+    // The tables of the partitions at `indices`, read in as needed; one that cannot be read is left out
+    vector<Table *> get_partitions(const Partitioning &scheme, const vector<int> &indices)
     {
+        vector<Table *> result;
+        for (int i : indices)
+        {
+            Table *t(getTable(scheme.partition_table(i)));
+            if (t)
+                result.push_back(t);
+        }
+        return result;
+    }
+    // The table if it is in memory, without reading it in
+    Table *resident(const Text &name) const
+    {
+        shared_lock<shared_mutex> guard(catalog_mutex);
+        auto it(tables.find(name));
+        return it == tables.end() ? nullptr : it->second.table;
+    }
+    // Forgets a table; statements already holding it keep it until release_retired frees it.
+    // Returns the table if it was in memory
+    Table *retire_table(const Text &name)
+    {
+        unique_lock<shared_mutex> guard(catalog_mutex);
+        stubs.erase(name);
         auto it(tables.find(name));
         if (it == tables.end())
             return nullptr;
-        return it->second;
+        Table *t(it->second.table);
+        retired.push_back(t);
+        tables.erase(it);
+        return t;
+    }
+    // Frees the retired tables, unless a Pin is held; returns the number freed
+    int release_retired()
+    {
+        unique_lock<shared_mutex> exclusive(pin_lock, try_to_lock);
+        if (!exclusive.owns_lock())
+            return 0;
+        unique_lock<shared_mutex> guard(catalog_mutex);
+        return free_retired();
+    }
+    Table *getTable(const Text &name)
+    {
+        {
+            shared_lock<shared_mutex> guard(catalog_mutex);
+            auto it(tables.find(name));
+            if (it != tables.end())
+            {
+                it->second.last_used.store(now(), memory_order_relaxed);
+                return it->second.table;
+            }
+            if (!stubs.count(name) || !loader)
+                return nullptr;
+        }
+
+        lock_guard<mutex> loading(load_mutex);
+        TableStub stub;
+        {
+            shared_lock<shared_mutex> guard(catalog_mutex);
+            auto it(tables.find(name));
+            if (it != tables.end()) // loaded while this thread waited
+                return it->second.table;
+            auto st(stubs.find(name));
+            if (st == stubs.end())
+                return nullptr;
+            stub = st->second;
+        }
+
+        Table *t(loader(name, stub));
+        unique_lock<shared_mutex> guard(catalog_mutex);
+        if (!t)
+        {
+            stubs.erase(name); // unreadable, reported once by the loader
+            return nullptr;
+        }
+        if (!stubs.erase(name)) // retired while it was read
+        {
+            retired.push_back(t);
+            return nullptr;
+        }
+        tables.emplace(name, t);
+        return t;
     }
     bool exists(const Text &name) const
     {
-        return tables.find(name) != tables.end();
+        shared_lock<shared_mutex> guard(catalog_mutex);
+        return tables.find(name) != tables.end() || stubs.find(name) != stubs.end() || views.find(name) != views.end() ||
+               partitioned.find(name) != partitioned.end();
+    }
+    bool add_view(const Text &name, const Text &base, const Text &definition)
+    {
+        unique_lock<shared_mutex> guard(catalog_mutex);
+        if (tables.count(name) || stubs.count(name) || partitioned.count(name))
+            return false;
+        return views.emplace(name, ViewEntry{base, definition, nullptr}).second;
+    }
+    bool is_view(const Text &name) const
+    {
+        shared_lock<shared_mutex> guard(catalog_mutex);
+        return views.count(name);
+    }
+    bool get_view(const Text &name, Text &base, Text &definition, Table::Listener *&state) const
+    {
+        shared_lock<shared_mutex> guard(catalog_mutex);
+        auto it(views.find(name));
+        if (it == views.end())
+            return false;
+        base = it->second.base;
+        definition = it->second.definition;
+        state = it->second.state.get();
+        return true;
+    }
+    void set_view_state(const Text &name, unique_ptr<Table::Listener> state)
+    {
+        unique_lock<shared_mutex> guard(catalog_mutex);
+        views.at(name).state = move(state);
+    }
+    vector<Table *> all_tables() const // the ones in memory
+    {
+        shared_lock<shared_mutex> guard(catalog_mutex);
+        vector<Table *> result;
+        result.reserve(tables.size());
+        for (const auto &entry : tables)
+            result.push_back(entry.second.table);
+        return result;
+    }
+    size_t stub_count() const
+    {
+        shared_lock<shared_mutex> guard(catalog_mutex);
+        return stubs.size();
+    }
+    // Turns the least recently used tables idle for at least `idle` back into stubs until the
+    // rest fits in `budget` bytes. Every change is already in the table's files, so nothing is
+    // written. Gives up while any Pin is held; returns the number of tables evicted.
+    int evict_idle(size_t budget, chrono::milliseconds idle)
+    {
+        unique_lock<shared_mutex> exclusive(pin_lock, try_to_lock);
+        if (!exclusive.owns_lock())
+            return 0;
+        unique_lock<shared_mutex> guard(catalog_mutex);
+        free_retired();
+
+        size_t total(0);
+        vector<tuple<int64_t, size_t, Text>> candidates; // last_used, bytes, name
+        int64_t cutoff(now() - chrono::duration_cast<chrono::steady_clock::duration>(idle).count());
+        for (const auto &entry : tables)
+        {
+            size_t bytes(entry.second.table->estimated_bytes());
+            total += bytes;
+            int64_t used(entry.second.last_used.load(memory_order_relaxed));
+            Table *t(entry.second.table); // views hold on to their base, transactions to their tables
+            if (used <= cutoff && !t->has_listeners() && !t->in_transaction())
+                candidates.emplace_back(used, bytes, entry.first);
+        }
+        sort(candidates.begin(), candidates.end());
+
+        int evicted(0);
+        for (const auto &candidate : candidates)
+        {
+            if (total <= budget)
+                break;
+            auto it(tables.find(get<2>(candidate)));
+            Table *t(it->second.table);
+            stubs[t->get_name()] = {t->get_columns(), t->pk_column_names(), t->bitmap_index_definitions()};
+            tables.erase(it);
+            delete t;
+            total -= get<1>(candidate);
+            ++evicted;
+        }
+        return evicted;
     }
 };
 
@@ -519,6 +2524,7 @@ public:
     Text table_name;
     vector<Column> columns;
     vector<Text> pk_columns;
+    shared_ptr<Partitioning> partitioning; // PARTITION BY, else nullptr
 };
 
 class AST_Insert
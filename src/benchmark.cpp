@@ -0,0 +1,201 @@
+#include "../include/Session.cpp"
+#include "../include/DataGenerator.cpp"
+#include <chrono>
+
+using Clock = chrono::steady_clock;
+
+struct Measurement
+{
+    uint64_t rows;
+    string operation;
+    vector<double> micros; // of the operations that succeeded
+    uint64_t failures;
+};
+
+static void usage()
+{
+    cout << "Usage: mini_db_bench [--rows N[,N...]] [--dist uniform|zipf] [--theta T]\n"
+         << "                     [--ops N] [--scan-ops N] [--data DIR] [--out FILE]\n"
+         << "  --rows      scale factors to run, 1000 to 100000000 (default 1000,100000)\n"
+         << "  --dist      key and category distribution (default uniform)\n"
+         << "  --theta     Zipf skew (default 0.99)\n"
+         << "  --ops       point operations per measurement (default 1000)\n"
+         << "  --scan-ops  full-scan operations per measurement (default 10)\n"
+         << "  --data      scratch data directory (default <tmp>/mini_db_bench)\n"
+         << "  --out       write the JSON report to FILE instead of stdout\n";
+}
+
+static uint64_t counted(int counter) { return Metrics::snapshot().counters[counter]; }
+
+// Times fn(0) to fn(ops - 1). An operation fails when fn returns false or, given a counter, when
+// it leaves the counter unchanged: a statement that does nothing is not timed as one that works
+template <typename Fn>
+static Measurement measure(uint64_t rows, const string &operation, int ops, Fn fn, int counter = NOT_FOUND)
+{
+    Measurement m{rows, operation, {}, 0};
+    m.micros.reserve(ops);
+    for (int i(0); i < ops; ++i)
+    {
+        uint64_t before(counter == NOT_FOUND ? 0 : counted(counter));
+        auto start(Clock::now());
+        bool ok(fn(i));
+        double micros(chrono::duration<double, micro>(Clock::now() - start).count());
+        if (ok && (counter == NOT_FOUND || counted(counter) > before))
+            m.micros.push_back(micros);
+        else
+            ++m.failures;
+    }
+    return m;
+}
+
+static double percentile(const vector<double> &sorted, double p)
+{
+    if (sorted.empty())
+        return 0;
+    int idx(min<int>(sorted.size() - 1, (int)(p * sorted.size())));
+    return sorted[idx];
+}
+
+static void write_json(ostream &out, const string &dist, double theta, const vector<Measurement> &results)
+{
+    out << fixed << setprecision(3);
+    out << "{\n  \"benchmark\": \"mini_db\",\n  \"distribution\": \"" << dist << "\",\n  \"theta\": " << theta
+        << ",\n  \"results\": [\n";
+
+    for (int i(0); i < results.size(); ++i)
+    {
+        vector<double> sorted(results[i].micros);
+        sort(sorted.begin(), sorted.end());
+
+        double total(0);
+        for (double us : sorted)
+            total += us;
+
+        out << "    {\"rows\": " << results[i].rows
+            << ", \"operation\": \"" << results[i].operation << "\""
+            << ", \"ops\": " << sorted.size()
+            << ", \"failures\": " << results[i].failures
+            << ", \"total_ms\": " << total / 1000.0
+            << ", \"throughput_ops_per_sec\": " << (total > 0 ? sorted.size() / (total / 1e6) : 0.0)
+            << ", \"latency_us\": {\"mean\": " << (sorted.empty() ? 0.0 : total / sorted.size())
+            << ", \"min\": " << (sorted.empty() ? 0.0 : sorted.front())
+            << ", \"p50\": " << percentile(sorted, 0.50)
+            << ", \"p99\": " << percentile(sorted, 0.99)
+            << ", \"max\": " << (sorted.empty() ? 0.0 : sorted.back()) << "}}"
+            << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    out << "  ]\n}\n";
+}
+
+int main(int argc, char **argv)
+{
+    vector<uint64_t> scales = {1000, 100000};
+    string dist("uniform"), out_file;
+    fs::path data_dir(fs::temp_directory_path() / "mini_db_bench");
+    double theta(0.99);
+    int ops(1000), scan_ops(10);
+
+    for (int i(1); i < argc; ++i)
+    {
+        string arg(argv[i]);
+        if (arg == "--rows" && i + 1 < argc)
+        {
+            scales.clear();
+            for (const auto &part : Helper::split_commas_respecting_quotes(argv[++i]))
+                scales.push_back(stoull(part));
+        }
+        else if (arg == "--dist" && i + 1 < argc)
+            dist = Helper::to_lower(argv[++i]);
+        else if (arg == "--theta" && i + 1 < argc)
+            theta = atof(argv[++i]);
+        else if (arg == "--ops" && i + 1 < argc)
+            ops = atoi(argv[++i]);
+        else if (arg == "--scan-ops" && i + 1 < argc)
+            scan_ops = atoi(argv[++i]);
+        else if (arg == "--data" && i + 1 < argc)
+            data_dir = argv[++i];
+        else if (arg == "--out" && i + 1 < argc)
+            out_file = argv[++i];
+        else
+        {
+            usage();
+            return (arg == "--help" || arg == "-h") ? 0 : 1;
+        }
+    }
+
+    if (dist != "uniform" && dist != "zipf")
+    {
+        usage();
+        return (1);
+    }
+
+    bool zipfian(dist == "zipf");
+    Helper::data_dir() = data_dir;
+    const string table("bench");
+    vector<Measurement> results;
+    ostream discard(nullptr);
+
+    for (uint64_t rows : scales)
+    {
+        cerr << "Scale " << rows << " rows...\n";
+        fs::remove_all(data_dir);
+
+        DataGenerator generator(rows, zipfian);
+        results.push_back(measure(rows, "generate", 1, [&](int)
+                                  { generator.write_table(table); return true; }));
+
+        Catalog catalog;
+        results.push_back(measure(rows, "load", 1, [&](int)
+                                  {
+            Helper::load_existing_tables(&catalog);
+            return catalog.getTable(table) != nullptr; // tables are read in on first use
+        }));
+
+        Session session(&catalog, discard);
+        KeyChooser keys(rows, zipfian, theta);
+        mt19937_64 rng(7);
+
+        // SELECT reads the row the primary key index names
+        results.push_back(measure(rows, "pk_lookup", ops, [&](int)
+                                  { return session.execute("SELECT * FROM bench WHERE id = " + to_string(keys.next(rng))); },
+                                  Metrics::ROWS_RETURNED));
+        results.push_back(measure(rows, "filtered_scan", scan_ops, [&](int i)
+                                  { return session.execute("SELECT COUNT(*) FROM bench WHERE amount > " + to_string(100 * (i % 9 + 1))); },
+                                  Metrics::ROWS_RETURNED));
+        results.push_back(measure(rows, "group_by", scan_ops, [&](int)
+                                  { return session.execute("SELECT category, COUNT(*), AVG(amount) FROM bench GROUP BY category"); },
+                                  Metrics::ROWS_RETURNED));
+        results.push_back(measure(rows, "order_by", scan_ops, [&](int)
+                                  { return session.execute("SELECT id, amount FROM bench ORDER BY amount DESC, id"); },
+                                  Metrics::ROWS_RETURNED));
+        results.push_back(measure(rows, "insert", ops, [&](int i)
+                                  { return session.execute(generator.insert_statement(table, rows + i)); },
+                                  Metrics::ROWS_INSERTED));
+        results.push_back(measure(rows, "update", ops, [&](int)
+                                  { return session.execute("UPDATE bench SET qty += 1 WHERE id = " + to_string(keys.next(rng))); },
+                                  Metrics::ROWS_UPDATED));
+
+        // keys are drawn without replacement: one already deleted moves on to the next one that is not
+        vector<bool> deleted(rows);
+        uint64_t deletes(min<uint64_t>(ops, rows));
+        results.push_back(measure(rows, "delete", deletes, [&](int)
+                                  {
+            uint64_t key(keys.next(rng) % rows);
+            while (deleted[key])
+                key = (key + 1) % rows;
+            deleted[key] = true;
+            return session.execute("DELETE FROM bench WHERE id = " + to_string(key)); },
+                                  Metrics::ROWS_DELETED));
+    }
+
+    fs::remove_all(data_dir);
+
+    if (out_file.empty())
+        write_json(cout, dist, theta, results);
+    else
+    {
+        ofstream file(out_file);
+        write_json(file, dist, theta, results);
+    }
+    return (0);
+}
@@ -0,0 +1,72 @@
+#include "../include/Protocol.cpp"
+#include "../include/Helper.cpp"
+
+static void usage()
+{
+    cout << "Usage: mini_db_client [--host ADDR] [--port N] [--socket PATH]\n"
+         << "  Reads statements from stdin, one per line, and prints the server's reply.\n";
+}
+
+int main(int argc, char **argv)
+{
+    string host("127.0.0.1"), socket_path;
+    int port(5499);
+
+    for (int i(1); i < argc; ++i)
+    {
+        string arg(argv[i]);
+        if (arg == "--host" && i + 1 < argc)
+            host = argv[++i];
+        else if (arg == "--port" && i + 1 < argc)
+            port = atoi(argv[++i]);
+        else if (arg == "--socket" && i + 1 < argc)
+            socket_path = argv[++i];
+        else
+        {
+            usage();
+            return (arg == "--help" || arg == "-h") ? 0 : 1;
+        }
+    }
+
+    int fd(socket_path.empty() ? Protocol::connect_tcp(host, port) : Protocol::connect_unix(socket_path));
+    if (fd < 0)
+    {
+        cerr << "Cannot connect to " << (socket_path.empty() ? host + ":" + to_string(port) : socket_path) << "\n";
+        return (1);
+    }
+
+    bool interactive(isatty(STDIN_FILENO));
+    if (interactive)
+        cout << "\nConnected to mini database engine\n"
+             << "Type 'help' for commands\n"
+             << "SQL> ";
+
+    string line, reply;
+    while (getline(cin, line))
+    {
+        if (Helper::trim(line).empty())
+        {
+            if (interactive)
+                cout << "SQL> ";
+            continue;
+        }
+
+        if (!Protocol::send_frame(fd, line) || !Protocol::recv_frame(fd, reply))
+        {
+            cerr << "\nConnection lost\n";
+            close(fd);
+            return (1);
+        }
+        cout << reply;
+
+        string lower(Helper::to_lower(Helper::trim(line)));
+        if (lower == "exit" || lower == "quit")
+            break;
+
+        if (interactive)
+            cout << "SQL> ";
+    }
+
+    close(fd);
+    return (0);
+}
@@ -0,0 +1,137 @@
+#include "../include/Server.cpp"
+#include "../include/Compactor.cpp"
+#include "../include/Checkpointer.cpp"
+#include "../include/TableEvictor.cpp"
+#include <csignal>
+
+static atomic<bool> stop_requested(false);
+
+static void on_signal(int) { stop_requested = true; }
+
+static void usage()
+{
+    cout << "Usage: mini_db_server [--host ADDR] [--port N] [--socket PATH] [--threads N]\n"
+         << "                      [--metrics PATH] [--metrics-interval S] [--checkpoint-interval S]\n"
+         << "                      [--memory-budget MB] [--evict-idle S] [--buffer-pool MB] [--sort-memory MB]\n"
+         << "                      [--durability enqueue|flush]\n"
+         << "  --host ADDR           TCP address to bind (default 127.0.0.1)\n"
+         << "  --port N              TCP port, 0 disables TCP (default 5499)\n"
+         << "  --socket PATH         also listen on a Unix domain socket\n"
+         << "  --threads N           statement worker threads (default: hardware threads)\n"
+         << "  --metrics PATH        Prometheus text file (default ../data/metrics.prom)\n"
+         << "  --metrics-interval S  seconds between metrics file updates (default 10)\n"
+         << "  --checkpoint-interval S\n"
+         << "                        seconds between checkpoints, 0 only checkpoints on shutdown (default 60)\n"
+         << "  --memory-budget MB    evict idle tables while the loaded ones use more (default 0: never)\n"
+         << "  --evict-idle S        seconds without a statement before a table may be evicted (default 60)\n"
+         << "  --buffer-pool MB      memory for table pages; colder pages spill to scratch files (default: unlimited)\n"
+         << "  --sort-memory MB      memory per ORDER BY before it spills sorted runs to temp files (default 256)\n"
+         << "  --durability MODE     acknowledge writes once queued (enqueue, default) or once written (flush);\n"
+         << "                        a session can change it with SET DURABILITY\n";
+}
+
+int main(int argc, char **argv)
+{
+    string host("127.0.0.1"), socket_path, metrics_path((Helper::data_dir() / "metrics.prom").string()), durability("enqueue");
+    int port(5499), threads(thread::hardware_concurrency()), metrics_interval(10), checkpoint_interval(60),
+        memory_budget_mb(0), evict_idle(60), buffer_pool_mb(0), sort_memory_mb(0);
+
+    for (int i(1); i < argc; ++i)
+    {
+        string arg(argv[i]);
+        if (arg == "--host" && i + 1 < argc)
+            host = argv[++i];
+        else if (arg == "--port" && i + 1 < argc)
+            port = atoi(argv[++i]);
+        else if (arg == "--socket" && i + 1 < argc)
+            socket_path = argv[++i];
+        else if (arg == "--threads" && i + 1 < argc)
+            threads = atoi(argv[++i]);
+        else if (arg == "--metrics" && i + 1 < argc)
+            metrics_path = argv[++i];
+        else if (arg == "--metrics-interval" && i + 1 < argc)
+            metrics_interval = max(1, atoi(argv[++i]));
+        else if (arg == "--checkpoint-interval" && i + 1 < argc)
+            checkpoint_interval = max(0, atoi(argv[++i]));
+        else if (arg == "--memory-budget" && i + 1 < argc)
+            memory_budget_mb = max(0, atoi(argv[++i]));
+        else if (arg == "--evict-idle" && i + 1 < argc)
+            evict_idle = max(0, atoi(argv[++i]));
+        else if (arg == "--buffer-pool" && i + 1 < argc)
+            buffer_pool_mb = max(0, atoi(argv[++i]));
+        else if (arg == "--sort-memory" && i + 1 < argc)
+            sort_memory_mb = max(0, atoi(argv[++i]));
+        else if (arg == "--durability" && i + 1 < argc && (string(argv[i + 1]) == "enqueue" || string(argv[i + 1]) == "flush"))
+            durability = argv[++i];
+        else
+        {
+            usage();
+            return (arg == "--help" || arg == "-h") ? 0 : 1;
+        }
+    }
+
+    if (buffer_pool_mb)
+        BufferPool<RowPage>::instance().set_limit((size_t)buffer_pool_mb << 20);
+    if (sort_memory_mb)
+        ExternalSort::set_default_budget((size_t)sort_memory_mb << 20);
+    WriteQueue::instance().set_default_durability(durability == "flush" ? WriteQueue::FLUSH : WriteQueue::ENQUEUE);
+
+    Catalog catalog;
+    Helper::load_existing_tables(&catalog);
+    WriteQueue::instance().start();
+
+    Compactor compactor(&catalog);
+    compactor.start();
+
+    Checkpointer checkpointer(&catalog, chrono::seconds(checkpoint_interval));
+    checkpointer.start();
+
+    TableEvictor evictor(&catalog, (size_t)memory_budget_mb << 20, chrono::seconds(evict_idle));
+    if (memory_budget_mb)
+        evictor.start();
+
+    MetricsExporter exporter(metrics_path, chrono::seconds(metrics_interval));
+    exporter.start();
+
+    Server server(&catalog, threads);
+
+    if (port > 0)
+    {
+        if (!server.listen_tcp(host, port))
+        {
+            cerr << "Cannot listen on " << host << ":" << port << "\n";
+            return (1);
+        }
+        cout << "Listening on " << host << ":" << port << "\n";
+    }
+    if (!socket_path.empty())
+    {
+        if (!server.listen_unix(socket_path))
+        {
+            cerr << "Cannot listen on " << socket_path << "\n";
+            return (1);
+        }
+        cout << "Listening on " << socket_path << "\n";
+    }
+    if (port <= 0 && socket_path.empty())
+    {
+        usage();
+        return (1);
+    }
+
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+    signal(SIGPIPE, SIG_IGN);
+
+    server.run(stop_requested);
+
+    compactor.stop();
+    evictor.stop();
+    checkpointer.stop();
+    WriteQueue::instance().stop();
+    exporter.stop();
+    if (!socket_path.empty())
+        unlink(socket_path.c_str());
+    cout << "\nServer stopped\n";
+    return (0);
+}
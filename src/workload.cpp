@@ -0,0 +1,282 @@
+#include "../include/Session.cpp"
+#include "../include/DataGenerator.cpp"
+#include "../include/Histogram.cpp"
+#include <chrono>
+#include <array>
+#include <thread>
+
+using Clock = chrono::steady_clock;
+
+enum Operation
+{
+    READ,
+    UPDATE,
+    INSERT,
+    SCAN,
+    OPERATION_COUNT
+};
+
+static const char *OPERATION_NAMES[OPERATION_COUNT] = {"read", "update", "insert", "scan"};
+
+struct WorkloadConfig
+{
+    uint64_t records = 100000;
+    int threads = 4;
+    double seconds = 10;
+    uint64_t max_ops = 0; // 0 = run for `seconds`
+    double mix[OPERATION_COUNT] = {95, 5, 0, 0};
+    string dist = "zipf";
+    double theta = 0.99;
+    fs::path data_dir = fs::temp_directory_path() / "mini_db_workload";
+    string out_file;
+};
+
+// Picks the key for the next operation; `latest` favours the most recently inserted ids
+class KeySource
+{
+    const WorkloadConfig &config;
+    ZipfGenerator zipf;
+    atomic<uint64_t> &next_id;
+
+public:
+    KeySource(const WorkloadConfig &cfg, atomic<uint64_t> &ids)
+        : config(cfg), zipf(cfg.dist == "uniform" ? 1 : cfg.records, cfg.theta), next_id(ids) {}
+
+    template <typename Rng>
+    uint64_t next(Rng &rng) const
+    {
+        uint64_t limit(next_id.load());
+        if (config.dist == "uniform")
+            return uniform_int_distribution<uint64_t>(0, limit - 1)(rng);
+
+        uint64_t rank(zipf.next(rng));
+        if (config.dist == "latest")
+            return rank < limit ? limit - 1 - rank : 0;
+        return rank % limit;
+    }
+};
+
+static void usage()
+{
+    cout << "Usage: mini_db_workload [--preset a|b|c|e] [--records N] [--threads N]\n"
+         << "                        [--seconds S | --ops N] [--read P] [--update P] [--insert P] [--scan P]\n"
+         << "                        [--dist uniform|zipf|latest] [--theta T] [--data DIR] [--out FILE]\n"
+         << "  Presets follow YCSB: a = 50% read / 50% update, b = 95/5 read/update,\n"
+         << "  c = read only, e = 95% scan / 5% insert. Explicit percentages override the preset.\n";
+}
+
+static bool apply_preset(WorkloadConfig &config, const string &name)
+{
+    double presets[4][OPERATION_COUNT] = {{50, 50, 0, 0}, {95, 5, 0, 0}, {100, 0, 0, 0}, {0, 0, 5, 95}};
+    string letters("abce");
+    size_t idx(letters.find(Helper::to_lower(name)));
+    if (name.size() != 1 || idx == string::npos)
+        return false;
+
+    copy(presets[idx], presets[idx] + OPERATION_COUNT, config.mix);
+    if (name == "e" || name == "E")
+        config.dist = "latest";
+    return true;
+}
+
+static string statement_for(Operation op, uint64_t key, DataGenerator &generator)
+{
+    switch (op)
+    {
+    case READ:
+        return "SELECT * FROM usertable WHERE id = " + to_string(key);
+    case UPDATE:
+        return "UPDATE usertable SET qty += 1 WHERE id = " + to_string(key);
+    case INSERT:
+        return generator.insert_statement("usertable", key);
+    default:
+        return "SELECT COUNT(*) FROM usertable WHERE id >= " + to_string(key);
+    }
+}
+
+// Failed statements are counted apart: the throughput and latencies are those of the ones that ran
+static void write_report(ostream &out, const WorkloadConfig &config, double elapsed, const Histogram *histograms,
+                         const uint64_t *failures)
+{
+    uint64_t total(0), failed(0);
+    for (int op(0); op < OPERATION_COUNT; ++op)
+    {
+        total += histograms[op].count();
+        failed += failures[op];
+    }
+
+    out << fixed << setprecision(3);
+    out << "{\n  \"records\": " << config.records << ",\n  \"threads\": " << config.threads
+        << ",\n  \"distribution\": \"" << config.dist << "\",\n  \"elapsed_sec\": " << elapsed
+        << ",\n  \"operations\": " << total << ",\n  \"failures\": " << failed
+        << ",\n  \"throughput_ops_per_sec\": " << (elapsed > 0 ? total / elapsed : 0.0)
+        << ",\n  \"latency_us\": {\n";
+
+    bool first(true);
+    for (int op(0); op < OPERATION_COUNT; ++op)
+    {
+        const Histogram &h(histograms[op]);
+        if (!h.count() && !failures[op])
+            continue;
+
+        out << (first ? "" : ",\n") << "    \"" << OPERATION_NAMES[op] << "\": {\"count\": " << h.count()
+            << ", \"failures\": " << failures[op]
+            << ", \"mean\": " << h.mean() / 1000.0
+            << ", \"min\": " << h.lowest() / 1000.0
+            << ", \"p50\": " << h.percentile(50) / 1000.0
+            << ", \"p99\": " << h.percentile(99) / 1000.0
+            << ", \"p999\": " << h.percentile(99.9) / 1000.0
+            << ", \"max\": " << h.highest() / 1000.0 << "}";
+        first = false;
+    }
+    out << "\n  }\n}\n";
+}
+
+int main(int argc, char **argv)
+{
+    WorkloadConfig config;
+    bool explicit_mix(false);
+
+    for (int i(1); i < argc; ++i)
+    {
+        string arg(argv[i]);
+        bool has_value(i + 1 < argc);
+
+        if (arg == "--preset" && has_value)
+        {
+            if (!apply_preset(config, argv[++i]))
+            {
+                usage();
+                return (1);
+            }
+        }
+        else if (arg == "--records" && has_value)
+            config.records = stoull(argv[++i]);
+        else if (arg == "--threads" && has_value)
+            config.threads = atoi(argv[++i]);
+        else if (arg == "--seconds" && has_value)
+            config.seconds = atof(argv[++i]);
+        else if (arg == "--ops" && has_value)
+            config.max_ops = stoull(argv[++i]);
+        else if ((arg == "--read" || arg == "--update" || arg == "--insert" || arg == "--scan") && has_value)
+        {
+            if (!explicit_mix)
+                fill(config.mix, config.mix + OPERATION_COUNT, 0.0);
+            explicit_mix = true;
+            int op(arg == "--read" ? READ : arg == "--update" ? UPDATE : arg == "--insert" ? INSERT : SCAN);
+            config.mix[op] = atof(argv[++i]);
+        }
+        else if (arg == "--dist" && has_value)
+            config.dist = Helper::to_lower(argv[++i]);
+        else if (arg == "--theta" && has_value)
+            config.theta = atof(argv[++i]);
+        else if (arg == "--data" && has_value)
+            config.data_dir = argv[++i];
+        else if (arg == "--out" && has_value)
+            config.out_file = argv[++i];
+        else
+        {
+            usage();
+            return (arg == "--help" || arg == "-h") ? 0 : 1;
+        }
+    }
+
+    double mix_total(0);
+    for (double share : config.mix)
+        mix_total += share;
+    if (mix_total <= 0 || config.threads < 1 || !config.records ||
+        (config.dist != "uniform" && config.dist != "zipf" && config.dist != "latest"))
+    {
+        usage();
+        return (1);
+    }
+
+    Helper::data_dir() = config.data_dir;
+    fs::remove_all(config.data_dir);
+
+    cerr << "Loading " << config.records << " records...\n";
+    DataGenerator(config.records, config.dist != "uniform").write_table("usertable");
+
+    Catalog catalog;
+    Helper::load_existing_tables(&catalog);
+
+    atomic<uint64_t> next_id(config.records), issued(0);
+    KeySource keys(config, next_id);
+    vector<array<Histogram, OPERATION_COUNT>> per_thread(config.threads);
+    vector<array<uint64_t, OPERATION_COUNT>> failed_per_thread(config.threads);
+    vector<thread> workers;
+
+    cerr << "Running " << config.threads << " thread(s)...\n";
+    auto started(Clock::now());
+    auto deadline(started + chrono::duration_cast<Clock::duration>(chrono::duration<double>(config.seconds)));
+
+    for (int t(0); t < config.threads; ++t)
+    {
+        workers.emplace_back([&, t]()
+                             {
+            ostream discard(nullptr);
+            Session session(&catalog, discard);
+            DataGenerator generator(0, config.dist != "uniform", 1000 + t);
+            mt19937_64 rng(t + 1);
+            uniform_real_distribution<double> pick(0.0, mix_total);
+            auto &histograms(per_thread[t]);
+            auto &failed(failed_per_thread[t]);
+            failed.fill(0);
+
+            while (true)
+            {
+                if (config.max_ops && issued.fetch_add(1) >= config.max_ops)
+                    break;
+                if (!config.max_ops && Clock::now() >= deadline)
+                    break;
+
+                double roll(pick(rng));
+                int op(0);
+                while (op + 1 < OPERATION_COUNT && roll >= config.mix[op])
+                    roll -= config.mix[op++];
+
+                uint64_t key(op == INSERT ? next_id.fetch_add(1) : keys.next(rng));
+                string statement(statement_for((Operation)op, key, generator));
+
+                auto start(Clock::now());
+                bool ok(false);
+                try
+                {
+                    ok = session.execute(statement);
+                }
+                catch (const exception &)
+                {
+                }
+                if (ok)
+                    histograms[op].record(chrono::duration_cast<chrono::nanoseconds>(Clock::now() - start).count());
+                else
+                    ++failed[op];
+            } });
+    }
+
+    for (auto &worker : workers)
+        worker.join();
+    double elapsed(chrono::duration<double>(Clock::now() - started).count());
+
+    Histogram totals[OPERATION_COUNT];
+    uint64_t failures[OPERATION_COUNT] = {};
+    for (int t(0); t < config.threads; ++t)
+    {
+        for (int op(0); op < OPERATION_COUNT; ++op)
+        {
+            totals[op].merge(per_thread[t][op]);
+            failures[op] += failed_per_thread[t][op];
+        }
+    }
+
+    fs::remove_all(config.data_dir);
+
+    if (config.out_file.empty())
+        write_report(cout, config, elapsed, totals, failures);
+    else
+    {
+        ofstream file(config.out_file);
+        write_report(file, config, elapsed, totals, failures);
+    }
+    return (0);
+}